@@ -1,18 +1,418 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <ucontext.h>
+#include <unistd.h>
 #include "concurrent_ctx.h"
+#include "util/epoch.h"
 #include "dep/thpool/thpool.h"
+#include "rmalloc.h"
 
-threadpool ConcurrentSearchThreadPool = NULL;
+/* A query running as a coroutine on the scheduler. Coroutines running with the GIL are pinned to
+ * the worker holding it, while coroutines running without it may be resumed by any worker */
+typedef struct concurrentTask {
+  ucontext_t uctx;
+  void *stack;
+  size_t stackSize;
+  void (*func)(void *);
+  void *arg;
+  // The worker currently running the task
+  struct concurrentWorker *worker;
+  // The concurrent context the task yielded from, or NULL if it is not suspended in a yield
+  ConcurrentSearchCtx *cctx;
+  // set when the task's keys are closed, either by the scheduler at the end of a quantum or because
+  // the task runs without the GIL
+  int keysClosed;
+  // set while the task runs without the GIL, see ConcurrentSearch_Unlock
+  int unlocked;
+  // set once the task starts running, and enters its epoch
+  int started;
+  int done;
+  struct concurrentTask *next;
+} ConcurrentTask;
 
-/** Start the concurrent search thread pool. Should be called when initializing the module */
-void ConcurrentSearch_ThreadPoolStart() {
-  if (ConcurrentSearchThreadPool == NULL) {
-    ConcurrentSearchThreadPool = thpool_init(CONCURRENT_SEARCH_POOL_SIZE);
+typedef struct {
+  ConcurrentTask *head, *tail;
+  size_t size;
+} ConcurrentTaskQueue;
+
+/* A scheduler thread */
+typedef struct concurrentWorker {
+  pthread_t thread;
+  // The context used only to lock and unlock the GIL for the scheduling quanta
+  RedisModuleCtx *ctx;
+  ucontext_t schedCtx;
+} ConcurrentWorker;
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  // tasks that need the GIL to run, including new ones
+  ConcurrentTaskQueue locked;
+  // tasks running without the GIL
+  ConcurrentTaskQueue unlocked;
+  // new tasks held back by ConcurrentSearch_HoldNewTasks, and the number of holds
+  ConcurrentTaskQueue held;
+  int holds;
+  // set while one of the workers is running a quantum of locked tasks
+  int gilTaken;
+  ConcurrentWorker *workers;
+  int numWorkers;
+} concurrentSched = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+/* The task running on the current thread. Code running inside a coroutine must read it before
+ * yielding, since the coroutine may be resumed on another thread */
+static __thread ConcurrentTask *currentTask = NULL;
+
+void ConcurrentSearch_CloseKeys(ConcurrentSearchCtx *ctx);
+void ConcurrentSearch_ReopenKeys(ConcurrentSearchCtx *ctx);
+
+static long long elapsedNS(struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  return (long long)1000000000 * (now.tv_sec - since->tv_sec) + (now.tv_nsec - since->tv_nsec);
+}
+
+static void concurrentQueue_Push(ConcurrentTaskQueue *q, ConcurrentTask *t) {
+  t->next = NULL;
+  if (q->tail) {
+    q->tail->next = t;
+  } else {
+    q->head = t;
+  }
+  q->tail = t;
+  q->size++;
+}
+
+static ConcurrentTask *concurrentQueue_Pop(ConcurrentTaskQueue *q) {
+  ConcurrentTask *t = q->head;
+  if (t) {
+    q->head = t->next;
+    if (!q->head) q->tail = NULL;
+    q->size--;
+  }
+  return t;
+}
+
+/* The entry point of every coroutine. makecontext can only pass int arguments portably, so the task
+ * is taken from the thread local current task instead.
+ *
+ * The whole task runs inside an epoch, so the index structures it reads stay valid even when it
+ * runs without the GIL, or releases it between quanta */
+static void concurrentTask_Main(void) {
+  ConcurrentTask *t = currentTask;
+  t->started = 1;
+  int epoch = Epoch_Enter();
+  t->func(t->arg);
+  Epoch_Exit(epoch);
+  t->done = 1;
+  setcontext(&t->worker->schedCtx);
+}
+
+static void concurrentTask_Free(ConcurrentTask *t) {
+  munmap(t->stack, t->stackSize);
+  rm_free(t);
+}
+
+/* Run a task on the worker until it yields or finishes */
+static void concurrentWorker_Resume(ConcurrentWorker *w, ConcurrentTask *t) {
+  t->worker = w;
+  currentTask = t;
+  swapcontext(&w->schedCtx, &t->uctx);
+  currentTask = NULL;
+}
+
+/* Put a task that yielded back in the queue matching its mode, or free it if it is done. Must be
+ * called with the scheduler lock held */
+static void concurrentWorker_RequeueLocked(ConcurrentTask *t) {
+  if (t->done) {
+    concurrentTask_Free(t);
+  } else if (t->unlocked) {
+    concurrentQueue_Push(&concurrentSched.unlocked, t);
+    pthread_cond_signal(&concurrentSched.cond);
+  } else {
+    concurrentQueue_Push(&concurrentSched.locked, t);
+  }
+}
+
+/* Run a quantum of the tasks that need the GIL. We take the GIL once, run the queued coroutines
+ * round robin, each until it yields or finishes, and then close the keys of all the suspended ones
+ * and release the GIL. Keys are only reopened by coroutines that actually get to run in a later
+ * quantum */
+static void concurrentWorker_RunLocked(ConcurrentWorker *w) {
+  RedisModule_ThreadSafeContextLock(w->ctx);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+
+  pthread_mutex_lock(&concurrentSched.lock);
+  for (size_t n = concurrentSched.locked.size; n > 0; n--) {
+    ConcurrentTask *t = concurrentQueue_Pop(&concurrentSched.locked);
+    if (concurrentSched.holds && !t->started) {
+      concurrentQueue_Push(&concurrentSched.held, t);
+      continue;
+    }
+    pthread_mutex_unlock(&concurrentSched.lock);
+
+    concurrentWorker_Resume(w, t);
+
+    pthread_mutex_lock(&concurrentSched.lock);
+    concurrentWorker_RequeueLocked(t);
+    if (elapsedNS(&start) > CONCURRENT_QUANTUM_NS) break;
+  }
+
+  for (ConcurrentTask *t = concurrentSched.locked.head; t; t = t->next) {
+    if (t->cctx && !t->keysClosed) {
+      ConcurrentSearch_CloseKeys(t->cctx);
+      t->keysClosed = 1;
+    }
+  }
+  concurrentSched.gilTaken = 0;
+  // another worker may be waiting to run the next quantum
+  pthread_cond_broadcast(&concurrentSched.cond);
+  pthread_mutex_unlock(&concurrentSched.lock);
+
+  RedisModule_ThreadSafeContextUnlock(w->ctx);
+}
+
+/* The scheduler loop. One worker at a time runs quanta of the tasks that need the GIL, while the
+ * others run the tasks that don't need it in parallel */
+static void *concurrentWorker_Main(void *p) {
+  ConcurrentWorker *w = p;
+  pthread_mutex_lock(&concurrentSched.lock);
+  for (;;) {
+    if (!concurrentSched.gilTaken && concurrentSched.locked.size) {
+      concurrentSched.gilTaken = 1;
+      pthread_mutex_unlock(&concurrentSched.lock);
+      concurrentWorker_RunLocked(w);
+      pthread_mutex_lock(&concurrentSched.lock);
+    } else if (concurrentSched.unlocked.size) {
+      ConcurrentTask *t = concurrentQueue_Pop(&concurrentSched.unlocked);
+      pthread_mutex_unlock(&concurrentSched.lock);
+      concurrentWorker_Resume(w, t);
+      pthread_mutex_lock(&concurrentSched.lock);
+      concurrentWorker_RequeueLocked(t);
+    } else {
+      pthread_cond_wait(&concurrentSched.cond, &concurrentSched.lock);
+    }
+  }
+  return NULL;
+}
+
+/** Start the concurrent search scheduler. Should be called when initializing the module */
+void ConcurrentSearch_SchedulerStart() {
+  if (concurrentSched.workers) return;
+
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  concurrentSched.numWorkers = MAX(1, MIN(ncpu, CONCURRENT_SEARCH_MAX_WORKERS));
+  concurrentSched.workers = rm_calloc(concurrentSched.numWorkers, sizeof(ConcurrentWorker));
+  for (int i = 0; i < concurrentSched.numWorkers; i++) {
+    ConcurrentWorker *w = &concurrentSched.workers[i];
+    w->ctx = RedisModule_GetThreadSafeContext(NULL);
+    pthread_create(&w->thread, NULL, concurrentWorker_Main, w);
+    pthread_detach(w->thread);
+  }
+}
+
+/* Run a function as a coroutine on the concurrent search scheduler */
+void ConcurrentSearch_Run(void (*func)(void *), void *arg) {
+  ConcurrentTask *t = rm_calloc(1, sizeof(*t));
+  t->func = func;
+  t->arg = arg;
+
+  // The lowest page of the stack is a guard page, so an overflow crashes instead of corrupting
+  // memory. Pages are only committed when touched, so a small query costs just a few of them
+  t->stackSize = CONCURRENT_STACK_SIZE + getpagesize();
+  t->stack = mmap(NULL, t->stackSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  mprotect(t->stack, getpagesize(), PROT_NONE);
+
+  getcontext(&t->uctx);
+  t->uctx.uc_stack.ss_sp = (char *)t->stack + getpagesize();
+  t->uctx.uc_stack.ss_size = t->stackSize - getpagesize();
+  t->uctx.uc_link = NULL;
+  makecontext(&t->uctx, concurrentTask_Main, 0);
+
+  pthread_mutex_lock(&concurrentSched.lock);
+  if (concurrentSched.holds) {
+    concurrentQueue_Push(&concurrentSched.held, t);
+  } else {
+    concurrentQueue_Push(&concurrentSched.locked, t);
+    pthread_cond_signal(&concurrentSched.cond);
+  }
+  pthread_mutex_unlock(&concurrentSched.lock);
+}
+
+void ConcurrentSearch_HoldNewTasks() {
+  pthread_mutex_lock(&concurrentSched.lock);
+  concurrentSched.holds++;
+  pthread_mutex_unlock(&concurrentSched.lock);
+}
+
+void ConcurrentSearch_ReleaseNewTasks() {
+  pthread_mutex_lock(&concurrentSched.lock);
+  if (concurrentSched.holds && !--concurrentSched.holds) {
+    ConcurrentTask *t;
+    while ((t = concurrentQueue_Pop(&concurrentSched.held))) {
+      concurrentQueue_Push(&concurrentSched.locked, t);
+    }
+    pthread_cond_broadcast(&concurrentSched.cond);
+  }
+  pthread_mutex_unlock(&concurrentSched.lock);
+}
+
+/* The threads parts of a single query run on, see ConcurrentSearch_RunParallel. Created on first
+ * use, with a thread per core besides the caller's */
+static struct {
+  pthread_once_t once;
+  threadpool pool;
+  int size;
+} concurrentParallel = {.once = PTHREAD_ONCE_INIT};
+
+/* The calls of a single ConcurrentSearch_RunParallel. Each call is claimed by whichever thread gets
+ * to it first: the caller claims the calls that no pool thread picked up yet instead of waiting for
+ * them, so it only ever waits for calls that are already running. The batch is shared with the pool
+ * threads and freed by the last one to let go of it, since a pool thread may only get to it after
+ * the caller returned */
+typedef struct {
+  void (*func)(void *);
+  void **args;
+  int n;
+  // the next call to claim, and the number of calls that are done
+  int next;
+  int done;
+  int refcount;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+} concurrentParallelBatch;
+
+static void concurrentParallel_Init() {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  concurrentParallel.size = MAX(0, MIN(ncpu, CONCURRENT_SEARCH_MAX_WORKERS) - 1);
+  if (concurrentParallel.size) {
+    concurrentParallel.pool = thpool_init(concurrentParallel.size);
+  }
+}
+
+static void concurrentParallelBatch_Release(concurrentParallelBatch *b) {
+  if (__atomic_sub_fetch(&b->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+    rm_free(b);
   }
 }
 
-/* Run a function on the concurrent thread pool */
-void ConcurrentSearch_ThreadPoolRun(void (*func)(void *), void *arg) {
-  thpool_add_work(ConcurrentSearchThreadPool, func, arg);
+/* Run the calls of a batch that were not claimed yet */
+static void concurrentParallelBatch_Run(concurrentParallelBatch *b) {
+  int i;
+  while ((i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED)) < b->n) {
+    b->func(b->args[i]);
+    pthread_mutex_lock(&b->lock);
+    if (++b->done == b->n) {
+      pthread_cond_signal(&b->cond);
+    }
+    pthread_mutex_unlock(&b->lock);
+  }
+}
+
+static void concurrentParallel_RunJob(void *p) {
+  concurrentParallelBatch *b = p;
+  concurrentParallelBatch_Run(b);
+  concurrentParallelBatch_Release(b);
+}
+
+int ConcurrentSearch_Parallelism() {
+  pthread_once(&concurrentParallel.once, concurrentParallel_Init);
+  return concurrentParallel.size + 1;
+}
+
+void ConcurrentSearch_RunParallel(void (*func)(void *), void **args, int n) {
+  pthread_once(&concurrentParallel.once, concurrentParallel_Init);
+  if (n <= 0) return;
+
+  concurrentParallelBatch *b = rm_malloc(sizeof(*b));
+  *b = (concurrentParallelBatch){.func = func, .args = args, .n = n, .refcount = 1};
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->cond, NULL);
+  for (int i = 1; i < n && concurrentParallel.pool; i++) {
+    __atomic_add_fetch(&b->refcount, 1, __ATOMIC_RELAXED);
+    if (thpool_add_work(concurrentParallel.pool, concurrentParallel_RunJob, b) != 0) {
+      concurrentParallelBatch_Release(b);
+      break;
+    }
+  }
+
+  // the caller runs the calls the pool did not get to, and waits for the ones that are running
+  concurrentParallelBatch_Run(b);
+  pthread_mutex_lock(&b->lock);
+  while (b->done < n) {
+    pthread_cond_wait(&b->cond, &b->lock);
+  }
+  pthread_mutex_unlock(&b->lock);
+  concurrentParallelBatch_Release(b);
+}
+
+/* The threads background work runs on, see ConcurrentSearch_RunBackground. Created on first use */
+static struct {
+  pthread_once_t once;
+  threadpool pool;
+} concurrentBackground = {.once = PTHREAD_ONCE_INIT};
+
+static void concurrentBackground_Init() {
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  concurrentBackground.pool = thpool_init(MAX(1, MIN(ncpu, CONCURRENT_SEARCH_MAX_WORKERS)));
+}
+
+typedef struct {
+  void (*func)(void *);
+  void *arg;
+} concurrentBackgroundJob;
+
+static void *concurrentBackground_RunThread(void *p) {
+  concurrentBackgroundJob job = *(concurrentBackgroundJob *)p;
+  rm_free(p);
+  job.func(job.arg);
+  return NULL;
+}
+
+void ConcurrentSearch_RunBackground(void (*func)(void *), void *arg) {
+  pthread_once(&concurrentBackground.once, concurrentBackground_Init);
+  if (concurrentBackground.pool && thpool_add_work(concurrentBackground.pool, func, arg) == 0) {
+    return;
+  }
+
+  // the caller expects func to run without the GIL, so we can't just call it here
+  concurrentBackgroundJob *job = rm_malloc(sizeof(*job));
+  *job = (concurrentBackgroundJob){.func = func, .arg = arg};
+  pthread_t t;
+  pthread_create(&t, NULL, concurrentBackground_RunThread, job);
+  pthread_detach(t);
+}
+
+/* Release the GIL for the rest of the task's execution, until ConcurrentSearch_Lock is called */
+void ConcurrentSearch_Unlock(ConcurrentSearchCtx *ctx) {
+  ConcurrentTask *t = currentTask;
+  if (!t || t->unlocked) {
+    return;
+  }
+  ConcurrentSearch_CloseKeys(ctx);
+  t->keysClosed = 1;
+  t->unlocked = 1;
+  swapcontext(&t->uctx, &t->worker->schedCtx);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ctx->lastTime);
+  ctx->ticker = 0;
+}
+
+/* Wait for the GIL after ConcurrentSearch_Unlock, and reopen the task's keys */
+void ConcurrentSearch_Lock(ConcurrentSearchCtx *ctx) {
+  ConcurrentTask *t = currentTask;
+  if (!t || !t->unlocked) {
+    return;
+  }
+  t->unlocked = 0;
+  swapcontext(&t->uctx, &t->worker->schedCtx);
+  ConcurrentSearch_ReopenKeys(ctx);
+  t->keysClosed = 0;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ctx->lastTime);
+  ctx->ticker = 0;
 }
 
 void ConcurrentSearch_CloseKeys(ConcurrentSearchCtx *ctx) {
@@ -35,16 +435,27 @@ void ConcurrentSearch_ReopenKeys(ConcurrentSearchCtx *ctx) {
   }
 }
 
-/** Check the elapsed timer, and release the lock if enough time has passed */
-inline void ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
-  static struct timespec now;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
-
-  long long durationNS = (long long)1000000000 * (now.tv_sec - ctx->lastTime.tv_sec) +
-                         (now.tv_nsec - ctx->lastTime.tv_nsec);
+/** Check the elapsed timer, and yield execution if enough time has passed */
+void ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
+  if (elapsedNS(&ctx->lastTime) <= CONCURRENT_TIMEOUT_NS) {
+    return;
+  }
 
-  // Timeout - release the thread safe context lock and let other threads run as well
-  if (durationNS > CONCURRENT_TIMEOUT_NS) {
+  ConcurrentTask *t = currentTask;
+  if (t) {
+    // Switch back to the scheduler. Our keys stay open while other coroutines run in the same
+    // quantum, and the scheduler closes them if it releases the GIL before we run again. Tasks
+    // running without the GIL have closed their keys already
+    t->cctx = t->unlocked ? NULL : ctx;
+    swapcontext(&t->uctx, &t->worker->schedCtx);
+    t->cctx = NULL;
+    if (t->keysClosed && !t->unlocked) {
+      ConcurrentSearch_ReopenKeys(ctx);
+      t->keysClosed = 0;
+    }
+  } else {
+    // Not running on the scheduler - release the thread safe context lock and let other threads
+    // run as well
     ConcurrentSearch_CloseKeys(ctx);
     RedisModule_ThreadSafeContextUnlock(ctx->ctx);
 
@@ -54,11 +465,11 @@ inline void ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx) {
     // See http://blog.firetree.net/2005/06/22/thread-yield-after-mutex-unlock/
     RedisModule_ThreadSafeContextLock(ctx->ctx);
     ConcurrentSearch_ReopenKeys(ctx);
-    // Right after re-acquiring the lock, we sample the current time.
-    // This will be used to calculate the elapsed running time
-    clock_gettime(CLOCK_MONOTONIC_RAW, &ctx->lastTime);
-    ctx->ticker = 0;
   }
+  // Right after getting back execution, we sample the current time.
+  // This will be used to calculate the elapsed running time
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ctx->lastTime);
+  ctx->ticker = 0;
 }
 
 /** Initialize a concurrent context */
@@ -73,9 +484,8 @@ void ConcurrentSearchCtx_Init(RedisModuleCtx *rctx, ConcurrentSearchCtx *ctx) {
   clock_gettime(CLOCK_MONOTONIC_RAW, &ctx->lastTime);
 }
 
-void ConcurrentSearchCtx_Free(ConcurrentSearchCtx *ctx) {
-  // Release the monitored open keys
-  for (size_t i = 0; i < ctx->numOpenKeys; i++) {
+void ConcurrentSearch_ReleaseKeys(ConcurrentSearchCtx *ctx, size_t from) {
+  for (size_t i = from; i < ctx->numOpenKeys; i++) {
     // Close the monitored key and free its reopen string
     RedisModule_CloseKey(ctx->openKeys[i].key);
     RedisModule_FreeString(ctx->ctx, ctx->openKeys[i].keyName);
@@ -85,6 +495,14 @@ void ConcurrentSearchCtx_Free(ConcurrentSearchCtx *ctx) {
       ctx->openKeys[i].freePrivData(ctx->openKeys[i].privdata);
     }
   }
+  if (from < ctx->numOpenKeys) {
+    ctx->numOpenKeys = from;
+  }
+}
+
+void ConcurrentSearchCtx_Free(ConcurrentSearchCtx *ctx) {
+  // Release the monitored open keys
+  ConcurrentSearch_ReleaseKeys(ctx, 0);
   free(ctx->openKeys);
 }
 
@@ -4,26 +4,31 @@
 #include "redisearch.h"
 #include "redismodule.h"
 #include <time.h>
-#include <dep/thpool/thpool.h>
 
 /** Concurrent Search Exection Context.
  *
- * We allow queries to run concurrently, each running on its own thread, locking the redis GIL
- * for a bit, releasing it, and letting others run as well.
+ * We allow queries to run concurrently, locking the redis GIL for a bit, releasing it, and letting
+ * others run as well.
  *
  * The queries do not really run in parallel, but one at a time, competing over the global lock.
  * This does not speed processing - in fact it can actually slow it down. But it prevents a
  * common situation, where very slow queries block the entire redis instance for a long time.
  *
- * We intend to switch this model to a single thread running multiple "coroutines", but for now
- * this naive implementation is good enough and will fix the search concurrency issue.
+ * Every query runs as a coroutine on a scheduler thread, with its own small stack. The scheduler
+ * works in quanta: it takes the GIL once, runs its queued coroutines round robin until the quantum
+ * is over, and only then releases the GIL. Switching between coroutines is just a context swap,
+ * and keys are closed once per quantum, and reopened only by coroutines that run again.
+ *
+ * A query can also release the GIL for parts of its execution that only read index snapshots (see
+ * ConcurrentSearch_Unlock). Those parts run in parallel on the other scheduler threads.
  *
  * The ConcurrentSearchCtx is part of a query, and the query calls the CONCURRENT_CTX_TICK macro
  * for every "cycle" - meaning a processed search result. The concurrency engine will switch
- * execution to another query when the current thread has spent enough time working.
+ * execution to another query when the current coroutine has spent enough time working.
  *
- * The current switch threshold is 200 microseconds. Since measuring time is slow in itself (~50ns)
- * we sample the elapsed time every 20 "cycles" of the query processor.
+ * The current switch threshold is 50 microseconds per coroutine, and 200 microseconds per quantum.
+ * Since measuring time is slow in itself (~50ns) we sample the elapsed time every 25 "cycles" of
+ * the query processor.
  *
  */
 
@@ -51,18 +56,23 @@ typedef struct {
   size_t numOpenKeys;
 } ConcurrentSearchCtx;
 
-/** The maximal size of the concurrent query thread pool. Since only one thread is operational at a
- * time, it's not a problem besides memory consumption, to have much more threads than CPU cores.
- * By default the pool starts with just one thread, and scales up as needed  */
-#define CONCURRENT_SEARCH_POOL_SIZE 100
+/** The maximal number of scheduler threads. We start one per CPU core: only one of them runs
+ * queries holding the GIL at a time, and the rest run queries that released it */
+#define CONCURRENT_SEARCH_MAX_WORKERS 64
+
+/** The stack size of every query coroutine. The stack memory is only committed when used */
+#define CONCURRENT_STACK_SIZE (512 * 1024)
 
 /** The number of execution "ticks" per elapsed time check. This is intended to reduce the number of
  * calls to clock_gettime() */
 #define CONCURRENT_TICK_CHECK 25
 
-/** The timeout after which we try to switch to another query thread - in Nanoseconds */
+/** The timeout after which we try to switch to another query coroutine - in Nanoseconds */
 #define CONCURRENT_TIMEOUT_NS 50000
 
+/** The time the scheduler runs coroutines before releasing the GIL - in Nanoseconds */
+#define CONCURRENT_QUANTUM_NS 200000
+
 /* Add a "monitored" key to the context. When keys are open during concurrent execution, they need
  * to be closed before we yield execution and release the GIL, and reopened when we get back the
  * execution context.
@@ -80,13 +90,58 @@ void ConcurrentSearch_AddKey(ConcurrentSearchCtx *ctx, RedisModuleKey *key, int
                              RedisModuleString *keyName, ConcurrentReopenCallback cb,
                              void *privdata, void (*freePrivDataCallback)(void *));
 
-/** Start the concurrent search thread pool. Should be called when initializing the module */
-void ConcurrentSearch_ThreadPoolStart();
-
-/* Run a function on the concurrent thread pool */
-void ConcurrentSearch_ThreadPoolRun(void (*func)(void *), void *arg);
-
-/** Check the elapsed timer, and release the lock if enough time has passed */
+/* Close and stop monitoring all the keys that were added after the first `from` keys, releasing
+ * their private data. This is used by callers that registered keys but ended up consuming the data
+ * behind them right away, and do not need to be notified when they are reopened */
+void ConcurrentSearch_ReleaseKeys(ConcurrentSearchCtx *ctx, size_t from);
+
+/** Start the concurrent search scheduler. Should be called when initializing the module */
+void ConcurrentSearch_SchedulerStart();
+
+/* Run a function as a coroutine on the concurrent search scheduler. The function is called with the
+ * GIL already held, and should not lock or unlock it itself. It runs inside an epoch (see
+ * util/epoch.h), so memory retired while it runs is not released before it returns */
+void ConcurrentSearch_Run(void (*func)(void *), void *arg);
+
+/* Hold back the tasks that did not start running yet, until ConcurrentSearch_ReleaseNewTasks is
+ * called as many times. The running tasks go on, so under a steady load of queries this lets the
+ * epoch drain for a writer that can only run while no reader is active. Tasks only start with the
+ * GIL held, so a writer holding it knows no task starts under it */
+void ConcurrentSearch_HoldNewTasks();
+
+/* Release a hold taken with ConcurrentSearch_HoldNewTasks, starting the held tasks once no hold is
+ * left */
+void ConcurrentSearch_ReleaseNewTasks();
+
+/* Release the GIL until ConcurrentSearch_Lock is called, letting the query run in parallel to
+ * other queries and to redis itself. All the monitored keys are closed, and until we lock again we
+ * must not touch the keyspace or call any redis API besides memory allocation. Only structures that
+ * are safe to read concurrently with writers, retiring their memory through the epoch the query
+ * runs in, may be accessed. Does nothing when not running on the scheduler */
+void ConcurrentSearch_Unlock(ConcurrentSearchCtx *ctx);
+
+/* Take the GIL back after ConcurrentSearch_Unlock, and reopen the monitored keys */
+void ConcurrentSearch_Lock(ConcurrentSearchCtx *ctx);
+
+/* Call func on each of the n args in parallel, returning once all the calls are done. The calls
+ * run on a shared pool of threads and on the calling thread, which takes every call the pool did
+ * not start yet rather than waiting for it, so a busy pool never holds the caller back. The calls
+ * must not touch the keyspace or call any redis API besides memory allocation, and run inside the
+ * caller's epoch, if any */
+void ConcurrentSearch_RunParallel(void (*func)(void *), void **args, int n);
+
+/* The number of threads ConcurrentSearch_RunParallel can spread its calls on, including the
+ * caller */
+int ConcurrentSearch_Parallelism();
+
+/* Run a function on a pool of background threads, with a thread per core, returning right away.
+ * The function runs without the GIL and outside of any epoch. It may take the GIL with a thread safe
+ * context, but must not touch the keyspace without it. This is used for work that does not need
+ * any redis state, e.g. tokenizing documents before they are indexed. The pool is separate from
+ * the one used by ConcurrentSearch_RunParallel, so background work does not hold back queries */
+void ConcurrentSearch_RunBackground(void (*func)(void *), void *arg);
+
+/** Check the elapsed timer, and yield execution if enough time has passed */
 void ConcurrentSearch_CheckTimer(ConcurrentSearchCtx *ctx);
 
 /** Initialize and reset a concurrent search ctx */
@@ -96,7 +151,7 @@ void ConcurrentSearchCtx_Init(RedisModuleCtx *rctx, ConcurrentSearchCtx *ctx);
 void ConcurrentSearchCtx_Free(ConcurrentSearchCtx *ctx);
 
 /** This macro is called by concurrent executors (currently the query only).
- * It checks if enough time has passed and releases the global lock if that is the case.
+ * It checks if enough time has passed and yields to other queries if that is the case.
  */
 #define CONCURRENT_CTX_TICK(x)                           \
   {                                                      \
@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <string.h>
+#include "decode_cache.h"
+#include "rmalloc.h"
+#include "util/khash.h"
+
+size_t DecodeCache_MaxMem = DECODE_CACHE_DEFAULT_MAXMEM;
+
+KHASH_MAP_INIT_INT64(decodedBlocks, DecodedBlock *)
+
+static struct {
+  pthread_mutex_t lock;
+  khash_t(decodedBlocks) * blocks;
+  DecodedBlock *head, *tail;
+  DecodeCacheStats stats;
+} decodeCache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+#define BLOCK_KEY(p) ((uint64_t)(uintptr_t)(p))
+
+void DecodedBlock_Release(DecodedBlock *b) {
+  if (__atomic_sub_fetch(&b->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    rm_free(b);
+  }
+}
+
+static void decodeCache_Unlink(DecodedBlock *b) {
+  if (b->prev) {
+    b->prev->next = b->next;
+  } else {
+    decodeCache.head = b->next;
+  }
+  if (b->next) {
+    b->next->prev = b->prev;
+  } else {
+    decodeCache.tail = b->prev;
+  }
+  b->prev = b->next = NULL;
+}
+
+static void decodeCache_PushFront(DecodedBlock *b) {
+  b->prev = NULL;
+  b->next = decodeCache.head;
+  if (decodeCache.head) {
+    decodeCache.head->prev = b;
+  } else {
+    decodeCache.tail = b;
+  }
+  decodeCache.head = b;
+}
+
+/* Take a block out of the cache, dropping the cache's reference to it. Must be called with the
+ * lock held */
+static void decodeCache_RemoveLocked(DecodedBlock *b) {
+  khiter_t k = kh_get(decodedBlocks, decodeCache.blocks, BLOCK_KEY(b->key));
+  if (k != kh_end(decodeCache.blocks)) {
+    kh_del(decodedBlocks, decodeCache.blocks, k);
+  }
+  decodeCache_Unlink(b);
+  decodeCache.stats.numBlocks--;
+  decodeCache.stats.memsize -= b->memsize;
+  DecodedBlock_Release(b);
+}
+
+DecodedBlock *DecodeCache_Get(const void *key) {
+  DecodedBlock *b = NULL;
+  pthread_mutex_lock(&decodeCache.lock);
+  if (decodeCache.blocks) {
+    khiter_t k = kh_get(decodedBlocks, decodeCache.blocks, BLOCK_KEY(key));
+    if (k != kh_end(decodeCache.blocks)) {
+      b = kh_value(decodeCache.blocks, k);
+    }
+  }
+  if (b) {
+    __atomic_add_fetch(&b->refcount, 1, __ATOMIC_RELAXED);
+    decodeCache_Unlink(b);
+    decodeCache_PushFront(b);
+    decodeCache.stats.hits++;
+  } else {
+    decodeCache.stats.misses++;
+  }
+  pthread_mutex_unlock(&decodeCache.lock);
+  return b;
+}
+
+void DecodeCache_Put(const void *key, uint32_t num, int len, uint32_t *const cols[],
+                     const uint32_t *positions) {
+  size_t memsize = sizeof(DecodedBlock) + (len * num + num + 1) * sizeof(uint32_t);
+  if (memsize > DecodeCache_MaxMem) {
+    return;
+  }
+
+  // we build the block before taking the lock
+  DecodedBlock *b = rm_malloc(memsize);
+  *b = (DecodedBlock){.key = key, .num = num, .refcount = 1, .memsize = memsize};
+  uint32_t *p = b->data;
+  for (int i = 0; i < len; i++, p += num) {
+    b->cols[i] = p;
+    memcpy(p, cols[i], num * sizeof(uint32_t));
+  }
+  b->positions = p;
+  memcpy(p, positions, (num + 1) * sizeof(uint32_t));
+
+  pthread_mutex_lock(&decodeCache.lock);
+  if (!decodeCache.blocks) {
+    decodeCache.blocks = kh_init(decodedBlocks);
+  }
+  int rc;
+  khiter_t k = kh_put(decodedBlocks, decodeCache.blocks, BLOCK_KEY(key), &rc);
+  if (rc == 0) {
+    // another reader cached the block while we were decoding it
+    pthread_mutex_unlock(&decodeCache.lock);
+    rm_free(b);
+    return;
+  }
+  kh_value(decodeCache.blocks, k) = b;
+  decodeCache_PushFront(b);
+  decodeCache.stats.numBlocks++;
+  decodeCache.stats.memsize += memsize;
+  while (decodeCache.stats.memsize > DecodeCache_MaxMem && decodeCache.tail != b) {
+    decodeCache_RemoveLocked(decodeCache.tail);
+  }
+  pthread_mutex_unlock(&decodeCache.lock);
+}
+
+void DecodeCache_Invalidate(const void *key) {
+  pthread_mutex_lock(&decodeCache.lock);
+  if (decodeCache.stats.numBlocks) {
+    khiter_t k = kh_get(decodedBlocks, decodeCache.blocks, BLOCK_KEY(key));
+    if (k != kh_end(decodeCache.blocks)) {
+      decodeCache_RemoveLocked(kh_value(decodeCache.blocks, k));
+    }
+  }
+  pthread_mutex_unlock(&decodeCache.lock);
+}
+
+void DecodeCache_Clear() {
+  pthread_mutex_lock(&decodeCache.lock);
+  while (decodeCache.tail) {
+    decodeCache_RemoveLocked(decodeCache.tail);
+  }
+  pthread_mutex_unlock(&decodeCache.lock);
+}
+
+DecodeCacheStats DecodeCache_GetStats() {
+  pthread_mutex_lock(&decodeCache.lock);
+  DecodeCacheStats ret = decodeCache.stats;
+  pthread_mutex_unlock(&decodeCache.lock);
+  return ret;
+}
@@ -0,0 +1,66 @@
+#ifndef __DECODE_CACHE_H__
+#define __DECODE_CACHE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The default memory limit of the decode cache, in bytes. It can be changed with the
+ * DECODECACHE_MAXMEM module argument, and 0 disables the cache */
+#define DECODE_CACHE_DEFAULT_MAXMEM (32 * 1024 * 1024)
+
+extern size_t DecodeCache_MaxMem;
+
+/* A block of an inverted index decoded into column arrays, shared by all the readers of the block.
+ * Blocks are reference counted, the cache holding one reference while the block is in it */
+typedef struct decodedBlock {
+  // the data buffer of the decoded block
+  const void *key;
+  uint32_t num;
+  uint32_t refcount;
+  size_t memsize;
+  // the neighbours of the block in the LRU list, prev being the more recently used one
+  struct decodedBlock *prev, *next;
+  // the decoded integers of every record, in encoding order. cols[0] holds absolute docIds
+  uint32_t *cols[4];
+  // the offset of each record in the block's buffer, plus one for the end of the last record
+  uint32_t *positions;
+  uint32_t data[];
+} DecodedBlock;
+
+/* A process wide cache of decoded index blocks, so blocks of frequently queried terms are not
+ * decoded again by every query reading them.
+ *
+ * Blocks are keyed by their data buffer. Only blocks that can no longer change are cached, i.e.
+ * every block but the last one of an index, whose buffers are never modified in place. A buffer
+ * that is replaced is retired, and its cached block is dropped when the buffer is finally freed, so
+ * a key is never reused while its block is in the cache.
+ *
+ * All the functions are thread safe */
+
+/* Get the cached block of a buffer, or NULL if it is not cached. The block must be released with
+ * DecodedBlock_Release */
+DecodedBlock *DecodeCache_Get(const void *key);
+
+/* Cache the decoded records of a buffer, evicting the least recently used blocks to make room for
+ * them. len is the number of columns */
+void DecodeCache_Put(const void *key, uint32_t num, int len, uint32_t *const cols[],
+                     const uint32_t *positions);
+
+void DecodedBlock_Release(DecodedBlock *b);
+
+/* Drop the cached block of a buffer that is being freed */
+void DecodeCache_Invalidate(const void *key);
+
+/* Drop all the cached blocks */
+void DecodeCache_Clear();
+
+typedef struct {
+  size_t numBlocks;
+  size_t memsize;
+  size_t hits;
+  size_t misses;
+} DecodeCacheStats;
+
+DecodeCacheStats DecodeCache_GetStats();
+
+#endif
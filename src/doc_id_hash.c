@@ -0,0 +1,167 @@
+#include <string.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include "doc_id_hash.h"
+#include "rmalloc.h"
+#include "util/fnv.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define DOCIDHASH_SIMD
+#include <emmintrin.h>
+#endif
+
+/* Control bytes of free slots have their high bit set, full slots hold the 7 low bits of the hash */
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((int8_t)((hash)&0x7f))
+
+static uint32_t docIdHash_Hash(const char *key, size_t len) {
+  uint32_t h = fnv_32a_buf((void *)key, len, 0x811c9dc5);
+  // FNV's high bits are poorly mixed and we pick the group with them, so we finalize it like
+  // murmur3 does
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+/* A bitmask of the slots of a group whose control byte is b */
+static inline uint32_t group_Match(const int8_t *g, int8_t b) {
+#ifdef DOCIDHASH_SIMD
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)g);
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b)));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < DOCIDHASH_GROUP_SIZE; i++) {
+    if (g[i] == b) m |= 1 << i;
+  }
+  return m;
+#endif
+}
+
+/* A bitmask of the empty and deleted slots of a group */
+static inline uint32_t group_MatchFree(const int8_t *g) {
+#ifdef DOCIDHASH_SIMD
+  return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)g));
+#else
+  uint32_t m = 0;
+  for (int i = 0; i < DOCIDHASH_GROUP_SIZE; i++) {
+    if (g[i] < 0) m |= 1 << i;
+  }
+  return m;
+#endif
+}
+
+DocIdHash *NewDocIdHash() {
+  return rm_calloc(1, sizeof(DocIdHash));
+}
+
+/* Return the slot of a key, or -1 if it is not in the map. We probe the groups quadratically, and
+ * stop at the first group with an empty slot, as the key would have been put there */
+static ssize_t docIdHash_Find(DocIdHash *h, const char *key, size_t len, uint32_t hash) {
+  if (!h->numGroups) return -1;
+
+  size_t mask = h->numGroups - 1;
+  size_t g = H1(hash) & mask;
+  for (size_t i = 1;; i++) {
+    const int8_t *ctrl = h->ctrl + g * DOCIDHASH_GROUP_SIZE;
+    for (uint32_t m = group_Match(ctrl, H2(hash)); m; m &= m - 1) {
+      size_t s = g * DOCIDHASH_GROUP_SIZE + __builtin_ctz(m);
+      DocIdHashSlot *slot = &h->slots[s];
+      if (slot->hash == hash && !strncmp(slot->key, key, len) && slot->key[len] == '\0') {
+        return s;
+      }
+    }
+    if (group_Match(ctrl, CTRL_EMPTY)) return -1;
+    g = (g + i) & mask;
+  }
+}
+
+/* Return the first free slot in the probe sequence of a hash. There is always one, as the map
+ * grows before it is 7/8 full */
+static size_t docIdHash_FindFree(DocIdHash *h, uint32_t hash) {
+  size_t mask = h->numGroups - 1;
+  size_t g = H1(hash) & mask;
+  for (size_t i = 1;; i++) {
+    uint32_t m = group_MatchFree(h->ctrl + g * DOCIDHASH_GROUP_SIZE);
+    if (m) {
+      return g * DOCIDHASH_GROUP_SIZE + __builtin_ctz(m);
+    }
+    g = (g + i) & mask;
+  }
+}
+
+/* Move all the keys into a new table of numGroups groups, dropping the deleted slots */
+static void docIdHash_Resize(DocIdHash *h, size_t numGroups) {
+  int8_t *oldCtrl = h->ctrl;
+  DocIdHashSlot *oldSlots = h->slots;
+  size_t oldCap = h->numGroups * DOCIDHASH_GROUP_SIZE;
+
+  size_t cap = numGroups * DOCIDHASH_GROUP_SIZE;
+  h->numGroups = numGroups;
+  h->ctrl = rm_malloc(cap);
+  memset(h->ctrl, CTRL_EMPTY, cap);
+  h->slots = rm_malloc(cap * sizeof(DocIdHashSlot));
+  h->growthLeft = cap - cap / 8 - h->size;
+
+  for (size_t i = 0; i < oldCap; i++) {
+    if (oldCtrl[i] < 0) continue;
+    size_t s = docIdHash_FindFree(h, oldSlots[i].hash);
+    h->ctrl[s] = H2(oldSlots[i].hash);
+    h->slots[s] = oldSlots[i];
+  }
+  rm_free(oldCtrl);
+  rm_free(oldSlots);
+}
+
+t_docId DocIdHash_Get(DocIdHash *h, const char *key, size_t len) {
+  ssize_t s = docIdHash_Find(h, key, len, docIdHash_Hash(key, len));
+  return s < 0 ? 0 : h->slots[s].docId;
+}
+
+void DocIdHash_Put(DocIdHash *h, const char *key, size_t len, t_docId docId) {
+  uint32_t hash = docIdHash_Hash(key, len);
+  ssize_t s = docIdHash_Find(h, key, len, hash);
+  if (s >= 0) {
+    h->slots[s].docId = docId;
+    return;
+  }
+
+  if (!h->growthLeft) {
+    // if deletions left the map less than half full we only rehash it to drop them
+    size_t cap = h->numGroups * DOCIDHASH_GROUP_SIZE;
+    docIdHash_Resize(h, h->size < cap * 7 / 16 ? h->numGroups : MAX(h->numGroups * 2, 1));
+  }
+
+  s = docIdHash_FindFree(h, hash);
+  if (h->ctrl[s] == CTRL_EMPTY) {
+    h->growthLeft--;
+  }
+  h->ctrl[s] = H2(hash);
+  h->slots[s] = (DocIdHashSlot){.key = key, .hash = hash, .docId = docId};
+  h->size++;
+}
+
+int DocIdHash_Delete(DocIdHash *h, const char *key, size_t len) {
+  ssize_t s = docIdHash_Find(h, key, len, docIdHash_Hash(key, len));
+  if (s < 0) {
+    return 0;
+  }
+  h->ctrl[s] = CTRL_DELETED;
+  h->size--;
+  return 1;
+}
+
+size_t DocIdHash_MemUsage(DocIdHash *h) {
+  return sizeof(DocIdHash) + h->numGroups * DOCIDHASH_GROUP_SIZE * (1 + sizeof(DocIdHashSlot));
+}
+
+void DocIdHash_Free(DocIdHash *h) {
+  rm_free(h->ctrl);
+  rm_free(h->slots);
+  rm_free(h);
+}
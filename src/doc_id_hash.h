@@ -0,0 +1,56 @@
+#ifndef __DOC_ID_HASH_H__
+#define __DOC_ID_HASH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "redisearch.h"
+
+/* DocIdHash - an open addressing hash map of document keys to docIds, used by the DocIdMap of
+ * indexes created with HASHKEYS.
+ *
+ * The layout follows Google's SwissTable: slots are split into groups of 16, and each slot has a
+ * control byte holding 7 bits of its key's hash, or a marker for empty and deleted slots. A lookup
+ * compares the 16 control bytes of a group at once (with SSE2 where available), and only looks at
+ * the slots whose control byte matches, so most probes touch one cache line of control bytes and a
+ * single slot.
+ *
+ * The map does not copy the keys. It keeps pointers to the NUL terminated keys given to
+ * DocIdHash_Put, which must stay valid as long as the map holds them */
+
+#define DOCIDHASH_GROUP_SIZE 16
+
+typedef struct {
+  const char *key;
+  uint32_t hash;
+  t_docId docId;
+} DocIdHashSlot;
+
+typedef struct {
+  // one control byte per slot
+  int8_t *ctrl;
+  DocIdHashSlot *slots;
+  // the number of groups, always a power of 2 (or 0 before the first insertion)
+  size_t numGroups;
+  size_t size;
+  // the number of insertions into empty slots we can do before growing the map. Deleted slots
+  // still count as used until the map is rehashed
+  size_t growthLeft;
+} DocIdHash;
+
+DocIdHash *NewDocIdHash();
+
+/* Get the docId of a key, or 0 if the key is not in the map */
+t_docId DocIdHash_Get(DocIdHash *h, const char *key, size_t len);
+
+/* Put a key in the map, or replace its docId if it is already there */
+void DocIdHash_Put(DocIdHash *h, const char *key, size_t len, t_docId docId);
+
+/* Remove a key from the map. Returns 1 if it was in the map, 0 otherwise */
+int DocIdHash_Delete(DocIdHash *h, const char *key, size_t len);
+
+/* The memory used by the map, not including the keys */
+size_t DocIdHash_MemUsage(DocIdHash *h);
+
+void DocIdHash_Free(DocIdHash *h);
+
+#endif
@@ -7,6 +7,7 @@
 #include "dep/triemap/triemap.h"
 #include "sortable.h"
 #include "rmalloc.h"
+#include "util/epoch.h"
 
 /* Creates a new DocTable with a given capacity */
 DocTable NewDocTable(size_t cap) {
@@ -15,16 +16,33 @@ DocTable NewDocTable(size_t cap) {
                     .maxDocId = 0,
                     .memsize = 0,
                     .docs = rm_calloc(cap, sizeof(RSDocumentMetadata)),
-                    .dim = NewDocIdMap()};
+                    .dim = NewDocIdMap(DocIdMap_Trie),
+                    .keys = {.blockSize = DOCTABLE_KEYS_BLOCK}};
+}
+
+void DocTable_SetIdMapType(DocTable *t, DocIdMapType type) {
+  DocIdMap_Free(&t->dim);
+  t->dim = NewDocIdMap(type);
 }
 
 /* Get the metadata for a doc Id from the DocTable.
 *  If docId is not inside the table, we return NULL */
 inline RSDocumentMetadata *DocTable_Get(DocTable *t, t_docId docId) {
-  if (docId == 0 || docId > t->maxDocId) {
+  // the table may be read by queries running without the GIL while documents are added to it
+  if (docId == 0 || docId > __atomic_load_n(&t->maxDocId, __ATOMIC_ACQUIRE)) {
     return NULL;
   }
-  return &t->docs[docId];
+  return &__atomic_load_n(&t->docs, __ATOMIC_ACQUIRE)[docId];
+}
+
+static void docTable_FreePayload(void *p) {
+  RSPayload *pl = p;
+  rm_free(pl->data);
+  rm_free(pl);
+}
+
+static void docTable_FreeSortingVector(void *p) {
+  SortingVector_Free(p);
 }
 
 /** Get the docId of a key if it exists in the table, or 0 if it doesnt */
@@ -32,6 +50,33 @@ t_docId DocTable_GetId(DocTable *dt, const char *key) {
   return DocIdMap_Get(&dt->dim, key);
 }
 
+/* The copy of a document in the table being compacted, or NULL if it was not copied (yet) */
+static RSDocumentMetadata *docTable_GetCopy(DocTable *t, t_docId docId) {
+  DocTableCompaction *c = t->compaction;
+  if (!c || docId > c->remap.maxOldId || !c->remap.newIds[docId]) {
+    return NULL;
+  }
+  return &c->table.docs[c->remap.newIds[docId]];
+}
+
+static size_t dmd_payloadSize(RSDocumentMetadata *md) {
+  return md->payload ? md->payload->len + sizeof(RSPayload) : 0;
+}
+
+/* Update the copy of a document in the table being compacted, if it was copied, after its metadata
+ * was changed. The copy's payload may have been retired, so we get its old size */
+static void docTable_UpdateCopy(DocTable *t, t_docId docId, RSDocumentMetadata *md,
+                                size_t oldPayloadSize) {
+  RSDocumentMetadata *cp = docTable_GetCopy(t, docId);
+  if (cp) {
+    DocTable *ct = &t->compaction->table;
+    ct->memsize += dmd_payloadSize(md) - oldPayloadSize;
+    char *key = cp->key;
+    *cp = *md;
+    cp->key = key;
+  }
+}
+
 /* Set the payload for a document. Returns 1 if we set the payload, 0 if we couldn't find the
  * document */
 int DocTable_SetPayload(DocTable *t, t_docId docId, const char *data, size_t len) {
@@ -41,23 +86,22 @@ int DocTable_SetPayload(DocTable *t, t_docId docId, const char *data, size_t len
     return 0;
   }
 
-  /* If we already have metadata - clean up the old data */
+  /* If we already have metadata - clean up the old data. Queries may still be reading it */
+  size_t oldSize = dmd_payloadSize(dmd);
   if (dmd->payload) {
-    /* Free the old payload */
-    if (dmd->payload->data) {
-      rm_free(dmd->payload->data);
-    }
     t->memsize -= dmd->payload->len;
-  } else {
-    dmd->payload = rm_malloc(sizeof(RSPayload));
+    Epoch_Retire(dmd->payload, docTable_FreePayload);
   }
   /* Copy it... */
-  dmd->payload->data = rm_calloc(1, len + 1);
-  dmd->payload->len = len;
-  memcpy(dmd->payload->data, data, len);
+  RSPayload *pl = rm_malloc(sizeof(RSPayload));
+  pl->data = rm_calloc(1, len + 1);
+  pl->len = len;
+  memcpy(pl->data, data, len);
+  dmd->payload = pl;
 
   dmd->flags |= Document_HasPayload;
   t->memsize += len;
+  docTable_UpdateCopy(t, docId, dmd, oldSize);
   return 1;
 }
 
@@ -72,15 +116,21 @@ int DocTable_SetSortingVector(DocTable *t, t_docId docId, RSSortingVector *v) {
   /* Null vector means remove the current vector if it exists */
   if (!v) {
     if (dmd->sortVector) {
-      SortingVector_Free(dmd->sortVector);
+      Epoch_Retire(dmd->sortVector, docTable_FreeSortingVector);
+      dmd->sortVector = NULL;
     }
     dmd->flags &= ~Document_HasSortVector;
+    docTable_UpdateCopy(t, docId, dmd, dmd_payloadSize(dmd));
     return 1;
   }
 
-  /* Set th new vector and the flags accordingly */
+  /* Set th new vector and the flags accordingly. Queries may still be reading the old one */
+  if (dmd->sortVector && dmd->sortVector != v) {
+    Epoch_Retire(dmd->sortVector, docTable_FreeSortingVector);
+  }
   dmd->sortVector = v;
   dmd->flags |= Document_HasSortVector;
+  docTable_UpdateCopy(t, docId, dmd, dmd_payloadSize(dmd));
 
   return 1;
 }
@@ -97,12 +147,17 @@ t_docId DocTable_Put(DocTable *t, const char *key, double score, u_char flags, c
   if (xid) {
     return 0;
   }
-  t_docId docId = ++t->maxDocId;
-  // if needed - grow the table
-  if (t->maxDocId + 1 >= t->cap) {
-
-    t->cap += 1 + (t->cap ? MIN(t->cap / 2, 1024 * 1024) : 1);
-    t->docs = rm_realloc(t->docs, t->cap * sizeof(RSDocumentMetadata));
+  t_docId docId = t->maxDocId + 1;
+  // if needed - grow the table. Queries may be reading the old table, so we copy it and retire it
+  // instead of reallocating it
+  if (docId + 1 >= t->cap) {
+
+    size_t cap = t->cap + 1 + (t->cap ? MIN(t->cap / 2, 1024 * 1024) : 1);
+    RSDocumentMetadata *docs = rm_malloc(cap * sizeof(RSDocumentMetadata));
+    memcpy(docs, t->docs, docId * sizeof(RSDocumentMetadata));
+    Epoch_Retire(t->docs, NULL);
+    __atomic_store_n(&t->docs, docs, __ATOMIC_RELEASE);
+    t->cap = cap;
   }
 
   /* Copy the payload since it's probably an input string not retained */
@@ -117,11 +172,18 @@ t_docId DocTable_Put(DocTable *t, const char *key, double score, u_char flags, c
     t->memsize += payloadSize + sizeof(RSPayload);
   }
 
-  t->docs[docId] = (RSDocumentMetadata){
-      .key = rm_strdup(key), .score = score, .flags = flags, .payload = dpl, .maxFreq = 1};
+  size_t keyLen = strlen(key);
+  t->docs[docId] = (RSDocumentMetadata){.key = Arena_Strndup(&t->keys, key, keyLen),
+                                        .score = score,
+                                        .flags = flags,
+                                        .payload = dpl,
+                                        .maxFreq = 1};
+  // only publish the new id once its metadata is written
+  __atomic_store_n(&t->maxDocId, docId, __ATOMIC_RELEASE);
   ++t->size;
-  t->memsize += sizeof(RSDocumentMetadata) + strlen(key);
-  DocIdMap_Put(&t->dim, key, docId);
+  t->memsize += sizeof(RSDocumentMetadata) + keyLen;
+  // hash maps point to the key, so we give them the table's copy of it
+  DocIdMap_Put(&t->dim, t->docs[docId].key, docId);
   return docId;
 }
 
@@ -160,7 +222,6 @@ void dmd_free(RSDocumentMetadata *md) {
     md->sortVector = NULL;
     md->flags &= ~Document_HasSortVector;
   }
-  rm_free(md->key);
 }
 void DocTable_Free(DocTable *t) {
   // we start at docId 1, not 0
@@ -170,7 +231,126 @@ void DocTable_Free(DocTable *t) {
   if (t->docs) {
     rm_free(t->docs);
   }
+  Arena_Free(&t->keys);
   DocIdMap_Free(&t->dim);
+  rm_free(t->remap.newIds);
+  if (t->compaction) {
+    // the copied documents and the garbage are still the table's
+    t->compaction->numGarbage = 0;
+    DocTable_FreeCompacted(t->compaction);
+  }
+}
+
+void DocTable_StartCompaction(DocTable *t) {
+  DocTableCompaction *c = rm_calloc(1, sizeof(*c));
+  size_t numLive = t->size - 1 - t->numDeleted;
+  c->table = NewDocTable(numLive + 2 + MIN(numLive / 2, 1024 * 1024));
+  if (t->dim.hash) {
+    DocTable_SetIdMapType(&c->table, DocIdMap_Hash);
+  }
+  c->remapCap = t->maxDocId + 1;
+  c->remap.newIds = rm_calloc(c->remapCap, sizeof(t_docId));
+  t->compaction = c;
+}
+
+/* Copy a live document to the compacted table, returning its new docId. The copy shares its payload
+ * and sorting vector */
+static t_docId docTable_Copy(DocTable *ct, RSDocumentMetadata *md) {
+  t_docId docId = ct->maxDocId + 1;
+  // the copy is not read by anyone yet, so we can reallocate it
+  if (docId + 1 >= ct->cap) {
+    ct->cap += 1 + MIN(ct->cap / 2, 1024 * 1024);
+    ct->docs = rm_realloc(ct->docs, ct->cap * sizeof(RSDocumentMetadata));
+  }
+  size_t keyLen = strlen(md->key);
+  ct->docs[docId] = *md;
+  ct->docs[docId].key = Arena_Strndup(&ct->keys, md->key, keyLen);
+  DocIdMap_Put(&ct->dim, ct->docs[docId].key, docId);
+  ct->maxDocId = docId;
+  ++ct->size;
+  ct->memsize += sizeof(RSDocumentMetadata) + keyLen + dmd_payloadSize(md);
+  return docId;
+}
+
+int DocTable_CompactStep(DocTable *t, size_t num) {
+  DocTableCompaction *c = t->compaction;
+  for (; num > 0 && c->remap.maxOldId < t->maxDocId; num--) {
+    t_docId oldId = c->remap.maxOldId + 1;
+    if (oldId >= c->remapCap) {
+      c->remapCap = t->maxDocId + 1 + MIN(t->maxDocId / 2, 1024 * 1024);
+      c->remap.newIds = rm_realloc(c->remap.newIds, c->remapCap * sizeof(t_docId));
+    }
+
+    RSDocumentMetadata *md = &t->docs[oldId];
+    t_docId newId = 0;
+    if (!(md->flags & Document_Deleted)) {
+      newId = docTable_Copy(&c->table, md);
+    } else if (md->payload || md->sortVector) {
+      // queries may still read it, so it's freed with the old table
+      if (c->numGarbage == c->garbageCap) {
+        c->garbageCap = c->garbageCap ? c->garbageCap * 2 : 16;
+        c->garbage = rm_realloc(c->garbage, c->garbageCap * sizeof(RSDocumentMetadata));
+      }
+      c->garbage[c->numGarbage++] = *md;
+    }
+    c->remap.newIds[oldId] = newId;
+    c->remap.maxOldId = oldId;
+  }
+  return c->remap.maxOldId == t->maxDocId;
+}
+
+DocTableCompaction *DocTable_SwitchCompacted(DocTable *t) {
+  // the documents added since the last step
+  DocTable_CompactStep(t, SIZE_MAX);
+
+  // no query is running, so nothing is reading the old table. We only swap the tables here, the old
+  // one is freed later, see DocTable_FreeCompacted
+  DocTableCompaction *c = t->compaction;
+  DocTable old = *t;
+  DocTable *ct = &c->table;
+  t->docs = ct->docs;
+  t->keys = ct->keys;
+  t->dim = ct->dim;
+  t->cap = ct->cap;
+  t->size = ct->size;
+  t->maxDocId = ct->maxDocId;
+  t->memsize = ct->memsize;
+  __atomic_store_n(&t->numDeleted, ct->numDeleted, __ATOMIC_RELAXED);
+  t->docIdGen++;
+  t->remap = c->remap;
+  t->compaction = NULL;
+
+  *ct = old;
+  ct->remap = (DocIdRemap){0};
+  ct->compaction = NULL;
+  c->remap = (DocIdRemap){0};
+  return c;
+}
+
+void DocTable_FreeCompacted(DocTableCompaction *c) {
+  for (size_t i = 0; i < c->numGarbage; i++) {
+    dmd_free(&c->garbage[i]);
+  }
+  rm_free(c->garbage);
+  // the live documents were moved to the other table
+  rm_free(c->table.docs);
+  Arena_Free(&c->table.keys);
+  DocIdMap_Free(&c->table.dim);
+  rm_free(c->remap.newIds);
+  rm_free(c);
+}
+
+size_t DocTable_Compact(DocTable *t) {
+  DocTable_StartCompaction(t);
+  DocTableCompaction *c = DocTable_SwitchCompacted(t);
+  size_t ret = c->table.maxDocId - t->maxDocId;
+  DocTable_FreeCompacted(c);
+  return ret;
+}
+
+void DocTable_EndCompaction(DocTable *t) {
+  rm_free(t->remap.newIds);
+  t->remap = (DocIdRemap){0};
 }
 
 int DocTable_Delete(DocTable *t, const char *key) {
@@ -178,13 +358,22 @@ int DocTable_Delete(DocTable *t, const char *key) {
   if (docId && docId <= t->maxDocId) {
 
     RSDocumentMetadata *md = &t->docs[docId];
+    size_t oldSize = dmd_payloadSize(md);
     if (md->payload) {
-      rm_free(md->payload->data);
-      rm_free(md->payload);
+      Epoch_Retire(md->payload, docTable_FreePayload);
       md->payload = NULL;
     }
 
     md->flags |= Document_Deleted;
+    __atomic_add_fetch(&t->numDeleted, 1, __ATOMIC_RELAXED);
+    // a copied document stays in the compacted table, deleted as well
+    RSDocumentMetadata *cp = docTable_GetCopy(t, docId);
+    if (cp) {
+      DocTable *ct = &t->compaction->table;
+      DocIdMap_Delete(&ct->dim, cp->key);
+      ct->numDeleted++;
+    }
+    docTable_UpdateCopy(t, docId, md, oldSize);
     return DocIdMap_Delete(&t->dim, key);
   }
   return 0;
@@ -208,6 +397,16 @@ void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb) {
       SortingVector_RdbSave(rdb, t->docs[i].sortVector);
     }
   }
+
+  // the indexes save the docIdGen of their docIds, so a compaction goes on renumbering them after
+  // the table is loaded. The copy of a compaction that did not switch to it yet is not saved
+  RedisModule_SaveUnsigned(rdb, t->docIdGen);
+  RedisModule_SaveUnsigned(rdb, t->remap.newIds ? t->remap.maxOldId + 1 : 0);
+  if (t->remap.newIds) {
+    for (t_docId i = 0; i <= t->remap.maxOldId; i++) {
+      RedisModule_SaveUnsigned(rdb, t->remap.newIds[i]);
+    }
+  }
 }
 void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver) {
   size_t sz = RedisModule_LoadUnsigned(rdb);
@@ -219,8 +418,11 @@ void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver) {
   }
   t->size = sz;
   for (size_t i = 1; i < sz; i++) {
+    // the saved key includes its NUL terminator
     size_t len;
-    t->docs[i].key = RedisModule_LoadStringBuffer(rdb, &len);
+    char *key = RedisModule_LoadStringBuffer(rdb, &len);
+    t->docs[i].key = Arena_Strndup(&t->keys, key, len ? len - 1 : 0);
+    RedisModule_Free(key);
 
     t->docs[i].flags = RedisModule_LoadUnsigned(rdb);
     t->docs[i].maxFreq = 0;
@@ -243,9 +445,24 @@ void DocTable_RdbLoad(DocTable *t, RedisModuleIO *rdb, int encver) {
     // We always save deleted docs to rdb, but we don't want to load them back to the id map
     if (!(t->docs[i].flags & Document_Deleted)) {
       DocIdMap_Put(&t->dim, t->docs[i].key, i);
+    } else {
+      t->numDeleted++;
     }
     t->memsize += sizeof(RSDocumentMetadata) + len;
   }
+
+  // version 7 and up save the docIdGen and the remap of a compaction in progress
+  if (encver >= 7) {
+    t->docIdGen = RedisModule_LoadUnsigned(rdb);
+    size_t n = RedisModule_LoadUnsigned(rdb);
+    if (n) {
+      t->remap.newIds = rm_malloc(n * sizeof(t_docId));
+      t->remap.maxOldId = n - 1;
+      for (size_t i = 0; i < n; i++) {
+        t->remap.newIds[i] = RedisModule_LoadUnsigned(rdb);
+      }
+    }
+  }
 }
 
 void DocTable_AOFRewrite(DocTable *t, RedisModuleString *key, RedisModuleIO *aof) {
@@ -266,39 +483,56 @@ void DocTable_AOFRewrite(DocTable *t, RedisModuleString *key, RedisModuleIO *aof
   }
 }
 
-DocIdMap NewDocIdMap() {
-
-  TrieMap *m = NewTrieMap();
-  return (DocIdMap){m};
+DocIdMap NewDocIdMap(DocIdMapType type) {
+  if (type == DocIdMap_Hash) {
+    return (DocIdMap){.hash = NewDocIdHash()};
+  }
+  return (DocIdMap){.tm = NewTrieMap()};
 }
 
 t_docId DocIdMap_Get(DocIdMap *m, const char *key) {
+  if (m->hash) {
+    return DocIdHash_Get(m->hash, key, strlen(key));
+  }
 
   void *val = TrieMap_Find(m->tm, (char *)key, strlen(key));
   if (val && val != TRIEMAP_NOTFOUND) {
-    return *((t_docId *)val);
+    return (t_docId)(uintptr_t)val;
   }
   return 0;
 }
 
-void *_docIdMap_replace(void *oldval, void *newval) {
-  if (oldval) {
-    rm_free(oldval);
-  }
+static void *_docIdMap_replace(void *oldval, void *newval) {
   return newval;
 }
 
-void DocIdMap_Put(DocIdMap *m, const char *key, t_docId docId) {
+/* The values of the map are docIds, not pointers, so there is nothing to free */
+static void _docIdMap_nopFree(void *p) {
+}
 
-  t_docId *pd = rm_malloc(sizeof(t_docId));
-  *pd = docId;
-  TrieMap_Add(m->tm, (char *)key, strlen(key), pd, _docIdMap_replace);
+void DocIdMap_Put(DocIdMap *m, const char *key, t_docId docId) {
+  if (m->hash) {
+    DocIdHash_Put(m->hash, key, strlen(key), docId);
+    return;
+  }
+  TrieMap_Add(m->tm, (char *)key, strlen(key), (void *)(uintptr_t)docId, _docIdMap_replace);
 }
 
 void DocIdMap_Free(DocIdMap *m) {
-  TrieMap_Free(m->tm, RedisModule_Free);
+  if (m->hash) {
+    DocIdHash_Free(m->hash);
+    return;
+  }
+  TrieMap_Free(m->tm, _docIdMap_nopFree);
 }
 
 int DocIdMap_Delete(DocIdMap *m, const char *key) {
-  return TrieMap_Delete(m->tm, (char *)key, strlen(key), RedisModule_Free);
-}
\ No newline at end of file
+  if (m->hash) {
+    return DocIdHash_Delete(m->hash, key, strlen(key));
+  }
+  return TrieMap_Delete(m->tm, (char *)key, strlen(key), _docIdMap_nopFree);
+}
+
+size_t DocIdMap_MemUsage(DocIdMap *m) {
+  return m->hash ? DocIdHash_MemUsage(m->hash) : TrieMap_MemUsage(m->tm);
+}
@@ -6,21 +6,54 @@
 #include "dep/triemap/triemap.h"
 #include "redisearch.h"
 #include "sortable.h"
+#include "util/arena.h"
+#include "doc_id_hash.h"
+
+typedef enum {
+  // keys are kept in a TrieMap, which shares their common prefixes
+  DocIdMap_Trie,
+  // keys are kept in a hash map, which is faster for keys with little prefix sharing, e.g. UUIDs.
+  // The map does not copy the keys, see DocIdHash
+  DocIdMap_Hash,
+} DocIdMapType;
+
+/* Map between external id an incremental id. The docIds are stored inline as the values of the map,
+ * not as pointers to them. Exactly one of tm and hash is set, according to the type of the map */
+typedef struct {
+  TrieMap *tm;
+  DocIdHash *hash;
+} DocIdMap;
 
-/* Map between external id an incremental id */
-typedef struct { TrieMap *tm; } DocIdMap;
-
-DocIdMap NewDocIdMap();
+DocIdMap NewDocIdMap(DocIdMapType type);
 /* Get docId from a did-map. Returns 0  if the key is not in the map */
 t_docId DocIdMap_Get(DocIdMap *m, const char *key);
 
-/* Put a new doc id in the map if it does not already exist */
+/* Put a new doc id in the map if it does not already exist. Hash maps keep a pointer to the key, so
+ * it must outlive the map */
 void DocIdMap_Put(DocIdMap *m, const char *key, t_docId docId);
 
 int DocIdMap_Delete(DocIdMap *m, const char *key);
 /* Free the doc id map */
 void DocIdMap_Free(DocIdMap *m);
 
+/* The memory used by the map, not including the keys of hash maps */
+size_t DocIdMap_MemUsage(DocIdMap *m);
+
+/* How DocTable_Compact renumbered the documents of a table. Every docId the table had before maps
+ * to the document's new docId, or to 0 if the document was deleted */
+typedef struct {
+  t_docId *newIds;
+  t_docId maxOldId;
+} DocIdRemap;
+
+/* Get the new docId of a document by its docId before the table was compacted, or 0 if it was
+ * deleted */
+static inline t_docId DocIdRemap_Get(const DocIdRemap *r, t_docId oldId) {
+  return oldId <= r->maxOldId ? r->newIds[oldId] : 0;
+}
+
+struct docTableCompaction;
+
 /* The DocTable is a simple mapping between incremental ids and the original document key and
  * metadata. It is also responsible for storing the id incrementor for the index and assigning
  * new
@@ -35,13 +68,47 @@ typedef struct {
   size_t cap;
   size_t memsize;
   RSDocumentMetadata *docs;
+  // the number of deleted documents, which stay in the table. Updated atomically, as the garbage
+  // collector reads it without the GIL
+  size_t numDeleted;
   DocIdMap dim;
-
+  // the keys of the documents, packed one after the other. Keys are never freed one by one, the
+  // key of a deleted document stays in the table along with its metadata
+  Arena keys;
+  // incremented whenever the table is compacted. Every index of the table's documents records the
+  // generation of the docIds it holds, and is renumbered with remap until it is up to date
+  uint32_t docIdGen;
+  // the renumbering of the last compaction, kept until all the indexes are renumbered. Its newIds
+  // are NULL otherwise
+  DocIdRemap remap;
+  // the compacted copy of the table being built, see DocTable_StartCompaction, or NULL
+  struct docTableCompaction *compaction;
 } DocTable;
 
+/* A compaction of a DocTable in progress. Until DocTable_SwitchCompacted, table is the compacted
+ * copy of the documents copied so far, which shares their payloads and sorting vectors, and remap
+ * maps the docIds of the copied documents up to remap.maxOldId. After it, table holds what is left
+ * of the old table, to be freed with DocTable_FreeCompacted */
+typedef struct docTableCompaction {
+  DocTable table;
+  DocIdRemap remap;
+  size_t remapCap;
+  // the metadata of deleted documents that were not copied, whose payloads and sorting vectors are
+  // freed along with the old table
+  RSDocumentMetadata *garbage;
+  size_t numGarbage;
+  size_t garbageCap;
+} DocTableCompaction;
+
+/* The block size of the key arena of the table */
+#define DOCTABLE_KEYS_BLOCK (64 * 1024)
+
 /* Creates a new DocTable with a given capacity */
 DocTable NewDocTable(size_t cap);
 
+/* Replace the id map of an empty table with a new map of the given type */
+void DocTable_SetIdMapType(DocTable *t, DocIdMapType type);
+
 /* Get the metadata for a doc Id from the DocTable.
 *  If docId is not inside the table, we return NULL */
 RSDocumentMetadata *DocTable_Get(DocTable *t, t_docId docId);
@@ -80,6 +147,38 @@ void DocTable_Free(DocTable *t);
 
 int DocTable_Delete(DocTable *t, const char *key);
 
+/* Start compacting the table, dropping its deleted documents and giving the remaining ones the
+ * docIds 1 to N, in the order of their current docIds. The compacted table is built as a copy by
+ * DocTable_CompactStep while the table is used as usual, and replaces it in
+ * DocTable_SwitchCompacted. Documents added meanwhile are copied as well, and deleting or updating
+ * a copied document updates its copy. The table must not be compacted again before
+ * DocTable_EndCompaction is called */
+void DocTable_StartCompaction(DocTable *t);
+
+/* Copy up to num more documents to the compacted table. Returns 1 once every document of the table
+ * was copied, until more are added */
+int DocTable_CompactStep(DocTable *t, size_t num);
+
+/* Copy the documents that are left, and replace the table with its compacted copy. The mapping from
+ * the old docIds to the new ones is kept in the table's remap, and the table moves to a new
+ * docIdGen. Every index of the table's documents must be renumbered before it is used again, and no
+ * query may be running.
+ *
+ * Returns the compaction, holding the old table, whose table.maxDocId is the old maxDocId. It is
+ * not referenced by anything else, and can be freed without the GIL */
+DocTableCompaction *DocTable_SwitchCompacted(DocTable *t);
+
+/* Free the old table returned by DocTable_SwitchCompacted, along with the deleted documents it kept
+ */
+void DocTable_FreeCompacted(DocTableCompaction *c);
+
+/* Compact the table in one go, see DocTable_StartCompaction. No query may be running. Returns the
+ * number of docIds that were reclaimed */
+size_t DocTable_Compact(DocTable *t);
+
+/* Release the remap of the last compaction, once all the indexes were renumbered */
+void DocTable_EndCompaction(DocTable *t);
+
 /* Save the table to RDB. Called from the owning index */
 void DocTable_RdbSave(DocTable *t, RedisModuleIO *rdb);
 
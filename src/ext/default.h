@@ -8,4 +8,8 @@
 
 int DefaultExtensionInit(RSExtensionCtx *ctx);
 
+/* Calculate sum(TF-IDF)*document score for each result */
+double TFIDFScorer(RSScoringFunctionCtx *ctx, RSIndexResult *h, RSDocumentMetadata *dmd,
+                   double minScore);
+
 #endif
\ No newline at end of file
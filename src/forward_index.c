@@ -2,53 +2,136 @@
 #include "tokenize.h"
 #include "util/fnv.h"
 #include "util/logging.h"
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/param.h>
 #include "rmalloc.h"
 
+/* Hash tables that grew beyond this many buckets are not kept by pooled forward indexes */
+#define FORWARD_INDEX_MAX_POOLED_BUCKETS (64 * 1024)
+
+/* The pool of freed forward indexes. Forward indexes are built and freed on any thread, so the pool
+ * is guarded by a lock */
+static struct {
+  pthread_mutex_t lock;
+  ForwardIndex *entries[FORWARD_INDEX_POOL_SIZE];
+  size_t num;
+} forwardIndexPool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void forwardIndex_Destroy(ForwardIndex *idx) {
+  kh_destroy(32, idx->hits);
+  if (idx->stemmer) {
+    idx->stemmer->Free(idx->stemmer);
+  }
+  if (idx->language) {
+    rm_free(idx->language);
+  }
+  Arena_Free(&idx->arena);
+  rm_free(idx);
+}
+
 ForwardIndex *NewForwardIndex(Document doc) {
-  ForwardIndex *idx = rm_malloc(sizeof(ForwardIndex));
+  ForwardIndex *idx = NULL;
+  pthread_mutex_lock(&forwardIndexPool.lock);
+  if (forwardIndexPool.num) {
+    idx = forwardIndexPool.entries[--forwardIndexPool.num];
+  }
+  pthread_mutex_unlock(&forwardIndexPool.lock);
+
+  if (!idx) {
+    idx = rm_calloc(1, sizeof(ForwardIndex));
+    idx->hits = kh_init(32);
+    Arena_Init(&idx->arena, FORWARD_INDEX_ARENA_BLOCK);
+  }
 
-  idx->hits = kh_init(32);
   idx->docScore = doc.score;
   idx->docId = doc.docId;
   idx->totalFreq = 0;
   idx->uniqueTokens = 0;
   idx->maxFreq = 0;
-  idx->stemmer = NewStemmer(SnowballStemmer, doc.language);
+
+  // creating a stemmer is expensive, so we keep the previous document's one if we can
+  const char *lang = doc.language ? doc.language : DEFAULT_LANGUAGE;
+  if (!idx->language || strcmp(idx->language, lang)) {
+    if (idx->stemmer) {
+      idx->stemmer->Free(idx->stemmer);
+    }
+    if (idx->language) {
+      rm_free(idx->language);
+    }
+    idx->stemmer = NewStemmer(SnowballStemmer, lang);
+    idx->language = rm_strdup(lang);
+  }
 
   return idx;
 }
 
 void ForwardIndexFree(ForwardIndex *idx) {
-  khiter_t k;
-  for (k = kh_begin(idx->hits); k != kh_end(idx->hits); ++k) {
-    if (kh_exist(idx->hits, k)) {
-      ForwardIndexEntry *ent = kh_value(idx->hits, k);
-      // rm_free((void *)ent->term);
-
-      kh_del(32, idx->hits, k);
-      VVW_Free(ent->vw);
+  // the entries are all in the arena, so there is nothing to free one by one
+  Arena_Reset(&idx->arena);
+  if (kh_n_buckets(idx->hits) > FORWARD_INDEX_MAX_POOLED_BUCKETS) {
+    kh_destroy(32, idx->hits);
+    idx->hits = kh_init(32);
+  } else {
+    kh_clear(32, idx->hits);
+  }
 
-      if (ent->stringFreeable) {
-        rm_free((char *)ent->term);
-      }
-      rm_free(ent);
-    }
+  pthread_mutex_lock(&forwardIndexPool.lock);
+  if (forwardIndexPool.num < FORWARD_INDEX_POOL_SIZE) {
+    forwardIndexPool.entries[forwardIndexPool.num++] = idx;
+    idx = NULL;
   }
-  kh_destroy(32, idx->hits);
+  pthread_mutex_unlock(&forwardIndexPool.lock);
 
-  if (idx->stemmer) {
-    idx->stemmer->Free(idx->stemmer);
+  if (idx) {
+    forwardIndex_Destroy(idx);
   }
-  rm_free(idx);
-  // TODO: check if we need to rm_free each entry separately
 }
 
 // void ForwardIndex_NormalizeFreq(ForwardIndex *idx, ForwardIndexEntry *e) {
 //   e->freq = e->freq / idx->maxFreq;
 // }
 
+/* The initial capacity of the offset vectors of new entries */
+#define FORWARD_INDEX_INITIAL_OFFSETS 8
+
+/* Create an entry and its offset vector in the arena */
+static ForwardIndexEntry *forwardIndex_NewEntry(ForwardIndex *idx, Token *t) {
+  struct {
+    ForwardIndexEntry ent;
+    VarintVectorWriter vw;
+    Buffer buf;
+  } *p = Arena_Alloc(&idx->arena, sizeof(*p));
+
+  p->buf = (Buffer){.data = Arena_Alloc(&idx->arena, FORWARD_INDEX_INITIAL_OFFSETS),
+                    .cap = FORWARD_INDEX_INITIAL_OFFSETS};
+  p->vw = (VarintVectorWriter){.bw = NewBufferWriter(&p->buf)};
+
+  // tokens are only valid during the token callback, so we keep a copy of the term
+  char *term = Arena_Alloc(&idx->arena, t->len + 1);
+  memcpy(term, t->s, t->len);
+  term[t->len] = '\0';
+  p->ent = (ForwardIndexEntry){
+      .docId = idx->docId, .term = term, .len = t->len, .docScore = idx->docScore, .vw = &p->vw};
+  return &p->ent;
+}
+
+/* Make sure an offset vector has room for another offset, growing it inside the arena. The old
+ * data is simply left behind until the arena is reset */
+static void forwardIndex_ReserveOffset(ForwardIndex *idx, VarintVectorWriter *vw) {
+  Buffer *buf = vw->bw.buf;
+  if (buf->offset + MAX_VARINT_LEN <= buf->cap) {
+    return;
+  }
+  size_t cap = buf->cap * 2;
+  char *data = Arena_Alloc(&idx->arena, cap);
+  memcpy(data, buf->data, buf->offset);
+  buf->data = data;
+  buf->cap = cap;
+  vw->bw.pos = data + buf->offset;
+}
+
 int forwardIndexTokenFunc(void *ctx, Token t) {
   ForwardIndex *idx = ctx;
 
@@ -58,17 +141,7 @@ int forwardIndexTokenFunc(void *ctx, Token t) {
   ForwardIndexEntry *h = NULL;
   khiter_t k = kh_get(32, idx->hits, hval);  // first have to get ieter
   if (k == kh_end(idx->hits)) {              // k will be equal to kh_end if key not present
-    /// LG_DEBUG("new entry %.*s\n", t.len, t.s);
-    h = rm_calloc(1, sizeof(ForwardIndexEntry));
-    h->docId = idx->docId;
-    h->fieldMask = 0;
-    h->term = t.s;
-    h->len = t.len;
-    h->stringFreeable = t.stringFreeable;
-    h->freq = 0;
-
-    h->vw = NewVarintVectorWriter(4);
-    h->docScore = idx->docScore;
+    h = forwardIndex_NewEntry(idx, &t);
 
     int ret;
     k = kh_put(32, idx->hits, hval, &ret);
@@ -88,12 +161,22 @@ int forwardIndexTokenFunc(void *ctx, Token t) {
   idx->totalFreq += h->freq;
   idx->uniqueTokens++;
   idx->maxFreq = MAX(h->freq, idx->maxFreq);
+  forwardIndex_ReserveOffset(idx, h->vw);
   VVW_Write(h->vw, t.pos);
 
   // LG_DEBUG("%d) %s, token freq: %f total freq: %f\n", t.pos, t.s, h->freq, idx->totalFreq);
   return 0;
 }
 
+void ForwardIndex_SetDocId(ForwardIndex *idx, t_docId docId) {
+  idx->docId = docId;
+  for (khiter_t k = kh_begin(idx->hits); k != kh_end(idx->hits); ++k) {
+    if (kh_exist(idx->hits, k)) {
+      kh_value(idx->hits, k)->docId = docId;
+    }
+  }
+}
+
 ForwardIndexIterator ForwardIndex_Iterate(ForwardIndex *i) {
   ForwardIndexIterator iter;
   iter.idx = i;
@@ -111,6 +194,8 @@ ForwardIndexEntry *ForwardIndexIterator_Next(ForwardIndexIterator *iter) {
   // if we haven't reached the end, return the current iterator's entry
   if (iter->k != kh_end(iter->idx->hits) && kh_exist(iter->idx->hits, iter->k)) {
     ForwardIndexEntry *entry = kh_value(iter->idx->hits, iter->k);
+    // the document is fully tokenized by now, so we know its max frequency
+    entry->docMaxFreq = iter->idx->maxFreq;
     ++iter->k;
     return entry;
   }
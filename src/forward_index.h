@@ -5,16 +5,19 @@
 #include "varint.h"
 #include "tokenize.h"
 #include "document.h"
+#include "util/arena.h"
 
 typedef struct {
   t_docId docId;
+  // a NULL terminated copy of the term, in the forward index's arena
   const char *term;
   size_t len;
   uint32_t freq;
   float docScore;
+  // the maximal frequency of any term in the document, set when iterating the forward index
+  uint32_t docMaxFreq;
   t_fieldMask fieldMask;
   VarintVectorWriter *vw;
-  int stringFreeable;
 } ForwardIndexEntry;
 
 KHASH_MAP_INIT_INT(32, ForwardIndexEntry *)
@@ -22,6 +25,12 @@ KHASH_MAP_INIT_INT(32, ForwardIndexEntry *)
 // the quantizationn factor used to encode normalized (0..1) frquencies in the index
 #define FREQ_QUANTIZE_FACTOR 0xFFFF
 
+/* The terms of a single document, built by tokenizing it and then written to the inverted indexes.
+ *
+ * The entries, their offset vectors and their terms are all allocated from the forward index's
+ * arena, so the forward index does not depend on the document's text once it is built. Freed
+ * forward indexes are kept in a pool, and their arena, hash table and stemmer are reused by the
+ * next documents, so building a forward index rarely calls the allocator */
 typedef struct {
   khash_t(32) * hits;
   t_docId docId;
@@ -30,8 +39,17 @@ typedef struct {
   float docScore;
   int uniqueTokens;
   Stemmer *stemmer;
+  // the language of the stemmer, so it can be reused by documents in the same language
+  char *language;
+  Arena arena;
 } ForwardIndex;
 
+/* The number of freed forward indexes kept for reuse */
+#define FORWARD_INDEX_POOL_SIZE 32
+
+/* The block size of the forward index arenas */
+#define FORWARD_INDEX_ARENA_BLOCK (16 * 1024)
+
 typedef struct {
   ForwardIndex *idx;
   khiter_t k;
@@ -39,10 +57,15 @@ typedef struct {
 
 int forwardIndexTokenFunc(void *ctx, Token t);
 
+/* Release a forward index, returning it to the pool */
 void ForwardIndexFree(ForwardIndex *idx);
 ForwardIndex *NewForwardIndex(Document doc);
 ForwardIndexIterator ForwardIndex_Iterate(ForwardIndex *i);
 ForwardIndexEntry *ForwardIndexIterator_Next(ForwardIndexIterator *iter);
 void ForwardIndex_NormalizeFreq(ForwardIndex *, ForwardIndexEntry *);
 
+/* Set the docId of a forward index that was built before the document got its id, e.g. when it was
+ * tokenized in the background */
+void ForwardIndex_SetDocId(ForwardIndex *idx, t_docId docId);
+
 #endif
\ No newline at end of file
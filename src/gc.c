@@ -0,0 +1,595 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include "gc.h"
+#include "geo_index.h"
+#include "inverted_index.h"
+#include "numeric_index.h"
+#include "redis_index.h"
+#include "rmalloc.h"
+#include "rmutil/periodic.h"
+#include "util/epoch.h"
+#include "concurrent_ctx.h"
+
+long long GC_IntervalMS = GC_DEFAULT_INTERVAL_MS;
+
+/* The number of keys we ask SCAN to go over at once */
+#define GC_SCAN_COUNT "100"
+
+/* The steps of a compaction, see GarbageCollector */
+typedef enum {
+  GCCompact_None,
+  // building the compacted copy of the document table
+  GCCompact_Table,
+  // building renumbered copies of the indexes, while keeping the table's copy up to date
+  GCCompact_Prepare,
+  // waiting for the running queries to finish, to switch to the compacted table
+  GCCompact_Switch,
+  // switching the indexes to their renumbered copies, renumbering what they are missing
+  GCCompact_Renumber,
+} gcCompactPhase;
+
+/* A term whose key was returned by SCAN, waiting to be repaired */
+typedef struct {
+  char *str;
+  size_t len;
+} gcTerm;
+
+struct GarbageCollector {
+  IndexSpec *sp;
+  struct RMUtilTimer *timer;
+  // set under the GIL and the lock when the index is freed, after which the collector no longer
+  // touches it
+  int stopped;
+  // held while looking at the index without the GIL, so GC_Stop waits for us before it is freed
+  pthread_mutex_t lock;
+  // the number of deleted documents when we last found too little garbage to start a pass. We
+  // don't take the GIL to check again until more documents are deleted
+  size_t idleDeletes;
+  // the current interval between runs, backing off while there is nothing to do
+  long long intervalMS;
+
+  // the prefix of the index's term keys, and a SCAN pattern matching them
+  char *keyPrefix;
+  size_t keyPrefixLen;
+  char *keyPattern;
+
+  // set while a pass over the index is in progress
+  int inPass;
+  // the number of deleted documents when the pass started
+  size_t passDeletes;
+
+  // set by GC_Compact, until we start the compaction
+  int compactRequested;
+  gcCompactPhase phase;
+  // set while we hold back new queries for the running ones to finish, and since when
+  int holding;
+  struct timespec holdStart;
+  int holdWarned;
+
+  // the SCAN cursor of the term keys, which is 0 again once the scan is done
+  long long cursor;
+  int scanDone;
+  // the terms of the last SCAN reply, and the one we repair
+  gcTerm *terms;
+  size_t numTerms;
+  size_t termsCap;
+  size_t termIdx;
+  // the block of the current term to continue from
+  uint32_t startBlock;
+
+  // the numeric field we repair, or the number of fields once we're done with all of them, and the
+  // range of its tree to continue from
+  int numericField;
+  size_t startRange;
+  // the geo field we renumber while compacting, or the number of fields once we're done
+  int geoField;
+
+  GCStats stats;
+};
+
+/* Write s to dst, escaping the characters SCAN's MATCH treats as patterns */
+static char *gc_EscapePattern(char *dst, const char *s) {
+  for (; *s; s++) {
+    if (strchr("*?[]\\", *s)) {
+      *dst++ = '\\';
+    }
+    *dst++ = *s;
+  }
+  return dst;
+}
+
+/* Drop the terms of the last SCAN reply we did not get to */
+static void gc_ClearTerms(GarbageCollector *gc) {
+  for (size_t i = gc->termIdx; i < gc->numTerms; i++) {
+    rm_free(gc->terms[i].str);
+  }
+  gc->numTerms = gc->termIdx = 0;
+}
+
+static void gc_Free(void *p) {
+  GarbageCollector *gc = p;
+  pthread_mutex_destroy(&gc->lock);
+  gc_ClearTerms(gc);
+  rm_free(gc->terms);
+  rm_free(gc->keyPrefix);
+  rm_free(gc->keyPattern);
+  rm_free(gc);
+}
+
+/* Get the first field of a type from the i-th field on, or the number of fields if there is none */
+static int gc_NextField(GarbageCollector *gc, int i, FieldType type) {
+  IndexSpec *sp = gc->sp;
+  while (i < sp->numFields && sp->fields[i].type != type) {
+    i++;
+  }
+  return i;
+}
+
+/* Move to the first numeric field from the i-th field on */
+static void gc_SeekNumericField(GarbageCollector *gc, int i) {
+  gc->numericField = gc_NextField(gc, i, F_NUMERIC);
+  gc->startRange = 0;
+}
+
+static void gc_StartPass(GarbageCollector *gc) {
+  gc_ClearTerms(gc);
+  gc->inPass = 1;
+  gc->passDeletes = gc->sp->docs.numDeleted;
+  gc->cursor = 0;
+  gc->scanDone = 0;
+  gc->startBlock = 0;
+  gc_SeekNumericField(gc, 0);
+  gc->geoField = gc_NextField(gc, 0, F_GEO);
+}
+
+static double gc_ElapsedMS(struct timespec *since) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - since->tv_sec) * 1000.0 + (now.tv_nsec - since->tv_nsec) / 1000000.0;
+}
+
+/* Stop holding back new queries, if we are */
+static void gc_Release(GarbageCollector *gc) {
+  if (gc->holding) {
+    ConcurrentSearch_ReleaseNewTasks();
+    gc->holding = 0;
+  }
+}
+
+/* Switch to the compacted document table, and start a pass switching all of its indexes to their
+ * renumbered copies. Returns the old table, which we free once we release the GIL */
+static DocTableCompaction *gc_SwitchTable(GarbageCollector *gc) {
+  IndexSpec *sp = gc->sp;
+  DocTableCompaction *old = DocTable_SwitchCompacted(&sp->docs);
+  gc->stats.docIdsReclaimed += old->table.maxDocId - sp->docs.maxDocId;
+  gc_Release(gc);
+  // cached query results hold the old docIds
+  sp->revisionId++;
+  gc->stats.collectedDeletes = 0;
+  gc_StartPass(gc);
+  gc->phase = GCCompact_Renumber;
+  return old;
+}
+
+/* Queries hold docIds while they run, so we only switch to the compacted table while none is
+ * running. Under
+ * a steady load of queries there may never be such a moment, so while we wait we hold back the new
+ * ones, letting the running ones finish. We warn once if that takes long, e.g. because of a slow
+ * query */
+static void gc_WaitForQueries(GarbageCollector *gc, RedisModuleCtx *ctx) {
+  if (!gc->holding) {
+    ConcurrentSearch_HoldNewTasks();
+    gc->holding = 1;
+    gc->holdWarned = 0;
+    clock_gettime(CLOCK_MONOTONIC, &gc->holdStart);
+    return;
+  }
+  if (!gc->holdWarned && gc_ElapsedMS(&gc->holdStart) > GC_COMPACT_WAIT_WARN_MS) {
+    RedisModule_Log(ctx, "warning",
+                    "Compacting index %s: new queries are held back while waiting for running "
+                    "ones to finish for over %d ms",
+                    gc->sp->name, GC_COMPACT_WAIT_WARN_MS);
+    gc->holdWarned = 1;
+  }
+}
+
+static void gc_EndPass(GarbageCollector *gc) {
+  gc->inPass = 0;
+  if (gc->phase == GCCompact_Prepare) {
+    // every index has its renumbered copy, we can switch to the compacted table
+    gc->phase = GCCompact_Switch;
+    return;
+  }
+  gc->stats.collectedDeletes = gc->passDeletes;
+  gc->stats.numPasses++;
+  if (gc->phase == GCCompact_Renumber) {
+    // every index is renumbered, we don't need the remap anymore
+    DocTable_EndCompaction(&gc->sp->docs);
+    gc->phase = GCCompact_None;
+    gc->stats.numCompactions++;
+  }
+}
+
+/* Get the next batch of term keys from SCAN, keeping the terms of the index */
+static void gc_ScanTerms(GarbageCollector *gc, RedisModuleCtx *ctx) {
+  RedisModuleString *cursor = RedisModule_CreateStringFromLongLong(ctx, gc->cursor);
+  RedisModuleCallReply *r = RedisModule_Call(ctx, "SCAN", "scccc", cursor, "MATCH",
+                                             gc->keyPattern, "COUNT", GC_SCAN_COUNT);
+  RedisModule_FreeString(ctx, cursor);
+  if (r == NULL || RedisModule_CallReplyType(r) != REDISMODULE_REPLY_ARRAY ||
+      RedisModule_CallReplyLength(r) != 2) {
+    // we go on with the numeric indexes. A compaction can't skip any term, so it scans again
+    if (gc->phase == GCCompact_Renumber) {
+      gc->cursor = 0;
+    } else {
+      gc->scanDone = 1;
+    }
+    if (r) RedisModule_FreeCallReply(r);
+    return;
+  }
+
+  cursor = RedisModule_CreateStringFromCallReply(RedisModule_CallReplyArrayElement(r, 0));
+  if (RedisModule_StringToLongLong(cursor, &gc->cursor) == REDISMODULE_ERR) {
+    gc->cursor = 0;
+  }
+  RedisModule_FreeString(ctx, cursor);
+  gc->scanDone = gc->cursor == 0;
+
+  RedisModuleCallReply *keys = RedisModule_CallReplyArrayElement(r, 1);
+  size_t nkeys = RedisModule_CallReplyLength(keys);
+  gc->numTerms = gc->termIdx = 0;
+  for (size_t i = 0; i < nkeys; i++) {
+    size_t len;
+    const char *key =
+        RedisModule_CallReplyStringPtr(RedisModule_CallReplyArrayElement(keys, i), &len);
+    // terms never contain a '/', which is a separator. Keys that do belong to other indexes whose
+    // names start with ours and a '/'
+    if (len < gc->keyPrefixLen || memcmp(key, gc->keyPrefix, gc->keyPrefixLen) ||
+        memchr(key + gc->keyPrefixLen, '/', len - gc->keyPrefixLen)) {
+      continue;
+    }
+    if (gc->numTerms == gc->termsCap) {
+      gc->termsCap = MAX(gc->termsCap * 2, 16);
+      gc->terms = rm_realloc(gc->terms, gc->termsCap * sizeof(gcTerm));
+    }
+    len -= gc->keyPrefixLen;
+    gc->terms[gc->numTerms++] =
+        (gcTerm){.str = rm_strndup(key + gc->keyPrefixLen, len), .len = len};
+  }
+  RedisModule_FreeCallReply(r);
+}
+
+/* Repair up to budget blocks of the current term, and move on to the next term if we're done with
+ * it. While compacting we copy up to budget renumbered blocks of the term instead, and once we
+ * switched to the compacted table the term switches to its copies and renumbers the rest. Returns
+ * the number of blocks we went over */
+static int gc_RepairTerm(GarbageCollector *gc, RedisModuleCtx *ctx, int budget,
+                         IndexRepairStats *rs) {
+  IndexSpec *sp = gc->sp;
+  gcTerm *term = &gc->terms[gc->termIdx];
+  RedisSearchCtx sctx = SEARCH_CTX_STATIC(ctx, sp);
+  RedisModuleString *keyName = fmtRedisTermKey(&sctx, term->str, term->len);
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_FreeString(ctx, keyName);
+
+  int work = 1;
+  uint32_t next = 0;
+  if (k && RedisModule_ModuleTypeGetType(k) == InvertedIndexType) {
+    InvertedIndex *idx = RedisModule_ModuleTypeGetValue(k);
+    if (gc->phase == GCCompact_Prepare) {
+      work = InvertedIndex_PrepareRenumber(idx, &sp->docs.compaction->remap, budget);
+      // we ran out of budget before copying all we could
+      next = work == budget;
+      work = MAX(1, work);
+    } else if (gc->phase == GCCompact_Renumber) {
+      IndexRenumbering *r = idx->renumbering;
+      work = MAX(1, (int)(idx->size - (r ? r->copies[r->size - 1].end : 0)));
+      Redis_RenumberInvertedIndex(&sctx, idx, rs);
+    } else {
+      if (idx->size > gc->startBlock) {
+        work = MAX(1, MIN(budget, (int)(idx->size - gc->startBlock)));
+      }
+
+      IndexRepairStats before = *rs;
+      next = InvertedIndex_Repair(idx, &sp->docs, gc->startBlock, budget, rs);
+      sp->stats.numRecords -=
+          MIN(sp->stats.numRecords, rs->recordsRemoved - before.recordsRemoved);
+      sp->stats.invertedSize -=
+          MIN(sp->stats.invertedSize, rs->bytesCollected - before.bytesCollected);
+    }
+
+    // every record of the term was deleted, we drop it from the index. Blocks left empty are only
+    // dropped when no query is running, until then we keep the term
+    if (!next && idx->size == 1 && idx->blocks[0].numDocs == 0) {
+      RedisModule_DeleteKey(k);
+      Trie_Delete(sp->terms, term->str, term->len);
+      if (sp->stats.numTerms) sp->stats.numTerms--;
+      sp->stats.termsSize -= MIN(sp->stats.termsSize, term->len);
+      gc->stats.termsRemoved++;
+    }
+  }
+  if (k) {
+    RedisModule_CloseKey(k);
+  }
+
+  if (next) {
+    // copying doesn't go by startBlock, the index keeps track of its copies
+    gc->startBlock = gc->phase == GCCompact_Prepare ? 0 : next;
+  } else {
+    gc->startBlock = 0;
+    rm_free(term->str);
+    gc->termIdx++;
+  }
+  return work;
+}
+
+/* Repair the ranges of the current numeric field for about budget blocks, and move on to the next
+ * field if we're done with it. While compacting we copy renumbered blocks of its ranges instead,
+ * and once we switched to the compacted table the field is renumbered in one go. Returns the number
+ * of blocks we went over */
+static int gc_RepairNumeric(GarbageCollector *gc, RedisModuleCtx *ctx, int budget,
+                            IndexRepairStats *rs) {
+  IndexSpec *sp = gc->sp;
+  RedisSearchCtx sctx = SEARCH_CTX_STATIC(ctx, sp);
+  RedisModuleString *keyName = fmtRedisNumericIndexKey(&sctx, sp->fields[gc->numericField].name);
+  RedisModuleKey *k = RedisModule_OpenKey(ctx, keyName, REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_FreeString(ctx, keyName);
+
+  // splitting the tree between our runs moves its ranges around, so we may skip some of them. Their
+  // records are left for the next pass
+  size_t next = 0;
+  if (k && RedisModule_ModuleTypeGetType(k) == NumericIndexType) {
+    NumericRangeTree *t = RedisModule_ModuleTypeGetValue(k);
+    if (gc->phase == GCCompact_Prepare) {
+      const DocIdRemap *remap = &sp->docs.compaction->remap;
+      next = NumericRangeTree_PrepareRenumber(t, remap, gc->startRange, budget);
+    } else if (gc->phase == GCCompact_Renumber) {
+      NumericIndex_Renumber(&sctx, t, rs);
+    } else {
+      next = NumericRangeTree_Repair(t, &sp->docs, gc->startRange, budget, rs);
+    }
+  }
+  if (k) {
+    RedisModule_CloseKey(k);
+  }
+
+  if (next) {
+    gc->startRange = next;
+    return budget;
+  }
+  gc_SeekNumericField(gc, gc->numericField + 1);
+  return 1;
+}
+
+/* While compacting, copy the locations of up to GC_DOCS_PER_RUN documents of the current geo field
+ * to its renumbered copy, and once we switched to the compacted table replace the field's index
+ * with the copy. We move on to the next field when we're done with this one. This ends the run */
+static int gc_RenumberGeo(GarbageCollector *gc, RedisModuleCtx *ctx, int budget) {
+  RedisSearchCtx sctx = SEARCH_CTX_STATIC(ctx, gc->sp);
+  GeoIndex gi = {.ctx = &sctx, .sp = &gc->sp->fields[gc->geoField]};
+  int done = 1;
+  if (gc->phase == GCCompact_Prepare) {
+    done = GeoIndex_PrepareRenumber(&gi, GC_DOCS_PER_RUN);
+  } else {
+    GeoIndex_Renumber(&gi);
+  }
+  if (done) {
+    gc->geoField = gc_NextField(gc, gc->geoField + 1, F_GEO);
+  }
+  return budget;
+}
+
+static struct timespec gc_Interval(long long ms) {
+  return (struct timespec){.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+}
+
+static void gc_SetInterval(GarbageCollector *gc, long long ms) {
+  if (ms == gc->intervalMS) return;
+  gc->intervalMS = ms;
+  RMUtilTimer_SetInterval(gc->timer, gc_Interval(ms));
+}
+
+/* Double the interval between runs, as there was nothing to do */
+static void gc_Backoff(GarbageCollector *gc) {
+  gc_SetInterval(gc, MIN(gc->intervalMS * 2, GC_IntervalMS * GC_MAX_BACKOFF));
+}
+
+/* Returns 1 if the collector may have work to do, checking the index without taking the GIL. The
+ * deleted documents counter is the only thing that changes under the GIL and makes a pass due,
+ * since the garbage ratio can only grow as documents are deleted. Returns -1 if the collector was
+ * stopped */
+static int gc_HasWork(GarbageCollector *gc) {
+  pthread_mutex_lock(&gc->lock);
+  int ret = -1;
+  if (!gc->stopped) {
+    size_t numDeleted = __atomic_load_n(&gc->sp->docs.numDeleted, __ATOMIC_RELAXED);
+    ret = gc->inPass || gc->phase != GCCompact_None ||
+          __atomic_load_n(&gc->compactRequested, __ATOMIC_RELAXED) ||
+          numDeleted != gc->idleDeletes;
+  }
+  pthread_mutex_unlock(&gc->lock);
+  return ret;
+}
+
+static int gc_PeriodicCallback(RedisModuleCtx *ctx, void *privdata) {
+  GarbageCollector *gc = privdata;
+  int hasWork = gc_HasWork(gc);
+  if (hasWork <= 0) {
+    if (!hasWork) gc_Backoff(gc);
+    return hasWork == 0;
+  }
+  // while holding back new queries, we only take the GIL once the running ones are done, or to warn
+  // that they take long
+  if (gc->holding && Epoch_Active() &&
+      (gc->holdWarned || gc_ElapsedMS(&gc->holdStart) <= GC_COMPACT_WAIT_WARN_MS)) {
+    return 1;
+  }
+
+  RedisModule_ThreadSafeContextLock(ctx);
+  // the index was freed, we stop the timer, which frees us
+  if (gc->stopped) {
+    RedisModule_ThreadSafeContextUnlock(ctx);
+    return 0;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  IndexRepairStats rs = {0};
+  DocTableCompaction *oldTable = NULL;
+
+  if (gc->compactRequested && gc->phase == GCCompact_None) {
+    __atomic_store_n(&gc->compactRequested, 0, __ATOMIC_RELAXED);
+    DocTable_StartCompaction(&gc->sp->docs);
+    gc->phase = GCCompact_Table;
+  }
+  if (gc->phase == GCCompact_Table) {
+    if (!DocTable_CompactStep(&gc->sp->docs, GC_DOCS_PER_RUN)) {
+      gc_SetInterval(gc, GC_IntervalMS);
+      goto done;
+    }
+    // any repair pass in progress is abandoned, the deleted documents it was after are dropped by
+    // the compaction
+    gc->phase = GCCompact_Prepare;
+    gc_StartPass(gc);
+  } else if (gc->phase == GCCompact_Prepare) {
+    // the documents added meanwhile are copied as well, so their records get renumbered copies
+    DocTable_CompactStep(&gc->sp->docs, GC_DOCS_PER_RUN);
+  }
+  if (gc->phase == GCCompact_Switch) {
+    if (Epoch_Active()) {
+      gc_WaitForQueries(gc, ctx);
+      RedisModule_ThreadSafeContextUnlock(ctx);
+      gc_SetInterval(gc, MIN(GC_IntervalMS, GC_COMPACT_WAIT_POLL_MS));
+      return 1;
+    }
+    oldTable = gc_SwitchTable(gc);
+  }
+
+  if (!gc->inPass) {
+    if (GC_GarbageRatio(gc->sp) < GC_MIN_GARBAGE_RATIO) {
+      gc->idleDeletes = gc->sp->docs.numDeleted;
+      RedisModule_ThreadSafeContextUnlock(ctx);
+      gc_Backoff(gc);
+      return 1;
+    }
+    gc_StartPass(gc);
+  }
+  gc_SetInterval(gc, GC_IntervalMS);
+
+  int budget = GC_BLOCKS_PER_RUN;
+  while (budget > 0 && gc->inPass) {
+    if (gc->termIdx < gc->numTerms) {
+      budget -= gc_RepairTerm(gc, ctx, budget, &rs);
+    } else if (!gc->scanDone) {
+      gc_ScanTerms(gc, ctx);
+      budget--;
+    } else if (gc->numericField < gc->sp->numFields) {
+      budget -= gc_RepairNumeric(gc, ctx, budget, &rs);
+    } else if ((gc->phase == GCCompact_Prepare || gc->phase == GCCompact_Renumber) &&
+               gc->geoField < gc->sp->numFields) {
+      budget -= gc_RenumberGeo(gc, ctx, budget);
+    } else {
+      gc_EndPass(gc);
+    }
+  }
+
+done:
+  gc->stats.recordsCollected += rs.recordsRemoved;
+  gc->stats.bytesCollected += rs.bytesCollected;
+  gc->stats.blocksRemoved += rs.blocksRemoved;
+  gc->stats.numRuns++;
+  gc->stats.totalMSRun += gc_ElapsedMS(&start);
+
+  RedisModule_ThreadSafeContextUnlock(ctx);
+  if (oldTable) {
+    DocTable_FreeCompacted(oldTable);
+  }
+  return 1;
+}
+
+GarbageCollector *NewGarbageCollector(IndexSpec *sp) {
+  if (GC_IntervalMS <= 0) {
+    return NULL;
+  }
+
+  GarbageCollector *gc = rm_calloc(1, sizeof(GarbageCollector));
+  gc->sp = sp;
+  pthread_mutex_init(&gc->lock, NULL);
+  // we look at the index on the first run
+  gc->idleDeletes = SIZE_MAX;
+  gc->intervalMS = GC_IntervalMS;
+  size_t nameLen = strlen(sp->name);
+  gc->keyPrefix = rm_malloc(nameLen + 5);
+  gc->keyPrefixLen = sprintf(gc->keyPrefix, TERM_KEY_FORMAT, sp->name, 0, "");
+
+  // every character of the name may be escaped
+  gc->keyPattern = rm_malloc(2 * nameLen + 6);
+  char *p = gc_EscapePattern(stpcpy(gc->keyPattern, TERM_KEY_PREFIX), sp->name);
+  strcpy(p, "/*");
+
+  // the index was loaded in the middle of a compaction, we go on renumbering its indexes
+  if (sp->docs.remap.newIds) {
+    gc_StartPass(gc);
+    gc->phase = GCCompact_Renumber;
+  }
+
+  gc->timer = RMUtil_NewPeriodicTimer(gc_PeriodicCallback, gc_Free, gc, gc_Interval(GC_IntervalMS));
+  return gc;
+}
+
+void GC_Stop(GarbageCollector *gc) {
+  pthread_mutex_lock(&gc->lock);
+  gc->stopped = 1;
+  pthread_mutex_unlock(&gc->lock);
+  // the collector only changes this under the GIL, and won't take it again
+  gc_Release(gc);
+  RMUtilTimer_Terminate(gc->timer);
+}
+
+int GC_Compact(GarbageCollector *gc) {
+  if (gc->compactRequested || gc->phase != GCCompact_None) {
+    return REDISMODULE_ERR;
+  }
+  __atomic_store_n(&gc->compactRequested, 1, __ATOMIC_RELAXED);
+  // the collector may be backing off, we don't wait for it
+  RMUtilTimer_SetInterval(gc->timer, gc_Interval(GC_IntervalMS));
+  return REDISMODULE_OK;
+}
+
+int GC_IsCompacting(GarbageCollector *gc) {
+  return gc && (gc->compactRequested || gc->phase != GCCompact_None);
+}
+
+const char *GC_CompactionPhase(GarbageCollector *gc) {
+  if (!gc || (!gc->compactRequested && gc->phase == GCCompact_None)) {
+    return "none";
+  }
+  switch (gc->phase) {
+    case GCCompact_Table:
+      return "copying_table";
+    case GCCompact_Prepare:
+      return "renumbering_indexes";
+    case GCCompact_Renumber:
+      return "switching_indexes";
+    default:
+      return "waiting_for_queries";
+  }
+}
+
+GCStats GC_GetStats(GarbageCollector *gc) {
+  if (!gc) {
+    return (GCStats){0};
+  }
+  GCStats ret = gc->stats;
+  ret.compactionWaitMS = gc->holding ? gc_ElapsedMS(&gc->holdStart) : 0;
+  return ret;
+}
+
+double GC_GarbageRatio(IndexSpec *sp) {
+  size_t pending = sp->docs.numDeleted - GC_GetStats(sp->gc).collectedDeletes;
+  size_t total = sp->stats.numDocuments + pending;
+  return total ? (double)pending / total : 0;
+}
@@ -0,0 +1,109 @@
+#ifndef __GC_H__
+#define __GC_H__
+
+#include <stdlib.h>
+#include "redismodule.h"
+#include "spec.h"
+
+/* The default interval between two runs of the garbage collector of an index, in milliseconds. It
+ * can be changed with the GC_INTERVAL module argument, and 0 disables garbage collection */
+#define GC_DEFAULT_INTERVAL_MS 100
+
+extern long long GC_IntervalMS;
+
+/* While an index has no garbage, the interval between runs of its collector doubles after each run,
+ * up to this many times GC_IntervalMS */
+#define GC_MAX_BACKOFF 16
+
+/* The maximal number of index blocks the collector repairs in a single run, i.e. while holding the
+ * GIL */
+#define GC_BLOCKS_PER_RUN 100
+
+/* The number of documents a compaction copies to the compacted document table in a single run */
+#define GC_DOCS_PER_RUN 10000
+
+/* While a compaction waits for the running queries to finish, the collector checks on them every
+ * this many milliseconds, and warns once if they take longer than GC_COMPACT_WAIT_WARN_MS */
+#define GC_COMPACT_WAIT_POLL_MS 5
+#define GC_COMPACT_WAIT_WARN_MS 1000
+
+/* A pass over the index starts once this fraction of its documents were deleted since the last one
+ */
+#define GC_MIN_GARBAGE_RATIO 0.01
+
+typedef struct {
+  // records of deleted documents removed from the text and numeric indexes
+  size_t recordsCollected;
+  // the memory freed, in bytes
+  size_t bytesCollected;
+  // index blocks that were left empty or merged into their neighbours
+  size_t blocksRemoved;
+  // terms whose records were all deleted, and were dropped from the index
+  size_t termsRemoved;
+  // the number of deleted documents whose records were all collected, i.e. that were deleted
+  // before the start of the last complete pass
+  size_t collectedDeletes;
+  // complete passes over the index
+  size_t numPasses;
+  // the runs that did any work, and their total time
+  size_t numRuns;
+  double totalMSRun;
+  // completed compactions of the index, and the docIds they reclaimed
+  size_t numCompactions;
+  size_t docIdsReclaimed;
+  // how long the compaction in progress has been waiting for the running queries to finish
+  double compactionWaitMS;
+} GCStats;
+
+/* The garbage collector of an index.
+ *
+ * FT.DEL only marks documents as deleted in the document table, and their records stay in the
+ * inverted indexes, where every query skips them. Once enough documents were deleted, the collector
+ * makes a pass over the index in the background, removing their records from the inverted index of
+ * every term and then from the ranges of every numeric field.
+ *
+ * The collector has its own thread, and works in short runs repairing up to GC_BLOCKS_PER_RUN
+ * blocks while holding the GIL, every GC_IntervalMS. A run only takes the GIL if documents were
+ * deleted since the last time it found too little garbage, or if it has work in progress, and the
+ * interval backs off while there is nothing to do. The terms are walked with a SCAN cursor over
+ * their keys, so a pass can be resumed between runs and visits every term that exists throughout
+ * the pass, even while terms are added and removed.
+ *
+ * The collector also compacts the index on demand. Deleted documents keep their docIds, so after
+ * heavy churn the docIds are sparse, and the document table and every scan over the docIds are
+ * mostly made of deleted documents. A compaction first builds a copy of the document table with
+ * dense docIds in the background, see DocTable_StartCompaction. It then makes a pass building
+ * renumbered copies of every term, numeric and geo index, a few blocks or documents per run, see
+ * InvertedIndex_PrepareRenumber. It then waits for a moment no query is running, holding back new
+ * queries until the running ones are done, to switch to the table's copy. Last, it makes a pass
+ * switching every index to its copy, only renumbering the records written since it was copied. An
+ * index that is used before the pass gets to it is switched when it is opened, so queries never
+ * see the old docIds */
+typedef struct GarbageCollector GarbageCollector;
+
+/* Start the garbage collector of an index that was put in the keyspace. Returns NULL if garbage
+ * collection is disabled */
+GarbageCollector *NewGarbageCollector(IndexSpec *sp);
+
+/* Stop the collector of an index that is being freed. Must be called holding the GIL. The collector
+ * never touches the index again, and frees itself on its own thread */
+void GC_Stop(GarbageCollector *gc);
+
+/* Start compacting the index. Returns REDISMODULE_ERR if a compaction is already in progress */
+int GC_Compact(GarbageCollector *gc);
+
+/* Returns 1 if a compaction of the index was started and is not done yet */
+int GC_IsCompacting(GarbageCollector *gc);
+
+/* The step of the compaction in progress, as shown by FT.INFO: "none", "copying_table",
+ * "renumbering_indexes", "waiting_for_queries" or "switching_indexes" */
+const char *GC_CompactionPhase(GarbageCollector *gc);
+
+/* Get the statistics of a collector, or empty ones if it is NULL */
+GCStats GC_GetStats(GarbageCollector *gc);
+
+/* The fraction of the index's documents that were deleted, and whose records may still be in the
+ * index */
+double GC_GarbageRatio(IndexSpec *sp);
+
+#endif
@@ -3,17 +3,28 @@
 #include "rmutil/util.h"
 #include "rmalloc.h"
 #include "id_list.h"
+#include <math.h>
+#include <sys/param.h>
 
 #define GEOINDEX_KEY_FMT "geo:%s/%s"
+#define GEOINDEX_RENUMBER_KEY_FMT "geo-renumber:%s/%s"
+
+#define GEO_EARTH_RADIUS_M 6372797.560856
 
 RedisModuleString *fmtGeoIndexKey(GeoIndex *gi) {
   return RedisModule_CreateStringPrintf(gi->ctx->redisCtx, GEOINDEX_KEY_FMT, gi->ctx->spec->name,
                                         gi->sp->name);
 }
 
+RedisModuleString *fmtGeoIndexRenumberKey(GeoIndex *gi) {
+  return RedisModule_CreateStringPrintf(gi->ctx->redisCtx, GEOINDEX_RENUMBER_KEY_FMT,
+                                        gi->ctx->spec->name, gi->sp->name);
+}
+
 /* Add a docId to a geoindex key. Right now we just use redis' own GEOADD */
-int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat) {
+int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, const char *slon, const char *slat) {
 
+  GeoIndex_Renumber(gi);
   RedisModuleString *ks = fmtGeoIndexKey(gi);
 
   RedisModuleCtx *ctx = gi->ctx->redisCtx;
@@ -26,9 +37,102 @@ int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat) {
     return REDISMODULE_ERR;
   }
 
+  // a document that was already copied to the renumbered copy is updated there as well
+  DocTableCompaction *c = gi->ctx->spec->docs.compaction;
+  t_docId newId = c && docId <= gi->sp->renumberedUpTo ? DocIdRemap_Get(&c->remap, docId) : 0;
+  if (newId) {
+    rep = RedisModule_Call(ctx, "GEOADD", "sccs", fmtGeoIndexRenumberKey(gi), slon, slat,
+                           RedisModule_CreateStringFromLongLong(ctx, (long long)newId));
+    if (rep == NULL || RedisModule_CallReplyType(rep) == REDISMODULE_REPLY_ERROR) {
+      return REDISMODULE_ERR;
+    }
+  }
+
   return REDISMODULE_OK;
 }
 
+/* Copy the locations of the documents whose old docIds are in (from, to] to the renumbered copy of
+ * the index, under their new docIds. The index is a sorted set whose members are docIds, so we look
+ * them up by docId rather than scan it */
+static void geoIndex_CopyRenumbered(GeoIndex *gi, const DocIdRemap *remap, t_docId from,
+                                    t_docId to) {
+  RedisModuleCtx *ctx = gi->ctx->redisCtx;
+  RedisModuleString *ks = fmtGeoIndexKey(gi);
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, ks, REDISMODULE_READ);
+  RedisModule_FreeString(ctx, ks);
+  if (!key || RedisModule_KeyType(key) != REDISMODULE_KEYTYPE_ZSET) {
+    if (key) RedisModule_CloseKey(key);
+    return;
+  }
+  ks = fmtGeoIndexRenumberKey(gi);
+  RedisModuleKey *copy = RedisModule_OpenKey(ctx, ks, REDISMODULE_READ | REDISMODULE_WRITE);
+  RedisModule_FreeString(ctx, ks);
+
+  for (t_docId docId = from + 1; docId <= to; docId++) {
+    t_docId newId = DocIdRemap_Get(remap, docId);
+    if (!newId) continue;
+
+    double score;
+    RedisModuleString *ele = RedisModule_CreateStringFromLongLong(ctx, docId);
+    int rc = RedisModule_ZsetScore(key, ele, &score);
+    RedisModule_FreeString(ctx, ele);
+    if (rc == REDISMODULE_OK) {
+      ele = RedisModule_CreateStringFromLongLong(ctx, newId);
+      RedisModule_ZsetAdd(copy, score, ele, NULL);
+      RedisModule_FreeString(ctx, ele);
+    }
+  }
+  RedisModule_CloseKey(copy);
+  RedisModule_CloseKey(key);
+}
+
+int GeoIndex_PrepareRenumber(GeoIndex *gi, size_t num) {
+  DocIdRemap *remap = &gi->ctx->spec->docs.compaction->remap;
+  FieldSpec *fs = gi->sp;
+  // a copy left behind by a compaction that was not completed, e.g. before a restart
+  if (!fs->renumberedUpTo) {
+    RedisModuleCallReply *rep =
+        RedisModule_Call(gi->ctx->redisCtx, "DEL", "s", fmtGeoIndexRenumberKey(gi));
+    if (rep) RedisModule_FreeCallReply(rep);
+  }
+  t_docId to = MIN(remap->maxOldId, fs->renumberedUpTo + num);
+  geoIndex_CopyRenumbered(gi, remap, fs->renumberedUpTo, to);
+  fs->renumberedUpTo = to;
+  return to == remap->maxOldId;
+}
+
+/* Copy the locations the renumbered copy of the index is missing, and replace the index with it */
+static void geoIndex_SwitchRenumbered(GeoIndex *gi, const DocIdRemap *remap) {
+  RedisModuleCtx *ctx = gi->ctx->redisCtx;
+  geoIndex_CopyRenumbered(gi, remap, gi->sp->renumberedUpTo, remap->maxOldId);
+
+  RedisModuleString *ks = fmtGeoIndexKey(gi);
+  RedisModuleString *copy = fmtGeoIndexRenumberKey(gi);
+  RedisModuleKey *key = RedisModule_OpenKey(ctx, copy, REDISMODULE_READ);
+  int empty = !key || RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_EMPTY;
+  if (key) RedisModule_CloseKey(key);
+
+  // no document left has a location
+  RedisModuleCallReply *rep = empty ? RedisModule_Call(ctx, "DEL", "s", ks)
+                                    : RedisModule_Call(ctx, "RENAME", "ss", copy, ks);
+  if (rep) RedisModule_FreeCallReply(rep);
+  RedisModule_FreeString(ctx, copy);
+  RedisModule_FreeString(ctx, ks);
+}
+
+int GeoIndex_Renumber(GeoIndex *gi) {
+  DocTable *dt = &gi->ctx->spec->docs;
+  if (gi->sp->docIdGen == dt->docIdGen) {
+    return 0;
+  }
+  if (dt->remap.newIds) {
+    geoIndex_SwitchRenumbered(gi, &dt->remap);
+  }
+  gi->sp->docIdGen = dt->docIdGen;
+  gi->sp->renumberedUpTo = 0;
+  return 1;
+}
+
 /* Parse a geo filter from redis arguments. We assume the filter args start at argv[0], and FILTER
  * is not passed to us.
  * The GEO filter syntax is (FILTER) <property> LONG LAT DIST m|km|ft|mi
@@ -108,6 +212,7 @@ t_docId *__gr_load(GeoIndex *gi, GeoFilter *gf, size_t *num) {
 }
 
 IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf) {
+  GeoIndex_Renumber(gi);
   size_t sz;
   t_docId *docIds = __gr_load(gi, gf, &sz);
   if (!docIds) {
@@ -118,3 +223,28 @@ IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf) {
   rm_free(docIds);
   return ret;
 }
+
+/* Convert a radius to meters, the same way GEORADIUS does */
+static double geoFilter_RadiusMeters(GeoFilter *gf) {
+  if (!gf->unit || !strcasecmp(gf->unit, "km")) return gf->radius * 1000;
+  if (!strcasecmp(gf->unit, "mi")) return gf->radius * 1609.34;
+  if (!strcasecmp(gf->unit, "ft")) return gf->radius * 0.3048;
+  return gf->radius;
+}
+
+size_t GeoIndex_EstimateFilter(GeoIndex *gi, GeoFilter *gf) {
+  RedisModuleString *ks = fmtGeoIndexKey(gi);
+  RedisModuleKey *key = RedisModule_OpenKey(gi->ctx->redisCtx, ks, REDISMODULE_READ);
+  size_t total = 0;
+  if (key && RedisModule_KeyType(key) == REDISMODULE_KEYTYPE_ZSET) {
+    total = RedisModule_ValueLength(key);
+  }
+  if (key) RedisModule_CloseKey(key);
+  RedisModule_FreeString(gi->ctx->redisCtx, ks);
+  if (!total) return 0;
+
+  // the part of the earth's surface covered by the radius
+  double r = MIN(geoFilter_RadiusMeters(gf), M_PI * GEO_EARTH_RADIUS_M);
+  double cap = (1 - cos(r / GEO_EARTH_RADIUS_M)) / 2;
+  return MAX(1, (size_t)(total * cap));
+}
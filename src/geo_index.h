@@ -12,7 +12,24 @@ typedef struct geoIndex {
   FieldSpec *sp;
 } GeoIndex;
 
-int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, char *slon, char *slat);
+/* Add a document's location to the index. The index is renumbered first if the spec's DocTable was
+ * compacted since it was written */
+int GeoIndex_AddStrings(GeoIndex *gi, t_docId docId, const char *slon, const char *slat);
+
+/* Copy the locations of up to num more documents to a renumbered copy of the index, while the
+ * spec's DocTable is being compacted, see DocTable_StartCompaction. Documents are copied in the
+ * order of their docIds, up to the last one the compaction got to, and locations added meanwhile
+ * are added to the copy as well. Returns 1 once every document the compaction got to was copied */
+int GeoIndex_PrepareRenumber(GeoIndex *gi, size_t num);
+
+/* Renumber the index if it was written before the spec's DocTable was last compacted, replacing it
+ * with its renumbered copy once the documents it is missing are copied. Returns 1 if the index was
+ * renumbered */
+int GeoIndex_Renumber(GeoIndex *gi);
+
+/* The key of the renumbered copy of the index, which only exists from the start of a compaction of
+ * the spec's DocTable until the index is renumbered */
+RedisModuleString *fmtGeoIndexRenumberKey(GeoIndex *gi);
 
 typedef struct geoFilter {
 
@@ -28,4 +45,9 @@ int GeoFilter_Parse(GeoFilter *gf, RedisModuleString **argv, int argc);
 void GeoFilter_Free(GeoFilter *gf);
 IndexIterator *NewGeoRangeIterator(GeoIndex *gi, GeoFilter *gf);
 
+/* Estimate the number of documents matching a filter, for query planning. We only know how many
+ * documents the index has, so we assume they are spread evenly on the globe. Returns 0 only if the
+ * index is empty */
+size_t GeoIndex_EstimateFilter(GeoIndex *gi, GeoFilter *gf);
+
 #endif
\ No newline at end of file
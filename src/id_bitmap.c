@@ -0,0 +1,213 @@
+#include <string.h>
+#include <sys/param.h>
+#include "index_result.h"
+#include "index_iterator.h"
+#include "rmalloc.h"
+#include "id_bitmap.h"
+
+#define IDBITMAP_CHUNK(id) ((id) >> IDBITMAP_CHUNK_BITS)
+#define IDBITMAP_WORD(id) (((id) & ((1 << IDBITMAP_CHUNK_BITS) - 1)) >> 6)
+#define IDBITMAP_BIT(id) (1ULL << ((id)&63))
+
+/* Set a docId in the bitmap, allocating its chunk if needed */
+static void IdBitmap_Add(IdBitmapIterator *it, t_docId docId) {
+  size_t c = IDBITMAP_CHUNK(docId);
+  if (c >= it->numChunks) {
+    size_t n = MAX(it->numChunks * 2, c + 1);
+    it->chunks = rm_realloc(it->chunks, n * sizeof(*it->chunks));
+    memset(it->chunks + it->numChunks, 0, (n - it->numChunks) * sizeof(*it->chunks));
+    it->numChunks = n;
+  }
+  if (!it->chunks[c]) {
+    it->chunks[c] = rm_calloc(IDBITMAP_CHUNK_WORDS, sizeof(uint64_t));
+  }
+  uint64_t *w = &it->chunks[c][IDBITMAP_WORD(docId)];
+  if (!(*w & IDBITMAP_BIT(docId))) {
+    *w |= IDBITMAP_BIT(docId);
+    it->size++;
+  }
+}
+
+/* Return the first docId in the bitmap which is >= docId, or 0 if there is none */
+static t_docId IdBitmap_Next(IdBitmapIterator *it, t_docId docId) {
+  size_t w = IDBITMAP_WORD(docId);
+  uint64_t mask = ~0ULL << (docId & 63);
+  for (size_t c = IDBITMAP_CHUNK(docId); c < it->numChunks; c++, w = 0, mask = ~0ULL) {
+    uint64_t *words = it->chunks[c];
+    if (!words) continue;
+
+    for (; w < IDBITMAP_CHUNK_WORDS; w++, mask = ~0ULL) {
+      uint64_t bits = words[w] & mask;
+      if (bits) {
+        return (t_docId)((c << IDBITMAP_CHUNK_BITS) | (w << 6) | __builtin_ctzll(bits));
+      }
+    }
+  }
+  return 0;
+}
+
+static inline int IdBitmap_Has(IdBitmapIterator *it, t_docId docId) {
+  size_t c = IDBITMAP_CHUNK(docId);
+  return c < it->numChunks && it->chunks[c] &&
+         (it->chunks[c][IDBITMAP_WORD(docId)] & IDBITMAP_BIT(docId));
+}
+
+/* Move the iterator to docId, which is known to be in the bitmap */
+static inline void IdBitmap_SetCurrent(IdBitmapIterator *it, t_docId docId, RSIndexResult **r) {
+  it->lastDocId = docId;
+  it->pos = docId + 1;
+  it->res->docId = docId;
+  *r = it->res;
+}
+
+int IB_Read(void *ctx, RSIndexResult **r) {
+  IdBitmapIterator *it = ctx;
+  if (it->atEOF) {
+    return INDEXREAD_EOF;
+  }
+  t_docId docId = IdBitmap_Next(it, it->pos);
+  if (!docId) {
+    it->atEOF = 1;
+    return INDEXREAD_EOF;
+  }
+  IdBitmap_SetCurrent(it, docId, r);
+  return INDEXREAD_OK;
+}
+
+/* Skip to a docId. Hits are a single bit test, misses continue to the next docId in the bitmap */
+int IB_SkipTo(void *ctx, uint32_t docId, RSIndexResult **r) {
+  IdBitmapIterator *it = ctx;
+  if (it->atEOF) {
+    return INDEXREAD_EOF;
+  }
+  // we never go back
+  if (docId < it->pos) {
+    docId = it->pos;
+  }
+  if (IdBitmap_Has(it, docId)) {
+    IdBitmap_SetCurrent(it, docId, r);
+    return INDEXREAD_OK;
+  }
+
+  t_docId next = IdBitmap_Next(it, docId);
+  if (!next) {
+    it->atEOF = 1;
+    return INDEXREAD_EOF;
+  }
+  IdBitmap_SetCurrent(it, next, r);
+  return INDEXREAD_NOTFOUND;
+}
+
+void IB_Abort(void *ctx) {
+  ((IdBitmapIterator *)ctx)->atEOF = 1;
+}
+
+t_docId IB_LastDocId(void *ctx) {
+  return ((IdBitmapIterator *)ctx)->lastDocId;
+}
+
+int IB_HasNext(void *ctx) {
+  return !((IdBitmapIterator *)ctx)->atEOF;
+}
+
+RSIndexResult *IB_Current(void *ctx) {
+  return ((IdBitmapIterator *)ctx)->res;
+}
+
+size_t IB_Len(void *ctx) {
+  return ((IdBitmapIterator *)ctx)->size;
+}
+
+void IB_Free(struct indexIterator *self) {
+  IdBitmapIterator *it = self->ctx;
+  for (size_t i = 0; i < it->numChunks; i++) {
+    if (it->chunks[i]) rm_free(it->chunks[i]);
+  }
+  rm_free(it->chunks);
+  IndexResult_Free(it->res);
+  rm_free(it);
+  rm_free(self);
+}
+
+static IdBitmapIterator *newIdBitmapCtx() {
+  IdBitmapIterator *it = rm_new(IdBitmapIterator);
+  it->chunks = NULL;
+  it->numChunks = 0;
+  it->size = 0;
+  it->pos = 0;
+  it->lastDocId = 0;
+  it->atEOF = 0;
+  it->res = NewVirtualResult();
+  it->res->fieldMask = RS_FIELDMASK_ALL;
+  it->res->freq = 1;
+  return it;
+}
+
+static IndexIterator *newIdBitmapIterator(IdBitmapIterator *it);
+
+/* Clone the bitmap by copying the chunks covering the range, clearing the bits outside of it */
+IndexIterator *IB_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  IdBitmapIterator *src = ctx;
+  IdBitmapIterator *it = newIdBitmapCtx();
+  size_t from = IDBITMAP_CHUNK(minId);
+  size_t to = maxId ? MIN(IDBITMAP_CHUNK(maxId - 1) + 1, src->numChunks) : 0;
+  if (from < to) {
+    it->numChunks = to;
+    it->chunks = rm_calloc(to, sizeof(*it->chunks));
+  }
+
+  for (size_t c = from; c < to; c++) {
+    if (!src->chunks[c]) continue;
+    uint64_t *words = it->chunks[c] = rm_malloc(IDBITMAP_CHUNK_WORDS * sizeof(uint64_t));
+    memcpy(words, src->chunks[c], IDBITMAP_CHUNK_WORDS * sizeof(uint64_t));
+    for (size_t w = 0; w < IDBITMAP_CHUNK_WORDS; w++) {
+      t_docId first = (t_docId)((c << IDBITMAP_CHUNK_BITS) | (w << 6));
+      if (first + 63 < minId || first >= maxId) {
+        words[w] = 0;
+        continue;
+      }
+      if (first < minId) words[w] &= ~0ULL << (minId - first);
+      if (maxId - first < 64) words[w] &= (1ULL << (maxId - first)) - 1;
+      it->size += __builtin_popcountll(words[w]);
+    }
+  }
+  it->pos = minId;
+  return newIdBitmapIterator(it);
+}
+
+static IndexIterator *newIdBitmapIterator(IdBitmapIterator *it) {
+  IndexIterator *ret = rm_new(IndexIterator);
+  ret->ctx = it;
+  ret->Free = IB_Free;
+  ret->HasNext = IB_HasNext;
+  ret->LastDocId = IB_LastDocId;
+  ret->Len = IB_Len;
+  ret->NumEstimated = IB_Len;
+  ret->MaxScore = NULL;
+  ret->Read = IB_Read;
+  ret->Current = IB_Current;
+  ret->SkipTo = IB_SkipTo;
+  ret->Abort = IB_Abort;
+  ret->Clone = IB_Clone;
+  return ret;
+}
+
+IndexIterator *NewIdBitmapIterator(IndexIterator **its, int num) {
+  IdBitmapIterator *it = newIdBitmapCtx();
+
+  // drain all the children into the bitmap. They are consumed one by one, so no merging is needed
+  for (int i = 0; i < num; i++) {
+    if (!its[i]) continue;
+    RSIndexResult *r;
+    int rc;
+    while (INDEXREAD_EOF != (rc = its[i]->Read(its[i]->ctx, &r))) {
+      if (rc == INDEXREAD_OK) {
+        IdBitmap_Add(it, r->docId);
+      }
+    }
+    its[i]->Free(its[i]);
+  }
+  free(its);
+
+  return newIdBitmapIterator(it);
+}
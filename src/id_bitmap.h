@@ -0,0 +1,35 @@
+#ifndef __ID_BITMAP_H__
+#define __ID_BITMAP_H__
+
+#include "index_iterator.h"
+
+/* Every chunk of the bitmap covers 2^16 consecutive document ids, roaring style */
+#define IDBITMAP_CHUNK_BITS 16
+#define IDBITMAP_CHUNK_WORDS ((1 << IDBITMAP_CHUNK_BITS) / 64)
+
+/* An iterator over a bitmap of document ids, materialized up front from other iterators. It is used
+ * instead of a union when the union is very wide (e.g. big prefix expansions or wide numeric
+ * ranges) and we only care about which documents match, not how they matched.
+ *
+ * The bitmap is keyed by the high bits of the docId, and each non empty chunk is a plain bitset, so
+ * SkipTo is a constant time bit test */
+typedef struct {
+  uint64_t **chunks;
+  size_t numChunks;
+  size_t size;
+  // the next docId we will consider when reading
+  t_docId pos;
+  t_docId lastDocId;
+  int atEOF;
+  RSIndexResult *res;
+} IdBitmapIterator;
+
+/* Create a new IdBitmapIterator by reading all the given iterators to their end. The child
+ * iterators and the array holding them are freed once they are consumed. NULL children are
+ * ignored.
+ *
+ * The resulting iterator yields virtual results, so any per-term information (frequencies, offsets,
+ * field flags) of the children is dropped */
+IndexIterator *NewIdBitmapIterator(IndexIterator **its, int num);
+
+#endif
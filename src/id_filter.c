@@ -2,25 +2,36 @@
 #include "doc_table.h"
 #include "rmalloc.h"
 #include "id_list.h"
+#include <string.h>
 
 /* Create a new IdFilter from a list of redis strings. count is the number of strings, guaranteed to
  * be less than or equal to the length of args */
-IdFilter *NewIdFilter(RedisModuleString **args, int count, DocTable *dt) {
+IdFilter *NewIdFilter(RedisModuleString **args, int count) {
 
   IdFilter *ret = malloc(sizeof(*ret));
-  *ret = (IdFilter){.ids = NULL, .keys = args, .size = 0};
+  *ret = (IdFilter){.ids = NULL, .keys = NULL, .numKeys = 0, .size = 0};
   if (count <= 0) {
     return ret;
   }
-  ret->ids = calloc(count, sizeof(t_docId));
+  ret->keys = calloc(count, sizeof(char *));
   for (int i = 0; i < count; i++) {
+    ret->keys[i] = strdup(RedisModule_StringPtrLen(args[i], NULL));
+  }
+  ret->numKeys = count;
+  return ret;
+}
 
-    t_docId did = DocTable_GetId(dt, RedisModule_StringPtrLen(args[i], NULL));
+void IdFilter_Resolve(IdFilter *f, DocTable *dt) {
+  if (!f->ids && f->numKeys) {
+    f->ids = calloc(f->numKeys, sizeof(t_docId));
+  }
+  f->size = 0;
+  for (int i = 0; i < f->numKeys; i++) {
+    t_docId did = DocTable_GetId(dt, f->keys[i]);
     if (did) {
-      ret->ids[ret->size++] = did;
+      f->ids[f->size++] = did;
     }
   }
-  return ret;
 }
 
 void IdFilter_Free(IdFilter *f) {
@@ -28,6 +39,10 @@ void IdFilter_Free(IdFilter *f) {
     free(f->ids);
     f->ids = NULL;
   }
+  for (int i = 0; i < f->numKeys; i++) {
+    free(f->keys[i]);
+  }
+  free(f->keys);
   free(f);
 }
 
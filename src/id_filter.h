@@ -9,13 +9,19 @@
  * created from a list of keys in the index */
 typedef struct idFilter {
   t_docId *ids;
-  RedisModuleString **keys;
+  char **keys;
+  int numKeys;
   t_offset size;
 } IdFilter;
 
 /* Create a new IdFilter from a list of redis strings. count is the number of strings, guaranteed to
- * be less than or equal to the length of args */
-IdFilter *NewIdFilter(RedisModuleString **args, int count, DocTable *dt);
+ * be less than or equal to the length of args. The keys are copied, and only resolved to docIds by
+ * IdFilter_Resolve */
+IdFilter *NewIdFilter(RedisModuleString **args, int count);
+
+/* Resolve the filter's keys to their docIds in the table. A compaction may renumber the docIds of
+ * the table, so this is done right before the query runs, inside its epoch */
+void IdFilter_Resolve(IdFilter *f, DocTable *dt);
 
 /* Free the filter's internal data, but not the filter itself, that is allocated on the stack */
 void IdFilter_Free(IdFilter *f);
@@ -29,6 +29,20 @@ void IL_Abort(void *ctx) {
   ((IdListIterator *)ctx)->atEOF = 1;
 }
 
+/* Return the offset of the first docId in the list from offset from on which is >= docId */
+static t_offset IL_LowerBound(IdListIterator *it, t_offset from, t_docId docId) {
+  t_offset lo = from, hi = it->size;
+  while (lo < hi) {
+    t_offset mid = (lo + hi) / 2;
+    if (it->docIds[mid] < docId) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
 /* Skip to a docid, potentially reading the entry into hit, if the docId
  * matches */
 int IL_SkipTo(void *ctx, uint32_t docId, RSIndexResult **r) {
@@ -43,26 +57,8 @@ int IL_SkipTo(void *ctx, uint32_t docId, RSIndexResult **r) {
     return INDEXREAD_EOF;
   }
 
-  t_offset top = it->size - 1, bottom = it->offset;
-  t_offset i = bottom;
-  t_offset newi;
-
-  while (bottom < top) {
-    t_docId did = it->docIds[i];
-    if (did == docId) {
-      break;
-    }
-    if (docId <= did) {
-      top = i;
-    } else {
-      bottom = i;
-    }
-    newi = (bottom + top) / 2;
-    if (newi == i) {
-      break;
-    }
-    i = newi;
-  }
+  // the last id is known to be >= docId, so we always land on an id
+  t_offset i = IL_LowerBound(it, it->offset, docId);
   it->offset = i + 1;
   if (it->offset == it->size) {
     it->atEOF = 1;
@@ -109,12 +105,22 @@ size_t IL_Len(void *ctx) {
   return (size_t)((IdListIterator *)ctx)->size;
 }
 
+size_t IL_NumEstimated(void *ctx) {
+  return (size_t)((IdListIterator *)ctx)->size;
+}
+
 static int cmp_docids(const void *p1, const void *p2) {
   const t_docId *d1 = p1, *d2 = p2;
 
   return (int)(*d1 - *d2);
 }
 
+IndexIterator *IL_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  IdListIterator *it = ctx;
+  t_offset from = IL_LowerBound(it, 0, minId), to = IL_LowerBound(it, 0, maxId);
+  return NewIdListIterator(it->docIds + from, to > from ? to - from : 0);
+}
+
 IndexIterator *NewIdListIterator(t_docId *ids, t_offset num) {
 
   // first sort the ids, so the caller will not have to deal with it
@@ -137,9 +143,12 @@ IndexIterator *NewIdListIterator(t_docId *ids, t_offset num) {
   ret->HasNext = IL_HasNext;
   ret->LastDocId = IL_LastDocId;
   ret->Len = IL_Len;
+  ret->NumEstimated = IL_NumEstimated;
+  ret->MaxScore = NULL;
   ret->Read = IL_Read;
   ret->Current = IL_Current;
   ret->SkipTo = IL_SkipTo;
   ret->Abort = IL_Abort;
+  ret->Clone = IL_Clone;
   return ret;
 }
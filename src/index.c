@@ -25,6 +25,63 @@ void UI_Abort(void *ctx) {
   }
 }
 
+static int UI_ReadHeap(void *ctx, RSIndexResult **hit);
+static int UI_SkipToHeap(void *ctx, t_docId docId, RSIndexResult **hit);
+
+/* Return 1 if all the existing iterators in the list can bound their scores */
+static int IndexIterators_CanBoundScore(IndexIterator **its, int num) {
+  for (int i = 0; i < num; i++) {
+    if (its[i] && !its[i]->MaxScore) return 0;
+  }
+  return 1;
+}
+
+/* Sum up the score bounds of a list of iterators. The TF-IDF scorer sums up the scores of the
+ * children of both unions and intersections, and only ever divides the sum by the slop, so the sum
+ * bounds both */
+static double IndexIterators_MaxScore(IndexIterator **its, int num, t_docId docId,
+                                      t_docId *until) {
+  double ret = 0;
+  if (until) *until = UINT32_MAX;
+  for (int i = 0; i < num; i++) {
+    if (!its[i]) continue;
+    t_docId childUntil;
+    ret += its[i]->MaxScore(its[i]->ctx, docId, until ? &childUntil : NULL);
+    if (until) *until = MIN(*until, childUntil);
+  }
+  return ret;
+}
+
+/* Clone a list of child iterators to a docId range. NULL children stay NULL. Returns NULL if any of
+ * the children cannot be cloned */
+static IndexIterator **IndexIterators_Clone(IndexIterator **its, int num, t_docId minId,
+                                            t_docId maxId) {
+  IndexIterator **ret = calloc(num, sizeof(IndexIterator *));
+  for (int i = 0; i < num; i++) {
+    if (!its[i]) continue;
+    if (!its[i]->Clone || !(ret[i] = its[i]->Clone(its[i]->ctx, minId, maxId))) {
+      for (int j = 0; j < i; j++) {
+        if (ret[j]) ret[j]->Free(ret[j]);
+      }
+      free(ret);
+      return NULL;
+    }
+  }
+  return ret;
+}
+
+static IndexIterator *UI_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  UnionContext *ui = ctx;
+  IndexIterator **its = IndexIterators_Clone(ui->its, ui->num, minId, maxId);
+  return its ? NewUnionIterator(its, ui->num, ui->docTable, ui->quickExit) : NULL;
+}
+
+/* Heap order for the union's children - the smallest docId on top */
+static int cmpChildDocIds(const void *e1, const void *e2, const void *udata) {
+  const t_docId d1 = *(const t_docId *)e1, d2 = *(const t_docId *)e2;
+  return d1 < d2 ? 1 : (d1 > d2 ? -1 : 0);
+}
+
 IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int quickExit) {
   // create union context
   UnionContext *ctx = calloc(1, sizeof(UnionContext));
@@ -36,6 +93,8 @@ IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int
   ctx->current = NewUnionResult(num);
   ctx->len = 0;
   ctx->quickExit = quickExit;
+  ctx->heap = NULL;
+  ctx->topk = NULL;
   // bind the union iterator calls
   IndexIterator *it = malloc(sizeof(IndexIterator));
   it->ctx = ctx;
@@ -46,7 +105,24 @@ IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *dt, int
   it->HasNext = UI_HasNext;
   it->Free = UnionIterator_Free;
   it->Len = UI_Len;
+  it->NumEstimated = UI_NumEstimated;
+  it->MaxScore = IndexIterators_CanBoundScore(its, num) ? UI_MaxScore : NULL;
   it->Abort = UI_Abort;
+  it->Clone = UI_Clone;
+
+  // with many children, scanning all of them for the minimal docId on every read is too slow
+  if (num > UNION_HEAP_THRESHOLD) {
+    ctx->heap = malloc(heap_sizeof(num));
+    heap_init(ctx->heap, cmpChildDocIds, NULL, num);
+    // all children start at docId 0, so the first read or skip advances them
+    for (int i = 0; i < num; i++) {
+      if (its[i]) {
+        heap_offerx(ctx->heap, &ctx->docIds[i]);
+      }
+    }
+    it->Read = UI_ReadHeap;
+    it->SkipTo = UI_SkipToHeap;
+  }
   return it;
 }
 
@@ -117,6 +193,247 @@ inline int UI_Read(void *ctx, RSIndexResult **hit) {
   return INDEXREAD_EOF;
 }
 
+#define UI_HEAP_TOP(ui) (*(t_docId *)heap_peek(ui->heap))
+
+/* Read the next record of a child, skipping filtered ones. Returns 0 if it's at its end */
+static inline int UI_AdvanceChild(UnionContext *ui, int i) {
+  IndexIterator *it = ui->its[i];
+  RSIndexResult *res;
+  int rc;
+  while ((rc = it->Read(it->ctx, &res)) == INDEXREAD_NOTFOUND)
+    ;
+  if (rc == INDEXREAD_EOF) return 0;
+  ui->docIds[i] = res->docId;
+  return 1;
+}
+
+/* Skip a child to docId, or the first docId after it. Returns 0 if it's at its end */
+static inline int UI_SkipChild(UnionContext *ui, int i, t_docId docId) {
+  IndexIterator *it = ui->its[i];
+  RSIndexResult *res;
+  int rc = it->SkipTo(it->ctx, docId, &res);
+  if (rc == INDEXREAD_EOF) return 0;
+  if (rc == INDEXREAD_NOTFOUND && res->docId <= docId) {
+    // some iterators don't tell us where a miss left them, so we read their next record
+    return UI_AdvanceChild(ui, i);
+  }
+  ui->docIds[i] = res->docId;
+  return 1;
+}
+
+/* Collect the hits of all the children at the top of the heap into the current result. The
+ * children are put back in the heap without advancing them */
+static void UI_CollectHeapTop(UnionContext *ui, RSIndexResult **hit) {
+  t_docId docId = UI_HEAP_TOP(ui);
+  t_docId *top[ui->num];
+  int n = 0;
+
+  AggregateResult_Reset(ui->current);
+  while (heap_count(ui->heap) && UI_HEAP_TOP(ui) == docId) {
+    top[n] = heap_poll(ui->heap);
+    IndexIterator *it = ui->its[top[n] - ui->docIds];
+    AggregateResult_AddChild(ui->current, it->Current(it->ctx));
+    n++;
+    if (ui->quickExit) break;
+  }
+  for (int i = 0; i < n; i++) {
+    heap_offerx(ui->heap, top[i]);
+  }
+  ui->minDocId = docId;
+
+  if (hit) {
+    // like UI_SkipTo, a single hit is pushed upstream as is
+    *hit = n == 1 ? ui->current->agg.children[0] : ui->current;
+  }
+}
+
+/* UI_Read for unions with many children. Instead of scanning all children, we only advance the ones
+ * at the top of the heap */
+static int UI_ReadHeap(void *ctx, RSIndexResult **hit) {
+  UnionContext *ui = ctx;
+  if (ui->atEnd) {
+    return INDEXREAD_EOF;
+  }
+
+  // advance all the children at or behind the last docId we've returned
+  while (heap_count(ui->heap) && UI_HEAP_TOP(ui) <= ui->minDocId) {
+    t_docId *top = heap_poll(ui->heap);
+    if (UI_AdvanceChild(ui, top - ui->docIds)) {
+      heap_offerx(ui->heap, top);
+    }
+  }
+  if (!heap_count(ui->heap)) {
+    ui->atEnd = 1;
+    return INDEXREAD_EOF;
+  }
+
+  UI_CollectHeapTop(ui, hit);
+  ui->len++;
+  return INDEXREAD_OK;
+}
+
+/* UI_SkipTo for unions with many children. Only the children behind docId are skipped */
+static int UI_SkipToHeap(void *ctx, t_docId docId, RSIndexResult **hit) {
+  UnionContext *ui = ctx;
+  if (docId == 0) {
+    return UI_ReadHeap(ctx, hit);
+  }
+  if (ui->atEnd) {
+    return INDEXREAD_EOF;
+  }
+
+  while (heap_count(ui->heap) && UI_HEAP_TOP(ui) < docId) {
+    t_docId *top = heap_poll(ui->heap);
+    if (UI_SkipChild(ui, top - ui->docIds, docId)) {
+      heap_offerx(ui->heap, top);
+    }
+  }
+  if (!heap_count(ui->heap)) {
+    ui->atEnd = 1;
+    return INDEXREAD_EOF;
+  }
+
+  if (UI_HEAP_TOP(ui) == docId) {
+    UI_CollectHeapTop(ui, hit);
+    return INDEXREAD_OK;
+  }
+
+  // not found, like UI_SkipTo the next read continues after the minimal docId
+  AggregateResult_Reset(ui->current);
+  ui->minDocId = UI_HEAP_TOP(ui);
+  if (hit) {
+    *hit = ui->current;
+  }
+  return INDEXREAD_NOTFOUND;
+}
+
+/* Bounds are compared with some slack, so rounding differences between a bound and the actual
+ * score never prune a document that makes it into the top-k */
+#define UI_TOPK_CANNOT_ENTER(bound, minScore) ((bound)*1.000001 < (minScore))
+
+/* UI_Read for unions pruning their results to the top-k, using block-max WAND. The active children
+ * are kept ordered by their current docId. The pivot is the first child at which the sum of the
+ * children's global score bounds could make it into the top-k - documents before it cannot. If the
+ * block-max bounds of the pivot docId still cannot make it, we skip to the end of the shortest
+ * block instead of evaluating it */
+static int UI_ReadTopK(void *ctx, RSIndexResult **hit) {
+  UnionContext *ui = ctx;
+  UnionTopK *tk = ui->topk;
+  if (ui->atEnd) {
+    return INDEXREAD_EOF;
+  }
+
+  // all the children need to be advanced past the last docId we've returned
+  t_docId target = ui->minDocId + 1;
+  while (1) {
+    // move the children behind the target to it, dropping the ones at their end
+    int n = 0;
+    for (int k = 0; k < tk->numActive; k++) {
+      int i = tk->order[k];
+      if (ui->docIds[i] < target) {
+        int ok = ui->docIds[i] + 1 == target ? UI_AdvanceChild(ui, i) : UI_SkipChild(ui, i, target);
+        if (!ok) continue;
+      }
+      tk->order[n++] = i;
+    }
+    tk->numActive = n;
+
+    // the children only move forward a bit on every round, so insertion sort is cheap
+    for (int k = 1; k < n; k++) {
+      int i = tk->order[k], j = k;
+      for (; j > 0 && ui->docIds[tk->order[j - 1]] > ui->docIds[i]; j--) {
+        tk->order[j] = tk->order[j - 1];
+      }
+      tk->order[j] = i;
+    }
+
+    // find the pivot
+    double minScore = *tk->minScore;
+    double bound = 0;
+    int p = 0;
+    for (; p < n; p++) {
+      bound += tk->maxScores[tk->order[p]];
+      if (!UI_TOPK_CANNOT_ENTER(bound, minScore)) break;
+    }
+    if (p == n) {
+      // nothing left can make it
+      if (n) tk->pruned = 1;
+      ui->atEnd = 1;
+      return INDEXREAD_EOF;
+    }
+    t_docId pivot = ui->docIds[tk->order[p]];
+    while (p + 1 < n && ui->docIds[tk->order[p + 1]] == pivot) p++;
+
+    // check the bounds of the blocks holding the pivot
+    t_docId until = UINT32_MAX;
+    bound = 0;
+    for (int k = 0; k <= p; k++) {
+      IndexIterator *it = ui->its[tk->order[k]];
+      t_docId childUntil;
+      bound += it->MaxScore(it->ctx, pivot, &childUntil);
+      until = MIN(until, childUntil);
+    }
+    if (UI_TOPK_CANNOT_ENTER(bound, minScore)) {
+      // nothing can make it until the shortest block ends, or until the next child joins in
+      tk->pruned = 1;
+      if (p + 1 == n && until == UINT32_MAX) {
+        ui->atEnd = 1;
+        return INDEXREAD_EOF;
+      }
+      target = p + 1 < n ? ui->docIds[tk->order[p + 1]] : until + 1;
+      if (until < target - 1) target = until + 1;
+      continue;
+    }
+
+    if (ui->docIds[tk->order[0]] < pivot) {
+      // the children before the pivot cannot make it on their own, skip them to it
+      tk->pruned = 1;
+      target = pivot;
+      continue;
+    }
+
+    // all the children up to the pivot are at it
+    AggregateResult_Reset(ui->current);
+    for (int k = 0; k <= p; k++) {
+      IndexIterator *it = ui->its[tk->order[k]];
+      AggregateResult_AddChild(ui->current, it->Current(it->ctx));
+    }
+    ui->minDocId = pivot;
+    ui->len++;
+    if (hit) {
+      *hit = p == 0 ? ui->current->agg.children[0] : ui->current;
+    }
+    return INDEXREAD_OK;
+  }
+}
+
+int UnionIterator_EnableTopK(IndexIterator *it, const double *minScore) {
+  UnionContext *ui = it->ctx;
+  if (!it->MaxScore || ui->quickExit) {
+    return 0;
+  }
+
+  UnionTopK *tk = calloc(1, sizeof(*tk));
+  tk->minScore = minScore;
+  tk->maxScores = calloc(ui->num, sizeof(double));
+  tk->order = calloc(ui->num, sizeof(int));
+  for (int i = 0; i < ui->num; i++) {
+    if (!ui->its[i]) continue;
+    tk->maxScores[i] = ui->its[i]->MaxScore(ui->its[i]->ctx, 0, NULL);
+    tk->order[tk->numActive++] = i;
+  }
+  ui->topk = tk;
+
+  // the heap is not used when pruning
+  if (ui->heap) {
+    heap_free(ui->heap);
+    ui->heap = NULL;
+  }
+  it->Read = UI_ReadTopK;
+  it->SkipTo = UI_SkipTo;
+  return 1;
+}
+
 int UI_Next(void *ctx) {
   // RSIndexResult h = NewIndexResult();
   return UI_Read(ctx, NULL);
@@ -237,6 +554,14 @@ void UnionIterator_Free(IndexIterator *it) {
   }
 
   free(ui->docIds);
+  if (ui->heap) {
+    heap_free(ui->heap);
+  }
+  if (ui->topk) {
+    free(ui->topk->maxScores);
+    free(ui->topk->order);
+    free(ui->topk);
+  }
   IndexResult_Free(ui->current);
   free(ui->its);
   free(ui);
@@ -244,7 +569,36 @@ void UnionIterator_Free(IndexIterator *it) {
 }
 
 size_t UI_Len(void *ctx) {
-  return ((UnionContext *)ctx)->len;
+  UnionContext *ui = ctx;
+  if (ui->topk && ui->topk->pruned) {
+    // we don't know how many documents we've skipped, but the union matches at least as many as
+    // its largest child
+    size_t ret = ui->len;
+    for (int i = 0; i < ui->num; i++) {
+      if (ui->its[i]) {
+        ret = MAX(ret, ui->its[i]->NumEstimated(ui->its[i]->ctx));
+      }
+    }
+    return ret;
+  }
+  return ui->len;
+}
+
+double UI_MaxScore(void *ctx, t_docId docId, t_docId *until) {
+  UnionContext *ui = ctx;
+  return IndexIterators_MaxScore(ui->its, ui->num, docId, until);
+}
+
+/* A union yields at most the sum of its children */
+size_t UI_NumEstimated(void *ctx) {
+  UnionContext *ui = ctx;
+  size_t ret = 0;
+  for (int i = 0; i < ui->num; i++) {
+    if (ui->its[i]) {
+      ret += ui->its[i]->NumEstimated(ui->its[i]->ctx);
+    }
+  }
+  return ret;
 }
 
 void IntersectIterator_Free(IndexIterator *it) {
@@ -257,6 +611,9 @@ void IntersectIterator_Free(IndexIterator *it) {
     // IndexResult_Free(&ui->currentHits[i]);
   }
   free(ui->docIds);
+  free(ui->order);
+  free(ui->hits);
+  free(ui->gaps);
   IndexResult_Free(ui->current);
   free(ui->its);
   free(it->ctx);
@@ -273,6 +630,66 @@ void II_Abort(void *ctx) {
   }
 }
 
+// Every this many rounds of an intersection we check if its children should be reordered
+#define INTERSECT_REORDER_INTERVAL 32
+
+static size_t II_ChildEstimate(IndexIterator *it) {
+  return it ? it->NumEstimated(it->ctx) : 0;
+}
+
+/* Order the children of the intersection by their estimated number of results, so the rarest one
+ * drives the iteration and we skip through the denser ones */
+static void II_SortChildren(IntersectContext *ic) {
+  size_t est[ic->num];
+  for (int i = 0; i < ic->num; i++) {
+    ic->order[i] = i;
+    est[i] = II_ChildEstimate(ic->its[i]);
+  }
+  // insertion sort, intersections have very few children
+  for (int i = 1; i < ic->num; i++) {
+    int cur = ic->order[i];
+    int j = i - 1;
+    for (; j >= 0 && est[ic->order[j]] > est[cur]; j--) {
+      ic->order[j + 1] = ic->order[j];
+    }
+    ic->order[j + 1] = cur;
+  }
+}
+
+/* The estimates might be off, e.g. for unions of overlapping terms or nested intersections. We
+ * move a child ahead of the one before it if it turns out to be much sparser */
+static void II_Reorder(IntersectContext *ic) {
+  for (int k = 1; k < ic->num; k++) {
+    if (ic->gaps[ic->order[k]] > 2 * ic->gaps[ic->order[k - 1]]) {
+      int tmp = ic->order[k];
+      ic->order[k] = ic->order[k - 1];
+      ic->order[k - 1] = tmp;
+    }
+  }
+}
+
+/* Record how far a child landed from the position we asked it to advance to */
+static inline void II_TrackGap(IntersectContext *ic, int i, t_docId docId) {
+  ic->gaps[i] = ic->gaps[i] - (ic->gaps[i] >> 3) + (docId - ic->lastDocId);
+}
+
+/* Collect the children's hits into the current result, in their original order so slop and order
+ * checks see them the way the query was written */
+static void II_CollectHits(IntersectContext *ic) {
+  AggregateResult_Reset(ic->current);
+  for (int i = 0; i < ic->num; i++) {
+    AggregateResult_AddChild(ic->current, ic->hits[i]);
+  }
+}
+
+static IndexIterator *II_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  IntersectContext *ic = ctx;
+  IndexIterator **its = IndexIterators_Clone(ic->its, ic->num, minId, maxId);
+  return its ? NewIntersecIterator(its, ic->num, ic->docTable, ic->fieldMask, ic->maxSlop,
+                                   ic->inOrder)
+             : NULL;
+}
+
 IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
                                    t_fieldMask fieldMask, int maxSlop, int inOrder) {
 
@@ -286,8 +703,13 @@ IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
   ctx->fieldMask = fieldMask;
   ctx->atEnd = 0;
   ctx->docIds = calloc(num, sizeof(t_docId));
+  ctx->order = calloc(num, sizeof(int));
+  ctx->hits = calloc(num, sizeof(RSIndexResult *));
+  ctx->gaps = calloc(num, sizeof(t_docId));
+  ctx->rounds = 0;
   ctx->current = NewIntersectResult(num);
   ctx->docTable = dt;
+  II_SortChildren(ctx);
 
   // bind the iterator calls
   IndexIterator *it = malloc(sizeof(IndexIterator));
@@ -298,8 +720,11 @@ IndexIterator *NewIntersecIterator(IndexIterator **its, int num, DocTable *dt,
   it->Current = II_Current;
   it->HasNext = II_HasNext;
   it->Len = II_Len;
+  it->NumEstimated = II_NumEstimated;
+  it->MaxScore = IndexIterators_CanBoundScore(its, num) ? II_MaxScore : NULL;
   it->Free = IntersectIterator_Free;
   it->Abort = II_Abort;
+  it->Clone = II_Clone;
   return it;
 }
 
@@ -319,7 +744,8 @@ int II_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
 
   int rc = INDEXREAD_EOF;
   // skip all iterators to docId
-  for (int i = 0; i < ic->num; i++) {
+  for (int k = 0; k < ic->num; k++) {
+    int i = ic->order[k];
     IndexIterator *it = ic->its[i];
 
     if (!it || !it->HasNext(it->ctx)) return INDEXREAD_EOF;
@@ -341,7 +767,7 @@ int II_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
       return rc;
     } else if (rc == INDEXREAD_OK) {
       // YAY! found!
-      AggregateResult_AddChild(ic->current, res);
+      ic->hits[i] = res;
       ic->lastDocId = docId;
 
       ++nfound;
@@ -352,6 +778,7 @@ int II_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
   }
 
   if (nfound == ic->num) {
+    II_CollectHits(ic);
     if (hit) {
       *hit = ic->current;
     }
@@ -382,9 +809,12 @@ int II_Read(void *ctx, RSIndexResult **hit) {
   do {
 
     nh = 0;
-    AggregateResult_Reset(ic->current);
+    if (++ic->rounds % INTERSECT_REORDER_INTERVAL == 0) {
+      II_Reorder(ic);
+    }
 
-    for (i = 0; i < ic->num; i++) {
+    for (int k = 0; k < ic->num; k++) {
+      i = ic->order[k];
       IndexIterator *it = ic->its[i];
 
       if (!it) goto eof;
@@ -394,7 +824,7 @@ int II_Read(void *ctx, RSIndexResult **hit) {
       int rc = INDEXREAD_OK;
       if (ic->docIds[i] != ic->lastDocId || ic->lastDocId == 0) {
 
-        if (i == 0 && ic->docIds[i] >= ic->lastDocId) {
+        if (k == 0 && ic->docIds[i] >= ic->lastDocId) {
           rc = it->Read(it->ctx, &h);
         } else {
           rc = it->SkipTo(it->ctx, ic->lastDocId, &h);
@@ -403,6 +833,9 @@ int II_Read(void *ctx, RSIndexResult **hit) {
         //        h->docId, it->LastDocId(it->ctx), rc);
 
         if (rc == INDEXREAD_EOF) goto eof;
+        if (h->docId >= ic->lastDocId) {
+          II_TrackGap(ic, i, h->docId);
+        }
         ic->docIds[i] = h->docId;
       }
 
@@ -412,13 +845,14 @@ int II_Read(void *ctx, RSIndexResult **hit) {
       }
       if (rc == INDEXREAD_OK) {
         ++nh;
-        AggregateResult_AddChild(ic->current, h);
+        ic->hits[i] = h;
       } else {
         ic->lastDocId++;
       }
     }
 
     if (nh == ic->num) {
+      II_CollectHits(ic);
       // printf("II %p HIT @ %d\n", ic, ic->current->docId);
       // sum up all hits
       if (hit != NULL) {
@@ -462,6 +896,17 @@ size_t II_Len(void *ctx) {
   return ((IntersectContext *)ctx)->len;
 }
 
+/* An intersection yields at most what its rarest child does */
+size_t II_NumEstimated(void *ctx) {
+  IntersectContext *ic = ctx;
+  return ic->num ? II_ChildEstimate(ic->its[ic->order[0]]) : 0;
+}
+
+double II_MaxScore(void *ctx, t_docId docId, t_docId *until) {
+  IntersectContext *ic = ctx;
+  return IndexIterators_MaxScore(ic->its, ic->num, docId, until);
+}
+
 void NI_Abort(void *ctx) {
   NotContext *nc = ctx;
   nc->child->Abort(nc->child->ctx);
@@ -538,6 +983,11 @@ size_t NI_Len(void *ctx) {
   return nc->child ? nc->child->Len(nc->child->ctx) : 0;
 }
 
+/* A not iterator matches almost everything, so it should never drive an intersection */
+size_t NI_NumEstimated(void *ctx) {
+  return SIZE_MAX;
+}
+
 /* Last docId */
 t_docId NI_LastDocId(void *ctx) {
   NotContext *nc = ctx;
@@ -545,6 +995,17 @@ t_docId NI_LastDocId(void *ctx) {
   return nc->lastDocId;
 }
 
+IndexIterator *NI_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  NotContext *nc = ctx;
+  IndexIterator *child = NULL;
+  if (nc->child) {
+    if (!nc->child->Clone || !(child = nc->child->Clone(nc->child->ctx, minId, maxId))) {
+      return NULL;
+    }
+  }
+  return NewNotIterator(child);
+}
+
 IndexIterator *NewNotIterator(IndexIterator *it) {
 
   NotContext *nc = malloc(sizeof(*nc));
@@ -560,9 +1021,12 @@ IndexIterator *NewNotIterator(IndexIterator *it) {
   ret->HasNext = NI_HasNext;
   ret->LastDocId = NI_LastDocId;
   ret->Len = NI_Len;
+  ret->NumEstimated = NI_NumEstimated;
+  ret->MaxScore = NULL;
   ret->Read = NI_Read;
   ret->SkipTo = NI_SkipTo;
   ret->Abort = NI_Abort;
+  ret->Clone = NI_Clone;
   return ret;
 }
 
@@ -651,6 +1115,11 @@ size_t OI_Len(void *ctx) {
   return nc->child ? nc->child->Len(nc->child->ctx) : 0;
 }
 
+/* An optional iterator matches everything */
+size_t OI_NumEstimated(void *ctx) {
+  return SIZE_MAX;
+}
+
 /* Last docId */
 t_docId OI_LastDocId(void *ctx) {
   OptionalMatchContext *nc = ctx;
@@ -658,6 +1127,17 @@ t_docId OI_LastDocId(void *ctx) {
   return nc->lastDocId;
 }
 
+IndexIterator *OI_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  OptionalMatchContext *nc = ctx;
+  IndexIterator *child = NULL;
+  if (nc->child) {
+    if (!nc->child->Clone || !(child = nc->child->Clone(nc->child->ctx, minId, maxId))) {
+      return NULL;
+    }
+  }
+  return NewOptionalIterator(child);
+}
+
 IndexIterator *NewOptionalIterator(IndexIterator *it) {
 
   OptionalMatchContext *nc = malloc(sizeof(*nc));
@@ -674,9 +1154,12 @@ IndexIterator *NewOptionalIterator(IndexIterator *it) {
   ret->HasNext = OI_HasNext;
   ret->LastDocId = OI_LastDocId;
   ret->Len = OI_Len;
+  ret->NumEstimated = OI_NumEstimated;
+  ret->MaxScore = NULL;
   ret->Read = OI_Read;
   ret->SkipTo = OI_SkipTo;
   ret->Abort = OI_Abort;
+  ret->Clone = OI_Clone;
   return ret;
 }
 
@@ -706,6 +1189,7 @@ int WI_Read(void *ctx, RSIndexResult **hit) {
     return INDEXREAD_EOF;
   }
   nc->res->docId = nc->current++;
+  *hit = nc->res;
   return INDEXREAD_OK;
 }
 
@@ -721,6 +1205,7 @@ int WI_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
 
   nc->current = docId;
   nc->res->docId = docId;
+  *hit = nc->res;
 
   return INDEXREAD_OK;
 }
@@ -756,6 +1241,14 @@ t_docId WI_LastDocId(void *ctx) {
   return nc->current;
 }
 
+/* A clone of a wildcard iterator is a wildcard iterator over the intersection of the ranges */
+IndexIterator *WI_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  WildcardIteratorCtx *nc = ctx;
+  IndexIterator *ret = NewWildcardIterator(MIN(nc->topId, maxId - 1));
+  ((WildcardIteratorCtx *)ret->ctx)->current = MAX(minId, 1);
+  return ret;
+}
+
 /* Create a new wildcard iterator */
 IndexIterator *NewWildcardIterator(t_docId maxId) {
   WildcardIteratorCtx *c = malloc(sizeof(*c));
@@ -772,8 +1265,11 @@ IndexIterator *NewWildcardIterator(t_docId maxId) {
   ret->HasNext = WI_HasNext;
   ret->LastDocId = WI_LastDocId;
   ret->Len = WI_Len;
+  ret->NumEstimated = WI_Len;
+  ret->MaxScore = NULL;
   ret->Read = WI_Read;
   ret->SkipTo = WI_SkipTo;
   ret->Abort = WI_Abort;
+  ret->Clone = WI_Clone;
   return ret;
 }
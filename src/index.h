@@ -7,6 +7,7 @@
 #include "index_iterator.h"
 #include "redisearch.h"
 #include "util/logging.h"
+#include "util/heap.h"
 #include "varint.h"
 #include <ctype.h>
 #include <stdio.h>
@@ -44,8 +45,29 @@ typedef struct {
   int atEnd;
   // If set to 1, we exit skips after the first hit found and not merge further results
   int quickExit;
+  // With many children, a min-heap of pointers into docIds, so we don't scan all of them per read
+  heap_t *heap;
+  // Top-k pruning state, NULL unless enabled with UnionIterator_EnableTopK
+  struct unionTopK *topk;
 } UnionContext;
 
+/* The state of a union pruning documents that cannot make it into the top-k results of a TF-IDF
+ * scored query, using the block-max WAND algorithm */
+typedef struct unionTopK {
+  // the lowest score in the query's top-k heap. Documents scoring less than it are skipped
+  const double *minScore;
+  // the upper bound of each child's score over its entire index
+  double *maxScores;
+  // the children that are not at their end yet, ordered by their current docId
+  int *order;
+  int numActive;
+  // set once we've skipped matching documents, which makes the union's length a lower bound
+  int pruned;
+} UnionTopK;
+
+// Unions with more children than this keep them in a heap ordered by docId
+#define UNION_HEAP_THRESHOLD 16
+
 /* Create a new UnionIterator over a list of underlying child iterators.
 It will return each document of the underlying iterators, exactly once */
 IndexIterator *NewUnionIterator(IndexIterator **its, int num, DocTable *t, int quickExit);
@@ -55,8 +77,15 @@ int UI_Next(void *ctx);
 int UI_Read(void *ctx, RSIndexResult **hit);
 int UI_HasNext(void *ctx);
 size_t UI_Len(void *ctx);
+size_t UI_NumEstimated(void *ctx);
+double UI_MaxScore(void *ctx, t_docId docId, t_docId *until);
 t_docId UI_LastDocId(void *ctx);
 
+/* Make the union skip documents that cannot score at least *minScore, where minScore is updated by
+ * the caller as it collects its top-k results. Scores are bounded for the TF-IDF scorer only.
+ * Returns 0 and leaves the union as is if any of its children cannot bound its scores */
+int UnionIterator_EnableTopK(IndexIterator *it, const double *minScore);
+
 /* The context used by the intersection methods during iterating an intersect
  * iterator */
 typedef struct {
@@ -64,6 +93,14 @@ typedef struct {
   t_docId *docIds;
   int *rcs;
   RSIndexResult *current;
+  // the order in which we advance the children, sparsest first. The first one drives the iteration
+  int *order;
+  // the hits of the children at the current position, in the children's original order
+  RSIndexResult **hits;
+  // a moving average (times 8) of the distance from the position we asked each child to advance
+  // to, to the docId it landed on. Used to reorder the children by their actual sparseness
+  t_docId *gaps;
+  uint32_t rounds;
   int num;
   size_t len;
   int maxSlop;
@@ -89,6 +126,8 @@ int II_Read(void *ctx, RSIndexResult **hit);
 int II_HasNext(void *ctx);
 RSIndexResult *II_Current(void *ctx);
 size_t II_Len(void *ctx);
+size_t II_NumEstimated(void *ctx);
+double II_MaxScore(void *ctx, t_docId docId, t_docId *until);
 t_docId II_LastDocId(void *ctx);
 
 /* A Not iterator works by wrapping another iterator, and returning OK for misses, and NOTFOUND for
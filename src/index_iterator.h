@@ -38,9 +38,25 @@ typedef struct indexIterator {
    * on the top iterator */
   size_t (*Len)(void *ctx);
 
+  /* Return an estimate of the number of results this iterator will yield, before reading it. Used
+   * to order the children of intersections */
+  size_t (*NumEstimated)(void *ctx);
+
+  /* Return an upper bound of the TF-IDF score the results of this iterator contribute from docId on.
+   * If until is not NULL, the bound only needs to hold up to the docId it is set to. NULL for
+   * iterators whose scores cannot be bounded. Used to prune top-k queries */
+  double (*MaxScore)(void *ctx, t_docId docId, t_docId *until);
+
   /* Abort the execution of the iterator and mark it as EOF. This is used for early aborting in case
    * of data consistency issues due to multi threading */
   void (*Abort)(void *ctx);
+
+  /* Create a new iterator over the same results, restricted to the docIds in [minId, maxId). The
+   * clone starts at minId regardless of the iterator's position, and does not share any mutable
+   * state with it, so it can be read on another thread. NULL for iterators that cannot be cloned,
+   * and returns NULL if the iterator has a child that cannot be. Used to split the evaluation of a
+   * query by docId ranges */
+  struct indexIterator *(*Clone)(void *ctx, t_docId minId, t_docId maxId);
 } IndexIterator;
 
 #endif
\ No newline at end of file
@@ -126,6 +126,12 @@ RSQueryTerm *NewTerm(RSToken *tok) {
   return ret;
 }
 
+RSQueryTerm *Term_Copy(RSQueryTerm *t) {
+  RSQueryTerm *ret = NewTerm(&(RSToken){.str = t->str, .len = t->len, .flags = t->flags});
+  ret->idf = t->idf;
+  return ret;
+}
+
 void Term_Free(RSQueryTerm *t) {
   if (t) {
     if (t->str) rm_free(t->str);
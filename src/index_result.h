@@ -7,6 +7,8 @@
 #define DEFAULT_RECORDLIST_SIZE 4
 
 RSQueryTerm *NewTerm(RSToken *tok);
+/* Copy a term, including its idf */
+RSQueryTerm *Term_Copy(RSQueryTerm *t);
 void Term_Free(RSQueryTerm *t);
 
 /** Reset the state of an existing index hit. This can be used to
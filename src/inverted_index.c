@@ -3,11 +3,15 @@
 #include "math.h"
 #include "varint.h"
 #include <stdio.h>
+#include <sys/param.h>
 #include "rmalloc.h"
 #include "qint.h"
 #include "qint.c"
+#include "pfor.h"
 #include "redis_index.h"
 #include "numeric_filter.h"
+#include "util/epoch.h"
+#include "decode_cache.h"
 
 // The number of entries in each index block. A new block will be created after every N entries
 #define INDEX_BLOCK_SIZE 100
@@ -15,32 +19,102 @@
 // Initial capacity (in bytes) of a new block
 #define INDEX_BLOCK_INITIAL_CAP 6
 
+// The number of records between skip table checkpoints inside a block
+#define INDEX_BLOCK_SKIP_INTERVAL 16
+
+// The maximal number of checkpoints a single block can hold
+#define INDEX_BLOCK_MAX_CHECKPOINTS ((INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SKIP_INTERVAL)
+
+// The largest record header an encoder writes, before the offset vector (a qint of 4 values)
+#define INDEX_RECORD_MAX_HEADER 17
+
 // The last block of the index
 #define INDEX_LAST_BLOCK(idx) (idx->blocks[idx->size - 1])
 
+// A block of the reader's snapshot. The last one is the reader's own copy
+#define IR_BLOCK(ir, i) ((i) + 1 == ir->numBlocks ? &ir->lastBlock : &ir->blocks[i])
+
 // pointer to the current block while reading the index
-#define IR_CURRENT_BLOCK(ir) (ir->idx->blocks[ir->currentBlock])
+#define IR_CURRENT_BLOCK(ir) (*IR_BLOCK(ir, ir->currentBlock))
+
+// In indexes with packed blocks, every block but the last one (which we are still writing to) is
+// packed
+#define INDEX_BLOCK_PACKED(idx, i) ((idx->flags & Index_PackedBlocks) && (i) + 1 < idx->size)
+#define IR_BLOCK_PACKED(ir) \
+  ((ir->idx->flags & Index_PackedBlocks) && ir->currentBlock + 1 < ir->numBlocks)
 
 static IndexReader *NewIndexReaderGeneric(InvertedIndex *idx, IndexDecoder decoder,
                                           IndexDecoderCtx decoderCtx, RSIndexResult *record);
+static void IndexReader_ResetBatch(IndexReader *ir);
+
+static void indexBlock_FreeBuffer(void *p) {
+  DecodeCache_Invalidate(p);
+  Buffer_Free(p);
+  free(p);
+}
+
+/* Retire a block's data buffer and skip table before replacing them, since readers may still be
+ * reading them from an older snapshot. The block is left without a skip table */
+static void IndexBlock_RetireData(IndexBlock *blk) {
+  Epoch_Retire(blk->data, indexBlock_FreeBuffer);
+  if (blk->checkpoints) {
+    Epoch_Retire(blk->checkpoints, NULL);
+  }
+  blk->checkpoints = NULL;
+  blk->numCheckpoints = 0;
+}
+
+/* Copy the index's blocks array to a new array of cap blocks */
+static IndexBlock *InvertedIndex_CopyBlocks(InvertedIndex *idx, uint32_t cap) {
+  IndexBlock *blocks = rm_malloc(cap * sizeof(IndexBlock));
+  if (idx->size) {
+    memcpy(blocks, idx->blocks, idx->size * sizeof(IndexBlock));
+  }
+  return blocks;
+}
+
+/* Replace the blocks array with a new one. The old array is retired rather than freed, since
+ * concurrent readers may still be reading it */
+static void InvertedIndex_PublishBlocks(InvertedIndex *idx, IndexBlock *blocks, uint32_t cap) {
+  if (idx->blocks) {
+    Epoch_Retire(idx->blocks, NULL);
+  }
+  __atomic_store_n(&idx->blocks, blocks, __ATOMIC_RELEASE);
+  idx->cap = cap;
+}
 
 /* Add a new block to the index with a given document id as the initial id */
 static void InvertedIndex_AddBlock(InvertedIndex *idx, t_docId firstId) {
 
-  idx->size++;
-  idx->blocks = rm_realloc(idx->blocks, idx->size * sizeof(IndexBlock));
-  idx->blocks[idx->size - 1] = (IndexBlock){.firstId = firstId, .lastId = 0, .numDocs = 0};
-  INDEX_LAST_BLOCK(idx).data = NewBuffer(INDEX_BLOCK_INITIAL_CAP);
+  if (idx->size == idx->cap) {
+    uint32_t cap = idx->cap ? idx->cap * 2 : 1;
+    InvertedIndex_PublishBlocks(idx, InvertedIndex_CopyBlocks(idx, cap), cap);
+  }
+  // the new block is out of the snapshot of all readers until we publish the new size
+  idx->blocks[idx->size] = (IndexBlock){
+      .firstId = firstId,
+      .lastId = 0,
+      .numDocs = 0,
+      .numCheckpoints = 0,
+      .maxFreq = 0,
+      .maxScore = 0,
+      .checkpoints = NULL,
+      .data = NewBuffer(INDEX_BLOCK_INITIAL_CAP)};
+  __atomic_store_n(&idx->size, idx->size + 1, __ATOMIC_RELEASE);
 }
 
 InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock) {
   InvertedIndex *idx = rm_malloc(sizeof(InvertedIndex));
   idx->blocks = NULL;
   idx->size = 0;
+  idx->cap = 0;
   idx->lastId = 0;
 
   idx->flags = flags;
   idx->numDocs = 0;
+  idx->docIdGen = 0;
+  idx->renumbering = NULL;
+  idx->scoreIndex = (ScoreIndex){.entries = NULL, .size = 0, .cap = 0, .floor = -1};
   if (initBlock) {
     InvertedIndex_AddBlock(idx, 0);
   }
@@ -48,37 +122,142 @@ InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock) {
 }
 
 void indexBlock_Free(IndexBlock *blk) {
-  Buffer_Free(blk->data);
-  free(blk->data);
+  indexBlock_FreeBuffer(blk->data);
+  rm_free(blk->checkpoints);
 }
 
-void InvertedIndex_Free(void *ctx) {
+/* Add a checkpoint to the block's skip table, for the record at the given offset whose preceding
+ * record's docId is lastId */
+static void IndexBlock_AddCheckpoint(IndexBlock *blk, t_docId lastId, size_t offset) {
+  if (blk->numCheckpoints == INDEX_BLOCK_MAX_CHECKPOINTS) {
+    return;
+  }
+  if (!blk->checkpoints) {
+    blk->checkpoints = rm_malloc(INDEX_BLOCK_MAX_CHECKPOINTS * sizeof(IndexBlockCheckpoint));
+  }
+  blk->checkpoints[blk->numCheckpoints++] =
+      (IndexBlockCheckpoint){.lastId = lastId, .offset = offset};
+}
+
+/* Drop the renumbered copies of the index's blocks from its i-th block on, before the block is
+ * modified. The copies are private, so they are freed right away */
+static void InvertedIndex_DropCopies(InvertedIndex *idx, uint32_t i) {
+  IndexRenumbering *r = idx->renumbering;
+  if (!r) {
+    return;
+  }
+  while (r->size && r->copies[r->size - 1].end > i) {
+    indexBlock_Free(&r->copies[--r->size].blk);
+  }
+  if (!r->size) {
+    rm_free(r->copies);
+    rm_free(r);
+    idx->renumbering = NULL;
+  }
+}
+
+static void invertedIndex_FreeNow(void *ctx) {
   InvertedIndex *idx = ctx;
+  InvertedIndex_DropCopies(idx, 0);
   for (uint32_t i = 0; i < idx->size; i++) {
     indexBlock_Free(&idx->blocks[i]);
   }
   rm_free(idx->blocks);
+  rm_free(idx->scoreIndex.entries);
   rm_free(idx);
 }
 
+void InvertedIndex_Free(void *ctx) {
+  Epoch_Retire(ctx, invertedIndex_FreeNow);
+}
+
+/* Put an entry in the score index's heap at position i, moving it down to its place */
+static void ScoreIndex_SiftDown(ScoreIndex *si, uint32_t i, ScoreIndexEntry e) {
+  while (2 * i + 1 < si->size) {
+    uint32_t c = 2 * i + 1;
+    if (c + 1 < si->size && si->entries[c + 1].impact < si->entries[c].impact) {
+      c++;
+    }
+    if (si->entries[c].impact >= e.impact) break;
+    si->entries[i] = si->entries[c];
+    i = c;
+  }
+  si->entries[i] = e;
+}
+
+/* Add a record to the score index. If the index is full, the record replaces the lowest one if it
+ * has a higher impact */
+static void ScoreIndex_Add(ScoreIndex *si, t_docId docId, uint32_t freq, float impact) {
+  ScoreIndexEntry e = {.docId = docId, .freq = freq, .impact = impact};
+  if (si->size < MAX_SCOREINDEX_SIZE) {
+    if (si->size == si->cap) {
+      si->cap = si->cap ? MIN(si->cap * 2, MAX_SCOREINDEX_SIZE) : 4;
+      si->entries = rm_realloc(si->entries, si->cap * sizeof(ScoreIndexEntry));
+    }
+    // sift the new entry up
+    uint32_t i = si->size++;
+    while (i > 0 && si->entries[(i - 1) / 2].impact > impact) {
+      si->entries[i] = si->entries[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+    si->entries[i] = e;
+    return;
+  }
+
+  if (impact <= si->entries[0].impact) {
+    si->floor = MAX(si->floor, impact);
+    return;
+  }
+  si->floor = MAX(si->floor, si->entries[0].impact);
+  ScoreIndex_SiftDown(si, 0, e);
+}
+
+/* Maps the docId of a record to the docId it is rewritten with, or to 0 to remove the record */
+typedef t_docId (*IndexRecordMapper)(void *ctx, t_docId docId);
+
+/* Keeps the records of documents that were not deleted. The context is the DocTable */
+static t_docId indexRepair_Map(void *ctx, t_docId docId) {
+  RSDocumentMetadata *md = DocTable_Get(ctx, docId);
+  return md && (md->flags & Document_Deleted) ? 0 : docId;
+}
+
+/* Renumbers the records of a compacted table. The context is the DocIdRemap */
+static t_docId indexRenumber_Map(void *ctx, t_docId docId) {
+  return DocIdRemap_Get(ctx, docId);
+}
+
+/* Map the docIds of the score index's entries, removing the entries mapped to 0 */
+static void ScoreIndex_Rewrite(ScoreIndex *si, IndexRecordMapper map, void *ctx) {
+  uint32_t n = 0;
+  for (uint32_t i = 0; i < si->size; i++) {
+    t_docId docId = map(ctx, si->entries[i].docId);
+    if (docId) {
+      si->entries[n] = si->entries[i];
+      si->entries[n++].docId = docId;
+    }
+  }
+  if (n == si->size) return;
+
+  // rebuild the heap
+  si->size = n;
+  for (uint32_t i = n / 2; i-- > 0;) {
+    ScoreIndex_SiftDown(si, i, si->entries[i]);
+  }
+}
+
 /* A callback called from the ConcurrentSearchCtx after regaining execution and reopening the
  * underlying term key. We check for changes in the underlying key, or possible deletion of it */
 void IndexReader_OnReopen(RedisModuleKey *k, void *privdata) {
 
   IndexReader *ir = privdata;
-  // If the key has been deleted we'll get a NULL here, so we just mark ourselves as EOF
-  if (k == NULL || RedisModule_ModuleTypeGetType(k) != InvertedIndexType) {
+  // If the key has been deleted or replaced, we just mark ourselves as EOF. The index we were
+  // reading is kept alive until the query is done with it, so we don't need to touch it
+  if (k == NULL || RedisModule_ModuleTypeGetType(k) != InvertedIndexType ||
+      RedisModule_ModuleTypeGetValue(k) != ir->idx) {
     ir->atEnd = 1;
-    ir->idx = NULL;
-    ir->br.buf = NULL;
-    return;
   }
 
-  // If the key is valid, we just reset the reader's buffer reader to the current block pointer
-  ir->idx = RedisModule_ModuleTypeGetValue(k);
-  size_t offset = ir->br.pos;
-  ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
-  ir->br.pos = offset;
+  // Otherwise we just go on reading our snapshot of the index
 }
 
 /******************************************************************************
@@ -184,6 +363,10 @@ IndexEncoder InvertedIndex_GetEncoder(IndexFlags flags) {
     case Index_DocIdsOnly:
       return encodeDocIdsOnly;
 
+    // 9. numeric value
+    case Index_StoreNumeric:
+      return encodeNumeric;
+
     // invalid encoder - we will fail
     default:
       break;
@@ -192,6 +375,98 @@ IndexEncoder InvertedIndex_GetEncoder(IndexFlags flags) {
   return NULL;
 }
 
+/* Decode a packed block into docIds and, for numeric indexes, the encoded values. The arrays must
+ * hold INDEX_BLOCK_SIZE entries. Returns the number of records */
+static uint32_t IndexBlock_DecodePacked(IndexBlock *blk, IndexFlags flags, t_docId *docIds,
+                                        uint32_t *values) {
+  BufferReader br = NewBufferReader(blk->data);
+  uint32_t num = PFor_Decode(&br, docIds);
+
+  // the deltas are relative to the block's first id
+  t_docId id = blk->firstId;
+  for (uint32_t i = 0; i < num; i++) {
+    docIds[i] = id += docIds[i];
+  }
+  if (flags & Index_StoreNumeric) {
+    Buffer_Read(&br, values, num * sizeof(uint32_t));
+  }
+  return num;
+}
+
+/* Re-encode a full block written record by record as a packed block. Packed blocks keep the docId
+ * deltas PForDelta encoded, followed by the raw numeric values for numeric indexes */
+static void IndexBlock_Pack(IndexBlock *blk, IndexFlags flags) {
+  IndexDecoder decoder = InvertedIndex_GetDecoder(flags & INDEX_STORAGE_MASK);
+  t_docId deltas[INDEX_BLOCK_SIZE];
+  uint32_t values[INDEX_BLOCK_SIZE];
+  RSIndexResult res = {0};
+
+  BufferReader br = NewBufferReader(blk->data);
+  t_docId lastId = blk->firstId;
+  uint32_t num = 0, readId = 0;
+  while (!BufferReader_AtEnd(&br) && num < INDEX_BLOCK_SIZE) {
+    decoder(&br, (IndexDecoderCtx){}, &res);
+    readId += res.docId;
+    deltas[num] = readId - lastId;
+    values[num++] = res.num.encoded;
+    lastId = readId;
+  }
+
+  Buffer *data = NewBuffer(INDEX_BLOCK_INITIAL_CAP);
+  BufferWriter bw = NewBufferWriter(data);
+  PFor_Encode(&bw, deltas, num);
+  if (flags & Index_StoreNumeric) {
+    Buffer_Write(&bw, values, num * sizeof(uint32_t));
+  }
+  Buffer_Truncate(data, 0);
+
+  // packed blocks are searched by rank, they don't need a skip table
+  IndexBlock_RetireData(blk);
+  blk->data = data;
+}
+
+/* Turn a packed block back into one written record by record, so it can be modified */
+static void IndexBlock_Unpack(IndexBlock *blk, IndexFlags flags) {
+  t_docId docIds[INDEX_BLOCK_SIZE];
+  uint32_t values[INDEX_BLOCK_SIZE];
+  uint32_t num = IndexBlock_DecodePacked(blk, flags, docIds, values);
+  IndexEncoder encoder = InvertedIndex_GetEncoder(flags);
+
+  Buffer *data = NewBuffer(INDEX_BLOCK_INITIAL_CAP);
+  BufferWriter bw = NewBufferWriter(data);
+  RSIndexResult res = {0};
+  t_docId lastId = 0;
+  for (uint32_t i = 0; i < num; i++) {
+    res.docId = docIds[i];
+    res.num.encoded = values[i];
+    encoder(&bw, docIds[i] - lastId, &res);
+    lastId = docIds[i];
+  }
+
+  IndexBlock_RetireData(blk);
+  blk->data = data;
+  IndexBlock_BuildCheckpoints(blk, flags);
+}
+
+/* Make sure the block's buffer can take len more bytes. Readers may be holding a snapshot of the
+ * buffer, so instead of reallocating it we copy it to a larger one and retire the old data */
+static void IndexBlock_Reserve(IndexBlock *blk, size_t len) {
+  Buffer *b = blk->data;
+  if (b->offset + len <= b->cap) {
+    return;
+  }
+  size_t cap = b->cap;
+  do {
+    cap += MIN(1 + cap / 5, 1024 * 1024);
+  } while (b->offset + len > cap);
+
+  char *data = rm_malloc(cap);
+  memcpy(data, b->data, b->offset);
+  Epoch_Retire(b->data, NULL);
+  __atomic_store_n(&b->data, data, __ATOMIC_RELEASE);
+  b->cap = cap;
+}
+
 /* Write a forward-index entry to an index writer */
 size_t InvertedIndex_WriteEntryGeneric(InvertedIndex *idx, IndexEncoder encoder, t_docId docId,
                                        RSIndexResult *entry) {
@@ -200,6 +475,9 @@ size_t InvertedIndex_WriteEntryGeneric(InvertedIndex *idx, IndexEncoder encoder,
 
   // see if we need to grow the current block
   if (blk->numDocs >= INDEX_BLOCK_SIZE) {
+    if (idx->flags & Index_PackedBlocks) {
+      IndexBlock_Pack(blk, idx->flags);
+    }
     InvertedIndex_AddBlock(idx, docId);
     blk = &INDEX_LAST_BLOCK(idx);
   }
@@ -208,13 +486,26 @@ size_t InvertedIndex_WriteEntryGeneric(InvertedIndex *idx, IndexEncoder encoder,
     blk->firstId = docId;
   }
 
-  BufferWriter bw = NewBufferWriter(blk->data);
+  // every INDEX_BLOCK_SKIP_INTERVAL records we add a checkpoint to the block's skip table
+  if (blk->numDocs && blk->numDocs % INDEX_BLOCK_SKIP_INTERVAL == 0) {
+    IndexBlock_AddCheckpoint(blk, blk->lastId, Buffer_Offset(blk->data));
+  }
+
+  // make room for the record up front, so the encoder never reallocates the buffer under readers
+  IndexBlock_Reserve(blk, INDEX_RECORD_MAX_HEADER +
+                              (entry->type == RSResultType_Term ? entry->term.offsets.len : 0));
+
+  // we encode through a copy of the buffer, so readers never see a partially written record
+  Buffer buf = *blk->data;
+  BufferWriter bw = NewBufferWriter(&buf);
 
   //  printf("Writing docId %d, delta %d, flags %x\n", docId, docId - idx->lastId, (int)idx->flags);
   size_t ret = encoder(&bw, docId - blk->lastId, entry);
+  __atomic_store_n(&blk->data->offset, buf.offset, __ATOMIC_RELEASE);
 
   idx->lastId = docId;
   blk->lastId = docId;
+  blk->maxFreq = MAX(blk->maxFreq, entry->freq);
   ++blk->numDocs;
   ++idx->numDocs;
 
@@ -227,7 +518,7 @@ size_t InvertedIndex_WriteForwardIndexEntry(InvertedIndex *idx, IndexEncoder enc
   RSIndexResult rec = (RSIndexResult){
       .type = RSResultType_Term,
       .docId = ent->docId,
-      .offsetsSz = ent->vw->bw.buf->offset,
+      .offsetsSz = ent->vw ? ent->vw->bw.buf->offset : 0,
       .freq = ent->freq,
       .fieldMask = ent->fieldMask,
       .term = (RSTermRecord){.term = NULL,
@@ -236,7 +527,15 @@ size_t InvertedIndex_WriteForwardIndexEntry(InvertedIndex *idx, IndexEncoder enc
                                                 : (RSOffsetVector){0, 0}},
 
   };
-  return InvertedIndex_WriteEntryGeneric(idx, encoder, ent->docId, &rec);
+  size_t ret = InvertedIndex_WriteEntryGeneric(idx, encoder, ent->docId, &rec);
+  INDEX_LAST_BLOCK(idx).maxScore = MAX(INDEX_LAST_BLOCK(idx).maxScore, ent->docScore);
+
+  if (INDEX_HAS_SCOREINDEX(idx)) {
+    uint32_t maxFreq = MAX(MAX(ent->docMaxFreq, ent->freq), 1);
+    ScoreIndex_Add(&idx->scoreIndex, ent->docId, ent->freq,
+                   (float)((double)ent->freq * ent->docScore / maxFreq));
+  }
+  return ret;
 }
 
 /* Write a numeric entry to the index */
@@ -254,7 +553,9 @@ inline int IR_HasNext(void *ctx) {
 }
 
 static void IndexReader_AdvanceBlock(IndexReader *ir) {
+  IndexReader_ResetBatch(ir);
   ir->currentBlock++;
+  ir->blocksRead++;
   ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
   ir->lastId = 0;  // IR_CURRENT_BLOCK(ir).firstId;
 }
@@ -388,6 +689,350 @@ IndexDecoder InvertedIndex_GetDecoder(uint32_t flags) {
   }
 }
 
+/******************************************************************************
+ * Index Delta Readers.
+ *
+ * A delta reader only decodes the docId delta of a record and steps over the rest of it. Unlike
+ * decoders they do not populate a result or filter anything, and are used to quickly move past
+ * records we are skipping over.
+ ******************************************************************************/
+
+#define DELTA_READER(name) static t_docId name(BufferReader *br)
+
+// records of 2 or 3 qint encoded integers
+DELTA_READER(readDeltaQint2) {
+  return qint_decodeFirst(br, 2);
+}
+
+DELTA_READER(readDeltaQint3) {
+  return qint_decodeFirst(br, 3);
+}
+
+// records ending with an offset vector, its length being the last qint encoded integer
+DELTA_READER(readDeltaQint2Offsets) {
+  uint32_t arr[2];
+  qint_decode(br, arr, 2);
+  Buffer_Skip(br, arr[1]);
+  return arr[0];
+}
+
+DELTA_READER(readDeltaQint3Offsets) {
+  uint32_t arr[3];
+  qint_decode(br, arr, 3);
+  Buffer_Skip(br, arr[2]);
+  return arr[0];
+}
+
+DELTA_READER(readDeltaQint4Offsets) {
+  uint32_t arr[4];
+  qint_decode(br, arr, 4);
+  Buffer_Skip(br, arr[3]);
+  return arr[0];
+}
+
+DELTA_READER(readDeltaDocIdsOnly) {
+  return ReadVarint(br);
+}
+
+DELTA_READER(readDeltaNumeric) {
+  t_docId delta = ReadVarint(br);
+  Buffer_Skip(br, sizeof(uint32_t));
+  return delta;
+}
+
+IndexDeltaReader InvertedIndex_GetDeltaReader(uint32_t flags) {
+
+  switch (flags & INDEX_STORAGE_MASK) {
+
+    // (freqs, fields, offset)
+    case Index_StoreFreqs | Index_StoreFieldFlags | Index_StoreTermOffsets:
+      return readDeltaQint4Offsets;
+
+    // (freqs), (fields)
+    case Index_StoreFreqs:
+    case Index_StoreFieldFlags:
+      return readDeltaQint2;
+
+    // (offsets)
+    case Index_StoreTermOffsets:
+      return readDeltaQint2Offsets;
+
+    // (freqs, offsets), (fields, offsets)
+    case Index_StoreFreqs | Index_StoreTermOffsets:
+    case Index_StoreFieldFlags | Index_StoreTermOffsets:
+      return readDeltaQint3Offsets;
+
+    // (freqs, fields)
+    case Index_StoreFreqs | Index_StoreFieldFlags:
+      return readDeltaQint3;
+
+    // ()
+    case Index_DocIdsOnly:
+      return readDeltaDocIdsOnly;
+
+    case Index_StoreNumeric:
+      return readDeltaNumeric;
+
+    default:
+      return NULL;
+  }
+}
+
+void IndexBlock_BuildCheckpoints(IndexBlock *blk, IndexFlags flags) {
+  if (blk->checkpoints) {
+    Epoch_Retire(blk->checkpoints, NULL);
+  }
+  blk->checkpoints = NULL;
+  blk->numCheckpoints = 0;
+
+  IndexDeltaReader deltaReader = InvertedIndex_GetDeltaReader(flags);
+  if (!deltaReader || blk->numDocs <= INDEX_BLOCK_SKIP_INTERVAL) {
+    return;
+  }
+
+  t_docId lastId = 0;
+  BufferReader br = NewBufferReader(blk->data);
+  for (uint16_t n = 0; !BufferReader_AtEnd(&br); n++) {
+    if (n && n % INDEX_BLOCK_SKIP_INTERVAL == 0) {
+      IndexBlock_AddCheckpoint(blk, lastId, BufferReader_Offset(&br));
+    }
+    lastId += deltaReader(&br);
+  }
+}
+
+/******************************************************************************
+ * Batch Decoding.
+ *
+ * Readers of qint encoded term indexes decode a whole block at once when reading sequentially,
+ * into per-integer column arrays, and then iterate the decoded arrays.
+ ******************************************************************************/
+
+/* Describes how the qint encoded integers of a record map to the result's "magic 4 uints" */
+typedef struct {
+  // 1 if the records are qint encoded. Otherwise only packed blocks are decoded in batches
+  int qint;
+  // 1 for numeric records, whose value is kept in the second column
+  int numeric;
+  // number of qint encoded integers per record
+  int len;
+  // 1 if the last integer is the length of the offset vector following it
+  int offsets;
+  // 1 if the record carries a field mask we filter by
+  int fields;
+  // index of each integer in the result: docId, freq, fieldMask, offsetsSz
+  uint8_t dest[4];
+} IndexBatchLayout;
+
+typedef struct indexDecodeBatch {
+  IndexBatchLayout layout;
+  // the decoded integers of each record, in encoding order. cols[0] holds absolute docIds
+  uint32_t *cols[4];
+  // the offset of each record in the block, plus one for the end of the last record
+  uint32_t *positions;
+  // the block the columns point to, if they were taken from the decode cache. Otherwise they point
+  // to the batch's own arrays
+  DecodedBlock *shared;
+  uint32_t ownCols[4][INDEX_BLOCK_SIZE];
+  uint32_t ownPositions[INDEX_BLOCK_SIZE + 1];
+  // the number of decoded records, and the next one to be read
+  uint32_t num;
+  uint32_t pos;
+  // the reader's lastId before the first decoded record
+  t_docId baseId;
+  // 1 if the batch holds an entire packed block
+  int packed;
+} IndexDecodeBatch;
+
+/* Get the batch layout matching the index flags. Returns 0 if there is none */
+static int InvertedIndex_GetBatchLayout(uint32_t flags, IndexBatchLayout *l) {
+  switch (flags & INDEX_STORAGE_MASK) {
+    case Index_StoreFreqs | Index_StoreFieldFlags | Index_StoreTermOffsets:
+      *l = (IndexBatchLayout){.qint = 1, .len = 4, .offsets = 1, .fields = 1, .dest = {0, 1, 2, 3}};
+      return 1;
+    case Index_StoreFreqs | Index_StoreFieldFlags:
+      *l = (IndexBatchLayout){.qint = 1, .len = 3, .offsets = 0, .fields = 1, .dest = {0, 1, 2}};
+      return 1;
+    case Index_StoreFieldFlags | Index_StoreTermOffsets:
+      *l = (IndexBatchLayout){.qint = 1, .len = 3, .offsets = 1, .fields = 1, .dest = {0, 2, 3}};
+      return 1;
+    case Index_StoreFreqs | Index_StoreTermOffsets:
+      *l = (IndexBatchLayout){.qint = 1, .len = 3, .offsets = 1, .fields = 0, .dest = {0, 1, 3}};
+      return 1;
+    case Index_StoreFreqs:
+      *l = (IndexBatchLayout){.qint = 1, .len = 2, .offsets = 0, .fields = 0, .dest = {0, 1}};
+      return 1;
+    case Index_StoreFieldFlags:
+      *l = (IndexBatchLayout){.qint = 1, .len = 2, .offsets = 0, .fields = 1, .dest = {0, 2}};
+      return 1;
+    case Index_StoreTermOffsets:
+      *l = (IndexBatchLayout){.qint = 1, .len = 2, .offsets = 1, .fields = 0, .dest = {0, 3}};
+      return 1;
+    case Index_DocIdsOnly:
+      *l = (IndexBatchLayout){.len = 1, .dest = {0}};
+      return 1;
+    case Index_StoreNumeric:
+      *l = (IndexBatchLayout){.numeric = 1, .len = 1, .dest = {0}};
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/* Point the batch back to its own arrays, releasing the cached block it used */
+static void IndexReader_ReleaseBatch(IndexDecodeBatch *b) {
+  if (b->shared) {
+    DecodedBlock_Release(b->shared);
+    b->shared = NULL;
+  }
+  for (int i = 0; i < 4; i++) {
+    b->cols[i] = b->ownCols[i];
+  }
+  b->positions = b->ownPositions;
+}
+
+static IndexDecodeBatch *IndexReader_GetBatch(IndexReader *ir) {
+  if (!ir->batch) {
+    ir->batch = rm_malloc(sizeof(IndexDecodeBatch));
+    InvertedIndex_GetBatchLayout(ir->idx->flags, &ir->batch->layout);
+    ir->batch->shared = NULL;
+    ir->batch->num = ir->batch->pos = ir->batch->packed = 0;
+    IndexReader_ReleaseBatch(ir->batch);
+  }
+  return ir->batch;
+}
+
+/* Only whole qint encoded blocks that can no longer change are shared through the decode cache.
+ * The last block of the snapshot is the reader's own copy, and is still being written to */
+#define IR_BLOCK_CACHEABLE(ir) \
+  (DecodeCache_MaxMem && ir->batchMode && ir->currentBlock + 1 < ir->numBlocks)
+
+/* Use the cached decoded records of the current block as the reader's batch, positioned at its
+ * first record. Returns 0 if the block is not cached */
+static int IndexReader_AttachCachedBatch(IndexReader *ir) {
+  if (!IR_BLOCK_CACHEABLE(ir) || IR_BLOCK_PACKED(ir)) {
+    return 0;
+  }
+  DecodedBlock *db = DecodeCache_Get(IR_CURRENT_BLOCK(ir).data);
+  if (!db) {
+    return 0;
+  }
+  IndexDecodeBatch *b = IndexReader_GetBatch(ir);
+  IndexReader_ReleaseBatch(b);
+  b->shared = db;
+  for (int i = 0; i < b->layout.len; i++) {
+    b->cols[i] = db->cols[i];
+  }
+  b->positions = db->positions;
+  b->num = db->num;
+  b->pos = 0;
+  b->baseId = 0;
+  b->packed = 0;
+  ir->br.pos = b->positions[b->num];
+  return 1;
+}
+
+/* Decode the rest of the current block into the reader's batch */
+static void IndexReader_DecodeBatch(IndexReader *ir) {
+  // when starting a block, another reader may have decoded it already
+  int wholeBlock = ir->br.pos == 0;
+  if (wholeBlock && IndexReader_AttachCachedBatch(ir)) {
+    return;
+  }
+  IndexDecodeBatch *b = IndexReader_GetBatch(ir);
+  IndexReader_ReleaseBatch(b);
+  b->pos = 0;
+  b->baseId = ir->lastId;
+
+  if (IR_BLOCK_PACKED(ir)) {
+    b->packed = 1;
+    b->num = IndexBlock_DecodePacked(&IR_CURRENT_BLOCK(ir), ir->idx->flags, b->cols[0], b->cols[1]);
+    ir->br.pos = Buffer_Offset(ir->br.buf);
+    return;
+  }
+
+  b->packed = 0;
+  b->num = qint_decodeBatch(&ir->br, b->layout.len, b->layout.offsets, b->cols, b->positions,
+                            INDEX_BLOCK_SIZE);
+
+  // turn the deltas into absolute docIds
+  t_docId id = ir->lastId;
+  for (uint32_t i = 0; i < b->num; i++) {
+    b->cols[0][i] = id += b->cols[0][i];
+  }
+
+  if (wholeBlock && IR_BLOCK_CACHEABLE(ir)) {
+    DecodeCache_Put(IR_CURRENT_BLOCK(ir).data, b->num, b->layout.len, b->cols, b->positions);
+  }
+}
+
+/* Read the next record of the batch into the reader's record. Like decoders, returns 0 if the
+ * record is filtered out */
+static inline int IndexReader_ReadBatch(IndexReader *ir) {
+  IndexDecodeBatch *b = ir->batch;
+  RSIndexResult *res = ir->record;
+  uint32_t i = b->pos++;
+
+  for (int j = 0; j < b->layout.len; j++) {
+    ((uint32_t *)res)[b->layout.dest[j]] = b->cols[j][i];
+  }
+  ir->lastId = res->docId;
+
+  if (b->layout.numeric) {
+    res->num.encoded = b->cols[1][i];
+    NumericFilter *f = ir->decoderCtx.ptr;
+    return !f || NumericFilter_Match(f, res->num.value);
+  }
+  if (b->layout.offsets) {
+    // the offset vector ends where the next record begins
+    res->term.offsets = (RSOffsetVector){
+        .data = IR_CURRENT_BLOCK(ir).data->data + b->positions[i + 1] - res->offsetsSz,
+        .len = res->offsetsSz};
+  }
+  if (b->layout.fields && ir->decoderCtx.num != RS_FIELDMASK_ALL) {
+    return res->fieldMask & ir->decoderCtx.num;
+  }
+  return 1;
+}
+
+/* Discard the records of the batch we have not read yet, moving the buffer reader back to the
+ * first of them. Packed blocks can't be read record by record, so we just skip them */
+static void IndexReader_DropBatch(IndexReader *ir) {
+  IndexDecodeBatch *b = ir->batch;
+  if (b->packed) {
+    b->pos = b->num;
+  } else {
+    ir->br.pos = b->positions[b->pos];
+  }
+  ir->lastId = b->pos ? b->cols[0][b->pos - 1] : b->baseId;
+  b->num = b->pos = 0;
+  IndexReader_ReleaseBatch(b);
+}
+
+/* Move the batch to its first record with a docId of at least docId, by binary search */
+static void IndexReader_SeekBatch(IndexReader *ir, t_docId docId) {
+  IndexDecodeBatch *b = ir->batch;
+  uint32_t lo = b->pos, hi = b->num;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (b->cols[0][mid] < docId) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  b->pos = lo;
+}
+
+/* Forget the batch when moving to another block */
+static void IndexReader_ResetBatch(IndexReader *ir) {
+  if (ir->batch) {
+    ir->batch->num = ir->batch->pos = ir->batch->packed = 0;
+    IndexReader_ReleaseBatch(ir->batch);
+  }
+}
+
+#define IR_HAS_BATCH(ir) (ir->batch && ir->batch->pos < ir->batch->num)
+
 IndexReader *NewNumericReader(InvertedIndex *idx, NumericFilter *flt) {
   RSIndexResult *res = NewNumericResult();
   res->freq = 1;
@@ -405,16 +1050,40 @@ int IR_Read(void *ctx, RSIndexResult **e) {
     goto eof;
   }
   do {
+    // read from the decoded batch if we have one
+    if (IR_HAS_BATCH(ir)) {
+      int rv = IndexReader_ReadBatch(ir);
+      if (ir->lastId >= ir->maxId) {
+        goto eof;
+      }
+      if (!rv) {
+        continue;
+      }
+      ++ir->len;
+      *e = ir->record;
+      return INDEXREAD_OK;
+    }
+
     if (BufferReader_AtEnd(&ir->br)) {
       // We're at the end of the last block...
-      if (ir->currentBlock + 1 == ir->idx->size) {
+      if (ir->currentBlock + 1 >= ir->numBlocks) {
         goto eof;
       }
       IndexReader_AdvanceBlock(ir);
     }
 
+    // when reading from the start of a block, decode all of it at once. Packed blocks can only be
+    // read this way
+    if (ir->br.pos == 0 && (ir->batchMode || IR_BLOCK_PACKED(ir))) {
+      IndexReader_DecodeBatch(ir);
+      continue;
+    }
+
     int rv = ir->decoder(&ir->br, ir->decoderCtx, ir->record);
     ir->lastId = ir->record->docId += ir->lastId;
+    if (ir->lastId >= ir->maxId) {
+      goto eof;
+    }
     // The decoder also acts as a filter. A zero return value means that the
     // current record should not be processed.
     if (!rv) {
@@ -439,9 +1108,9 @@ inline void IR_Seek(IndexReader *ir, t_offset offset, t_docId docId) {
   ir->lastId = docId;
 }
 
-int _isPos(InvertedIndex *idx, uint32_t i, t_docId docId) {
-  if (idx->blocks[i].firstId <= docId &&
-      (i == idx->size - 1 || idx->blocks[i + 1].firstId > docId)) {
+static int _isPos(IndexReader *ir, uint32_t i, t_docId docId) {
+  if (IR_BLOCK(ir, i)->firstId <= docId &&
+      (i == ir->numBlocks - 1 || IR_BLOCK(ir, i + 1)->firstId > docId)) {
     return 1;
   }
   return 0;
@@ -449,26 +1118,25 @@ int _isPos(InvertedIndex *idx, uint32_t i, t_docId docId) {
 
 static int IndexReader_SkipToBlock(IndexReader *ir, t_docId docId) {
 
-  InvertedIndex *idx = ir->idx;
-  if (idx->size == 0 || docId < idx->blocks[0].firstId) {
+  if (ir->numBlocks == 0 || docId < IR_BLOCK(ir, 0)->firstId) {
     return 0;
   }
   // if we don't need to move beyond the current block
-  if (_isPos(idx, ir->currentBlock, docId)) {
+  if (_isPos(ir, ir->currentBlock, docId)) {
     return 1;
   }
 
-  uint32_t top = idx->size, bottom = ir->currentBlock;
+  uint32_t top = ir->numBlocks, bottom = ir->currentBlock;
   uint32_t i = bottom;
   uint32_t newi;
 
   while (bottom <= top) {
-    if (_isPos(idx, i, docId)) {
+    if (_isPos(ir, i, docId)) {
       ir->currentBlock = i;
       goto found;
     }
 
-    if (docId < idx->blocks[i].firstId) {
+    if (docId < IR_BLOCK(ir, i)->firstId) {
       top = i - 1;
     } else {
       bottom = i + 1;
@@ -478,11 +1146,42 @@ static int IndexReader_SkipToBlock(IndexReader *ir, t_docId docId) {
   ir->currentBlock = i;
 
 found:
+  IndexReader_ResetBatch(ir);
+  ir->blocksRead++;
   ir->lastId = 0;
   ir->br = NewBufferReader(IR_CURRENT_BLOCK(ir).data);
   return 1;
 }
 
+/* Jump to the last checkpoint of the current block that precedes docId, if it is ahead of the
+ * reader's current position */
+static void IndexReader_SkipToCheckpoint(IndexReader *ir, t_docId docId) {
+  const IndexBlock *blk = &IR_CURRENT_BLOCK(ir);
+  int i = blk->numCheckpoints - 1;
+  while (i >= 0 && blk->checkpoints[i].lastId >= docId) {
+    i--;
+  }
+  if (i >= 0 && blk->checkpoints[i].offset > ir->br.pos) {
+    ir->br.pos = blk->checkpoints[i].offset;
+    ir->lastId = blk->checkpoints[i].lastId;
+  }
+}
+
+/* Step over all the records of the current block preceding docId using the delta reader, leaving
+ * the reader positioned on the first record that may match docId */
+static void IndexReader_StepTo(IndexReader *ir, t_docId docId) {
+  while (!BufferReader_AtEnd(&ir->br)) {
+    size_t pos = ir->br.pos;
+    t_docId id = ir->lastId + ir->deltaReader(&ir->br);
+    if (id >= docId) {
+      // rewind so the record is fully decoded by the next read
+      ir->br.pos = pos;
+      return;
+    }
+    ir->lastId = id;
+  }
+}
+
 /**
 Skip to the given docId, or one place after it
 @param ctx IndexReader context
@@ -506,9 +1205,20 @@ int IR_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
   }
 
   /* check if the id is out of range */
-  if (docId > ir->idx->lastId) {
+  if (docId > ir->lastBlock.lastId || docId >= ir->maxId) {
     goto eof;
   }
+
+  if (IR_HAS_BATCH(ir)) {
+    // if the id is within the decoded batch, just move forward in it
+    IndexDecodeBatch *b = ir->batch;
+    if (docId <= b->cols[0][b->num - 1]) {
+      IndexReader_SeekBatch(ir, docId);
+      goto read;
+    }
+    IndexReader_DropBatch(ir);
+  }
+
   // try to skip to the current block
   if (!IndexReader_SkipToBlock(ir, docId)) {
     if (IR_Read(ir, hit) == INDEXREAD_EOF) {
@@ -517,6 +1227,27 @@ int IR_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
     return INDEXREAD_NOTFOUND;
   }
 
+  // packed blocks are decoded as a whole and searched by rank
+  if (IR_BLOCK_PACKED(ir)) {
+    if (ir->br.pos == 0) {
+      IndexReader_DecodeBatch(ir);
+      IndexReader_SeekBatch(ir, docId);
+    }
+    goto read;
+  }
+  // and so are blocks another reader has already decoded
+  if (IndexReader_AttachCachedBatch(ir)) {
+    IndexReader_SeekBatch(ir, docId);
+    goto read;
+  }
+
+  // move close to the requested docId without decoding the records we are skipping over
+  if (ir->deltaReader) {
+    IndexReader_SkipToCheckpoint(ir, docId);
+    IndexReader_StepTo(ir, docId);
+  }
+
+read:;
   int rc;
   t_docId rid;
   while (INDEXREAD_EOF != (rc = IR_Read(ir, hit))) {
@@ -546,9 +1277,30 @@ static IndexReader *NewIndexReaderGeneric(InvertedIndex *idx, IndexDecoder decod
   ret->record = record;
   ret->len = 0;
   ret->atEnd = 0;
-  ret->br = NewBufferReader(IR_CURRENT_BLOCK(ret).data);
+
+  // take a snapshot of the index's blocks. Only the last block may change after this point. The
+  // size is loaded first: writers publish a new blocks array before the size that goes with it, so
+  // the array we load next holds at least that many initialized blocks
+  ret->numBlocks = __atomic_load_n(&idx->size, __ATOMIC_ACQUIRE);
+  ret->blocks = __atomic_load_n(&idx->blocks, __ATOMIC_ACQUIRE);
+  ret->blocksRead = ret->numBlocks ? 1 : 0;
+  if (ret->numBlocks) {
+    ret->lastBlock = ret->blocks[ret->numBlocks - 1];
+    ret->lastBuffer = *ret->lastBlock.data;
+  } else {
+    ret->lastBlock = (IndexBlock){.lastId = 0};
+    ret->lastBuffer = (Buffer){.data = NULL, .offset = 0, .cap = 0};
+    ret->atEnd = 1;
+  }
+  ret->lastBlock.data = &ret->lastBuffer;
+  ret->br = NewBufferReader(ret->numBlocks ? IR_CURRENT_BLOCK(ret).data : &ret->lastBuffer);
   ret->decoder = decoder;
   ret->decoderCtx = decoderCtx;
+  ret->deltaReader = InvertedIndex_GetDeltaReader(idx->flags);
+  IndexBatchLayout layout;
+  ret->batchMode = InvertedIndex_GetBatchLayout(idx->flags, &layout) && layout.qint;
+  ret->batch = NULL;
+  ret->maxId = UINT32_MAX;
   return ret;
 }
 
@@ -577,6 +1329,10 @@ IndexReader *NewTermIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldM
 void IR_Free(IndexReader *ir) {
 
   IndexResult_Free(ir->record);
+  if (ir->batch) {
+    IndexReader_ReleaseBatch(ir->batch);
+  }
+  rm_free(ir->batch);
   rm_free(ir);
 }
 
@@ -594,10 +1350,101 @@ void ReadIterator_Free(IndexIterator *it) {
   rm_free(it);
 }
 
+size_t IR_NumEstimated(void *ctx) {
+  IndexReader *ir = ctx;
+  return ir->idx ? ir->idx->numDocs : 0;
+}
+
+/* The TF-IDF score of a record is freq * idf * docScore / maxFreq, where maxFreq is the maximal
+ * frequency of any term in the document. Since freq <= maxFreq, a block's records contribute at most
+ * idf times the block's max document score */
+double IR_MaxScore(void *ctx, t_docId docId, t_docId *until) {
+  IndexReader *ir = ctx;
+  double idf = ir->record->term.term ? ir->record->term.term->idf : 0;
+
+  // find the first block that may hold docId, we never look behind the current block
+  uint32_t lo = ir->currentBlock, hi = ir->numBlocks;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (IR_BLOCK(ir, mid)->lastId < docId) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == ir->numBlocks) {
+    if (until) *until = UINT32_MAX;
+    return 0;
+  }
+  if (until) {
+    *until = IR_BLOCK(ir, lo)->lastId;
+    return idf * IR_BLOCK(ir, lo)->maxScore;
+  }
+
+  float maxScore = 0;
+  for (uint32_t i = lo; i < ir->numBlocks; i++) {
+    maxScore = MAX(maxScore, IR_BLOCK(ir, i)->maxScore);
+  }
+  return idf * maxScore;
+}
+
 inline t_docId IR_LastDocId(void *ctx) {
   return ((IndexReader *)ctx)->lastId;
 }
 
+/* Position a new reader before its first record with a docId of at least docId, without reading
+ * it */
+static void IndexReader_SeekTo(IndexReader *ir, t_docId docId) {
+  if (ir->atEnd || !IndexReader_SkipToBlock(ir, docId)) {
+    return;
+  }
+  if (IR_BLOCK_PACKED(ir)) {
+    IndexReader_DecodeBatch(ir);
+    IndexReader_SeekBatch(ir, docId);
+    return;
+  }
+  IndexReader_SkipToCheckpoint(ir, docId);
+  if (ir->deltaReader) {
+    IndexReader_StepTo(ir, docId);
+    return;
+  }
+  // without a delta reader we step over the records preceding docId by decoding them
+  while (!BufferReader_AtEnd(&ir->br)) {
+    size_t pos = ir->br.pos;
+    ir->decoder(&ir->br, ir->decoderCtx, ir->record);
+    if (ir->lastId + ir->record->docId >= docId) {
+      ir->br.pos = pos;
+      return;
+    }
+    ir->lastId += ir->record->docId;
+  }
+}
+
+/* Clone a reader, sharing its snapshot of the index. The clone owns a copy of the reader's
+ * record, including its term */
+static IndexIterator *IR_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  IndexReader *ir = ctx;
+  IndexReader *ret = rm_malloc(sizeof(IndexReader));
+  *ret = *ir;
+  ret->lastBlock.data = &ret->lastBuffer;
+  ret->record = rm_malloc(sizeof(RSIndexResult));
+  *ret->record = *ir->record;
+  if (ret->record->type == RSResultType_Term && ret->record->term.term) {
+    ret->record->term.term = Term_Copy(ir->record->term.term);
+  }
+
+  ret->currentBlock = 0;
+  ret->lastId = 0;
+  ret->len = 0;
+  ret->blocksRead = ret->numBlocks ? 1 : 0;
+  ret->batch = NULL;
+  ret->atEnd = ret->numBlocks == 0;
+  ret->br = NewBufferReader(ret->numBlocks ? IR_CURRENT_BLOCK(ret).data : &ret->lastBuffer);
+  ret->maxId = MIN(ir->maxId, maxId);
+  IndexReader_SeekTo(ret, minId);
+  return NewReadIterator(ret);
+}
+
 IndexIterator *NewReadIterator(IndexReader *ir) {
   IndexIterator *ri = rm_malloc(sizeof(IndexIterator));
   ri->ctx = ir;
@@ -607,30 +1454,170 @@ IndexIterator *NewReadIterator(IndexReader *ir) {
   ri->HasNext = IR_HasNext;
   ri->Free = ReadIterator_Free;
   ri->Len = IR_NumDocs;
+  ri->NumEstimated = IR_NumEstimated;
+  // only term records have scores we can bound
+  ri->MaxScore = ir->record->type == RSResultType_Term ? IR_MaxScore : NULL;
   ri->Current = IR_Current;
   ri->Abort = IR_Abort;
+  ri->Clone = IR_Clone;
   return ri;
 }
 
+/* A score index iterator yields a snapshot of a term's score index entries, in docId order */
 typedef struct {
-  InvertedIndex *idx;
-  uint32_t currentBlock;
-  DocTable *docs;
-  int numRepaired;
+  IndexReader *ir;
+  ScoreIndexEntry *entries;
+  uint32_t size;
+  uint32_t pos;
+  t_docId lastDocId;
+} ScoreIndexIterator;
+
+static int SI_HasNext(void *ctx) {
+  ScoreIndexIterator *si = ctx;
+  // the reader is marked at its end if the index is deleted while we yield the GIL
+  return si->pos < si->size && !si->ir->atEnd;
+}
+
+static int SI_Read(void *ctx, RSIndexResult **e) {
+  ScoreIndexIterator *si = ctx;
+  if (!SI_HasNext(si)) {
+    return INDEXREAD_EOF;
+  }
+  ScoreIndexEntry *ent = &si->entries[si->pos++];
+  RSIndexResult *record = si->ir->record;
+  record->docId = ent->docId;
+  record->freq = ent->freq;
+  record->fieldMask = RS_FIELDMASK_ALL;
+  record->offsetsSz = 0;
+  record->term.offsets = (RSOffsetVector){0, 0};
+  si->lastDocId = ent->docId;
+  *e = record;
+  return INDEXREAD_OK;
+}
+
+static int SI_SkipTo(void *ctx, t_docId docId, RSIndexResult **e) {
+  ScoreIndexIterator *si = ctx;
+  while (SI_HasNext(si) && si->entries[si->pos].docId < docId) {
+    si->pos++;
+  }
+  int rc = SI_Read(si, e);
+  if (rc == INDEXREAD_OK && si->lastDocId != docId) {
+    return INDEXREAD_NOTFOUND;
+  }
+  return rc;
+}
 
-} RepairContext;
+static t_docId SI_LastDocId(void *ctx) {
+  return ((ScoreIndexIterator *)ctx)->lastDocId;
+}
+
+static RSIndexResult *SI_Current(void *ctx) {
+  return ((ScoreIndexIterator *)ctx)->ir->record;
+}
+
+/* We only hold the top records, but the query matches all the records of the index */
+static size_t SI_Len(void *ctx) {
+  return IR_NumEstimated(((ScoreIndexIterator *)ctx)->ir);
+}
+
+static void SI_Abort(void *ctx) {
+  ScoreIndexIterator *si = ctx;
+  si->pos = si->size;
+}
 
-int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags) {
+static void SI_Free(IndexIterator *it) {
+  ScoreIndexIterator *si = it->ctx;
+  IR_Free(si->ir);
+  rm_free(si->entries);
+  rm_free(si);
+  rm_free(it);
+}
+
+static int cmpScoreIndexDocIds(const void *p1, const void *p2) {
+  const ScoreIndexEntry *e1 = p1, *e2 = p2;
+  return e1->docId < e2->docId ? -1 : (e1->docId > e2->docId ? 1 : 0);
+}
+
+IndexIterator *NewScoreIndexIterator(IndexReader *ir, DocTable *dt, size_t num) {
+  InvertedIndex *idx = ir->idx;
+  RSQueryTerm *term = ir->record->term.term;
+  // with no idf all the scores are 0, and the order is by docId
+  if (!INDEX_HAS_SCOREINDEX(idx) || !term || term->idf <= 0 || num == 0) {
+    return NULL;
+  }
+
+  // the live records with an impact above the floor outrank all the records outside the score
+  // index, so if there are enough of them, the top results are all in it
+  ScoreIndex *sx = &idx->scoreIndex;
+  size_t live = 0;
+  for (uint32_t i = 0; i < sx->size && live < num; i++) {
+    if (sx->entries[i].impact <= sx->floor) continue;
+    RSDocumentMetadata *dmd = DocTable_Get(dt, sx->entries[i].docId);
+    if (dmd && !(dmd->flags & Document_Deleted)) {
+      live++;
+    }
+  }
+  if (live < num) {
+    return NULL;
+  }
+
+  ScoreIndexIterator *si = rm_malloc(sizeof(*si));
+  si->ir = ir;
+  si->size = sx->size;
+  si->pos = 0;
+  si->lastDocId = 0;
+  si->entries = rm_malloc(sx->size * sizeof(ScoreIndexEntry));
+  memcpy(si->entries, sx->entries, sx->size * sizeof(ScoreIndexEntry));
+  qsort(si->entries, si->size, sizeof(ScoreIndexEntry), cmpScoreIndexDocIds);
+
+  IndexIterator *ret = rm_malloc(sizeof(IndexIterator));
+  ret->ctx = si;
+  ret->Clone = NULL;
+  ret->Read = SI_Read;
+  ret->SkipTo = SI_SkipTo;
+  ret->LastDocId = SI_LastDocId;
+  ret->HasNext = SI_HasNext;
+  ret->Free = SI_Free;
+  ret->Len = SI_Len;
+  ret->NumEstimated = SI_Len;
+  ret->MaxScore = NULL;
+  ret->Current = SI_Current;
+  ret->Abort = SI_Abort;
+  return ret;
+}
+
+/* Returns 1 if any record of a packed block belongs to a deleted document */
+static int IndexBlock_PackedHasDeleted(IndexBlock *blk, DocTable *dt, IndexFlags flags) {
+  t_docId docIds[INDEX_BLOCK_SIZE];
+  uint32_t values[INDEX_BLOCK_SIZE];
+  uint32_t num = IndexBlock_DecodePacked(blk, flags, docIds, values);
+  for (uint32_t i = 0; i < num; i++) {
+    RSDocumentMetadata *md = DocTable_Get(dt, docIds[i]);
+    if (md && (md->flags & Document_Deleted)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Rewrite the records of an unpacked block with their mapped docIds, removing those mapped to 0.
+ * Readers expect every block but the last one to hold records, so unless allowEmpty is set, a block
+ * whose records would all be removed is left as it is. Returns the number of records removed, or -1
+ * on error */
+static int IndexBlock_Rewrite(IndexBlock *blk, IndexFlags flags, int allowEmpty,
+                              IndexRecordMapper map, void *ctx) {
   t_docId lastReadId = 0;
-  blk->lastId = 0;
-  Buffer repair = *blk->data;
-  repair.offset = 0;
+  t_docId firstId = 0, lastId = 0;
 
+  // Readers may be in the middle of the block, so we never rewrite its buffer in place but write
+  // the rewritten records to a new one
   BufferReader br = NewBufferReader(blk->data);
-  BufferWriter bw = NewBufferWriter(&repair);
+  Buffer *repair = NewBuffer(MAX(Buffer_Offset(blk->data), INDEX_BLOCK_INITIAL_CAP));
+  BufferWriter bw = NewBufferWriter(repair);
 
-  RSIndexResult *res = NewTokenRecord(NULL);
+  RSIndexResult res = {0};
   int frags = 0;
+  int changed = 0;
 
   uint32_t readFlags = flags & INDEX_STORAGE_MASK;
   IndexDecoder decoder = InvertedIndex_GetDecoder(readFlags);
@@ -638,55 +1625,505 @@ int IndexBlock_Repair(IndexBlock *blk, DocTable *dt, IndexFlags flags) {
 
   if (!encoder || !decoder) {
     fprintf(stderr, "Could not get decoder/encoder for index\n");
+    indexBlock_FreeBuffer(repair);
     return -1;
   }
   while (!BufferReader_AtEnd(&br)) {
     const char *bufBegin = BufferReader_Current(&br);
-    decoder(&br, (IndexDecoderCtx){}, res);
+    decoder(&br, (IndexDecoderCtx){}, &res);
     size_t sz = BufferReader_Current(&br) - bufBegin;
-    lastReadId = res->docId += lastReadId;
-    RSDocumentMetadata *md = DocTable_Get(dt, res->docId);
+    t_docId delta = res.docId;
+    lastReadId = res.docId += lastReadId;
+    t_docId docId = map(ctx, res.docId);
 
-    if (md->flags & Document_Deleted) {
+    if (!docId) {
       frags += 1;
-      // printf("ignoring hole in doc %d, frags now %d\n", docId, frags);
+      continue;
+    }
+    if (docId - lastId != delta) {
+      changed = 1;
+      res.docId = docId;
+      encoder(&bw, docId - lastId, &res);
     } else {
+      // the record's delta is unchanged, so we copy it as it is
+      Buffer_Write(&bw, (void *)bufBegin, sz);
+    }
+    if (!firstId) firstId = docId;
+    lastId = docId;
+  }
 
-      if (frags) {
-        // printf("Writing entry %d, last read id %d, last blk id %d\n", docId, lastReadId,
-        //        blk->lastId);
-        encoder(&bw, res->docId - blk->lastId, res);
+  if (!(frags || changed) || (!lastId && !allowEmpty)) {
+    indexBlock_FreeBuffer(repair);
+    return 0;
+  }
+  blk->numDocs -= frags;
+  blk->firstId = firstId;
+  blk->lastId = lastId;
+  IndexBlock_RetireData(blk);
+  Buffer_Truncate(repair, 0);
+  blk->data = repair;
+  IndexBlock_BuildCheckpoints(blk, flags);
+  return frags;
+}
 
-      } else {
-        bw.buf->offset += sz;
-        bw.pos += sz;
+/* Append the records of src to dst, both being unpacked blocks of the same index, and free src.
+ * This moves records between blocks, so it is only done when no reader is active */
+static void IndexBlock_Merge(IndexBlock *dst, IndexBlock *src, IndexFlags flags) {
+  IndexDecoder decoder = InvertedIndex_GetDecoder(flags & INDEX_STORAGE_MASK);
+  IndexEncoder encoder = InvertedIndex_GetEncoder(flags);
+
+  size_t dstLen = Buffer_Offset(dst->data), srcLen = Buffer_Offset(src->data);
+  Buffer *data = NewBuffer(dstLen + srcLen + INDEX_RECORD_MAX_HEADER);
+  BufferWriter bw = NewBufferWriter(data);
+  Buffer_Write(&bw, dst->data->data, dstLen);
+
+  // the first record of a block holds its docId rather than a delta, so it is encoded again as a
+  // delta from dst's last record. The records following it are copied as they are
+  BufferReader br = NewBufferReader(src->data);
+  RSIndexResult res = {0};
+  decoder(&br, (IndexDecoderCtx){}, &res);
+  encoder(&bw, res.docId - dst->lastId, &res);
+  Buffer_Write(&bw, BufferReader_Current(&br), srcLen - BufferReader_Offset(&br));
+  Buffer_Truncate(data, 0);
+
+  IndexBlock_RetireData(dst);
+  dst->data = data;
+  dst->lastId = src->lastId;
+  dst->numDocs += src->numDocs;
+  dst->maxFreq = MAX(dst->maxFreq, src->maxFreq);
+  dst->maxScore = MAX(dst->maxScore, src->maxScore);
+  IndexBlock_BuildCheckpoints(dst, flags);
+  indexBlock_Free(src);
+}
+
+/* Drop the empty blocks in [start, end) and merge neighbouring blocks that fit in a single one.
+ * The last block of the index, which is written to, is left alone. Only called when no reader is
+ * active, as it moves blocks. Returns the number of blocks removed */
+static uint32_t InvertedIndex_MergeBlocks(InvertedIndex *idx, uint32_t start, uint32_t end) {
+  end = MIN(end, idx->size - 1);
+  uint32_t n = start;
+  for (uint32_t i = start; i < end; i++) {
+    IndexBlock *blk = &idx->blocks[i];
+    if (!blk->numDocs) {
+      indexBlock_Free(blk);
+      continue;
+    }
+    if (n > start && idx->blocks[n - 1].numDocs + blk->numDocs <= INDEX_BLOCK_SIZE) {
+      IndexBlock *dst = &idx->blocks[n - 1];
+      int packed = idx->flags & Index_PackedBlocks;
+      if (packed) {
+        IndexBlock_Unpack(dst, idx->flags);
+        IndexBlock_Unpack(blk, idx->flags);
+      }
+      IndexBlock_Merge(dst, blk, idx->flags);
+      if (packed) {
+        IndexBlock_Pack(dst, idx->flags);
       }
-      blk->lastId = res->docId;
+      continue;
     }
+    idx->blocks[n++] = *blk;
   }
-  if (frags) {
-    blk->numDocs -= frags;
-    *blk->data = repair;
-    Buffer_Truncate(blk->data, 0);
+  if (n == end) {
+    return 0;
   }
-  // IndexReader *ir = NewIndexReader()
-  return frags;
+  memmove(&idx->blocks[n], &idx->blocks[end], (idx->size - end) * sizeof(IndexBlock));
+  __atomic_store_n(&idx->size, idx->size - (end - n), __ATOMIC_RELEASE);
+  return end - n;
 }
 
-int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num) {
-  int n = 0;
-  while (startBlock < idx->size && (num <= 0 || n < num)) {
-    int rep = IndexBlock_Repair(&idx->blocks[startBlock], dt, idx->flags);
+/* The memory used by the data of the blocks in [start, end) */
+static size_t InvertedIndex_BlocksSize(InvertedIndex *idx, uint32_t start, uint32_t end) {
+  size_t sz = 0;
+  for (uint32_t i = start; i < end; i++) {
+    sz += idx->blocks[i].data->cap;
+  }
+  return sz;
+}
+
+int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num,
+                         IndexRepairStats *stats) {
+  // a new pass over the index, clean the score index as well
+  if (startBlock == 0) {
+    ScoreIndex_Rewrite(&idx->scoreIndex, indexRepair_Map, dt);
+  }
+  uint32_t end = num <= 0 ? idx->size : MIN(idx->size, startBlock + num);
+  size_t sizeBefore = InvertedIndex_BlocksSize(idx, startBlock, end);
+  InvertedIndex_DropCopies(idx, startBlock);
+
+  // Readers running without the GIL may be reading the blocks we modify, so while there are any we
+  // repair a copy of the blocks array, and publish it when we're done. Without readers we also
+  // drop the blocks left empty, and merge the ones left underfull
+  int compact = !Epoch_Active();
+  IndexBlock *blocks = idx->blocks;
+  if (!compact) {
+    blocks = InvertedIndex_CopyBlocks(idx, idx->cap);
+  }
+
+  int rc = 1;
+  size_t removed = 0;
+  uint32_t i;
+  for (i = startBlock; i < end; i++) {
+    IndexBlock *blk = &blocks[i];
+    int packed = INDEX_BLOCK_PACKED(idx, i);
+    // most blocks are clean, we don't unpack those
+    if (packed && !IndexBlock_PackedHasDeleted(blk, dt, idx->flags)) {
+      continue;
+    }
+    if (packed) {
+      IndexBlock_Unpack(blk, idx->flags);
+    }
+    int rep = IndexBlock_Rewrite(blk, idx->flags, compact, indexRepair_Map, dt);
+    if (packed && blk->numDocs) {
+      IndexBlock_Pack(blk, idx->flags);
+    }
     // we couldn't repair the block - return 0
     if (rep == -1) {
-      return 0;
+      rc = 0;
+      break;
+    }
+    removed += rep;
+  }
+
+  if (blocks != idx->blocks) {
+    InvertedIndex_PublishBlocks(idx, blocks, idx->cap);
+  }
+  idx->numDocs -= MIN(idx->numDocs, removed);
+
+  uint32_t merged = 0;
+  if (compact) {
+    merged = InvertedIndex_MergeBlocks(idx, startBlock, i);
+    i -= merged;
+  }
+  if (stats) {
+    stats->recordsRemoved += removed;
+    stats->blocksRemoved += merged;
+    size_t sizeAfter = InvertedIndex_BlocksSize(idx, startBlock, end - merged);
+    stats->bytesCollected += sizeBefore > sizeAfter ? sizeBefore - sizeAfter : 0;
+  }
+  return rc && i < idx->size ? i : 0;
+}
+
+/* A private copy of a block, which readers never see */
+static IndexBlock IndexBlock_Copy(IndexBlock *blk) {
+  IndexBlock cp = *blk;
+  size_t len = Buffer_Offset(blk->data);
+  cp.data = NewBuffer(MAX(len, 1));
+  memcpy(cp.data->data, blk->data->data, len);
+  cp.data->offset = len;
+  cp.checkpoints = NULL;
+  cp.numCheckpoints = 0;
+  return cp;
+}
+
+int InvertedIndex_PrepareRenumber(InvertedIndex *idx, const DocIdRemap *remap, int num) {
+  int packed = idx->flags & Index_PackedBlocks;
+  IndexRenumbering *r = idx->renumbering;
+  int n = 0;
+  for (; n < num; n++) {
+    uint32_t i = r && r->size ? r->copies[r->size - 1].end : 0;
+    if (i + 1 >= idx->size || idx->blocks[i].lastId > remap->maxOldId) {
+      break;
+    }
+    if (!r) {
+      r = idx->renumbering = rm_calloc(1, sizeof(IndexRenumbering));
+    }
+
+    IndexBlock blk = IndexBlock_Copy(&idx->blocks[i]);
+    if (packed) {
+      IndexBlock_Unpack(&blk, idx->flags);
+    }
+    int rep = IndexBlock_Rewrite(&blk, idx->flags, 1, indexRenumber_Map, (void *)remap);
+    uint32_t removed = MAX(rep, 0);
+
+    // as in InvertedIndex_MergeBlocks, copies left empty are dropped and underfull ones merged.
+    // Only the first copy may be empty, as it holds where the copies end until another one replaces
+    // it
+    IndexBlockCopy *last = r->size ? &r->copies[r->size - 1] : NULL;
+    if (last && last->blk.numDocs && last->blk.numDocs + blk.numDocs <= INDEX_BLOCK_SIZE) {
+      if (blk.numDocs) {
+        if (packed) IndexBlock_Unpack(&last->blk, idx->flags);
+        IndexBlock_Merge(&last->blk, &blk, idx->flags);
+        if (packed) IndexBlock_Pack(&last->blk, idx->flags);
+      } else {
+        indexBlock_Free(&blk);
+      }
+      last->end = i + 1;
+      last->removed += removed;
+      continue;
+    }
+    if (packed && blk.numDocs) {
+      IndexBlock_Pack(&blk, idx->flags);
+    } else if (!blk.checkpoints) {
+      IndexBlock_BuildCheckpoints(&blk, idx->flags);
+    }
+    if (last && !last->blk.numDocs) {
+      indexBlock_Free(&last->blk);
+      *last = (IndexBlockCopy){.blk = blk, .end = i + 1, .removed = last->removed + removed};
+      continue;
+    }
+    if (r->size == r->cap) {
+      r->cap = r->cap ? r->cap * 2 : 4;
+      r->copies = rm_realloc(r->copies, r->cap * sizeof(IndexBlockCopy));
+    }
+    r->copies[r->size++] = (IndexBlockCopy){.blk = blk, .end = i + 1, .removed = removed};
+  }
+  return n;
+}
+
+void InvertedIndex_Renumber(InvertedIndex *idx, const DocIdRemap *remap, IndexRepairStats *stats) {
+  ScoreIndex_Rewrite(&idx->scoreIndex, indexRenumber_Map, (void *)remap);
+  size_t sizeBefore = InvertedIndex_BlocksSize(idx, 0, idx->size);
+
+  // nothing reads an index before it is renumbered, so we free the blocks that were copied, and
+  // rewrite the others in place. Then we drop or merge the ones left empty or underfull
+  size_t removed = 0;
+  uint32_t start = 0;
+  IndexRenumbering *r = idx->renumbering;
+  if (r) {
+    uint32_t end = r->copies[r->size - 1].end;
+    for (uint32_t i = 0; i < end; i++) {
+      indexBlock_Free(&idx->blocks[i]);
+    }
+    memmove(&idx->blocks[r->size], &idx->blocks[end], (idx->size - end) * sizeof(IndexBlock));
+    for (uint32_t i = 0; i < r->size; i++) {
+      idx->blocks[i] = r->copies[i].blk;
+      removed += r->copies[i].removed;
+    }
+    idx->size -= end - r->size;
+    start = r->size;
+    rm_free(r->copies);
+    rm_free(r);
+    idx->renumbering = NULL;
+  }
+  for (uint32_t i = start; i < idx->size; i++) {
+    IndexBlock *blk = &idx->blocks[i];
+    int packed = INDEX_BLOCK_PACKED(idx, i);
+    if (packed) {
+      IndexBlock_Unpack(blk, idx->flags);
+    }
+    int rep = IndexBlock_Rewrite(blk, idx->flags, 1, indexRenumber_Map, (void *)remap);
+    if (packed && blk->numDocs) {
+      IndexBlock_Pack(blk, idx->flags);
+    }
+    removed += MAX(rep, 0);
+  }
+  idx->numDocs -= MIN(idx->numDocs, removed);
+  uint32_t merged = idx->size ? InvertedIndex_MergeBlocks(idx, 0, idx->size) : 0;
+
+  // new records are written after the last one left
+  idx->lastId = 0;
+  for (uint32_t i = idx->size; i-- > 0 && !idx->lastId;) {
+    idx->lastId = idx->blocks[i].lastId;
+  }
+
+  if (stats) {
+    stats->recordsRemoved += removed;
+    stats->blocksRemoved += merged;
+    size_t sizeAfter = InvertedIndex_BlocksSize(idx, 0, idx->size);
+    stats->bytesCollected += sizeBefore > sizeAfter ? sizeBefore - sizeAfter : 0;
+  }
+}
+
+/* Rewrite an unpacked block with the record of docId removed, and rec written in its place if it
+ * is not NULL. Returns 1 if the block held a record of docId */
+static int IndexBlock_Splice(IndexBlock *blk, IndexFlags flags, t_docId docId,
+                             RSIndexResult *rec) {
+  IndexDecoder decoder = InvertedIndex_GetDecoder(flags & INDEX_STORAGE_MASK);
+  IndexEncoder encoder = InvertedIndex_GetEncoder(flags);
+
+  // as in IndexBlock_Rewrite, readers may be in the middle of the block
+  BufferReader br = NewBufferReader(blk->data);
+  Buffer *data = NewBuffer(MAX(Buffer_Offset(blk->data), INDEX_BLOCK_INITIAL_CAP));
+  BufferWriter bw = NewBufferWriter(data);
+
+  RSIndexResult res = {0};
+  t_docId readId = 0, firstId = 0, lastId = 0;
+  uint32_t num = 0;
+  int found = 0, written = rec == NULL;
+  while (!BufferReader_AtEnd(&br)) {
+    const char *bufBegin = BufferReader_Current(&br);
+    decoder(&br, (IndexDecoderCtx){}, &res);
+    size_t sz = BufferReader_Current(&br) - bufBegin;
+    t_docId delta = res.docId;
+    readId = res.docId += readId;
+
+    if (!written && docId <= res.docId) {
+      encoder(&bw, docId - lastId, rec);
+      if (!firstId) firstId = docId;
+      lastId = docId;
+      num++;
+      written = 1;
+    }
+    if (res.docId == docId) {
+      found = 1;
+      continue;
     }
-    if (rep) {
-      // printf("Repaired %d holes in block %d\n", rep, startBlock);
+    if (res.docId - lastId != delta) {
+      encoder(&bw, res.docId - lastId, &res);
+    } else {
+      Buffer_Write(&bw, (void *)bufBegin, sz);
     }
-    n++;
-    startBlock++;
+    if (!firstId) firstId = res.docId;
+    lastId = res.docId;
+    num++;
+  }
+  if (!written) {
+    encoder(&bw, docId - lastId, rec);
+    if (!firstId) firstId = docId;
+    lastId = docId;
+    num++;
+  }
+
+  if (!found && !rec) {
+    indexBlock_FreeBuffer(data);
+    return 0;
+  }
+  Buffer_Truncate(data, 0);
+  IndexBlock_RetireData(blk);
+  blk->data = data;
+  blk->numDocs = num;
+  blk->firstId = firstId;
+  blk->lastId = lastId;
+  if (rec) {
+    blk->maxFreq = MAX(blk->maxFreq, rec->freq);
+  }
+  IndexBlock_BuildCheckpoints(blk, flags);
+  return found;
+}
+
+/* Move the records of an unpacked block from the n-th one on to dst, a new block */
+static void IndexBlock_Split(IndexBlock *blk, IndexFlags flags, uint32_t n, IndexBlock *dst) {
+  IndexDecoder decoder = InvertedIndex_GetDecoder(flags & INDEX_STORAGE_MASK);
+  IndexEncoder encoder = InvertedIndex_GetEncoder(flags);
+
+  size_t len = Buffer_Offset(blk->data);
+  BufferReader br = NewBufferReader(blk->data);
+  RSIndexResult res = {0};
+  t_docId readId = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    decoder(&br, (IndexDecoderCtx){}, &res);
+    readId += res.docId;
   }
+  size_t splitOffset = BufferReader_Offset(&br);
+
+  Buffer *head = NewBuffer(MAX(splitOffset, INDEX_BLOCK_INITIAL_CAP));
+  BufferWriter bw = NewBufferWriter(head);
+  Buffer_Write(&bw, blk->data->data, splitOffset);
+  Buffer_Truncate(head, 0);
+
+  // the first record of the new block holds its docId rather than a delta, the records following
+  // it are copied as they are
+  Buffer *tail =
+      NewBuffer(MAX(len - splitOffset + INDEX_RECORD_MAX_HEADER, INDEX_BLOCK_INITIAL_CAP));
+  bw = NewBufferWriter(tail);
+  decoder(&br, (IndexDecoderCtx){}, &res);
+  res.docId += readId;
+  encoder(&bw, res.docId, &res);
+  Buffer_Write(&bw, BufferReader_Current(&br), len - BufferReader_Offset(&br));
+  Buffer_Truncate(tail, 0);
+
+  *dst = (IndexBlock){.firstId = res.docId,
+                      .lastId = blk->lastId,
+                      .numDocs = blk->numDocs - n,
+                      .maxFreq = blk->maxFreq,
+                      .maxScore = blk->maxScore,
+                      .data = tail};
+  IndexBlock_RetireData(blk);
+  blk->data = head;
+  blk->lastId = readId;
+  blk->numDocs = n;
+  IndexBlock_BuildCheckpoints(blk, flags);
+  IndexBlock_BuildCheckpoints(dst, flags);
+}
 
-  return startBlock < idx->size ? startBlock : 0;
-}
\ No newline at end of file
+/* Remove the record of docId from the index, and write rec in its place if it is not NULL. Returns
+ * 1 if the index held a record of docId */
+static int InvertedIndex_Splice(InvertedIndex *idx, t_docId docId, RSIndexResult *rec) {
+  // records after the last one are appended as usual
+  if (!idx->size || docId > idx->lastId) {
+    if (rec) {
+      InvertedIndex_WriteEntryGeneric(idx, InvertedIndex_GetEncoder(idx->flags), docId, rec);
+    }
+    return 0;
+  }
+
+  // find the last block starting at or before docId. The last block may be empty, and then it
+  // starts nowhere
+  uint32_t lo = 0, hi = idx->size;
+  if (hi > 1 && !INDEX_LAST_BLOCK(idx).numDocs) {
+    hi--;
+  }
+  while (hi - lo > 1) {
+    uint32_t mid = (lo + hi) / 2;
+    if (idx->blocks[mid].firstId <= docId) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  uint32_t i = lo;
+  if (!rec && (docId < idx->blocks[i].firstId || docId > idx->blocks[i].lastId)) {
+    return 0;
+  }
+  InvertedIndex_DropCopies(idx, i);
+
+  // Readers keep reading their snapshot of the blocks array, so while there are any we modify a
+  // copy of it, and publish it when we're done. It may take one more block if we split one
+  uint32_t cap = idx->size < idx->cap ? idx->cap : idx->cap + 1;
+  IndexBlock *blocks = idx->blocks;
+  if (Epoch_Active() || cap != idx->cap) {
+    blocks = InvertedIndex_CopyBlocks(idx, cap);
+  }
+  uint32_t size = idx->size;
+
+  IndexBlock *blk = &blocks[i];
+  int packed = INDEX_BLOCK_PACKED(idx, i);
+  if (packed) {
+    IndexBlock_Unpack(blk, idx->flags);
+  }
+  int found = IndexBlock_Splice(blk, idx->flags, docId, rec);
+
+  if (!blk->numDocs && i + 1 < size) {
+    // only the last block may be empty
+    IndexBlock_RetireData(blk);
+    memmove(&blocks[i], &blocks[i + 1], (size - i - 1) * sizeof(IndexBlock));
+    size--;
+  } else if (blk->numDocs > INDEX_BLOCK_SIZE) {
+    memmove(&blocks[i + 2], &blocks[i + 1], (size - i - 1) * sizeof(IndexBlock));
+    IndexBlock_Split(blk, idx->flags, blk->numDocs / 2, &blocks[i + 1]);
+    size++;
+    if (idx->flags & Index_PackedBlocks) {
+      IndexBlock_Pack(blk, idx->flags);
+      if (i + 2 < size) {
+        IndexBlock_Pack(&blocks[i + 1], idx->flags);
+      }
+    }
+  } else if (packed) {
+    IndexBlock_Pack(blk, idx->flags);
+  }
+
+  if (blocks != idx->blocks) {
+    InvertedIndex_PublishBlocks(idx, blocks, cap);
+  }
+  __atomic_store_n(&idx->size, size, __ATOMIC_RELEASE);
+  idx->numDocs += (rec ? 1 : 0) - found;
+  return found;
+}
+
+static t_docId deleteEntry_Map(void *ctx, t_docId docId) {
+  return docId == *(t_docId *)ctx ? 0 : docId;
+}
+
+int InvertedIndex_DeleteEntry(InvertedIndex *idx, t_docId docId) {
+  if (idx->scoreIndex.size) {
+    ScoreIndex_Rewrite(&idx->scoreIndex, deleteEntry_Map, &docId);
+  }
+  return InvertedIndex_Splice(idx, docId, NULL);
+}
+
+int InvertedIndex_PutNumericEntry(InvertedIndex *idx, t_docId docId, float value) {
+  RSIndexResult rec = (RSIndexResult){
+      .docId = docId, .type = RSResultType_Numeric, .num = (RSNumericRecord){.value = value},
+  };
+  return InvertedIndex_Splice(idx, docId, &rec);
+}
@@ -11,21 +11,90 @@
 #include "numeric_filter.h"
 #include <stdint.h>
 
+/* A checkpoint inside an index block, taken every INDEX_BLOCK_SKIP_INTERVAL records. It allows
+ * readers skipping inside a block to jump straight to a record instead of decoding the block from
+ * its start */
+typedef struct {
+  // the docId of the record preceding the checkpoint, i.e. the delta base for decoding from it
+  t_docId lastId;
+  // the offset of the checkpoint record in the block's buffer
+  uint32_t offset;
+} IndexBlockCheckpoint;
+
 /* A single block of data in the index. The index is basically a list of blocks we iterate */
 typedef struct {
   t_docId firstId;
   t_docId lastId;
   uint16_t numDocs;
+  uint16_t numCheckpoints;
+  // The maximal frequency and document score of the block's records. Used as upper bounds of the
+  // block's scores when pruning top-k queries
+  uint32_t maxFreq;
+  float maxScore;
 
   Buffer *data;
+  // The block's skip table. NULL for blocks with less than INDEX_BLOCK_SKIP_INTERVAL records
+  IndexBlockCheckpoint *checkpoints;
 } IndexBlock;
 
+/* The maximal number of records kept in a term's score index */
+#define MAX_SCOREINDEX_SIZE 100
+
+typedef struct {
+  t_docId docId;
+  uint32_t freq;
+  // freq * docScore / the document's max freq, i.e. the record's TF-IDF score without the idf
+  float impact;
+} ScoreIndexEntry;
+
+/* A score index keeps the top records of a term by impact, so single term queries can be answered
+ * without scanning the entire index. The entries are a min-heap by impact, maintained as records
+ * are written. Only kept for indexes with Index_StoreScoreIndexes */
+typedef struct {
+  ScoreIndexEntry *entries;
+  uint32_t size;
+  uint32_t cap;
+  // the highest impact of a record that is not in the score index, or -1 if it holds all of them
+  float floor;
+} ScoreIndex;
+
+/* Score indexes are only kept along with frequencies, since their order depends on them */
+#define INDEX_HAS_SCOREINDEX(idx)                                               \
+  (((idx)->flags & (Index_StoreScoreIndexes | Index_StoreFreqs)) == \
+   (Index_StoreScoreIndexes | Index_StoreFreqs))
+
+/* A renumbered copy of blocks of an index. Copies left underfull are merged, so a copy may replace
+ * several blocks of the index */
+typedef struct {
+  IndexBlock blk;
+  // the number of blocks of the index that this copy and the ones before it replace
+  uint32_t end;
+  // the records of deleted documents that were left out of the copy
+  uint32_t removed;
+} IndexBlockCopy;
+
+/* The renumbered copies of the first blocks of an index, built ahead of the switch to a compacted
+ * DocTable, see InvertedIndex_PrepareRenumber */
+typedef struct {
+  IndexBlockCopy *copies;
+  uint32_t size;
+  uint32_t cap;
+} IndexRenumbering;
+
 typedef struct {
   IndexBlock *blocks;
   uint32_t size;
+  // the allocated length of blocks
+  uint32_t cap;
   IndexFlags flags;
   t_docId lastId;
   uint32_t numDocs;
+  ScoreIndex scoreIndex;
+  // the docIdGen of the docIds in the index, see DocTable. Only kept for term indexes, numeric
+  // indexes keep it for their entire tree
+  uint32_t docIdGen;
+  // the renumbered copies of its blocks while the DocTable is being compacted, or NULL
+  IndexRenumbering *renumbering;
 } InvertedIndex;
 
 struct indexReadCtx;
@@ -44,7 +113,40 @@ typedef union {
  * block */
 InvertedIndex *NewInvertedIndex(IndexFlags flags, int initBlock);
 void InvertedIndex_Free(void *idx);
-int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num);
+
+/* What InvertedIndex_Repair removed from an index */
+typedef struct {
+  // records of deleted documents
+  size_t recordsRemoved;
+  // the memory of the blocks' data that was freed
+  size_t bytesCollected;
+  // blocks that were left empty or merged into a neighbour
+  size_t blocksRemoved;
+} IndexRepairStats;
+
+/* Remove the records of deleted documents from num blocks of the index from startBlock on, or from
+ * all of them if num is 0. When no reader is active, blocks that are left empty are dropped and
+ * neighbouring blocks that fit in one are merged. What was removed is added to stats if it is not
+ * NULL. Returns the block to continue from, or 0 if we reached the end of the index */
+int InvertedIndex_Repair(InvertedIndex *idx, DocTable *dt, uint32_t startBlock, int num,
+                         IndexRepairStats *stats);
+
+/* Build renumbered copies of up to num more blocks of the index, while its DocTable is being
+ * compacted, see DocTable_StartCompaction. remap is the one of the compaction in progress, and
+ * blocks holding documents it did not get to yet are not copied, nor is the last block, which is
+ * still written to. The index is used as usual meanwhile, and modifying a block drops its copy.
+ * Returns the number of blocks copied, which is less than num once we copied all we could */
+int InvertedIndex_PrepareRenumber(InvertedIndex *idx, const DocIdRemap *remap, int num);
+
+/* Renumber the records of the index after its DocTable was compacted, removing those of deleted
+ * documents. The blocks copied by InvertedIndex_PrepareRenumber are replaced by their copies, and
+ * the rest are rewritten in place. This must be done before any reader or writer uses the index.
+ * The records removed are added to stats if it is not NULL */
+void InvertedIndex_Renumber(InvertedIndex *idx, const DocIdRemap *remap, IndexRepairStats *stats);
+
+/* Remove the record of a document from the index, e.g. when it is updated in place. Returns 1 if
+ * the index held a record of the document */
+int InvertedIndex_DeleteEntry(InvertedIndex *idx, t_docId docId);
 
 /**
  * Decode a single record from the buffer reader. This function is responsible for:
@@ -62,6 +164,19 @@ typedef int (*IndexDecoder)(BufferReader *br, IndexDecoderCtx ctx, RSIndexResult
  * endoder/decoder when reading and writing */
 IndexDecoder InvertedIndex_GetDecoder(uint32_t flags);
 
+/**
+ * Read only the docId delta of a single record, advancing the buffer reader past the rest of the
+ * record without decoding it. This is the fast path used to step over records while skipping.
+ */
+typedef t_docId (*IndexDeltaReader)(BufferReader *br);
+
+/* Get the delta reader matching the index flags, or NULL if there is none */
+IndexDeltaReader InvertedIndex_GetDeltaReader(uint32_t flags);
+
+/* (Re)build the skip table of a block by scanning its records. Used when the block's data was not
+ * written record by record, e.g. after loading from RDB or repairing it */
+void IndexBlock_BuildCheckpoints(IndexBlock *blk, IndexFlags flags);
+
 /* An IndexReader wraps an inverted index record for reading and iteration */
 typedef struct indexReadCtx {
   // the underlying data buffer
@@ -72,14 +187,35 @@ typedef struct indexReadCtx {
   t_docId lastId;
   uint32_t currentBlock;
 
+  /* A snapshot of the index taken when the reader was created, so it can be read without the GIL
+   * while writers append to it. The blocks before the last one never change under a reader, as
+   * writers that move them publish a new blocks array, and the last block and its buffer are
+   * copied, so records written after the snapshot are not seen */
+  uint32_t numBlocks;
+  IndexBlock *blocks;
+  IndexBlock lastBlock;
+  Buffer lastBuffer;
+
+  /* Records from this docId on are not read. Only set for clones restricted to a docId range */
+  t_docId maxId;
+
   /* The decoder's filtering context. It may be a number or a pointer. The number is used for
    * filtering field masks, the pointer for numeric filtering */
   IndexDecoderCtx decoderCtx;
   /* The decoding function for reading the index */
   IndexDecoder decoder;
+  /* The docId-only reader used to step over records when skipping. If NULL we skip by decoding
+   * every record */
+  IndexDeltaReader deltaReader;
+
+  /* If set, sequential reads decode whole blocks into a batch of column arrays and iterate them */
+  int batchMode;
+  struct indexDecodeBatch *batch;
 
   /* The number of records read */
   size_t len;
+  /* The number of blocks the reader moved to, for profiling */
+  size_t blocksRead;
 
   /* The record we are decoding into */
   RSIndexResult *record;
@@ -102,6 +238,11 @@ size_t InvertedIndex_WriteForwardIndexEntry(InvertedIndex *idx, IndexEncoder enc
  * number of bytes written */
 size_t InvertedIndex_WriteNumericEntry(InvertedIndex *idx, t_docId docId, float value);
 
+/* Write a numeric entry in its place in the index, replacing the document's record if the index
+ * already holds one. Unlike InvertedIndex_WriteNumericEntry, the docId may be lower than the last
+ * one written. Returns 1 if a record of the document was replaced */
+int InvertedIndex_PutNumericEntry(InvertedIndex *idx, t_docId docId, float value);
+
 /* Create a new index reader for numeric records, optionally using a given filter. If the filter is
  * NULL we will return all the records in the index */
 IndexReader *NewNumericReader(InvertedIndex *idx, NumericFilter *flt);
@@ -118,6 +259,11 @@ IndexEncoder InvertedIndex_GetEncoder(IndexFlags flags);
 IndexReader *NewTermIndexReader(InvertedIndex *idx, DocTable *docTable, t_fieldMask fieldMask,
                                 RSQueryTerm *term);
 
+/* Create an iterator over the score index of a term reader's index, if its top num live records by
+ * TF-IDF score are all in it. The iterator takes ownership of the reader. Returns NULL if the score
+ * index cannot answer the query, in which case the reader should be scanned instead */
+IndexIterator *NewScoreIndexIterator(IndexReader *ir, DocTable *dt, size_t num);
+
 /* free an index reader */
 void IR_Free(IndexReader *ir);
 
@@ -143,6 +289,14 @@ RSIndexResult *IR_Current(void *ctx);
 /* The number of docs in an inverted index entry */
 size_t IR_NumDocs(void *ctx);
 
+/* The number of records in the underlying index */
+size_t IR_NumEstimated(void *ctx);
+
+/* Return an upper bound of the TF-IDF score contribution of the reader's records from docId on. If
+ * until is not NULL, only the block holding docId is considered, and until is set to its last
+ * docId */
+double IR_MaxScore(void *ctx, t_docId docId, t_docId *until);
+
 /* LastDocId of an inverted index stateful reader */
 t_docId IR_LastDocId(void *ctx);
 
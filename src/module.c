@@ -28,50 +28,172 @@
 #include "ext/default.h"
 #include "search_request.h"
 #include "rmalloc.h"
+#include "decode_cache.h"
+#include "dep/triemap/triemap.h"
+#include "concurrent_ctx.h"
+#include "gc.h"
+
+/* Open the inverted index of a term for writing, adding the term to the index's terms trie.
+ * numDocs is the number of new documents the term appears in */
+static InvertedIndex *openTermIndex(RedisSearchCtx *ctx, const char *term, size_t len,
+                                    size_t numDocs) {
+  int isNew = IndexSpec_AddTermDocs(ctx->spec, term, len, numDocs);
+  if (isNew) {
+    ctx->spec->stats.numTerms += 1;
+    ctx->spec->stats.termsSize += len;
+  }
+  return Redis_OpenInvertedIndex(ctx, term, len, 1);
+}
 
-/* Add a parsed document to the index. If replace is set, we will add it be deleting an older
- * version of it first */
-int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int nosave,
-                int replace) {
+/* Write a forward index entry to its term's inverted index and update the stats of the index */
+static void writeIndexEntry(RedisSearchCtx *ctx, InvertedIndex *invidx, IndexEncoder enc,
+                            ForwardIndexEntry *entry) {
+  size_t sz = InvertedIndex_WriteForwardIndexEntry(invidx, enc, entry);
+
+  /* record the actual size consumption change */
+  ctx->spec->stats.invertedSize += sz;
+  ctx->spec->stats.numRecords++;
+
+  /* Record the space saved for offset vectors */
+  if (ctx->spec->flags & Index_StoreTermOffsets) {
+    ctx->spec->stats.offsetVecsSize += entry->vw->bw.buf->offset;
+    ctx->spec->stats.offsetVecRecords += entry->vw->nmemb;
+  }
+}
+
+/* How the fields of a document are tokenized, resolved from the spec with the GIL held. It holds
+ * no pointer into the spec, so the document can be tokenized without the GIL even if the index is
+ * dropped meanwhile */
+typedef struct {
+  // the weight and id of each field of the document, and whether it is a full text field at all
+  struct {
+    int fulltext;
+    double weight;
+    t_fieldMask id;
+  } * fields;
+  int numFields;
+  // a reference to the stopwords of the index
+  StopWordList *stopwords;
+  // whether non ASCII characters are case folded, see Index_FoldUnicode
+  int foldUnicode;
+} tokenizeSettings;
+
+static void tokenizeSettings_Init(tokenizeSettings *ts, IndexSpec *sp, Document *doc) {
+  ts->numFields = doc->numFields;
+  ts->fields = rm_calloc(doc->numFields, sizeof(*ts->fields));
+  for (int i = 0; i < doc->numFields; i++) {
+    const char *f = doc->fields[i].name;
+    FieldSpec *fs = IndexSpec_GetField(sp, f, strlen(f));
+    if (fs && fs->type == F_FULLTEXT) {
+      ts->fields[i].fulltext = 1;
+      ts->fields[i].weight = fs->weight;
+      ts->fields[i].id = fs->id;
+    }
+  }
+  ts->stopwords = StopWordList_Ref(sp->stopwords);
+  ts->foldUnicode = !!(sp->flags & Index_FoldUnicode);
+}
+
+/* Returns 1 if a document is tokenized the same way with both settings */
+static int tokenizeSettings_Equal(tokenizeSettings *a, tokenizeSettings *b) {
+  if (a->numFields != b->numFields || a->stopwords != b->stopwords ||
+      a->foldUnicode != b->foldUnicode) {
+    return 0;
+  }
+  for (int i = 0; i < a->numFields; i++) {
+    if (a->fields[i].fulltext != b->fields[i].fulltext ||
+        (a->fields[i].fulltext &&
+         (a->fields[i].weight != b->fields[i].weight || a->fields[i].id != b->fields[i].id))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void tokenizeSettings_Free(tokenizeSettings *ts) {
+  rm_free(ts->fields);
+  StopWordList_Free(ts->stopwords);
+}
+
+/* Tokenize the full text fields of a document into a new forward index. This needs no redis state,
+ * so it can run without the GIL. The field strings are only read, the forward index keeps its own
+ * copies of the terms */
+static ForwardIndex *tokenizeDocument(tokenizeSettings *ts, Document *doc) {
+  ForwardIndex *idx = NewForwardIndex(*doc);
+  int totalTokens = 0;
+
+  for (int i = 0; i < doc->numFields; i++) {
+    if (!ts->fields[i].fulltext) {
+      continue;
+    }
+
+    const char *c = RedisModule_StringPtrLen(doc->fields[i].text, NULL);
+    totalTokens = tokenize(c, ts->fields[i].weight, ts->fields[i].id, idx, forwardIndexTokenFunc,
+                           idx->stemmer, totalTokens, ts->stopwords, ts->foldUnicode);
+  }
+  return idx;
+}
+
+#define GEO_LON_MAXLEN 64
+#define GEO_FORMAT_ERROR "Invalid lon/lat format. Use \"lon lat\" or \"lon,lat\""
+
+/* Split the "lon lat" or "lon,lat" value of a geo field. The value is shared with the saved
+ * document, so the lon part is copied out to slon. Returns the lat part, or NULL if the value is
+ * malformed */
+static const char *splitGeoValue(const char *c, char slon[GEO_LON_MAXLEN]) {
+  const char *pos = strpbrk(c, " ,");
+  if (!pos || pos - c >= GEO_LON_MAXLEN) {
+    return NULL;
+  }
+  memcpy(slon, c, pos - c);
+  slon[pos - c] = '\0';
+  return pos + 1;
+}
+
+/* Put a document in the document table and index all of its fields, except for its terms which
+ * are collected in a forward index, to be written to their inverted indexes by the caller.
+ *
+ * If *fwIdx is set, it holds the document's terms, already tokenized by tokenizeDocument. Otherwise
+ * we tokenize the document once everything else is indexed, and set *fwIdx. Either way the caller
+ * frees the forward index. If replace is set, we will add it be deleting an older version of it
+ * first */
+static int indexDocumentFields(RedisSearchCtx *ctx, Document *doc, const char **errorString,
+                               int nosave, int replace, ForwardIndex **fwIdx) {
+
+  // cached query results do not apply to the index once we touch its documents
+  ctx->spec->revisionId++;
 
   // if we're in replace mode, first we need to try and delete the older version of the document
   if (replace) {
-    DocTable_Delete(&ctx->spec->docs, RedisModule_StringPtrLen(doc.docKey, NULL));
+    DocTable_Delete(&ctx->spec->docs, RedisModule_StringPtrLen(doc->docKey, NULL));
   }
 
-  doc.docId = DocTable_Put(&ctx->spec->docs, RedisModule_StringPtrLen(doc.docKey, NULL), doc.score,
-                           0, doc.payload, doc.payloadSize);
+  doc->docId = DocTable_Put(&ctx->spec->docs, RedisModule_StringPtrLen(doc->docKey, NULL),
+                            doc->score, 0, doc->payload, doc->payloadSize);
 
   // Make sure the document is not already in the index - it needs to be
   // incremental!
-  if (doc.docId == 0) {
+  if (doc->docId == 0) {
     *errorString = "Document already in index";
     return REDISMODULE_ERR;
   }
 
   // first save the document as hash
-  if (nosave == 0 && Redis_SaveDocument(ctx, &doc) != REDISMODULE_OK) {
+  if (nosave == 0 && Redis_SaveDocument(ctx, doc) != REDISMODULE_OK) {
     *errorString = "Could not save document data";
     return REDISMODULE_ERR;
   }
 
-  ForwardIndex *idx = NewForwardIndex(doc);
   RSSortingVector *sv = NULL;
   if (ctx->spec->sortables) {
     sv = NewSortingVector(ctx->spec->sortables->len);
   }
 
-  int totalTokens = 0;
-
-  for (int i = 0; i < doc.numFields; i++) {
-    // printf("Tokenizing %s: %s\n",
-    // RedisModule_StringPtrLen(doc.fields[i].name, NULL),
-    //        RedisModule_StringPtrLen(doc.fields[i].text, NULL));
-
+  for (int i = 0; i < doc->numFields; i++) {
     size_t len;
-    const char *f = doc.fields[i].name;
+    const char *f = doc->fields[i].name;
     len = strlen(f);
-    const char *c = RedisModule_StringPtrLen(doc.fields[i].text, NULL);
+    const char *c = RedisModule_StringPtrLen(doc->fields[i].text, NULL);
 
     FieldSpec *fs = IndexSpec_GetField(ctx->spec, f, len);
     if (fs == NULL) {
@@ -81,23 +203,21 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
 
     switch (fs->type) {
       case F_FULLTEXT:
+        // the text is tokenized separately, see tokenizeDocument
         if (sv && fs->sortable) {
           RSSortingVector_Put(sv, fs->sortIdx, (void *)c, RS_SORTABLE_STR);
         }
-
-        totalTokens = tokenize(c, fs->weight, fs->id, idx, forwardIndexTokenFunc, idx->stemmer,
-                               totalTokens, ctx->spec->stopwords);
         break;
       case F_NUMERIC: {
         double score;
 
-        if (RedisModule_StringToDouble(doc.fields[i].text, &score) == REDISMODULE_ERR) {
+        if (RedisModule_StringToDouble(doc->fields[i].text, &score) == REDISMODULE_ERR) {
           *errorString = "Could not parse numeric index value";
           goto error;
         }
 
         NumericRangeTree *rt = OpenNumericIndex(ctx, fs->name);
-        NumericRangeTree_Add(rt, doc.docId, score);
+        NumericRangeTree_Add(rt, doc->docId, score);
 
         // If this is a sortable numeric value - copy the value to the sorting vector
         if (sv && fs->sortable) {
@@ -106,18 +226,15 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
         break;
       }
       case F_GEO: {
-
-        char *pos = strpbrk(c, " ,");
-        if (!pos) {
-          *errorString = "Invalid lon/lat format. Use \"lon lat\" or \"lon,lat\"";
+        char slon[GEO_LON_MAXLEN];
+        const char *slat = splitGeoValue(c, slon);
+        if (!slat) {
+          *errorString = GEO_FORMAT_ERROR;
           goto error;
         }
-        *pos = '\0';
-        pos++;
-        char *slon = (char *)c, *slat = (char *)pos;
 
         GeoIndex gi = {.ctx = ctx, .sp = fs};
-        if (GeoIndex_AddStrings(&gi, doc.docId, slon, slat) == REDISMODULE_ERR) {
+        if (GeoIndex_AddStrings(&gi, doc->docId, slon, slat) == REDISMODULE_ERR) {
           *errorString = "Could not index geo value";
           goto error;
         }
@@ -130,70 +247,446 @@ int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int
     }
   }
 
-  RSDocumentMetadata *md = DocTable_Get(&ctx->spec->docs, doc.docId);
-  md->maxFreq = idx->maxFreq;
+  if (*fwIdx) {
+    ForwardIndex_SetDocId(*fwIdx, doc->docId);
+  } else {
+    tokenizeSettings ts;
+    tokenizeSettings_Init(&ts, ctx->spec, doc);
+    *fwIdx = tokenizeDocument(&ts, doc);
+    tokenizeSettings_Free(&ts);
+  }
+
+  RSDocumentMetadata *md = DocTable_Get(&ctx->spec->docs, doc->docId);
+  md->maxFreq = (*fwIdx)->maxFreq;
+  if (sv) {
+    DocTable_SetSortingVector(&ctx->spec->docs, doc->docId, sv);
+  }
+  ctx->spec->stats.numDocuments += 1;
+  return REDISMODULE_OK;
+
+error:
   if (sv) {
-    DocTable_SetSortingVector(&ctx->spec->docs, doc.docId, sv);
+    SortingVector_Free(sv);
   }
+  return REDISMODULE_ERR;
+}
 
-  // printf("totaltokens :%d\n", totalTokens);
-  if (totalTokens > 0) {
-    ForwardIndexIterator it = ForwardIndex_Iterate(idx);
+/* Write the terms of a document to their inverted indexes */
+static void writeForwardIndex(RedisSearchCtx *ctx, IndexEncoder enc, ForwardIndex *idx) {
+  ForwardIndexIterator it = ForwardIndex_Iterate(idx);
+  ForwardIndexEntry *entry;
+  while ((entry = ForwardIndexIterator_Next(&it)) != NULL) {
+    InvertedIndex *invidx = openTermIndex(ctx, entry->term, entry->len, 1);
+    if (invidx) {
+      writeIndexEntry(ctx, invidx, enc, entry);
+    }
+  }
+}
+
+/* Add a document to the index. If fwIdx is not NULL, it is the document's forward index, tokenized
+ * ahead of time by tokenizeDocument */
+static int addDocument(RedisSearchCtx *ctx, Document *doc, const char **errorString, int nosave,
+                       int replace, ForwardIndex *fwIdx) {
+  IndexEncoder enc = InvertedIndex_GetEncoder(ctx->spec->flags);
+  if (enc == NULL) {
+    *errorString = "Error encoding index";
+    return REDISMODULE_ERR;
+  }
+
+  ForwardIndex *idx = fwIdx;
+  int rc = indexDocumentFields(ctx, doc, errorString, nosave, replace, &idx);
+  if (rc == REDISMODULE_OK) {
+    writeForwardIndex(ctx, enc, idx);
+  }
+  if (idx && idx != fwIdx) {
+    ForwardIndexFree(idx);
+  }
+  return rc;
+}
+
+/* Add a parsed document to the index. If replace is set, we will add it be deleting an older
+ * version of it first */
+int AddDocument(RedisSearchCtx *ctx, Document doc, const char **errorString, int nosave,
+                int replace) {
+  return addDocument(ctx, &doc, errorString, nosave, replace, NULL);
+}
+
+/* Find a field of a document by name, or return NULL if it does not have it */
+static DocumentField *findDocumentField(Document *doc, const char *name) {
+  for (int i = 0; i < doc->numFields; i++) {
+    if (!strcmp(doc->fields[i].name, name)) {
+      return &doc->fields[i];
+    }
+  }
+  return NULL;
+}
 
-    ForwardIndexEntry *entry = ForwardIndexIterator_Next(&it);
+/* Build the sorting vector of a document from its sortable fields */
+static RSSortingVector *buildSortingVector(IndexSpec *sp, Document *doc) {
+  RSSortingVector *sv = NewSortingVector(sp->sortables->len);
+  for (int i = 0; i < doc->numFields; i++) {
+    const char *f = doc->fields[i].name;
+    FieldSpec *fs = IndexSpec_GetField(sp, f, strlen(f));
+    if (fs == NULL || !fs->sortable) {
+      continue;
+    }
+    double num;
+    if (fs->type == F_FULLTEXT) {
+      RSSortingVector_Put(sv, fs->sortIdx,
+                          (void *)RedisModule_StringPtrLen(doc->fields[i].text, NULL),
+                          RS_SORTABLE_STR);
+    } else if (fs->type == F_NUMERIC &&
+               RedisModule_StringToDouble(doc->fields[i].text, &num) == REDISMODULE_OK) {
+      RSSortingVector_Put(sv, fs->sortIdx, &num, RS_SORTABLE_NUM);
+    }
+  }
+  return sv;
+}
 
-    IndexEncoder enc = InvertedIndex_GetEncoder(ctx->spec->flags);
-    if (enc == NULL) {
-      *errorString = "Error encoding index";
-      goto error;
+/* Update the numeric and geo fields of a document in place, keeping its docId. old holds the
+ * fields the document was indexed with. The values of the document's fields were validated by the
+ * caller */
+static void updateDocumentFields(RedisSearchCtx *ctx, Document *doc, Document *old,
+                                 t_docId docId) {
+  for (int i = 0; i < doc->numFields; i++) {
+    const char *f = doc->fields[i].name;
+    FieldSpec *fs = IndexSpec_GetField(ctx->spec, f, strlen(f));
+    DocumentField *of = findDocumentField(old, f);
+    if (fs == NULL || (of && !RedisModule_StringCompare(of->text, doc->fields[i].text))) {
+      continue;
     }
-    while (entry != NULL) {
-      // ForwardIndex_NormalizeFreq(idx, entry);
-      int isNew = IndexSpec_AddTerm(ctx->spec, entry->term, entry->len);
-      InvertedIndex *invidx = Redis_OpenInvertedIndex(ctx, entry->term, entry->len, 1);
-      if (isNew) {
-        ctx->spec->stats.numTerms += 1;
-        ctx->spec->stats.termsSize += entry->len;
+
+    if (fs->type == F_NUMERIC) {
+      double value, oldValue;
+      RedisModule_StringToDouble(doc->fields[i].text, &value);
+      if (!of || RedisModule_StringToDouble(of->text, &oldValue) == REDISMODULE_ERR) {
+        oldValue = value;
       }
-      size_t sz = InvertedIndex_WriteForwardIndexEntry(invidx, enc, entry);
-
-      /*******************************************
-      * update stats for the index
-      ********************************************/
-
-      /* record the change in capacity of the buffer */
-      // ctx->spec->stats.invertedCap += w->bw.buf->cap - cap;
-      // ctx->spec->stats.skipIndexesSize += w->skipIndexWriter.buf->cap - skcap;
-      // ctx->spec->stats.scoreIndexesSize += w->scoreWriter.bw.buf->cap - sccap;
-      /* record the actual size consumption change */
-      ctx->spec->stats.invertedSize += sz;
-
-      ctx->spec->stats.numRecords++;
-      /* increment the number of terms if this is a new term*/
-
-      /* Record the space saved for offset vectors */
-      if (ctx->spec->flags & Index_StoreTermOffsets) {
-        ctx->spec->stats.offsetVecsSize += entry->vw->bw.buf->offset;
-        ctx->spec->stats.offsetVecRecords += entry->vw->nmemb;
+      NumericRangeTree *rt = OpenNumericIndex(ctx, fs->name);
+      NumericRangeTree_Delete(rt, docId, oldValue);
+      NumericRangeTree_Add(rt, docId, value);
+    } else if (fs->type == F_GEO) {
+      // the set member of the document is moved to its new position
+      char slon[GEO_LON_MAXLEN];
+      const char *slat = splitGeoValue(RedisModule_StringPtrLen(doc->fields[i].text, NULL), slon);
+      GeoIndex gi = {.ctx = ctx, .sp = fs};
+      GeoIndex_AddStrings(&gi, docId, slon, slat);
+    }
+  }
+}
+
+/* Update some of the fields of a saved document, as FT.ADD does with REPLACE PARTIAL. The fields
+ * of the document replace those of the saved document, and its other fields are kept.
+ *
+ * If neither the values of the document's full text fields nor its score changed, the document
+ * keeps its docId: its payload and sorting vector are replaced in its metadata, and only the
+ * numeric and geo indexes of the fields that changed are updated. Otherwise the document with the
+ * merged fields is deleted and indexed again, as with REPLACE. The score is part of the impacts of
+ * the score indexes and of the block max scores of the document's terms, which can't be updated in
+ * place. Documents that are not in the index or were not saved are added as they are */
+static int updateDocument(RedisSearchCtx *ctx, Document *doc, const char **errorString) {
+  IndexSpec *sp = ctx->spec;
+  t_docId docId = DocTable_GetId(&sp->docs, RedisModule_StringPtrLen(doc->docKey, NULL));
+  Document old = {.fields = NULL, .numFields = 0};
+  if (!docId || Redis_LoadDocument(ctx, doc->docKey, &old) == REDISMODULE_ERR) {
+    return AddDocument(ctx, *doc, errorString, 0, 1);
+  }
+
+  // the saved fields, with the new values of the fields we got
+  Document merged = *doc;
+  merged.fields = calloc(old.numFields + doc->numFields, sizeof(DocumentField));
+  merged.numFields = old.numFields;
+  memcpy(merged.fields, old.fields, old.numFields * sizeof(DocumentField));
+
+  int reindex = 0, rc = REDISMODULE_OK;
+  for (int i = 0; i < doc->numFields; i++) {
+    const char *f = doc->fields[i].name;
+    DocumentField *mf = findDocumentField(&merged, f);
+    FieldSpec *fs = IndexSpec_GetField(sp, f, strlen(f));
+    if (fs && fs->type == F_FULLTEXT &&
+        (!mf || RedisModule_StringCompare(mf->text, doc->fields[i].text))) {
+      reindex = 1;
+    }
+    double num;
+    char slon[GEO_LON_MAXLEN];
+    const char *c = RedisModule_StringPtrLen(doc->fields[i].text, NULL);
+    if (fs && fs->type == F_NUMERIC &&
+        RedisModule_StringToDouble(doc->fields[i].text, &num) == REDISMODULE_ERR) {
+      *errorString = "Could not parse numeric index value";
+      rc = REDISMODULE_ERR;
+      goto done;
+    }
+    if (fs && fs->type == F_GEO && !splitGeoValue(c, slon)) {
+      *errorString = GEO_FORMAT_ERROR;
+      rc = REDISMODULE_ERR;
+      goto done;
+    }
+    if (mf) {
+      mf->text = doc->fields[i].text;
+    } else {
+      merged.fields[merged.numFields++] = doc->fields[i];
+    }
+  }
+
+  RSDocumentMetadata *md = DocTable_Get(&sp->docs, docId);
+  if (reindex || md->score != doc->score) {
+    // the payload is kept unless we got a new one. Deleting the document releases it
+    char *payload = NULL;
+    if (!doc->payload && md->payload) {
+      payload = rm_malloc(md->payload->len + 1);
+      memcpy(payload, md->payload->data, md->payload->len);
+      merged.payload = payload;
+      merged.payloadSize = md->payload->len;
+    }
+    rc = AddDocument(ctx, merged, errorString, 0, 1);
+    rm_free(payload);
+    goto done;
+  }
+
+  if (Redis_SaveDocument(ctx, doc) != REDISMODULE_OK) {
+    *errorString = "Could not save document data";
+    rc = REDISMODULE_ERR;
+    goto done;
+  }
+  // cached query results do not apply to the index once we touch its documents
+  sp->revisionId++;
+  updateDocumentFields(ctx, doc, &old, docId);
+  if (doc->payload) {
+    DocTable_SetPayload(&sp->docs, docId, doc->payload, doc->payloadSize);
+  }
+  if (sp->sortables) {
+    DocTable_SetSortingVector(&sp->docs, docId, buildSortingVector(sp, &merged));
+  }
+
+done:
+  free(merged.fields);
+  free(old.fields);
+  return rc;
+}
+
+/* Documents added by FT.ADD with ASYNC are tokenized in the background if they have at least this
+ * many bytes of text, see addDocumentAsync. Smaller documents are cheaper to index right away than
+ * to hand off to another thread. It can be changed with the ASYNC_INDEX_MIN_SIZE module argument */
+#define ASYNC_INDEX_DEFAULT_MIN_SIZE 1024
+
+static size_t asyncIndexMinSize = ASYNC_INDEX_DEFAULT_MIN_SIZE;
+
+/* A document added by FT.ADD that is being tokenized in the background */
+typedef struct {
+  RedisModuleBlockedClient *bc;
+  char *indexName;
+  // how the document is tokenized, as the index was when the document was added
+  tokenizeSettings ts;
+  Document doc;
+  // the arguments of the command, retained until the document is indexed
+  RedisModuleString **argv;
+  int argc;
+  ForwardIndex *fwIdx;
+  int nosave;
+  int replace;
+} asyncIndexJob;
+
+static void asyncIndexJob_Free(RedisModuleCtx *ctx, asyncIndexJob *job) {
+  for (int i = 0; i < job->argc; i++) {
+    RedisModule_FreeString(ctx, job->argv[i]);
+  }
+  if (job->fwIdx) {
+    ForwardIndexFree(job->fwIdx);
+  }
+  tokenizeSettings_Free(&job->ts);
+  free(job->doc.fields);
+  rm_free(job->argv);
+  rm_free(job->indexName);
+  rm_free(job);
+}
+
+/* The second half of addDocumentAsync, running on the search scheduler with the GIL held: put the
+ * tokenized document in the index and reply to the client */
+static void asyncIndex_Write(void *p) {
+  asyncIndexJob *job = p;
+  RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(job->bc);
+  RedisModule_AutoMemory(ctx);
+
+  // the index might have been dropped, or even recreated with other fields, while we tokenized
+  IndexSpec *sp = IndexSpec_Load(ctx, job->indexName, 1);
+  if (sp == NULL) {
+    RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  } else {
+    // if the document would now be tokenized differently, we tokenize it again here
+    tokenizeSettings ts;
+    tokenizeSettings_Init(&ts, sp, &job->doc);
+    if (!tokenizeSettings_Equal(&ts, &job->ts)) {
+      ForwardIndexFree(job->fwIdx);
+      job->fwIdx = NULL;
+    }
+    tokenizeSettings_Free(&ts);
+
+    RedisSearchCtx sctx = SEARCH_CTX_STATIC(ctx, sp);
+    const char *msg = NULL;
+    if (addDocument(&sctx, &job->doc, &msg, job->nosave, job->replace, job->fwIdx) ==
+        REDISMODULE_ERR) {
+      RedisModule_ReplyWithError(ctx, msg ? msg : "Could not index document");
+    } else {
+      RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+  }
+
+  RedisModule_UnblockClient(job->bc, NULL);
+  asyncIndexJob_Free(ctx, job);
+  RedisModule_FreeThreadSafeContext(ctx);
+}
+
+/* The first half of addDocumentAsync, running in the background without the GIL */
+static void asyncIndex_Tokenize(void *p) {
+  asyncIndexJob *job = p;
+  job->fwIdx = tokenizeDocument(&job->ts, &job->doc);
+  ConcurrentSearch_Run(asyncIndex_Write, job);
+}
+
+/* Add a document without tokenizing it under the GIL. The client is blocked, the document's text is
+ * tokenized in the background, and only the rest of the indexing, which needs the keyspace, is done
+ * once we take the GIL back. The client gets its reply when the document is indexed.
+ *
+ * The background thread does not touch the spec, so it runs outside of any epoch: it doesn't hold
+ * back memory reclamation or compactions however long the document takes to tokenize. The write
+ * holds the GIL, as a synchronous FT.ADD does */
+static void addDocumentAsync(RedisModuleCtx *ctx, IndexSpec *sp, Document doc,
+                             RedisModuleString **argv, int argc, int nosave, int replace) {
+  asyncIndexJob *job = rm_calloc(1, sizeof(*job));
+  job->indexName = rm_strdup(sp->name);
+  tokenizeSettings_Init(&job->ts, sp, &doc);
+  job->doc = doc;
+  job->nosave = nosave;
+  job->replace = replace;
+
+  // the document points into the arguments, so we keep them alive until it's indexed
+  job->argc = argc;
+  job->argv = rm_malloc(argc * sizeof(RedisModuleString *));
+  for (int i = 0; i < argc; i++) {
+    RedisModule_RetainString(ctx, argv[i]);
+    job->argv[i] = argv[i];
+  }
+
+  job->bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
+  ConcurrentSearch_RunBackground(asyncIndex_Tokenize, job);
+}
+
+/* The batch's term map holds positions in its term array, there is nothing to free */
+static void termEntries_NopFree(void *p) {
+}
+
+/* The entries of a term in a batch of documents, in the order of their docIds */
+typedef struct {
+  const char *term;
+  size_t len;
+  ForwardIndexEntry **entries;
+  size_t numEntries;
+  size_t cap;
+} termEntries;
+
+/* Add a batch of parsed documents to the index. The documents are indexed in order, and their terms
+ * are merged so the inverted index of every term is opened once for the entire batch, and all of its
+ * new records are appended in docId order.
+ *
+ * rcs and errorStrings receive the result of every document, as in AddDocument. Returns the number of
+ * documents added */
+size_t AddDocumentBatch(RedisSearchCtx *ctx, Document *docs, size_t numDocs, int *rcs,
+                        const char **errorStrings, int nosave, int replace) {
+
+  IndexEncoder enc = InvertedIndex_GetEncoder(ctx->spec->flags);
+  if (enc == NULL) {
+    for (size_t i = 0; i < numDocs; i++) {
+      rcs[i] = REDISMODULE_ERR;
+      errorStrings[i] = "Error encoding index";
+    }
+    return 0;
+  }
+
+  ForwardIndex **fwds = rm_calloc(numDocs, sizeof(ForwardIndex *));
+  TrieMap *byTerm = NewTrieMap();
+  termEntries *terms = NULL;
+  size_t numTerms = 0, capTerms = 0, added = 0;
+
+  for (size_t i = 0; i < numDocs; i++) {
+    rcs[i] = indexDocumentFields(ctx, &docs[i], &errorStrings[i], nosave, replace, &fwds[i]);
+    if (rcs[i] == REDISMODULE_ERR) {
+      continue;
+    }
+    added++;
+
+    // docIds are assigned incrementally, so appending keeps every term's entries sorted
+    ForwardIndexIterator it = ForwardIndex_Iterate(fwds[i]);
+    ForwardIndexEntry *entry;
+    while ((entry = ForwardIndexIterator_Next(&it)) != NULL) {
+      // the map's keys are limited to 64KB, longer terms are written right away
+      if (entry->len > UINT16_MAX) {
+        InvertedIndex *invidx = openTermIndex(ctx, entry->term, entry->len, 1);
+        if (invidx) {
+          writeIndexEntry(ctx, invidx, enc, entry);
+        }
+        continue;
       }
-      // Redis_CloseWriter(w);
 
-      entry = ForwardIndexIterator_Next(&it);
+      void *p = TrieMap_Find(byTerm, (char *)entry->term, entry->len);
+      termEntries *te;
+      if (p == TRIEMAP_NOTFOUND) {
+        if (numTerms == capTerms) {
+          capTerms = capTerms ? capTerms * 2 : 64;
+          terms = rm_realloc(terms, capTerms * sizeof(termEntries));
+        }
+        te = &terms[numTerms];
+        *te = (termEntries){.term = entry->term, .len = entry->len};
+        // the map holds the term's position, as the array might move as it grows
+        TrieMap_Add(byTerm, (char *)entry->term, entry->len, (void *)(uintptr_t)++numTerms, NULL);
+      } else {
+        te = &terms[(uintptr_t)p - 1];
+      }
+      if (te->numEntries == te->cap) {
+        te->cap = te->cap ? te->cap * 2 : 4;
+        te->entries = rm_realloc(te->entries, te->cap * sizeof(ForwardIndexEntry *));
+      }
+      te->entries[te->numEntries++] = entry;
     }
-    // ctx->spec->stats->numDocuments += 1;
   }
-  ctx->spec->stats.numDocuments += 1;
-  ForwardIndexFree(idx);
-  return REDISMODULE_OK;
 
-error:
-  ForwardIndexFree(idx);
+  for (size_t i = 0; i < numTerms; i++) {
+    termEntries *te = &terms[i];
+    InvertedIndex *invidx = openTermIndex(ctx, te->term, te->len, te->numEntries);
+    for (size_t j = 0; invidx && j < te->numEntries; j++) {
+      writeIndexEntry(ctx, invidx, enc, te->entries[j]);
+    }
+    rm_free(te->entries);
+  }
 
-  return REDISMODULE_ERR;
+  // the terms point into the forward indexes, so we free them last
+  TrieMap_Free(byTerm, termEntries_NopFree);
+  rm_free(terms);
+  for (size_t i = 0; i < numDocs; i++) {
+    if (fwds[i]) ForwardIndexFree(fwds[i]);
+  }
+  rm_free(fwds);
+  return added;
+}
+
+/* Returns the index of an FT.ADD option between the score and FIELDS, or 0 if it is not there. The
+ * values of LANGUAGE and PAYLOAD are skipped, so neither they nor the index name, docId or score are
+ * taken for options */
+static int addDocument_OptionIndex(const char *opt, RedisModuleString **argv, int fieldsIdx) {
+  for (int i = 4; i < fieldsIdx; i++) {
+    const char *a = RedisModule_StringPtrLen(argv[i], NULL);
+    if (!strcasecmp(a, opt)) {
+      return i;
+    }
+    if (!strcasecmp(a, "LANGUAGE") || !strcasecmp(a, "PAYLOAD")) {
+      i++;
+    }
+  }
+  return 0;
 }
 
 /*
-## FT.ADD <index> <docId> <score> [NOSAVE] [REPLACE] [LANGUAGE <lang>] [PAYLOAD {payload}] FIELDS
+## FT.ADD <index> <docId> <score> [NOSAVE] [REPLACE [PARTIAL]] [ASYNC] [LANGUAGE <lang>]
+[PAYLOAD {payload}] FIELDS
 <field>
 <text> ....]
 Add a documet to the index.
@@ -217,6 +710,15 @@ and only index it.
 
     - REPLACE: If set, we will do an update and delete an older version of the document if it exists
 
+    - PARTIAL: Only with REPLACE. The fields given replace those of the saved document, and its
+    other fields are kept. If no full text field and not the score change, the document is updated
+    in place: it keeps its docId, and only the indexes of the numeric and geo fields that changed
+    are updated, along with its payload and sortable values
+
+    - ASYNC: If set, a document with a lot of text is tokenized in the background without blocking
+    redis, and the client gets its reply once it is indexed. The document is indexed right away
+    inside MULTI or Lua scripts, which can't wait for it, or if the server can't tell we're in one
+
     - FIELDS: Following the FIELDS specifier, we are looking for pairs of
 <field> <text> to be
 indexed.
@@ -242,6 +744,8 @@ int AddDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   int nosave = RMUtil_ArgExists("NOSAVE", argv, argc, 1);
   int fieldsIdx = RMUtil_ArgExists("FIELDS", argv, argc, 1);
   int replace = RMUtil_ArgExists("REPLACE", argv, argc, 1);
+  int partial = addDocument_OptionIndex("PARTIAL", argv, fieldsIdx);
+  int async = addDocument_OptionIndex("ASYNC", argv, fieldsIdx);
 
   // printf("argc: %d, fieldsIdx: %d, argc - fieldsIdx: %d, nosave: %d\n", argc,
   // fieldsIdx,
@@ -253,6 +757,11 @@ int AddDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
   RedisModule_AutoMemory(ctx);
 
+  if (partial && (!replace || nosave)) {
+    RedisModule_ReplyWithError(ctx, "PARTIAL requires REPLACE, and can't be used with NOSAVE");
+    goto cleanup;
+  }
+
   IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
   if (sp == NULL) {
     RedisModule_ReplyWithError(ctx, "Unknown Index name");
@@ -300,6 +809,37 @@ int AddDocumentCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
 
   LG_DEBUG("Adding doc %s with %d fields\n", RedisModule_StringPtrLen(doc.docKey, NULL),
            doc.numFields);
+
+  // partial updates mostly touch numeric fields, we only tokenize the document if its text changed
+  if (partial) {
+    const char *msg = NULL;
+    if (updateDocument(&sctx, &doc, &msg) == REDISMODULE_ERR) {
+      RedisModule_ReplyWithError(ctx, msg ? msg : "Could not index document");
+    } else {
+      RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    free(doc.fields);
+    goto cleanup;
+  }
+
+  // documents with a lot of text may be tokenized in the background, which takes the document with
+  // it. Blocking the client fails in transactions and scripts, which also expect to see the
+  // document indexed by the time the command returns
+  size_t textSize = 0;
+  for (int i = 0; async && i < doc.numFields; i++) {
+    FieldSpec *fs = IndexSpec_GetField(sp, doc.fields[i].name, strlen(doc.fields[i].name));
+    if (fs && fs->type == F_FULLTEXT) {
+      RedisModule_StringPtrLen(doc.fields[i].text, &len);
+      textSize += len;
+    }
+  }
+  if (async && textSize >= asyncIndexMinSize && RedisModule_GetContextFlags &&
+      !(RedisModule_GetContextFlags(ctx) &
+        (REDISMODULE_CTX_FLAGS_LUA | REDISMODULE_CTX_FLAGS_MULTI))) {
+    addDocumentAsync(ctx, sp, doc, argv, argc, nosave, replace);
+    goto cleanup;
+  }
+
   const char *msg = NULL;
   int rc = AddDocument(&sctx, doc, &msg, nosave, replace);
   if (rc == REDISMODULE_ERR) {
@@ -314,6 +854,108 @@ cleanup:
   return REDISMODULE_OK;
 }
 
+/*
+## FT.MADD <index> [NOSAVE] [REPLACE] [LANGUAGE lang] DOCUMENTS {docId} {score} {num_fields}
+    {field} {text} ... [{docId} {score} {num_fields} {field} {text} ...]
+Add a batch of documents to the index.
+
+The documents are indexed like FT.ADD, but the records of every term are appended to its inverted
+index at once for the entire batch, which makes this much faster than adding the documents one by
+one for bulk loads.
+
+## Parameters:
+
+    - index: The Fulltext index name. The index must be first created with FT.CREATE
+
+    - NOSAVE, REPLACE, LANGUAGE: As in FT.ADD, applied to all the documents of the batch
+
+    - DOCUMENTS: Following the DOCUMENTS specifier, we are looking for the documents of the batch.
+    Each document is its id, its score, the number of its fields and then pairs of <field> <text>
+
+Returns an array with a reply per document, OK or an error if it could not be added. Malformed
+batches return an error and do not add any document.
+*/
+int AddDocumentBatchCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  int docsIdx = argc > 2 ? RMUtil_ArgIndex("DOCUMENTS", argv + 2, argc - 2) + 2 : 0;
+  if (argc < 6 || docsIdx < 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+  // the options come before the documents, so field values cannot be mistaken for them
+  int nosave = RMUtil_ArgExists("NOSAVE", argv, docsIdx, 2) != 0;
+  int replace = RMUtil_ArgExists("REPLACE", argv, docsIdx, 2) != 0;
+
+  RedisModule_AutoMemory(ctx);
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 1);
+  if (sp == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  RedisSearchCtx sctx = SEARCH_CTX_STATIC(ctx, sp);
+
+  // Parse the optional LANGUAGE flag
+  const char *lang = NULL;
+  RMUtil_ParseArgsAfter("LANGUAGE", argv, docsIdx, "c", &lang);
+  if (lang && !IsSupportedLanguage(lang, strlen(lang))) {
+    return RedisModule_ReplyWithError(ctx, "Unsupported Language");
+  }
+
+  // count the documents and validate the batch before indexing any of them
+  size_t numDocs = 0;
+  for (int i = docsIdx + 1; i < argc; numDocs++) {
+    long long nfields;
+    double ds;
+    if (i + 2 >= argc || RedisModule_StringToLongLong(argv[i + 2], &nfields) == REDISMODULE_ERR ||
+        nfields < 0 || nfields > (argc - i - 3) / 2) {
+      return RedisModule_ReplyWithError(ctx, "Invalid document field count");
+    }
+    if (RedisModule_StringToDouble(argv[i + 1], &ds) == REDISMODULE_ERR) {
+      return RedisModule_ReplyWithError(ctx, "Could not parse document score");
+    }
+    if (ds > 1 || ds < 0) {
+      return RedisModule_ReplyWithError(ctx,
+                                        "Document scores must be normalized between 0.0 ... 1.0");
+    }
+    i += 3 + 2 * nfields;
+  }
+  if (numDocs == 0) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  Document *docs = rm_calloc(numDocs, sizeof(Document));
+  int *rcs = rm_calloc(numDocs, sizeof(int));
+  const char **msgs = rm_calloc(numDocs, sizeof(const char *));
+  for (int i = docsIdx + 1, n = 0; i < argc; n++) {
+    long long nfields;
+    double ds;
+    RedisModule_StringToLongLong(argv[i + 2], &nfields);
+    RedisModule_StringToDouble(argv[i + 1], &ds);
+    docs[n] = NewDocument(argv[i], ds, nfields, lang ? lang : DEFAULT_LANGUAGE, NULL, 0);
+    for (int j = 0; j < nfields; j++) {
+      docs[n].fields[j].name = RedisModule_StringPtrLen(argv[i + 3 + 2 * j], NULL);
+      docs[n].fields[j].text = argv[i + 4 + 2 * j];
+    }
+    i += 3 + 2 * nfields;
+  }
+
+  LG_DEBUG("Adding a batch of %zd docs\n", numDocs);
+  AddDocumentBatch(&sctx, docs, numDocs, rcs, msgs, nosave, replace);
+
+  RedisModule_ReplyWithArray(ctx, numDocs);
+  for (size_t n = 0; n < numDocs; n++) {
+    if (rcs[n] == REDISMODULE_ERR) {
+      RedisModule_ReplyWithError(ctx, msgs[n] ? msgs[n] : "Could not index document");
+    } else {
+      RedisModule_ReplyWithSimpleString(ctx, "OK");
+    }
+    free(docs[n].fields);
+  }
+  rm_free(docs);
+  rm_free(rcs);
+  rm_free(msgs);
+  return REDISMODULE_OK;
+}
+
 /* FT.SETPAYLOAD {index} {docId} {payload} */
 int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 
@@ -344,6 +986,7 @@ int SetPayloadCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     RedisModule_ReplyWithError(ctx, "Could not set payload ¯\\_(ツ)_/¯");
     goto cleanup;
   }
+  sp->revisionId++;
 
   RedisModule_ReplyWithSimpleString(ctx, "OK");
 cleanup:
@@ -398,7 +1041,7 @@ int RepairCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
     return RedisModule_ReplyWithError(ctx, "Could not open term index");
   }
 
-  int rc = InvertedIndex_Repair(idx, &sctx.spec->docs, startBlock, 10);
+  int rc = InvertedIndex_Repair(idx, &sctx.spec->docs, startBlock, 10, NULL);
   RedisModule_ReplyWithArray(ctx, 3);
   RedisModule_ReplyWithStringBuffer(ctx, sctx.spec->name, strlen(sctx.spec->name));
   RedisModule_ReplyWithStringBuffer(ctx, term, len);
@@ -428,6 +1071,11 @@ static int renderIndexOptions(RedisModuleCtx *ctx, IndexSpec *sp) {
   ADD_NEGATIVE_OPTION(Index_StoreFreqs, "NOFREQS");
   ADD_NEGATIVE_OPTION(Index_StoreFieldFlags, "NOFIELDS");
   ADD_NEGATIVE_OPTION(Index_StoreTermOffsets, "NOOFFSETS");
+  ADD_NEGATIVE_OPTION(Index_FoldUnicode, SPEC_ASCIIFOLD_STR);
+  if (sp->flags & Index_HashKeys) {
+    RedisModule_ReplyWithSimpleString(ctx, SPEC_HASHKEYS_STR);
+    n++;
+  }
   RedisModule_ReplySetArrayLength(ctx, n);
   return 2;
 }
@@ -484,7 +1132,7 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   //  REPLY_KVNUM(n, "score_index_size_mb", sp->stats.scoreIndexesSize / (float)0x100000);
 
   REPLY_KVNUM(n, "doc_table_size_mb", sp->docs.memsize / (float)0x100000);
-  REPLY_KVNUM(n, "key_table_size_mb", TrieMap_MemUsage(sp->docs.dim.tm) / (float)0x100000);
+  REPLY_KVNUM(n, "key_table_size_mb", DocIdMap_MemUsage(&sp->docs.dim) / (float)0x100000);
   REPLY_KVNUM(n, "records_per_doc_avg",
               (float)sp->stats.numRecords / (float)sp->stats.numDocuments);
   REPLY_KVNUM(n, "bytes_per_record_avg",
@@ -494,6 +1142,32 @@ int IndexInfoCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   REPLY_KVNUM(n, "offset_bits_per_record_avg",
               8.0F * (float)sp->stats.offsetVecsSize / (float)sp->stats.offsetVecRecords);
 
+  DecodeCacheStats dc = DecodeCache_GetStats();
+  REPLY_KVNUM(n, "decode_cache_blocks", dc.numBlocks);
+  REPLY_KVNUM(n, "decode_cache_sz_mb", dc.memsize / (float)0x100000);
+  REPLY_KVNUM(n, "decode_cache_hits", dc.hits);
+  REPLY_KVNUM(n, "decode_cache_misses", dc.misses);
+
+  QueryCache qc = sp->cache ? *sp->cache : (QueryCache){0};
+  REPLY_KVNUM(n, "query_cache_entries", qc.numEntries);
+  REPLY_KVNUM(n, "query_cache_sz_mb", qc.memsize / (float)0x100000);
+  REPLY_KVNUM(n, "query_cache_hits", qc.hits);
+  REPLY_KVNUM(n, "query_cache_misses", qc.misses);
+
+  GCStats gc = GC_GetStats(sp->gc);
+  REPLY_KVNUM(n, "gc_garbage_ratio", GC_GarbageRatio(sp));
+  REPLY_KVNUM(n, "gc_records_collected", gc.recordsCollected);
+  REPLY_KVNUM(n, "gc_bytes_collected_mb", gc.bytesCollected / (float)0x100000);
+  REPLY_KVNUM(n, "gc_blocks_removed", gc.blocksRemoved);
+  REPLY_KVNUM(n, "gc_terms_removed", gc.termsRemoved);
+  REPLY_KVNUM(n, "gc_passes", gc.numPasses);
+  REPLY_KVNUM(n, "gc_total_ms_run", gc.totalMSRun);
+  REPLY_KVNUM(n, "gc_compacting", GC_IsCompacting(sp->gc));
+  REPLY_KVSTR(n, "gc_compaction", GC_CompactionPhase(sp->gc));
+  REPLY_KVNUM(n, "gc_compaction_wait_ms", gc.compactionWaitMS);
+  REPLY_KVNUM(n, "gc_compactions", gc.numCompactions);
+  REPLY_KVNUM(n, "gc_docids_reclaimed", gc.docIdsReclaimed);
+
   RedisModule_ReplySetArrayLength(ctx, n);
   return REDISMODULE_OK;
 }
@@ -531,6 +1205,7 @@ int QueryExplainCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   }
 
   Query_Expand(q);
+  Query_Plan(q);
   char *explain = (char *)Query_DumpExplain(q);
   RedisModule_ReplyWithStringBuffer(ctx, explain, strlen(explain));
   free(explain);
@@ -571,6 +1246,7 @@ int DTAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   }
   t_docId d = DocTable_Put(&sp->docs, RedisModule_StringPtrLen(argv[2], NULL), (float)score,
                            (u_char)flags, payload, payloadSize);
+  sp->revisionId++;
 
   return RedisModule_ReplyWithLongLong(ctx, d);
 }
@@ -578,7 +1254,8 @@ int DTAddCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 /* FT.DEL {index} {doc_id}
 *  Delete a document from the index. Returns 1 if the document was in the index, or 0 if not.
 *
-*  **NOTE**: This does not actually delete the document from the index, just marks it as deleted
+*  **NOTE**: This does not actually delete the document from the index, just marks it as deleted.
+*  Its records are removed from the index later by the index's garbage collector
 */
 int DeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   RedisModule_AutoMemory(ctx);
@@ -593,6 +1270,7 @@ int DeleteCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   int rc = DocTable_Delete(&sp->docs, RedisModule_StringPtrLen(argv[2], NULL));
   if (rc == 1) {
     sp->stats.numDocuments--;
+    sp->revisionId++;
   }
   return RedisModule_ReplyWithLongLong(ctx, rc);
 }
@@ -790,7 +1468,55 @@ int SearchCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
 }
 
 /*
-## FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX]
+## FT.PROFILE {index} SEARCH {query} [search arguments ...]
+
+Run a search query like FT.SEARCH does, and return how the time was spent executing it.
+
+### Returns:
+
+    An array of two replies: the reply FT.SEARCH would have returned, and the profile of the query.
+    The profile lists the time in milliseconds spent in every stage of the query (parsing,
+    expansion, planning, opening the iterators, iterating, scoring, heap maintenance, loading the
+    documents and serializing the reply), followed by a tree of the query nodes laid out like the
+    output of FT.EXPLAIN, with the number of reads, skips, records returned, index blocks read and
+    the (inclusive) time spent in every node's iterator.
+*/
+int ProfileCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc < 4) {
+    return RedisModule_WrongArity(ctx);
+  }
+  if (strcasecmp(RedisModule_StringPtrLen(argv[2], NULL), "SEARCH")) {
+    return RedisModule_ReplyWithError(ctx, "Only SEARCH queries can be profiled");
+  }
+
+  RedisModule_AutoMemory(ctx);
+  RedisSearchCtx *sctx = NewSearchCtx(ctx, argv[1]);
+  if (sctx == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+
+  // the rest of the arguments are parsed exactly like FT.SEARCH's
+  RedisModuleString *args[argc - 1];
+  args[0] = argv[0];
+  args[1] = argv[1];
+  memcpy(args + 2, argv + 3, (argc - 3) * sizeof(*argv));
+
+  char *err;
+  RSSearchRequest *req = ParseRequest(sctx, args, argc - 1, &err);
+  if (req == NULL) {
+    RedisModule_Log(ctx, "warning", "Error parsing request: %s", err);
+    SearchCtx_Free(sctx);
+    return RedisModule_ReplyWithError(ctx, err);
+  }
+  req->flags |= Search_Profile;
+
+  int rc = RSSearchRequest_Process(ctx, req);
+  SearchCtx_Free(sctx);
+  return rc;
+}
+
+/*
+## FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [HASHKEYS]
     SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC] ...
 
 Creates an index with the given spec. The index name will be used in all the
@@ -812,6 +1538,9 @@ overwritten
     - NOSCOREIDX: If set, we avoid saving the top results for single words. Saves a lot of memory,
       slows down searches for common single word queries
 
+    - HASHKEYS: If set, document keys are mapped to internal ids with a hash map instead of a trie.
+      Faster for keys that share few prefixes, such as UUIDs
+
     - SCHEMA: After the SCHEMA keyword we define the index fields. They can be either numeric or
       textual.
       For textual fields we optionally specify a weight. The default weight is 1.0
@@ -848,6 +1577,7 @@ int CreateIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc)
   }
 
   RedisModule_ModuleTypeSetValue(k, IndexSpecType, sp);
+  sp->gc = NewGarbageCollector(sp);
 
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
@@ -925,6 +1655,39 @@ int DropIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
   return RedisModule_ReplyWithSimpleString(ctx, "OK");
 }
 
+/*
+## FT.COMPACT {index}
+
+Compact the docIds of an index in the background. Deleted documents keep their docIds, so after
+many deletes and updates the docIds are sparse. The garbage collector of the index gives the live
+documents consecutive docIds, and then renumbers all the index's records.
+
+### Returns:
+
+Simple string reply OK, or an error if the index does not exist, garbage collection is disabled or
+the index is already being compacted. FT.INFO reports gc_compacting until the compaction is done,
+and the step it is at in gc_compaction.
+*/
+int CompactIndexCommand(RedisModuleCtx *ctx, RedisModuleString **argv, int argc) {
+  if (argc != 2) {
+    return RedisModule_WrongArity(ctx);
+  }
+
+  RedisModule_AutoMemory(ctx);
+
+  IndexSpec *sp = IndexSpec_Load(ctx, RedisModule_StringPtrLen(argv[1], NULL), 0);
+  if (sp == NULL) {
+    return RedisModule_ReplyWithError(ctx, "Unknown Index name");
+  }
+  if (!sp->gc) {
+    return RedisModule_ReplyWithError(ctx, "Garbage collection is disabled");
+  }
+  if (GC_Compact(sp->gc) == REDISMODULE_ERR) {
+    return RedisModule_ReplyWithError(ctx, "Index is already being compacted");
+  }
+  return RedisModule_ReplyWithSimpleString(ctx, "OK");
+}
+
 /*
 ## FT.SUGGADD key string score [INCR] [PAYLOAD {payload}]
 
@@ -1183,8 +1946,7 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
   // Init extension mechanism
   Extensions_Init();
 
-  ConcurrentSearch_ThreadPoolStart();
-  printf("Initialized thread pool!\n");
+  ConcurrentSearch_SchedulerStart();
   /* Load extensions if needed */
   if (argc > 0 && RMUtil_ArgIndex("EXTLOAD", argv, argc) >= 0) {
     const char *ext = NULL;
@@ -1202,6 +1964,50 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
     }
   }
 
+  /* Set the memory limit of the query cache of every index */
+  if (argc > 0 && RMUtil_ArgIndex("QUERYCACHE_MAXMEM", argv, argc) >= 0) {
+    long long maxMem = -1;
+    RMUtil_ParseArgsAfter("QUERYCACHE_MAXMEM", argv, argc, "l", &maxMem);
+    if (maxMem < 0) {
+      RedisModule_Log(ctx, "warning", "Invalid QUERYCACHE_MAXMEM, expected a number of bytes");
+      return REDISMODULE_ERR;
+    }
+    QueryCache_MaxMem = maxMem;
+  }
+
+  /* Set the text size from which FT.ADD tokenizes documents in the background */
+  if (argc > 0 && RMUtil_ArgIndex("ASYNC_INDEX_MIN_SIZE", argv, argc) >= 0) {
+    long long minSize = -1;
+    RMUtil_ParseArgsAfter("ASYNC_INDEX_MIN_SIZE", argv, argc, "l", &minSize);
+    if (minSize < 0) {
+      RedisModule_Log(ctx, "warning", "Invalid ASYNC_INDEX_MIN_SIZE, expected a number of bytes");
+      return REDISMODULE_ERR;
+    }
+    asyncIndexMinSize = minSize;
+  }
+
+  /* Set the memory limit of the decoded blocks cache */
+  if (argc > 0 && RMUtil_ArgIndex("DECODECACHE_MAXMEM", argv, argc) >= 0) {
+    long long maxMem = -1;
+    RMUtil_ParseArgsAfter("DECODECACHE_MAXMEM", argv, argc, "l", &maxMem);
+    if (maxMem < 0) {
+      RedisModule_Log(ctx, "warning", "Invalid DECODECACHE_MAXMEM, expected a number of bytes");
+      return REDISMODULE_ERR;
+    }
+    DecodeCache_MaxMem = maxMem;
+  }
+
+  /* Set the interval between the runs of the garbage collector of every index */
+  if (argc > 0 && RMUtil_ArgIndex("GC_INTERVAL", argv, argc) >= 0) {
+    long long interval = -1;
+    RMUtil_ParseArgsAfter("GC_INTERVAL", argv, argc, "l", &interval);
+    if (interval < 0) {
+      RedisModule_Log(ctx, "warning", "Invalid GC_INTERVAL, expected a number of milliseconds");
+      return REDISMODULE_ERR;
+    }
+    GC_IntervalMS = interval;
+  }
+
   // Register the default hard coded extension
   if (Extension_Load("DEFAULT", DefaultExtensionInit) == REDISEARCH_ERR) {
     RedisModule_Log(ctx, "warning", "Could not register default extension");
@@ -1219,6 +2025,9 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_ADD_CMD, AddDocumentCommand, "write deny-oom", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_MADD_CMD, AddDocumentBatchCommand, "write deny-oom", 1,
+         1, 1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_SETPAYLOAD_CMD, SetPayloadCommand, "write deny-oom", 1,
          1, 1);
 
@@ -1241,10 +2050,15 @@ int RediSearch_InitModuleInternal(RedisModuleCtx *ctx, RedisModuleString **argv,
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_DROP_CMD, DropIndexCommand, "write", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_COMPACT_CMD, CompactIndexCommand, "write", 1, 1, 1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_INFO_CMD, IndexInfoCommand, "readonly", 1, 1, 1);
 
   RM_TRY(RedisModule_CreateCommand, ctx, RS_EXPLAIN_CMD, QueryExplainCommand, "readonly", 1, 1, 1);
 
+  RM_TRY(RedisModule_CreateCommand, ctx, RS_PROFILE_CMD, ProfileCommand, "readonly deny-oom", 1, 1,
+         1);
+
   RM_TRY(RedisModule_CreateCommand, ctx, RS_SUGADD_CMD, SuggestAddCommand, "write deny-oom", 1, 1,
          1);
 
@@ -4,6 +4,7 @@
 #include "rmutil/vector.h"
 #include "rmutil/util.h"
 #include "index.h"
+#include "id_bitmap.h"
 #include <math.h>
 #include "redismodule.h"
 //#include "tests/time_sample.h"
@@ -12,6 +13,10 @@
 #define NR_MAXRANGE_SIZE 10000
 #define NR_MAX_DEPTH 2
 
+// filters spanning at least this many ranges or documents are evaluated as a docId bitmap
+#define NUMERIC_BITMAP_MIN_RANGES 16
+#define NUMERIC_BITMAP_MIN_DOCS 100000
+
 typedef struct {
   IndexIterator *it;
   uint32_t lastRevId;
@@ -86,7 +91,12 @@ int NumericRange_Add(NumericRange *n, t_docId docId, double value, int checkCard
     ++n->card;
   }
 
-  InvertedIndex_WriteNumericEntry(n->entries, docId, value);
+  // documents updated in place keep their docIds, so their records may go before the last one
+  if (docId > n->entries->lastId) {
+    InvertedIndex_WriteNumericEntry(n->entries, docId, value);
+  } else {
+    InvertedIndex_PutNumericEntry(n->entries, docId, value);
+  }
 
   return n->card;
 }
@@ -125,12 +135,13 @@ NumericRangeNode *NewLeafNode(size_t cap, double min, double max, size_t splitCa
   n->maxDepth = 0;
   n->range = RedisModule_Alloc(sizeof(NumericRange));
 
-  *n->range = (NumericRange){.minVal = min,
-                             .maxVal = max,
-                             .card = 0,
-                             .splitCard = splitCard,
-                             .values = RedisModule_Calloc(splitCard, sizeof(float)),
-                             .entries = NewInvertedIndex(Index_StoreNumeric, 1)};
+  *n->range =
+      (NumericRange){.minVal = min,
+                     .maxVal = max,
+                     .card = 0,
+                     .splitCard = splitCard,
+                     .values = RedisModule_Calloc(splitCard, sizeof(float)),
+                     .entries = NewInvertedIndex(Index_StoreNumeric | Index_PackedBlocks, 1)};
   return n;
 }
 
@@ -254,6 +265,7 @@ NumericRangeTree *NewNumericRangeTree() {
   ret->numEntries = 0;
   ret->numRanges = 1;
   ret->revisionId = 0;
+  ret->docIdGen = 0;
   return ret;
 }
 
@@ -289,6 +301,169 @@ void NumericRangeNode_Traverse(NumericRangeNode *n,
   }
 }
 
+typedef struct {
+  t_docId docId;
+  int found;
+} numericDeleteCtx;
+
+static void __numericIndex_deleteCallback(NumericRangeNode *n, void *p) {
+  numericDeleteCtx *ctx = p;
+  if (n->range && InvertedIndex_DeleteEntry(n->range->entries, ctx->docId) && __isLeaf(n)) {
+    ctx->found = 1;
+  }
+}
+
+int NumericRangeTree_Delete(NumericRangeTree *t, t_docId docId, double value) {
+  // the ranges that may hold the record are on the value's path from the root
+  int found = 0;
+  for (NumericRangeNode *n = t->root; n; n = value < n->value ? n->left : n->right) {
+    if (n->range && InvertedIndex_DeleteEntry(n->range->entries, docId) && __isLeaf(n)) {
+      found = 1;
+    }
+    if (__isLeaf(n)) break;
+  }
+
+  // the document was indexed with another value, we look for it in every range
+  if (!found) {
+    numericDeleteCtx ctx = {.docId = docId};
+    NumericRangeNode_Traverse(t->root, __numericIndex_deleteCallback, &ctx);
+    found = ctx.found;
+  }
+  if (found) {
+    t->numEntries--;
+  }
+  return found;
+}
+
+typedef struct {
+  DocTable *dt;
+  IndexRepairStats stats;
+  // the position of the next range in traversal order, and the first one we repair
+  size_t pos;
+  size_t start;
+  // the number of blocks we may still repair
+  long budget;
+  // the range to continue from once we run out of budget, or 0 if we repaired every range
+  size_t next;
+  // records removed from leaves. Inner nodes may keep copies of their children's records
+  size_t leafRecordsRemoved;
+} numericRepairCtx;
+
+static void __numericIndex_repairCallback(NumericRangeNode *n, void *p) {
+  numericRepairCtx *ctx = p;
+  if (!n->range) {
+    return;
+  }
+  size_t pos = ctx->pos++;
+  if (pos < ctx->start || ctx->next) {
+    return;
+  }
+  if (ctx->budget <= 0) {
+    ctx->next = pos;
+    return;
+  }
+  InvertedIndex *entries = n->range->entries;
+  ctx->budget -= entries->size;
+  size_t removed = ctx->stats.recordsRemoved;
+  InvertedIndex_Repair(entries, ctx->dt, 0, 0, &ctx->stats);
+  if (__isLeaf(n)) {
+    ctx->leafRecordsRemoved += ctx->stats.recordsRemoved - removed;
+  }
+}
+
+size_t NumericRangeTree_Repair(NumericRangeTree *t, DocTable *dt, size_t startRange, int num,
+                               IndexRepairStats *stats) {
+  numericRepairCtx ctx = {.dt = dt, .start = startRange, .budget = num};
+  NumericRangeNode_Traverse(t->root, __numericIndex_repairCallback, &ctx);
+  t->numEntries -= MIN(t->numEntries, ctx.leafRecordsRemoved);
+  if (stats) {
+    stats->recordsRemoved += ctx.stats.recordsRemoved;
+    stats->bytesCollected += ctx.stats.bytesCollected;
+    stats->blocksRemoved += ctx.stats.blocksRemoved;
+  }
+  return ctx.next;
+}
+
+typedef struct {
+  const DocIdRemap *remap;
+  // the position of the next range in traversal order, and the first one we copy
+  size_t pos;
+  size_t start;
+  // the number of blocks we may still copy
+  long budget;
+  // the range to continue from once we run out of budget, or 0 if we went over every range
+  size_t next;
+} numericPrepareCtx;
+
+static void __numericIndex_prepareCallback(NumericRangeNode *n, void *p) {
+  numericPrepareCtx *ctx = p;
+  if (!n->range) {
+    return;
+  }
+  size_t pos = ctx->pos++;
+  if (pos < ctx->start || ctx->next) {
+    return;
+  }
+  if (ctx->budget <= 0) {
+    ctx->next = pos;
+    return;
+  }
+  InvertedIndex *entries = n->range->entries;
+  ctx->budget -= MAX(1, InvertedIndex_PrepareRenumber(entries, ctx->remap, entries->size));
+}
+
+size_t NumericRangeTree_PrepareRenumber(NumericRangeTree *t, const DocIdRemap *remap,
+                                        size_t startRange, int num) {
+  numericPrepareCtx ctx = {.remap = remap, .start = startRange, .budget = num};
+  NumericRangeNode_Traverse(t->root, __numericIndex_prepareCallback, &ctx);
+  return ctx.next;
+}
+
+typedef struct {
+  const DocIdRemap *remap;
+  IndexRepairStats stats;
+  // records removed from leaves. Inner nodes may keep copies of their children's records
+  size_t leafRecordsRemoved;
+} numericRenumberCtx;
+
+static void __numericIndex_renumberCallback(NumericRangeNode *n, void *p) {
+  numericRenumberCtx *ctx = p;
+  if (!n->range) {
+    return;
+  }
+  size_t removed = ctx->stats.recordsRemoved;
+  InvertedIndex_Renumber(n->range->entries, ctx->remap, &ctx->stats);
+  if (__isLeaf(n)) {
+    ctx->leafRecordsRemoved += ctx->stats.recordsRemoved - removed;
+  }
+}
+
+void NumericRangeTree_Renumber(NumericRangeTree *t, const DocIdRemap *remap,
+                               IndexRepairStats *stats) {
+  numericRenumberCtx ctx = {.remap = remap};
+  NumericRangeNode_Traverse(t->root, __numericIndex_renumberCallback, &ctx);
+  t->numEntries -= MIN(t->numEntries, ctx.leafRecordsRemoved);
+  // the ranges were rewritten, so iterators on them must not go on
+  t->revisionId++;
+  if (stats) {
+    stats->recordsRemoved += ctx.stats.recordsRemoved;
+    stats->bytesCollected += ctx.stats.bytesCollected;
+    stats->blocksRemoved += ctx.stats.blocksRemoved;
+  }
+}
+
+int NumericIndex_Renumber(RedisSearchCtx *ctx, NumericRangeTree *t, IndexRepairStats *stats) {
+  DocTable *dt = &ctx->spec->docs;
+  if (t->docIdGen == dt->docIdGen) {
+    return 0;
+  }
+  if (dt->remap.newIds) {
+    NumericRangeTree_Renumber(t, &dt->remap, stats);
+  }
+  t->docIdGen = dt->docIdGen;
+  return 1;
+}
+
 void NumericRangeTree_Free(NumericRangeTree *t) {
   NumericRangeNode_Free(t->root);
   RedisModule_Free(t);
@@ -307,8 +482,9 @@ IndexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f) {
 }
 
 /* Create a union iterator from the numeric filter, over all the sub-ranges in the tree that fit
- * the filter */
-IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
+ * the filter. If filterOnly is set, the caller does not need the numeric values of the results, and
+ * wide filters are materialized into a docId bitmap instead */
+IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f, int filterOnly) {
 
   Vector *v = NumericRangeTree_Find(t, f->min, f->max);
   if (!v || Vector_Size(v) == 0) {
@@ -329,6 +505,7 @@ IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
   // We create a  union iterator, advancing a union on all the selected range,
   // treating them as one consecutive range
   IndexIterator **its = calloc(n, sizeof(IndexIterator *));
+  size_t totalDocs = 0;
 
   for (size_t i = 0; i < n; i++) {
     NumericRange *rng;
@@ -337,15 +514,154 @@ IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f) {
       continue;
     }
 
+    totalDocs += rng->entries->numDocs;
     its[i] = NewNumericRangeIterator(rng, f);
   }
   Vector_Free(v);
 
+  // wide filters are read once into a bitmap rather than merged on every step
+  if (filterOnly && (n >= NUMERIC_BITMAP_MIN_RANGES || totalDocs >= NUMERIC_BITMAP_MIN_DOCS)) {
+    return NewIdBitmapIterator(its, n);
+  }
+
   IndexIterator *it = NewUnionIterator(its, n, NULL, 1);
 
   return it;
 }
 
+/* Estimate how many documents match a filter from the ranges it covers. Ranges at the ends of the
+ * filter are counted by the part of their span inside the filter, assuming evenly spread values */
+size_t NumericRangeTree_EstimateCard(NumericRangeTree *t, NumericFilter *f) {
+  Vector *v = NumericRangeTree_Find(t, f->min, f->max);
+  if (!v) return 0;
+
+  double card = 0;
+  for (size_t i = 0; i < Vector_Size(v); i++) {
+    NumericRange *rng;
+    Vector_Get(v, i, &rng);
+    if (!rng || !rng->entries->numDocs) continue;
+
+    double span = rng->maxVal - rng->minVal;
+    double lo = MAX(f->min, rng->minVal), hi = MIN(f->max, rng->maxVal);
+    if (span > 0 && hi - lo < span) {
+      // a range partly inside the filter has at least one matching document
+      card += MAX(1, rng->entries->numDocs * (hi - lo) / span);
+    } else {
+      card += rng->entries->numDocs;
+    }
+  }
+  Vector_Free(v);
+  return (size_t)card;
+}
+
+/* A post filter checks the results of its child against the value of a sortable numeric field */
+typedef struct {
+  IndexIterator *child;
+  NumericFilter *filter;
+  DocTable *docTable;
+  RSSortingKey key;
+} NumericPostFilterCtx;
+
+static int NPF_Match(NumericPostFilterCtx *nc, t_docId docId) {
+  RSDocumentMetadata *dmd = DocTable_Get(nc->docTable, docId);
+  if (!dmd || !dmd->sortVector) return 0;
+  RSSortableValue *v = RSSortingVector_Get(dmd->sortVector, &nc->key);
+  return v && v->type == RS_SORTABLE_NUM && NumericFilter_Match(nc->filter, v->num);
+}
+
+static int NPF_Read(void *ctx, RSIndexResult **hit) {
+  NumericPostFilterCtx *nc = ctx;
+  int rc;
+  while (INDEXREAD_EOF != (rc = nc->child->Read(nc->child->ctx, hit))) {
+    if (rc == INDEXREAD_OK && NPF_Match(nc, (*hit)->docId)) {
+      return INDEXREAD_OK;
+    }
+  }
+  return INDEXREAD_EOF;
+}
+
+/* Skip the child to docId. If the document it lands on does not pass the filter, we continue to the
+ * next one that does, and report a miss */
+static int NPF_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
+  NumericPostFilterCtx *nc = ctx;
+  int rc = nc->child->SkipTo(nc->child->ctx, docId, hit);
+  if (rc == INDEXREAD_EOF) return rc;
+  if (NPF_Match(nc, (*hit)->docId)) {
+    return (*hit)->docId == docId ? rc : INDEXREAD_NOTFOUND;
+  }
+  return NPF_Read(ctx, hit) == INDEXREAD_EOF ? INDEXREAD_EOF : INDEXREAD_NOTFOUND;
+}
+
+static RSIndexResult *NPF_Current(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  return nc->child->Current(nc->child->ctx);
+}
+
+static int NPF_HasNext(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  return nc->child->HasNext(nc->child->ctx);
+}
+
+static t_docId NPF_LastDocId(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  return nc->child->LastDocId(nc->child->ctx);
+}
+
+/* We do not know how many of the child's results pass the filter, so the child's count is an upper
+ * bound */
+static size_t NPF_Len(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  return nc->child->Len(nc->child->ctx);
+}
+
+static size_t NPF_NumEstimated(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  return nc->child->NumEstimated(nc->child->ctx);
+}
+
+static void NPF_Abort(void *ctx) {
+  NumericPostFilterCtx *nc = ctx;
+  nc->child->Abort(nc->child->ctx);
+}
+
+static void NPF_Free(IndexIterator *it) {
+  NumericPostFilterCtx *nc = it->ctx;
+  nc->child->Free(nc->child);
+  free(nc);
+  free(it);
+}
+
+static IndexIterator *NPF_Clone(void *ctx, t_docId minId, t_docId maxId) {
+  NumericPostFilterCtx *nc = ctx;
+  IndexIterator *child = nc->child->Clone ? nc->child->Clone(nc->child->ctx, minId, maxId) : NULL;
+  return child ? NewNumericPostFilterIterator(child, nc->filter, nc->docTable, nc->key.index)
+               : NULL;
+}
+
+IndexIterator *NewNumericPostFilterIterator(IndexIterator *child, NumericFilter *f, DocTable *dt,
+                                            int sortIdx) {
+  NumericPostFilterCtx *nc = malloc(sizeof(*nc));
+  nc->child = child;
+  nc->filter = f;
+  nc->docTable = dt;
+  nc->key = (RSSortingKey){.index = sortIdx, .ascending = 1};
+
+  IndexIterator *it = malloc(sizeof(*it));
+  it->ctx = nc;
+  it->Read = NPF_Read;
+  it->SkipTo = NPF_SkipTo;
+  it->Current = NPF_Current;
+  it->HasNext = NPF_HasNext;
+  it->LastDocId = NPF_LastDocId;
+  it->Len = NPF_Len;
+  it->NumEstimated = NPF_NumEstimated;
+  it->MaxScore = NULL;
+  it->Free = NPF_Free;
+  it->Abort = NPF_Abort;
+  it->Clone = NPF_Clone;
+  return it;
+}
+
 RedisModuleType *NumericIndexType = NULL;
 #define NUMERICINDEX_KEY_FMT "nm:%s/%s"
 
@@ -362,8 +678,10 @@ struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilte
     return NULL;
   }
   NumericRangeTree *t = RedisModule_ModuleTypeGetValue(key);
+  NumericIndex_Renumber(ctx, t, NULL);
 
-  IndexIterator *it = createNumericIterator(t, flt);
+  // numeric filter results are only used for filtering the query, not for their values
+  IndexIterator *it = createNumericIterator(t, flt, 1);
   if (!it) {
     return NULL;
   }
@@ -375,6 +693,18 @@ struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilte
   return it;
 }
 
+size_t NumericIndex_EstimateFilter(RedisSearchCtx *ctx, NumericFilter *flt) {
+  RedisModuleString *s = fmtRedisNumericIndexKey(ctx, flt->fieldName);
+  RedisModuleKey *key = RedisModule_OpenKey(ctx->redisCtx, s, REDISMODULE_READ);
+  size_t card = 0;
+  if (key && RedisModule_ModuleTypeGetType(key) == NumericIndexType) {
+    card = NumericRangeTree_EstimateCard(RedisModule_ModuleTypeGetValue(key), flt);
+  }
+  if (key) RedisModule_CloseKey(key);
+  RedisModule_FreeString(ctx->redisCtx, s);
+  return card;
+}
+
 NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, const char *fname) {
 
   RedisModuleString *s = fmtRedisNumericIndexKey(ctx, fname);
@@ -388,9 +718,11 @@ NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, const char *fname) {
   NumericRangeTree *t;
   if (type == REDISMODULE_KEYTYPE_EMPTY) {
     t = NewNumericRangeTree();
+    t->docIdGen = ctx->spec->docs.docIdGen;
     RedisModule_ModuleTypeSetValue(key, NumericIndexType, t);
   } else {
     t = RedisModule_ModuleTypeGetValue(key);
+    NumericIndex_Renumber(ctx, t, NULL);
   }
   return t;
 }
@@ -424,7 +756,7 @@ int NumericIndexType_Register(RedisModuleCtx *ctx) {
                                .free = NumericIndexType_Free,
                                .mem_usage = NumericIndexType_MemUsage};
 
-  NumericIndexType = RedisModule_CreateDataType(ctx, "numericdx", 0, &tm);
+  NumericIndexType = RedisModule_CreateDataType(ctx, "numericdx", NUMERIC_INDEX_ENCVER, &tm);
   if (NumericIndexType == NULL) {
     return REDISMODULE_ERR;
   }
@@ -446,12 +778,15 @@ static int __cmd_docId(const void *p1, const void *p2) {
   return (int)e1->docId - (int)e2->docId;
 }
 void *NumericIndexType_RdbLoad(RedisModuleIO *rdb, int encver) {
-  if (encver != 0) {
+  if (encver > NUMERIC_INDEX_ENCVER) {
     return 0;
   }
 
   NumericRangeTree *t = NewNumericRangeTree();
   uint64_t num = RedisModule_LoadUnsigned(rdb);
+  if (encver >= NUMERIC_INDEX_DOCIDGEN_VER) {
+    t->docIdGen = RedisModule_LoadUnsigned(rdb);
+  }
 
   // we create an array of all the entries so that we can sort them by docId
   NumericRangeEntry *entries = calloc(num, sizeof(NumericRangeEntry));
@@ -499,6 +834,7 @@ void NumericIndexType_RdbSave(RedisModuleIO *rdb, void *value) {
   NumericRangeTree *t = value;
 
   RedisModule_SaveUnsigned(rdb, t->numEntries);
+  RedisModule_SaveUnsigned(rdb, t->docIdGen);
 
   struct __niRdbSaveCtx ctx = {rdb, 0};
 
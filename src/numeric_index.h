@@ -14,6 +14,10 @@
 
 #define RT_LEAF_CARDINALITY_MAX 500
 
+#define NUMERIC_INDEX_ENCVER 1
+// Versions below this do not save the docIdGen of the tree
+#define NUMERIC_INDEX_DOCIDGEN_VER 1
+
 /* A numeric range is a node in a numeric range tree, representing a range of values bunched
  * toghether.
  * Since we do not know the distribution of scores ahead, we use a splitting approach - we start
@@ -49,6 +53,8 @@ typedef struct {
   size_t card;
 
   uint32_t revisionId;
+  // the docIdGen of the docIds in the tree, see DocTable
+  uint32_t docIdGen;
 } NumericRangeTree;
 
 struct indexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f);
@@ -56,6 +62,13 @@ struct indexIterator *NewNumericRangeIterator(NumericRange *nr, NumericFilter *f
 struct indexIterator *NewNumericFilterIterator(RedisSearchCtx *ctx, NumericFilter *flt,
                                                ConcurrentSearchCtx *csx);
 
+/* Create an iterator over the results of child that pass a numeric filter, by checking the value
+ * of a sortable field in the documents' sorting vectors rather than reading the numeric index. This
+ * is cheaper than intersecting with the filter when the child is much sparser than the filter.
+ * sortIdx is the index of the field in the sorting table. The filter is not owned by the iterator */
+struct indexIterator *NewNumericPostFilterIterator(struct indexIterator *child, NumericFilter *f,
+                                                   DocTable *dt, int sortIdx);
+
 /* Add an entry to a numeric range node. Returns the cardinality of the range after the
  * inserstion.
  * No deduplication is done */
@@ -84,16 +97,56 @@ NumericRangeTree *NewNumericRangeTree();
 /* Add a value to a tree. Returns 0 if no nodes were split, 1 if we splitted nodes */
 int NumericRangeTree_Add(NumericRangeTree *t, t_docId docId, double value);
 
+/* Remove a document's record from a tree, where value is the value it was added with. If it is not
+ * found in the ranges of that value, every range of the tree is searched. Ranges keep their bounds
+ * and cardinality. Returns 1 if the tree held a record of the document */
+int NumericRangeTree_Delete(NumericRangeTree *t, t_docId docId, double value);
+
 /* Recursively find all the leaves under tree's root, that correspond to a given min-max range.
  * Returns a vector with range node pointers. */
 Vector *NumericRangeTree_Find(NumericRangeTree *t, double min, double max);
 
+/* Estimate the number of documents in the tree matching a filter */
+size_t NumericRangeTree_EstimateCard(NumericRangeTree *t, NumericFilter *f);
+
+/* Remove the records of deleted documents from the ranges of the tree, in traversal order from the
+ * range startRange on, until about num blocks were repaired. What was removed is added to stats if
+ * it is not NULL. Returns the range to continue from, or 0 if we reached the last range. Splitting
+ * the tree changes the order of its ranges, so a repair continued after a split may skip or repeat
+ * some of them */
+size_t NumericRangeTree_Repair(NumericRangeTree *t, DocTable *dt, size_t startRange, int num,
+                               IndexRepairStats *stats);
+
+/* Build renumbered copies of the blocks of the tree's ranges while its DocTable is being compacted,
+ * in traversal order from the range startRange on, until about num blocks were copied. See
+ * InvertedIndex_PrepareRenumber. Returns the range to continue from, or 0 if we reached the last
+ * range */
+size_t NumericRangeTree_PrepareRenumber(NumericRangeTree *t, const DocIdRemap *remap,
+                                        size_t startRange, int num);
+
+/* Renumber the records of all the ranges of the tree after its DocTable was compacted, removing
+ * those of deleted documents. Ranges whose blocks were copied ahead by
+ * NumericRangeTree_PrepareRenumber only switch to the copies and renumber the rest. What was
+ * removed is added to stats if it is not NULL */
+void NumericRangeTree_Renumber(NumericRangeTree *t, const DocIdRemap *remap,
+                               IndexRepairStats *stats);
+
+/* Renumber a numeric index if it was written before the spec's DocTable was last compacted. Returns
+ * 1 if the index was renumbered */
+int NumericIndex_Renumber(RedisSearchCtx *ctx, NumericRangeTree *t, IndexRepairStats *stats);
+
 /* Free the tree and all nodes */
 void NumericRangeTree_Free(NumericRangeTree *t);
 
 extern RedisModuleType *NumericIndexType;
 
+/* Open the numeric index of a field for writing, creating it if it does not exist. The index is
+ * renumbered first if the spec's DocTable was compacted since it was written */
 NumericRangeTree *OpenNumericIndex(RedisSearchCtx *ctx, const char *fname);
+
+/* Estimate the number of documents matching a filter, for query planning. Returns 0 if the field
+ * has no numeric index */
+size_t NumericIndex_EstimateFilter(RedisSearchCtx *ctx, NumericFilter *flt);
 int NumericIndexType_Register(RedisModuleCtx *ctx);
 void *NumericIndexType_RdbLoad(RedisModuleIO *rdb, int encver);
 void NumericIndexType_RdbSave(RedisModuleIO *rdb, void *value);
@@ -0,0 +1,118 @@
+#include "pfor.h"
+#include "varint.h"
+#include <string.h>
+
+static inline size_t pfor_varintSize(uint32_t value) {
+  size_t sz = 1;
+  while (value >>= 7) {
+    // each continuation byte steals one from the value, see WriteVarint
+    --value;
+    ++sz;
+  }
+  return sz;
+}
+
+/* Pick the bit width with the smallest encoded size for the values */
+static int pfor_bestWidth(const uint32_t *vals, uint32_t num) {
+  int best = 32;
+  size_t bestSize = (size_t)num * 4;
+  for (int b = 0; b < 32; b++) {
+    size_t sz = ((size_t)num * b + 7) / 8;
+    uint32_t lastExc = 0;
+    for (uint32_t i = 0; i < num && sz < bestSize; i++) {
+      if (vals[i] >> b) {
+        sz += pfor_varintSize(i - lastExc) + pfor_varintSize(vals[i] >> b);
+        lastExc = i;
+      }
+    }
+    if (sz < bestSize) {
+      best = b;
+      bestSize = sz;
+    }
+  }
+  return best;
+}
+
+size_t PFor_Encode(BufferWriter *bw, const uint32_t *vals, uint32_t num) {
+  int b = pfor_bestWidth(vals, num);
+  uint32_t numExc = 0;
+  for (uint32_t i = 0; i < num; i++) {
+    numExc += b < 32 && vals[i] >> b;
+  }
+
+  size_t sz = WriteVarint(num, bw);
+  uint8_t width = b;
+  sz += Buffer_Write(bw, &width, 1);
+  sz += WriteVarint(numExc, bw);
+
+  // pack the low bits of all values, least significant bits first
+  uint64_t acc = 0;
+  int bits = 0;
+  uint64_t mask = ((uint64_t)1 << b) - 1;
+  for (uint32_t i = 0; i < num; i++) {
+    acc |= (vals[i] & mask) << bits;
+    bits += b;
+    while (bits >= 8) {
+      uint8_t c = acc & 0xff;
+      sz += Buffer_Write(bw, &c, 1);
+      acc >>= 8;
+      bits -= 8;
+    }
+  }
+  if (bits) {
+    uint8_t c = acc & 0xff;
+    sz += Buffer_Write(bw, &c, 1);
+  }
+
+  // patch list for the values that did not fit
+  if (numExc) {
+    uint32_t lastExc = 0;
+    for (uint32_t i = 0; i < num; i++) {
+      if (vals[i] >> b) {
+        sz += WriteVarint(i - lastExc, bw);
+        sz += WriteVarint(vals[i] >> b, bw);
+        lastExc = i;
+      }
+    }
+  }
+  return sz;
+}
+
+uint32_t PFor_Count(BufferReader *br) {
+  size_t pos = br->pos;
+  uint32_t num = ReadVarint(br);
+  br->pos = pos;
+  return num;
+}
+
+uint32_t PFor_Decode(BufferReader *br, uint32_t *out) {
+  uint32_t num = ReadVarint(br);
+  int b = (uint8_t)BUFFER_READ_BYTE(br);
+  uint32_t numExc = ReadVarint(br);
+
+  if (b == 0) {
+    memset(out, 0, num * sizeof(*out));
+  } else {
+    const uint8_t *p = (uint8_t *)BufferReader_Current(br);
+    uint64_t mask = ((uint64_t)1 << b) - 1;
+    uint64_t acc = 0;
+    int bits = 0;
+    for (uint32_t i = 0; i < num; i++) {
+      while (bits < b) {
+        acc |= (uint64_t)*p++ << bits;
+        bits += 8;
+      }
+      out[i] = acc & mask;
+      acc >>= b;
+      bits -= b;
+    }
+    Buffer_Skip(br, ((size_t)num * b + 7) / 8);
+  }
+
+  uint32_t i = 0;
+  while (numExc--) {
+    i += ReadVarint(br);
+    out[i] |= (uint32_t)ReadVarint(br) << b;
+  }
+  return num;
+}
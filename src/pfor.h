@@ -0,0 +1,29 @@
+#ifndef __PFOR_H__
+#define __PFOR_H__
+
+#include <stdint.h>
+#include "buffer.h"
+
+/* PForDelta ("patched frame of reference") encoding of small arrays of unsigned integers.
+ *
+ * All the values are bit packed with a single width, chosen to minimize the encoded size. Values
+ * that do not fit in that width are "exceptions": their low bits are packed along with the rest,
+ * and their high bits are written after the packed data, as a list of varints.
+ *
+ * The encoded format is:
+ *  varint count | byte bit width | varint exception count | packed bits | exceptions
+ * where each exception is a varint delta from the previous exception's index, and a varint of the
+ * value's high bits.
+ */
+
+/* Encode num values to the writer. Returns the number of bytes written */
+size_t PFor_Encode(BufferWriter *bw, const uint32_t *vals, uint32_t num);
+
+/* Read the number of values encoded at the reader's position, without moving it */
+uint32_t PFor_Count(BufferReader *br);
+
+/* Decode the values at the reader's position into out, which must hold PFor_Count values. Returns
+ * the number of values decoded */
+uint32_t PFor_Decode(BufferReader *br, uint32_t *out);
+
+#endif
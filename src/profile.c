@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include "profile.h"
+#include "inverted_index.h"
+
+const char *QueryStage_Names[QueryStage_Count] = {
+    [QueryStage_Parse] = "parse",       [QueryStage_Expand] = "expand",
+    [QueryStage_Plan] = "plan",         [QueryStage_Open] = "open",
+    [QueryStage_Iterate] = "iterate",   [QueryStage_Score] = "score",
+    [QueryStage_Heap] = "heap",         [QueryStage_Load] = "load",
+    [QueryStage_Serialize] = "serialize",
+};
+
+typedef struct {
+  IndexIterator *child;
+  IteratorProfile *profile;
+} ProfileIteratorCtx;
+
+static int PI_Read(void *ctx, RSIndexResult **hit) {
+  ProfileIteratorCtx *pc = ctx;
+  uint64_t start = Profile_Now();
+  int rc = pc->child->Read(pc->child->ctx, hit);
+  pc->profile->ns += Profile_Now() - start;
+  pc->profile->reads++;
+  if (rc != INDEXREAD_EOF) pc->profile->records++;
+  return rc;
+}
+
+static int PI_SkipTo(void *ctx, uint32_t docId, RSIndexResult **hit) {
+  ProfileIteratorCtx *pc = ctx;
+  uint64_t start = Profile_Now();
+  int rc = pc->child->SkipTo(pc->child->ctx, docId, hit);
+  pc->profile->ns += Profile_Now() - start;
+  pc->profile->skips++;
+  if (rc != INDEXREAD_EOF) pc->profile->records++;
+  return rc;
+}
+
+static RSIndexResult *PI_Current(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->Current(pc->child->ctx);
+}
+
+static int PI_HasNext(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->HasNext(pc->child->ctx);
+}
+
+static t_docId PI_LastDocId(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->LastDocId(pc->child->ctx);
+}
+
+static size_t PI_Len(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->Len(pc->child->ctx);
+}
+
+static size_t PI_NumEstimated(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->NumEstimated(pc->child->ctx);
+}
+
+static double PI_MaxScore(void *ctx, t_docId docId, t_docId *until) {
+  ProfileIteratorCtx *pc = ctx;
+  return pc->child->MaxScore(pc->child->ctx, docId, until);
+}
+
+static void PI_Abort(void *ctx) {
+  ProfileIteratorCtx *pc = ctx;
+  pc->child->Abort(pc->child->ctx);
+}
+
+static void PI_Free(IndexIterator *it) {
+  ProfileIteratorCtx *pc = it->ctx;
+  // term readers know how many blocks they went through
+  if (pc->child->Read == IR_Read) {
+    pc->profile->blocks += ((IndexReader *)pc->child->ctx)->blocksRead;
+  }
+  pc->child->Free(pc->child);
+  free(pc);
+  free(it);
+}
+
+IndexIterator *NewProfileIterator(IndexIterator *child, IteratorProfile *p) {
+  ProfileIteratorCtx *pc = malloc(sizeof(*pc));
+  pc->child = child;
+  pc->profile = p;
+
+  IndexIterator *it = malloc(sizeof(*it));
+  it->ctx = pc;
+  it->Read = PI_Read;
+  it->SkipTo = PI_SkipTo;
+  it->Current = PI_Current;
+  it->HasNext = PI_HasNext;
+  it->LastDocId = PI_LastDocId;
+  it->Len = PI_Len;
+  it->NumEstimated = PI_NumEstimated;
+  it->MaxScore = child->MaxScore ? PI_MaxScore : NULL;
+  it->Free = PI_Free;
+  it->Abort = PI_Abort;
+  // the counters are not safe to update from several threads, so profiled queries run serially
+  it->Clone = NULL;
+  return it;
+}
+
+IndexIterator *ProfileIterator_Child(IndexIterator *it) {
+  return ((ProfileIteratorCtx *)it->ctx)->child;
+}
@@ -0,0 +1,66 @@
+#ifndef __RS_PROFILE_H__
+#define __RS_PROFILE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include "index_iterator.h"
+
+/* Counters collected for a single query node while profiling a query. The time is inclusive, i.e.
+ * it contains the time spent in the node's children */
+typedef struct {
+  size_t reads;
+  size_t skips;
+  // the number of records the node returned from both reads and skips
+  size_t records;
+  // the number of index blocks read, only counted for term readers
+  size_t blocks;
+  uint64_t ns;
+} IteratorProfile;
+
+/* Wrap an iterator with one counting the calls to it, the records it returns and the time spent in
+ * it into p. The counters are not owned by the iterator, and must outlive it */
+IndexIterator *NewProfileIterator(IndexIterator *child, IteratorProfile *p);
+
+/* Return the iterator wrapped by a profile iterator */
+IndexIterator *ProfileIterator_Child(IndexIterator *it);
+
+/* The stages of a query timed separately by FT.PROFILE */
+typedef enum {
+  QueryStage_Parse,
+  QueryStage_Expand,
+  QueryStage_Plan,
+  // creating the iterators of the query nodes
+  QueryStage_Open,
+  // reading the root iterator
+  QueryStage_Iterate,
+  QueryStage_Score,
+  // maintaining the top results heap
+  QueryStage_Heap,
+  // loading the documents of the results
+  QueryStage_Load,
+  // replying the results, not including the loading of documents
+  QueryStage_Serialize,
+  QueryStage_Count,
+} QueryStage;
+
+extern const char *QueryStage_Names[QueryStage_Count];
+
+/* The time spent in every stage of a query, in nanoseconds */
+typedef struct {
+  uint64_t ns[QueryStage_Count];
+} QueryProfile;
+
+static inline uint64_t Profile_Now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Add the time passed since *start to a stage, and reset *start to now */
+static inline void QueryProfile_Tick(QueryProfile *p, QueryStage stage, uint64_t *start) {
+  uint64_t now = Profile_Now();
+  p->ns[stage] += now - *start;
+  *start = now;
+}
+
+#endif
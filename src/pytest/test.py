@@ -3,6 +3,7 @@ import redis
 import unittest
 from hotels import hotels
 import random
+import time
 
 
 class SearchTestCase(ModuleTestCase('../redisearch.so')):
@@ -23,6 +24,87 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 self.assertExists(r, prefix + ':idx/world')
                 self.assertExists(r, prefix + ':idx/lorem')
 
+    def testAddLarge(self):
+        # documents with a lot of text are tokenized in the background with ASYNC
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'title', 'text', 'body', 'text', 'price', 'numeric'))
+            body = ' '.join('word%d' % i for i in range(1000))
+            for i in range(20):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'async',
+                                                'fields', 'title', 'hello world', 'body', body,
+                                                'price', i))
+            with self.assertResponseError():
+                r.execute_command('ft.add', 'idx', 'doc0', 1.0, 'async', 'fields', 'body', body)
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc0', 1.0, 'replace', 'async',
+                                            'fields', 'title', 'hello kitty', 'body', body,
+                                            'price', 100))
+
+            # a transaction can't wait for the document, so it is indexed right away, and the
+            # following commands of the transaction see it
+            with r.pipeline(transaction=True) as p:
+                p.execute_command('ft.add', 'idx', 'doc20', 1.0, 'async', 'fields',
+                                  'title', 'hello multi', 'body', body)
+                p.execute_command('ft.search', 'idx', 'multi', 'nocontent')
+                res = p.execute()
+            self.assertEqual('OK', res[0])
+            self.assertEqual([1L, 'doc20'], res[1])
+
+            # a document named like the option is not indexed in the background
+            self.assertOk(r.execute_command('ft.add', 'idx', 'async', 1.0, 'fields',
+                                            'title', 'hello async', 'body', body))
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello word999', 'nocontent', 'limit', '0', '0')
+                self.assertEqual(22, res[0])
+                res = r.execute_command('ft.search', 'idx', 'async', 'nocontent')
+                self.assertEqual([1L, 'async'], res)
+                res = r.execute_command('ft.search', 'idx', 'kitty', 'limit', '0', '1')
+                self.assertEqual(1, res[0])
+                self.assertEqual('doc0', res[1])
+                self.assertEqual(body, r.hget('doc0', 'body'))
+                res = r.execute_command('ft.search', 'idx', 'word500', 'nocontent',
+                                        'filter', 'price', 100, 100)
+                self.assertEqual([1, 'doc0'], res)
+
+    def testAddBatch(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'title', 'text', 'price', 'numeric'))
+            N = 100
+            args = ['ft.madd', 'idx', 'DOCUMENTS']
+            for i in range(N):
+                args += ['doc%d' % i, 1.0, 2, 'title',
+                         'hello world' if i % 2 == 0 else 'hello werld', 'price', i]
+            # a document that is already in the batch is rejected, the rest are added
+            args += ['doc0', 1.0, 1, 'title', 'hello']
+            res = r.execute_command(*args)
+            self.assertEqual(N + 1, len(res))
+            self.assertEqual(['OK'] * N, res[:N])
+            self.assertIsInstance(res[N], redis.ResponseError)
+
+            self.assertRaises(redis.ResponseError, r.execute_command,
+                              'ft.madd', 'idx', 'DOCUMENTS', 'doc', 1.0, 3, 'title', 'hello')
+            self.assertRaises(redis.ResponseError, r.execute_command,
+                              'ft.madd', 'idx', 'DOCUMENTS', 'doc', 2.0, 1, 'title', 'hello')
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello', 'nocontent', 'limit', '0', '0')
+                self.assertEqual(N, res[0])
+                res = r.execute_command(
+                    'ft.search', 'idx', 'world', 'nocontent', 'limit', '0', '0')
+                self.assertEqual(N / 2, res[0])
+                res = r.execute_command('ft.search', 'idx', 'werld', 'nocontent',
+                                        'filter', 'price', 10, 19)
+                self.assertEqual(5, res[0])
+                res = r.execute_command('ft.search', 'idx', 'hello', 'limit', '0', '1',
+                                        'filter', 'price', '42', '42')
+                self.assertEqual(['title', 'hello world', 'price', '42'], res[2])
+
     def testUnion(self):
 
         with self.redis() as r:
@@ -187,6 +269,198 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                 self.assertEqual(1, r.execute_command('ft.del', 'idx', did))
                 self.assertEqual(0, r.execute_command('ft.del', 'idx', did))
 
+    def testGarbageCollector(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric'))
+            N = 1000
+            for i in range(N):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello term%d' % i, 'n', i))
+            for i in range(N):
+                if i % 10:
+                    self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc%d' % i))
+
+            # wait for the collector to go over the whole index
+            for _ in range(100):
+                res = r.execute_command('ft.info', 'idx')
+                d = {res[i]: res[i + 1] for i in range(0, len(res), 2)}
+                if float(d['gc_garbage_ratio']) == 0:
+                    break
+                time.sleep(0.1)
+            self.assertEqual(0, float(d['gc_garbage_ratio']))
+            self.assertGreaterEqual(int(d['gc_passes']), 1)
+            self.assertGreaterEqual(int(d['gc_records_collected']), 2 * N * 9 / 10)
+            self.assertEqual(N * 9 / 10, int(d['gc_terms_removed']))
+            self.assertEqual(N / 10 + 1, int(d['num_terms']))
+            self.assertEqual(N / 10 * 2, int(d['num_records']))
+
+            res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, N)
+            self.assertEqual(N / 10, res[0])
+            res = r.execute_command('ft.search', 'idx', 'term11')
+            self.assertEqual([0], res)
+            res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                    'filter', 'n', 0, 99)
+            self.assertEqual(10, res[0])
+
+    def testCompaction(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric', 'sortable',
+                'loc', 'geo'))
+            N = 100
+            # every document is replaced 10 times, leaving 9 deleted docIds behind for each
+            for _ in range(10):
+                for i in range(N):
+                    self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'replace',
+                                                    'fields', 'f', 'hello term%d' % i, 'n', i,
+                                                    'loc', '%f,%f' % (i / 100.0, i / 100.0)))
+            res = r.execute_command('ft.info', 'idx')
+            d = {res[i]: res[i + 1] for i in range(0, len(res), 2)}
+            self.assertEqual(10 * N, int(d['max_doc_id']))
+
+            self.assertOk(r.execute_command('ft.compact', 'idx'))
+            with self.assertResponseError():
+                r.execute_command('ft.compact', 'nosuchidx')
+
+            # wait for the collector to renumber the whole index
+            for _ in range(100):
+                res = r.execute_command('ft.info', 'idx')
+                d = {res[i]: res[i + 1] for i in range(0, len(res), 2)}
+                if not int(d['gc_compacting']):
+                    break
+                time.sleep(0.1)
+            self.assertEqual(0, int(d['gc_compacting']))
+            self.assertEqual('none', d['gc_compaction'])
+            self.assertEqual(0, float(d['gc_compaction_wait_ms']))
+            self.assertEqual(1, int(d['gc_compactions']))
+            self.assertEqual(9 * N, int(d['gc_docids_reclaimed']))
+            self.assertEqual(N, int(d['max_doc_id']))
+            self.assertEqual(N, int(d['num_docs']))
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, N)
+                self.assertEqual(N, res[0])
+                res = r.execute_command('ft.search', 'idx', 'term11', 'nocontent')
+                self.assertEqual([1L, 'doc11'], res)
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'filter', 'n', 10, 19)
+                self.assertEqual(10, res[0])
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'geofilter', 'loc', 0, 0, 1, 'km')
+                self.assertEqual([1L, 'doc0'], res)
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'sortby', 'n', 'desc', 'limit', 0, 3)
+                self.assertEqual([N, 'doc99', 'doc98', 'doc97'], res)
+
+                # new documents get the docIds following the compacted ones
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % N, 1.0, 'fields',
+                                                'f', 'hello new', 'n', N))
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 0)
+                self.assertEqual(N + 1, res[0])
+                self.assertEqual(1, r.execute_command('ft.del', 'idx', 'doc%d' % N))
+
+    def testPartialUpdate(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric', 'sortable',
+                'loc', 'geo'))
+            N = 10
+            for i in range(N):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'f', 'hello term%d' % i, 'n', i,
+                                                'loc', '%f,%f' % (i / 100.0, i / 100.0)))
+
+            with self.assertResponseError():
+                r.execute_command('ft.add', 'idx', 'doc0', 1.0, 'partial', 'fields', 'n', 1)
+            with self.assertResponseError():
+                r.execute_command('ft.add', 'idx', 'doc0', 1.0, 'replace', 'partial',
+                                  'fields', 'n', 'notanumber')
+
+            # numeric and geo changes update the document in place, keeping its docId
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc0', 1.0, 'replace', 'partial',
+                                            'fields', 'n', 100, 'loc', '1,1'))
+            res = r.execute_command('ft.info', 'idx')
+            d = {res[i]: res[i + 1] for i in range(0, len(res), 2)}
+            self.assertEqual(N, int(d['max_doc_id']))
+            self.assertEqual(N, int(d['num_docs']))
+
+            for _ in r.retry_with_rdb_reload():
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'filter', 'n', 0, 0)
+                self.assertEqual([0L], res)
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'filter', 'n', 100, 100)
+                self.assertEqual([1L, 'doc0'], res)
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'sortby', 'n', 'desc', 'limit', 0, 2)
+                self.assertEqual([N, 'doc0', 'doc9'], res)
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                        'geofilter', 'loc', 1, 1, 1, 'km')
+                self.assertEqual([1L, 'doc0'], res)
+                # the other fields were kept
+                res = r.execute_command('ft.search', 'idx', 'term0')
+                self.assertEqual(1, res[0])
+                self.assertEqual(['f', 'hello term0', 'n', '100', 'loc', '1,1'], res[2])
+
+            # changing a full text field indexes the merged document again
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc1', 1.0, 'replace', 'partial',
+                                            'fields', 'f', 'hello world'))
+            res = r.execute_command('ft.info', 'idx')
+            d = {res[i]: res[i + 1] for i in range(0, len(res), 2)}
+            self.assertEqual(N + 1, int(d['max_doc_id']))
+            self.assertEqual(N, int(d['num_docs']))
+            res = r.execute_command('ft.search', 'idx', 'term1', 'nocontent')
+            self.assertEqual([0L], res)
+            res = r.execute_command('ft.search', 'idx', 'world', 'nocontent',
+                                    'filter', 'n', 1, 1)
+            self.assertEqual([1L, 'doc1'], res)
+
+            # documents that are not in the index are added as they are
+            self.assertOk(r.execute_command('ft.add', 'idx', 'newdoc', 1.0, 'replace', 'partial',
+                                            'fields', 'f', 'hello new'))
+            res = r.execute_command('ft.search', 'idx', 'new', 'nocontent')
+            self.assertEqual([1L, 'newdoc'], res)
+
+            # only the options between the score and FIELDS are looked at
+            self.assertOk(r.execute_command('ft.add', 'idx', 'partial', 1.0, 'payload',
+                                            'partial', 'fields', 'f', 'hello partial'))
+            res = r.execute_command('ft.search', 'idx', 'partial', 'nocontent')
+            self.assertEqual([1L, 'partial'], res)
+
+    def testPartialUpdateScore(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'f', 'text', 'n', 'numeric'))
+            # the scores decrease with the docIds, so the last documents are neither in the score
+            # index of "hello" nor in a block that can beat the first ones
+            N = 150
+            for i in range(N):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, (N - i) / 1000.0,
+                                                'fields', 'f', 'hello world', 'n', i))
+
+            # raising the score indexes the document again, so its bounds are raised too
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc149', 1.0, 'replace', 'partial',
+                                            'fields', 'n', 1000))
+            for _ in r.retry_with_rdb_reload():
+                # a single term query is answered by the term's score index
+                res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 1)
+                self.assertEqual(['doc149'], res[1:])
+                # unions skip the blocks whose max score can't make it into the top results
+                res = r.execute_command('ft.search', 'idx', 'hello|world', 'nocontent',
+                                        'limit', 0, 1)
+                self.assertEqual(['doc149'], res[1:])
+
+            # and so does lowering it
+            self.assertOk(r.execute_command('ft.add', 'idx', 'doc0', 0.0001, 'replace', 'partial',
+                                            'fields', 'n', 1000))
+            res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 2)
+            self.assertEqual(['doc149', 'doc1'], res[1:])
+
     def testReplace(self):
 
         with self.redis() as r:
@@ -315,24 +589,102 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
             q = '(hello world) "what what" hello|world @bar:[10 100]|@bar:[200 300]'
             res = r.execute_command('ft.explain', 'idx', q)
 
-            self.assertEqual(res, """INTERSECT {
-  hello
-  world
-  EXACT {
-    what
-    what
+            self.assertEqual(res, """INTERSECT [~0] {
+  hello [~0]
+  world [~0]
+  EXACT [~0] {
+    what [~0]
+    what [~0]
   }
-  UNION {
-    hello
-    world
+  UNION [~0] {
+    hello [~0]
+    world [~0]
   }
-  UNION {
-    NUMERIC {10.000000 <= @bar <= 100.000000}
-    NUMERIC {200.000000 <= @bar <= 300.000000}
+  UNION [~0] {
+    NUMERIC {10.000000 <= @bar <= 100.000000} [~0]
+    NUMERIC {200.000000 <= @bar <= 300.000000} [~0]
   }
 }
 """)
 
+            # the planner orders the intersection by the estimates, and checks the wide numeric
+            # filter on the results of the rare term
+            for i in range(100):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'foo', 'hello world' if i else 'hello werld',
+                                                'bar', i))
+            res = r.execute_command('ft.explain', 'idx', 'hello werld @bar:[0 100]')
+            self.assertEqual(res, """INTERSECT [~1] {
+  werld [~1]
+  hello [~100]
+  NUMERIC {0.000000 <= @bar <= 100.000000} [~100, post filter]
+}
+""")
+            res = r.execute_command('ft.search', 'idx', 'hello werld @bar:[0 100]', 'nocontent')
+            self.assertEqual([1L, 'doc0'], res)
+
+    def testQueryCache(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'foo', 'text', 'bar', 'numeric'))
+            for i in range(10):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'foo', 'hello world', 'bar', i))
+
+            def cacheStats():
+                info = r.execute_command('ft.info', 'idx')
+                info = dict(zip(info[::2], info[1::2]))
+                return [int(float(info['query_cache_%s' % k])) for k in ('hits', 'misses')]
+
+            res = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 3)
+            self.assertEqual(res, r.execute_command('ft.search', 'idx', 'hello  ', 'nocontent',
+                                                    'limit', 0, 3))
+            self.assertEqual([1, 1], cacheStats())
+
+            # different paging and filters are cached separately
+            self.assertEqual(3, len(r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                                      'limit', 0, 2)))
+            self.assertEqual(3, len(r.execute_command('ft.search', 'idx', 'hello', 'nocontent',
+                                                      'filter', 'bar', 0, 1)))
+            self.assertEqual([1, 3], cacheStats())
+
+            # changing the index invalidates the cache
+            self.assertEqual(1, r.execute_command('ft.del', 'idx', res[1]))
+            res2 = r.execute_command('ft.search', 'idx', 'hello', 'nocontent', 'limit', 0, 3)
+            self.assertEqual(9, res2[0])
+            self.assertNotIn(res[1], res2)
+            self.assertEqual([1, 4], cacheStats())
+
+    def testProfile(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'foo', 'text'))
+            for i in range(100):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'foo', 'hello world' if i else 'hello werld'))
+
+            res, prof = r.execute_command('ft.profile', 'idx', 'search', 'hello werld',
+                                          'nocontent')
+            self.assertEqual([1L, 'doc0'], res)
+            stages = dict(zip(prof[:-2:2], prof[1:-2:2]))
+            self.assertItemsEqual(['parse', 'expand', 'plan', 'open', 'iterate', 'score',
+                                   'heap', 'load', 'serialize'], stages.keys())
+            for t in stages.values():
+                self.assertGreaterEqual(float(t), 0)
+
+            self.assertEqual('iterators', prof[-2])
+            root = prof[-1]
+            self.assertEqual('INTERSECT [~1]', root[0])
+            counters = dict(zip(root[1:11:2], root[2:11:2]))
+            self.assertEqual(1, counters['records'])
+            self.assertEqual('children', root[11])
+            self.assertEqual(['werld [~1]', 'hello [~100]'], [c[0] for c in root[12]])
+
+            with self.assertResponseError():
+                r.execute_command('ft.profile', 'idx', 'explain', 'hello')
+
     def testPaging(self):
         with self.redis() as r:
             r.flushdb()
@@ -393,6 +745,47 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
                     'ft.search', 'idx', 'constant term9*', 'nocontent')
                 self.assertEqual([0], res)
 
+    def testWidePrefixScoring(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'schema', 'title', 'text', 'weight', 5.0, 'body', 'text',
+                'n', 'numeric', 'sortable'))
+            # the prefix expands to more terms than it takes to be read into a bitmap
+            N = 100
+            for i in range(N):
+                self.assertOk(r.execute_command('ft.add', 'idx', 'doc%d' % i, 1.0, 'fields',
+                                                'title', ' '.join(['term%d' % i] * (1 + i % 7)),
+                                                'body', 'hello world', 'n', i))
+            self.assertOk(r.execute_command('ft.add', 'idx', 'other', 1.0, 'fields',
+                                            'title', 'nothing', 'body', 'termx', 'n', N))
+            union = '(%s)' % '|'.join('term%d' % i for i in range(N))
+
+            for _ in r.retry_with_rdb_reload():
+                # a scored prefix ranks its documents by the frequencies of the expanded terms, as
+                # the union of the terms does
+                res = r.execute_command('ft.search', 'idx', 'term*', 'nocontent', 'withscores',
+                                        'infields', 1, 'title', 'limit', 0, N)
+                expected = r.execute_command('ft.search', 'idx', '@title:' + union, 'nocontent',
+                                             'withscores', 'limit', 0, N)
+                self.assertEqual(N, res[0])
+                self.assertEqual(expected, res)
+                res = r.execute_command('ft.search', 'idx', 'hello term*', 'nocontent',
+                                        'withscores', 'limit', 0, 10)
+                expected = r.execute_command('ft.search', 'idx', 'hello ' + union, 'nocontent',
+                                             'withscores', 'limit', 0, 10)
+                self.assertEqual(expected, res)
+
+                # sorted by a field, the prefix only filters, and keeps its field mask
+                res = r.execute_command('ft.search', 'idx', '@title:term*', 'nocontent',
+                                        'sortby', 'n', 'desc', 'limit', 0, 3)
+                self.assertEqual([N, 'doc99', 'doc98', 'doc97'], res)
+                res = r.execute_command('ft.search', 'idx', 'term*', 'nocontent',
+                                        'sortby', 'n', 'desc', 'limit', 0, 3)
+                self.assertEqual([N + 1, 'other', 'doc99', 'doc98'], res)
+                res = r.execute_command('ft.search', 'idx', 'hello -term*', 'nocontent')
+                self.assertEqual([0], res)
+
     def testSortBy(self):
         with self.redis() as r:
             r.flushdb()
@@ -505,6 +898,64 @@ class SearchTestCase(ModuleTestCase('../redisearch.so')):
             with self.assertResponseError():
                 self.cmd('ft.search', 'idx', 'hello', 'inkeys', 4, 'foo')
 
+    def testHashKeys(self):
+        with self.redis() as r:
+            r.flushdb()
+            self.assertOk(r.execute_command(
+                'ft.create', 'idx', 'hashkeys', 'schema', 'foo', 'text'))
+            info = r.execute_command('ft.info', 'idx')
+            self.assertIn('HASHKEYS', info[info.index('index_options') + 1])
+
+            keys = ['%08x-%04x' % (i * 2654435761 % 2**32, i) for i in range(200)]
+            for k in keys:
+                self.assertOk(r.execute_command('ft.add', 'idx', k, 1.0, 'fields',
+                                                'foo', 'hello world'))
+            for k in keys[:100]:
+                self.assertEqual(1, r.execute_command('ft.del', 'idx', k))
+
+            for _ in r.retry_with_rdb_reload():
+                info = r.execute_command('ft.info', 'idx')
+                self.assertIn('HASHKEYS', info[info.index('index_options') + 1])
+                self.assertGreater(float(info[info.index('key_table_size_mb') + 1]), 0)
+
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello world', 'NOCONTENT', 'LIMIT', 0, 300)
+                self.assertEqual(100, res[0])
+                res = r.execute_command(
+                    'ft.search', 'idx', 'hello world', 'NOCONTENT', 'INKEYS', 3, *keys[98:101])
+                self.assertEqual([1, keys[100]], res)
+                with self.assertResponseError():
+                    r.execute_command('ft.add', 'idx', keys[150], 1.0, 'fields', 'foo', 'bar')
+
+    def testAsciiFold(self):
+        # "\xc3\x9cBER" is "ÜBER", "\xc3\xbcber" is "über" and "\xc3\x9cber" is "Über"
+        with self.redis() as r:
+            r.flushdb()
+            # indexes created before Unicode case folding are rewritten to the AOF with ASCIIFOLD
+            self.assertOk(r.execute_command(
+                'ft.create', 'old', 'asciifold', 'schema', 'foo', 'text'))
+            self.assertOk(r.execute_command(
+                'ft.create', 'new', 'schema', 'foo', 'text'))
+            for idx in ('old', 'new'):
+                self.assertOk(r.execute_command('ft.add', idx, 'doc1', 1.0, 'fields',
+                                                'foo', 'hello \xc3\x9cBER'))
+
+            for _ in r.retry_with_rdb_reload():
+                info = r.execute_command('ft.info', 'old')
+                self.assertIn('ASCIIFOLD', info[info.index('index_options') + 1])
+                info = r.execute_command('ft.info', 'new')
+                self.assertNotIn('ASCIIFOLD', info[info.index('index_options') + 1])
+
+                # the old index only lowercases ASCII, in documents and queries alike
+                self.assertEqual([1L, 'doc1'], r.execute_command(
+                    'ft.search', 'old', 'HELLO \xc3\x9cber', 'nocontent'))
+                self.assertEqual([0L], r.execute_command(
+                    'ft.search', 'old', '\xc3\xbcber', 'nocontent'))
+
+                for q in ('\xc3\xbcber', '\xc3\x9cber', '\xc3\x9cBER'):
+                    self.assertEqual([1L, 'doc1'], r.execute_command(
+                        'ft.search', 'new', q, 'nocontent'))
+
     def testSlopInOrder(self):
         with self.redis() as r:
             r.flushdb()
@@ -6,6 +6,12 @@
 #include "rmalloc.h"
 #include "qint.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define QINT_SIMD
+#include <immintrin.h>
+#include <pthread.h>
+#endif
+
 QINT_API size_t qint_encode(BufferWriter *bw, uint32_t arr[], int len) {
   if (len <= 0 || len > 4) return 0;
 
@@ -197,6 +203,152 @@ QINT_API size_t qint_decode4(BufferReader *br, uint32_t *i, uint32_t *i2, uint32
   return total + 1;
 }
 
+QINT_API uint32_t qint_decodeFirst(BufferReader *br, int len) {
+  const uint8_t *p = (uint8_t *)BufferReader_Current(br);
+  const uint8_t header = *p++;
+  uint32_t ret;
+  size_t total = 1, nused;
+  QINT_DECODE_VALUE(ret, header & 0x03, p, nused);
+  total += nused;
+  // the sizes of the rest of the integers are encoded in the leading byte, no need to read them
+  for (int i = 1; i < len; i++) {
+    total += ((header >> (i * 2)) & 0x03) + 1;
+  }
+  Buffer_Skip(br, total);
+  return ret;
+}
+
+/* The encoded size of 4 integers (without the leading byte) for every possible leading byte */
+static uint8_t qintSizes[256];
+/* Per leading byte, a shuffle mask moving the encoded bytes of 4 integers into 4 uint32 lanes */
+static uint8_t qintShuffleMasks[256][16];
+
+static void qint_initTables(void) {
+  for (int lead = 0; lead < 256; lead++) {
+    int off = 0;
+    for (int i = 0; i < 4; i++) {
+      int n = ((lead >> (i * 2)) & 0x03) + 1;
+      // 0x80 zeroes the high bytes of the lane
+      for (int b = 0; b < 4; b++) {
+        qintShuffleMasks[lead][i * 4 + b] = b < n ? off + b : 0x80;
+      }
+      off += n;
+    }
+    qintSizes[lead] = off;
+  }
+}
+
+/* The encoded size of the first len integers given a leading byte. Integers beyond len have zero
+ * bits in the leading byte, so we mask them out and deduct their one byte from the total */
+#define QINT_SIZE(lead, len) (qintSizes[(lead) & (0xFF >> (8 - (len)*2))] - (4 - (len)))
+
+QINT_API size_t qint_decodeBatchScalar(BufferReader *br, int len, int trailing, uint32_t *cols[],
+                                       uint32_t *positions, size_t max) {
+  const uint8_t *start = (uint8_t *)br->buf->data;
+  const uint8_t *p = (uint8_t *)BufferReader_Current(br);
+  const uint8_t *end = start + br->buf->offset;
+  size_t n = 0;
+
+  while (n < max && p < end) {
+    positions[n] = p - start;
+    const uint8_t header = *p++;
+    uint32_t val = 0;
+    for (int i = 0; i < len; i++) {
+      size_t nused;
+      QINT_DECODE_VALUE(val, (header >> (i * 2)) & 0x03, p, nused);
+      cols[i][n] = val;
+      p += nused;
+    }
+    if (trailing) {
+      p += val;
+    }
+    n++;
+  }
+  positions[n] = p - start;
+  Buffer_Skip(br, (p - start) - br->pos);
+  return n;
+}
+
+#ifdef QINT_SIMD
+static pthread_once_t qintTablesOnce = PTHREAD_ONCE_INIT;
+
+/* Transpose 4 decoded records into the columns, at record offset n */
+__attribute__((target("ssse3"))) static inline void qint_storeColumns(__m128i v[4], int len,
+                                                                       uint32_t *cols[], size_t n) {
+  __m128i t0 = _mm_unpacklo_epi32(v[0], v[1]);
+  __m128i t1 = _mm_unpacklo_epi32(v[2], v[3]);
+  __m128i t2 = _mm_unpackhi_epi32(v[0], v[1]);
+  __m128i t3 = _mm_unpackhi_epi32(v[2], v[3]);
+  __m128i c[4] = {_mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                  _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3)};
+  for (int i = 0; i < len; i++) {
+    _mm_storeu_si128((__m128i *)(cols[i] + n), c[i]);
+  }
+}
+
+__attribute__((target("ssse3"))) static size_t qint_decodeBatchSSE(BufferReader *br, int len,
+                                                                   int trailing, uint32_t *cols[],
+                                                                   uint32_t *positions,
+                                                                   size_t max) {
+  const uint8_t *start = (uint8_t *)br->buf->data;
+  const uint8_t *p = (uint8_t *)BufferReader_Current(br);
+  const uint8_t *end = start + br->buf->offset;
+  size_t n = 0;
+  __m128i v[4];
+  int nv = 0;
+
+  // we load 16 bytes after each leading byte, so near the end of the buffer we fall back to scalar
+  while (n + nv < max && end - p > 16) {
+    positions[n + nv] = p - start;
+    const uint8_t header = *p;
+    v[nv] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 1)),
+                             _mm_loadu_si128((const __m128i *)qintShuffleMasks[header]));
+    p += 1 + QINT_SIZE(header, len);
+    if (trailing) {
+      uint32_t rec[4];
+      _mm_storeu_si128((__m128i *)rec, v[nv]);
+      p += rec[len - 1];
+    }
+    if (++nv == 4) {
+      qint_storeColumns(v, len, cols, n);
+      n += 4;
+      nv = 0;
+    }
+  }
+
+  // flush the records of an incomplete group
+  for (int j = 0; j < nv; j++, n++) {
+    uint32_t rec[4];
+    _mm_storeu_si128((__m128i *)rec, v[j]);
+    for (int i = 0; i < len; i++) {
+      cols[i][n] = rec[i];
+    }
+  }
+
+  Buffer_Skip(br, (p - start) - br->pos);
+  uint32_t *tail[4];
+  for (int i = 0; i < len; i++) {
+    tail[i] = cols[i] + n;
+  }
+  return n + qint_decodeBatchScalar(br, len, trailing, tail, positions + n, max - n);
+}
+#endif
+
+QINT_API size_t qint_decodeBatch(BufferReader *br, int len, int trailing, uint32_t *cols[],
+                                 uint32_t *positions, size_t max) {
+#ifdef QINT_SIMD
+  static int hasSSSE3 = -1;
+  if (hasSSSE3 == -1) {
+    hasSSSE3 = __builtin_cpu_supports("ssse3");
+  }
+  if (hasSSSE3) {
+    pthread_once(&qintTablesOnce, qint_initTables);
+    return qint_decodeBatchSSE(br, len, trailing, cols, positions, max);
+  }
+#endif
+  return qint_decodeBatchScalar(br, len, trailing, cols, positions, max);
+}
+
 // void printConfig(unsigned char c) {
 
 //   int off = 1;
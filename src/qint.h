@@ -49,4 +49,22 @@ QINT_API size_t qint_decode3(BufferReader *br, uint32_t *i, uint32_t *i2, uint32
 QINT_API size_t qint_decode4(BufferReader *br, uint32_t *i, uint32_t *i2, uint32_t *i3,
                              uint32_t *i4);
 
+/* Decode only the first of len integers encoded with one leading byte, and advance the reader past
+ * all of them. Returns the first integer */
+QINT_API uint32_t qint_decodeFirst(BufferReader *br, int len);
+
+/* Decode up to max consecutive records of len (<= 4) qint encoded integers each, into column
+ * arrays: the i-th integer of every record is written to cols[i]. If trailing is set, the last
+ * integer of each record is the length of raw data following the integers, which is skipped.
+ * The offset of every record in the buffer is written to positions, plus one extra entry for the
+ * end of the last record. Returns the number of records decoded.
+ *
+ * This uses SSSE3 shuffles keyed by the leading byte where the CPU supports them */
+QINT_API size_t qint_decodeBatch(BufferReader *br, int len, int trailing, uint32_t *cols[],
+                                 uint32_t *positions, size_t max);
+
+/* The portable implementation of qint_decodeBatch, decoding one integer at a time */
+QINT_API size_t qint_decodeBatchScalar(BufferReader *br, int len, int trailing, uint32_t *cols[],
+                                       uint32_t *positions, size_t max);
+
 #endif
\ No newline at end of file
@@ -15,9 +15,25 @@
 #include "ext/default.h"
 #include "rmutil/sds.h"
 #include "concurrent_ctx.h"
+#include "id_bitmap.h"
 
 #define MAX_PREFIX_EXPANSIONS 200
 
+/* Prefixes expanding to more terms than this, or to terms with more documents than this in total,
+ * are materialized into a docId bitmap instead of being evaluated as a union, if they only filter
+ * the results */
+#define PREFIX_BITMAP_MIN_EXPANSIONS 64
+#define PREFIX_BITMAP_MIN_DOCS 100000
+
+/* Numeric filters on sortable fields matching this many times more documents than their sparsest
+ * sibling are checked against the sorting vectors of the sibling's results instead */
+#define QUERY_POSTFILTER_MIN_RATIO 10
+
+/* Queries expected to yield more results than this are evaluated in parallel, with every thread
+ * covering at least QUERY_PARALLEL_MIN_DOCS docIds */
+#define QUERY_PARALLEL_MIN_RESULTS 200000
+#define QUERY_PARALLEL_MIN_DOCS 50000
+
 static void QueryTokenNode_Free(QueryTokenNode *tn) {
   if (tn->str) free(tn->str);
 }
@@ -211,6 +227,16 @@ IndexIterator *Query_EvalTokenNode(Query *q, QueryNode *qn) {
     return NULL;
   }
 
+  // if the term is the entire query and it's ranked by TF-IDF, its top results may all be in the
+  // term's score index
+  if (isSingleWord && qn == q->root && qn->fieldMask == RS_FIELDMASK_ALL && !q->sortKey &&
+      q->scorer == TFIDFScorer) {
+    IndexIterator *it = NewScoreIndexIterator(ir, q->docTable, q->offset + q->limit);
+    if (it) {
+      return it;
+    }
+  }
+
   return NewReadIterator(ir);
 }
 
@@ -236,6 +262,8 @@ static IndexIterator *Query_EvalPrefixNode(Query *q, QueryNode *qn) {
   t_len slen = 0;
   float score = 0;
   int dist = 0;
+  size_t totalDocs = 0;
+  size_t firstKey = q->conc.numOpenKeys;
 
   // an upper limit on the number of expansions is enforced to avoid stuff like "*"
 
@@ -256,6 +284,7 @@ static IndexIterator *Query_EvalPrefixNode(Query *q, QueryNode *qn) {
     if (!ir) continue;
 
     // Add the reader to the iterator array
+    totalDocs += ir->idx->numDocs;
     its[itsSz++] = NewReadIterator(ir);
     if (itsSz == itsCap) {
       itsCap *= 2;
@@ -271,6 +300,20 @@ static IndexIterator *Query_EvalPrefixNode(Query *q, QueryNode *qn) {
     free(its);
     return NULL;
   }
+
+  // For very wide expansions, merging all the readers on every step costs much more than reading
+  // them once into a bitmap. The bitmap loses the frequencies, fields and offsets of the records,
+  // so we only use it where they don't matter: when the results are sorted by a field rather than
+  // scored, or the prefix is negated, and no phrase above it checks positions. The readers were
+  // opened with the node's field mask, so the bitmap only holds documents matching in its fields.
+  // They are consumed right away, so their keys need not be reopened
+  int filterOnly = (q->sortKey || q->filterDepth) && !q->positionsDepth;
+  int wide = itsSz >= PREFIX_BITMAP_MIN_EXPANSIONS || totalDocs >= PREFIX_BITMAP_MIN_DOCS;
+  if (filterOnly && wide) {
+    IndexIterator *ret = NewIdBitmapIterator(its, itsSz);
+    ConcurrentSearch_ReleaseKeys(&q->conc, firstKey);
+    return ret;
+  }
   return NewUnionIterator(its, itsSz, q->docTable, 1);
 }
 
@@ -279,26 +322,46 @@ static IndexIterator *Query_EvalPhraseNode(Query *q, QueryNode *qn) {
     return NULL;
   }
   QueryPhraseNode *node = &qn->pn;
-  // an intersect stage with one child is the same as the child, so we just
-  // return it
-  if (node->numChildren == 1) {
-    node->children[0]->fieldMask &= qn->fieldMask;
-    return Query_EvalNode(q, node->children[0]);
-  }
-
-  // recursively eval the children
-  IndexIterator **iters = calloc(node->numChildren, sizeof(IndexIterator *));
+  // post filters are applied to the intersection of the other children
+  QueryNode *children[node->numChildren];
+  int n = 0;
   for (int i = 0; i < node->numChildren; i++) {
-    node->children[i]->fieldMask &= qn->fieldMask;
-    iters[i] = Query_EvalNode(q, node->children[i]);
+    if (!node->children[i]->postFilter) children[n++] = node->children[i];
   }
+
   IndexIterator *ret;
-  if (node->exact) {
-    ret = NewIntersecIterator(iters, node->numChildren, q->docTable, q->fieldMask & qn->fieldMask,
-                              0, 1);
+  // an intersect stage with one child is the same as the child, so we just
+  // return it
+  if (n == 1) {
+    children[0]->fieldMask &= qn->fieldMask;
+    ret = Query_EvalNode(q, children[0]);
   } else {
-    ret = NewIntersecIterator(iters, node->numChildren, q->docTable, q->fieldMask & qn->fieldMask,
-                              q->maxSlop, q->inOrder);
+    // recursively eval the children
+    IndexIterator **iters = calloc(n, sizeof(IndexIterator *));
+    int checksPositions = node->exact || q->maxSlop >= 0;
+    q->positionsDepth += checksPositions;
+    for (int i = 0; i < n; i++) {
+      children[i]->fieldMask &= qn->fieldMask;
+      iters[i] = Query_EvalNode(q, children[i]);
+    }
+    q->positionsDepth -= checksPositions;
+    if (node->exact) {
+      ret = NewIntersecIterator(iters, n, q->docTable, q->fieldMask & qn->fieldMask, 0, 1);
+    } else {
+      ret = NewIntersecIterator(iters, n, q->docTable, q->fieldMask & qn->fieldMask, q->maxSlop,
+                                q->inOrder);
+    }
+  }
+
+  for (int i = 0; i < node->numChildren && ret; i++) {
+    QueryNode *pf = node->children[i];
+    if (pf->postFilter) {
+      int idx = RSSortingTable_GetFieldIdx(q->ctx->spec->sortables, pf->nn.nf->fieldName);
+      ret = NewNumericPostFilterIterator(ret, pf->nn.nf, q->docTable, idx);
+      if (q->profile) {
+        ret = NewProfileIterator(ret, &pf->profile);
+      }
+    }
   }
   return ret;
 }
@@ -317,7 +380,10 @@ static IndexIterator *Query_EvalNotNode(Query *q, QueryNode *qn) {
   }
   QueryNotNode *node = &qn->not;
 
-  return NewNotIterator(node->child ? Query_EvalNode(q, node->child) : NULL);
+  q->filterDepth++;
+  IndexIterator *child = node->child ? Query_EvalNode(q, node->child) : NULL;
+  q->filterDepth--;
+  return NewNotIterator(child);
 }
 
 static IndexIterator *Query_EvalOptionalNode(Query *q, QueryNode *qn) {
@@ -388,30 +454,48 @@ static IndexIterator *Query_EvalUnionNode(Query *q, QueryNode *qn) {
 }
 
 IndexIterator *Query_EvalNode(Query *q, QueryNode *n) {
+  // the planner knows the node is empty, no need to open anything
+  if (q->planned && n->card == 0) {
+    return NULL;
+  }
+  IndexIterator *ret = NULL;
   switch (n->type) {
     case QN_TOKEN:
-      return Query_EvalTokenNode(q, n);
+      ret = Query_EvalTokenNode(q, n);
+      break;
     case QN_PHRASE:
-      return Query_EvalPhraseNode(q, n);
+      ret = Query_EvalPhraseNode(q, n);
+      break;
     case QN_UNION:
-      return Query_EvalUnionNode(q, n);
+      ret = Query_EvalUnionNode(q, n);
+      break;
     case QN_NOT:
-      return Query_EvalNotNode(q, n);
+      ret = Query_EvalNotNode(q, n);
+      break;
     case QN_PREFX:
-      return Query_EvalPrefixNode(q, n);
+      ret = Query_EvalPrefixNode(q, n);
+      break;
     case QN_NUMERIC:
-      return Query_EvalNumericNode(q, &n->nn);
+      ret = Query_EvalNumericNode(q, &n->nn);
+      break;
     case QN_OPTIONAL:
-      return Query_EvalOptionalNode(q, n);
+      ret = Query_EvalOptionalNode(q, n);
+      break;
     case QN_GEO:
-      return Query_EvalGeofilterNode(q, &n->gn);
+      ret = Query_EvalGeofilterNode(q, &n->gn);
+      break;
     case QN_IDS:
-      return Query_EvalIdFilterNode(q, &n->fn);
+      ret = Query_EvalIdFilterNode(q, &n->fn);
+      break;
     case QN_WILDCARD:
-      return Query_EvalWildcardNode(q, n);
+      ret = Query_EvalWildcardNode(q, n);
+      break;
   }
 
-  return NULL;
+  if (ret && q->profile) {
+    ret = NewProfileIterator(ret, &n->profile);
+  }
+  return ret;
 }
 
 void QueryPhraseNode_AddChild(QueryNode *parent, QueryNode *child) {
@@ -451,6 +535,10 @@ Query *NewQueryFromRequest(RSSearchRequest *req) {
                req->slop, req->flags & Search_InOrder, req->scorer, req->payload, req->sortBy);
 
   q->docTable = &req->sctx->spec->docs;
+  q->parallel = req->flags & Search_Parallel ? 1 : 0;
+  if (req->flags & Search_Profile) {
+    q->profile = calloc(1, sizeof(QueryProfile));
+  }
 
   return q;
 }
@@ -473,6 +561,7 @@ Query *NewQuery(RedisSearchCtx *ctx, const char *query, size_t len, int offset,
   ret->payload = payload;
   ret->sortKey = sk;
   ret->aborted = 0;
+  ret->parallel = 0;
   ConcurrentSearchCtx_Init(ctx ? ctx->redisCtx : NULL, &ret->conc);
 
   // ret->expander = verbatim ? NULL : expander ? GetQueryExpander(expander) : NULL;
@@ -535,6 +624,133 @@ void Query_Expand(Query *q) {
   }
 }
 
+static size_t QueryNode_Estimate(Query *q, QueryNode *qn);
+
+/* Sum up the documents of the terms a prefix expands to, the same way the prefix is evaluated */
+static size_t Query_EstimatePrefix(Query *q, QueryNode *qn) {
+  Trie *terms = q->ctx->spec->terms;
+  if (qn->pfx.len < 3 || !terms) return 0;
+
+  TrieIterator *it = Trie_IteratePrefix(terms, qn->pfx.str, qn->pfx.len, 0);
+  rune *rstr = NULL;
+  t_len slen = 0;
+  float score = 0;
+  int dist = 0;
+  size_t n = 0, card = 0;
+  while (TrieIterator_Next(it, &rstr, &slen, NULL, &score, &dist) && n++ < MAX_PREFIX_EXPANSIONS) {
+    size_t len;
+    char *str = runesToStr(rstr, slen, &len);
+    card += Redis_TermNumDocs(q->ctx, str, len);
+    free(str);
+  }
+  DFAFilter_Free(it->ctx);
+  free(it->ctx);
+  TrieIterator_Free(it);
+  return card;
+}
+
+/* Estimate an intersection. Every child but the optional ones limits the results, so we take the
+ * smallest of them. Where the order of the children does not matter we also sort them by their
+ * estimates, and turn sparse numeric filters on sortable fields into post filters */
+static size_t Query_EstimatePhrase(Query *q, QueryNode *qn) {
+  QueryPhraseNode *pn = &qn->pn;
+  size_t card = q->docTable->size;
+  for (int i = 0; i < pn->numChildren; i++) {
+    size_t c = QueryNode_Estimate(q, pn->children[i]);
+    if (pn->children[i]->type != QN_OPTIONAL) card = MIN(card, c);
+  }
+
+  if (!pn->exact && q->maxSlop < 0 && !q->inOrder) {
+    // insertion sort, phrases have very few children
+    for (int i = 1; i < pn->numChildren; i++) {
+      QueryNode *cur = pn->children[i];
+      int j = i - 1;
+      for (; j >= 0 && pn->children[j]->card > cur->card; j--) {
+        pn->children[j + 1] = pn->children[j];
+      }
+      pn->children[j + 1] = cur;
+    }
+  }
+
+  for (int i = 0; i < pn->numChildren; i++) {
+    QueryNode *n = pn->children[i];
+    if (n->type != QN_NUMERIC ||
+        RSSortingTable_GetFieldIdx(q->ctx->spec->sortables, n->nn.nf->fieldName) < 0) {
+      continue;
+    }
+    // the sparsest sibling that can drive the intersection
+    size_t driver = SIZE_MAX;
+    for (int j = 0; j < pn->numChildren; j++) {
+      QueryNode *sib = pn->children[j];
+      if (j != i && sib->type != QN_NOT && sib->type != QN_OPTIONAL) {
+        driver = MIN(driver, sib->card);
+      }
+    }
+    n->postFilter =
+        driver != SIZE_MAX && driver > 0 && n->card >= QUERY_POSTFILTER_MIN_RATIO * driver;
+  }
+  return card;
+}
+
+static size_t QueryNode_Estimate(Query *q, QueryNode *qn) {
+  size_t numDocs = q->docTable->size;
+  size_t card = 0;
+  switch (qn->type) {
+    case QN_TOKEN:
+      card = Redis_TermNumDocs(q->ctx, qn->tn.str, qn->tn.len);
+      break;
+    case QN_PREFX:
+      card = Query_EstimatePrefix(q, qn);
+      break;
+    case QN_PHRASE:
+      card = Query_EstimatePhrase(q, qn);
+      break;
+    case QN_UNION:
+      for (int i = 0; i < qn->un.numChildren; i++) {
+        card += QueryNode_Estimate(q, qn->un.children[i]);
+      }
+      card = MIN(card, numDocs);
+      break;
+    case QN_NOT: {
+      // a negation cannot be proven empty by estimates, so it's never 0 unless the index is
+      size_t c = qn->not.child ? QueryNode_Estimate(q, qn->not.child) : 0;
+      card = numDocs > c ? numDocs - c : !!numDocs;
+    } break;
+    case QN_OPTIONAL:
+      if (qn->opt.child) QueryNode_Estimate(q, qn->opt.child);
+      card = numDocs;
+      break;
+    case QN_NUMERIC: {
+      const char *f = qn->nn.nf->fieldName;
+      FieldSpec *fs = IndexSpec_GetField(q->ctx->spec, f, strlen(f));
+      card = fs && fs->type == F_NUMERIC ? NumericIndex_EstimateFilter(q->ctx, qn->nn.nf) : 0;
+    } break;
+    case QN_GEO: {
+      const char *f = qn->gn.gf->property;
+      FieldSpec *fs = IndexSpec_GetField(q->ctx->spec, f, strlen(f));
+      if (fs && fs->type == F_GEO) {
+        GeoIndex gi = {.ctx = q->ctx, .sp = fs};
+        card = GeoIndex_EstimateFilter(&gi, qn->gn.gf);
+      }
+    } break;
+    case QN_IDS:
+      card = qn->fn.f->size;
+      break;
+    case QN_WILDCARD:
+      card = numDocs;
+      break;
+  }
+  return qn->card = card;
+}
+
+void Query_Plan(Query *q) {
+  if (!q->root || !q->ctx || !q->ctx->spec || !q->docTable) {
+    return;
+  }
+  QueryNode_Estimate(q, q->root);
+  q->planned = 1;
+}
+
 static sds doPad(sds s, int len) {
   if (!len) return s;
 
@@ -544,9 +760,14 @@ static sds doPad(sds s, int len) {
   return sdscat(s, buf);
 }
 
-static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
-  s = doPad(s, depth);
+/* Append the planner's estimate for a node, if the query was planned */
+static sds QueryNode_DumpEstimate(sds s, Query *q, QueryNode *qs) {
+  if (!q->planned) return s;
+  return sdscatprintf(s, qs->postFilter ? " [~%zu, post filter]" : " [~%zu]", qs->card);
+}
 
+/* Describe a node on a single line, without its children */
+static sds QueryNode_DumpHead(sds s, Query *q, QueryNode *qs) {
   if (qs->fieldMask == 0) {
     s = sdscat(s, "@NULL:");
   }
@@ -575,45 +796,25 @@ static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
 
   switch (qs->type) {
     case QN_PHRASE:
-      s = sdscatprintf(s, "%s {\n", qs->pn.exact ? "EXACT" : "INTERSECT");
-      for (int i = 0; i < qs->pn.numChildren; i++) {
-        s = QueryNode_DumpSds(s, q, qs->pn.children[i], depth + 1);
-      }
-      s = doPad(s, depth);
-
-      break;
+      return sdscat(s, qs->pn.exact ? "EXACT" : "INTERSECT");
+    case QN_UNION:
+      return sdscat(s, "UNION");
+    case QN_NOT:
+      return sdscat(s, "NOT");
+    case QN_OPTIONAL:
+      return sdscat(s, "OPTIONAL");
     case QN_TOKEN:
-      s = sdscatprintf(s, "%s%s\n", (char *)qs->tn.str, qs->tn.expanded ? "*" : "");
-      return s;
+      return sdscatprintf(s, "%s%s", (char *)qs->tn.str, qs->tn.expanded ? "*" : "");
 
     case QN_PREFX:
       s = sdscatprintf(s, "PREFIX{%s*", (char *)qs->pfx.str);
       break;
 
-    case QN_NOT:
-      s = sdscat(s, "NOT{\n");
-      s = QueryNode_DumpSds(s, q, qs->not.child, depth + 1);
-      s = doPad(s, depth);
-      break;
-
-    case QN_OPTIONAL:
-      s = sdscat(s, "OPTIONAL{\n");
-      s = QueryNode_DumpSds(s, q, qs->not.child, depth + 1);
-      s = doPad(s, depth);
-      break;
-
     case QN_NUMERIC: {
       NumericFilter *f = qs->nn.nf;
       s = sdscatprintf(s, "NUMERIC {%f %s @%s %s %f", f->min, f->inclusiveMin ? "<=" : "<",
                        f->fieldName, f->inclusiveMax ? "<=" : "<", f->max);
     } break;
-    case QN_UNION:
-      s = sdscat(s, "UNION {\n");
-      for (int i = 0; i < qs->un.numChildren; i++) {
-        s = QueryNode_DumpSds(s, q, qs->un.children[i], depth + 1);
-      }
-      s = doPad(s, depth);
-      break;
     case QN_GEO:
 
       s = sdscatprintf(s, "GEO {%f,%f --> %f %s", qs->gn.gf->lon, qs->gn.gf->lat, qs->gn.gf->radius,
@@ -631,9 +832,46 @@ static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
       s = sdscat(s, "<WILDCARD>");
       break;
   }
+  return sdscat(s, "}");
+}
 
-  s = sdscat(s, "}\n");
-  return s;
+/* Return the children of a node, if it has any */
+static QueryNode **QueryNode_Children(QueryNode *qs, int *num) {
+  switch (qs->type) {
+    case QN_PHRASE:
+      *num = qs->pn.numChildren;
+      return qs->pn.children;
+    case QN_UNION:
+      *num = qs->un.numChildren;
+      return qs->un.children;
+    case QN_NOT:
+      *num = 1;
+      return &qs->not.child;
+    case QN_OPTIONAL:
+      *num = 1;
+      return &qs->opt.child;
+    default:
+      *num = 0;
+      return NULL;
+  }
+}
+
+static sds QueryNode_DumpSds(sds s, Query *q, QueryNode *qs, int depth) {
+  s = doPad(s, depth);
+  s = QueryNode_DumpEstimate(QueryNode_DumpHead(s, q, qs), q, qs);
+
+  int num;
+  QueryNode **children = QueryNode_Children(qs, &num);
+  if (!children) {
+    return sdscat(s, "\n");
+  }
+
+  s = sdscat(s, qs->type == QN_NOT || qs->type == QN_OPTIONAL ? "{\n" : " {\n");
+  for (int i = 0; i < num; i++) {
+    s = QueryNode_DumpSds(s, q, children[i], depth + 1);
+  }
+  s = doPad(s, depth);
+  return sdscat(s, "}\n");
 }
 
 /* Return a string representation of the query parse tree. The string should be freed by the caller
@@ -650,6 +888,73 @@ const char *Query_DumpExplain(Query *q) {
   return ret;
 }
 
+/* Append the exact values of the filters of a node and its children. The parse tree only prints
+ * them rounded */
+static sds QueryNode_DumpFilters(sds s, QueryNode *qn) {
+  if (!qn) return s;
+  if (qn->type == QN_NUMERIC) {
+    NumericFilter *f = qn->nn.nf;
+    s = sdscatprintf(s, "|%a %a", f->min, f->max);
+  } else if (qn->type == QN_GEO) {
+    GeoFilter *gf = qn->gn.gf;
+    s = sdscatprintf(s, "|%a %a %a", gf->lon, gf->lat, gf->radius);
+  }
+  int n;
+  QueryNode **children = QueryNode_Children(qn, &n);
+  for (int i = 0; i < n; i++) {
+    s = QueryNode_DumpFilters(s, children[i]);
+  }
+  return s;
+}
+
+sds Query_CacheKey(Query *q) {
+  sds s = q->root ? QueryNode_DumpSds(sdsempty(), q, q->root, 0) : sdsnew("NULL");
+  s = QueryNode_DumpFilters(s, q->root);
+  s = sdscatprintf(s, "|%zu %zu %llx %d %d %p", q->offset, q->limit,
+                   (unsigned long long)q->fieldMask, q->maxSlop, q->inOrder, q->scorer);
+  if (q->sortKey) {
+    s = sdscatprintf(s, "|%d %d", q->sortKey->index, q->sortKey->ascending);
+  }
+  if (q->payload.data) {
+    s = sdscat(s, "|");
+    s = sdscatlen(s, q->payload.data, q->payload.len);
+  }
+  return s;
+}
+
+QueryResult *Query_CachedResult(Query *q, QueryCacheEntry *e) {
+  QueryResult *res = calloc(1, sizeof(QueryResult));
+  res->totalResults = e->totalResults;
+  res->numResults = e->numResults;
+  res->results = calloc(e->numResults, sizeof(ResultEntry));
+  for (size_t i = 0; i < e->numResults; i++) {
+    // the index did not change since the entry was cached, so the documents are all there
+    RSDocumentMetadata *dmd = DocTable_Get(&q->ctx->spec->docs, e->docIds[i]);
+    if (!dmd) continue;
+    res->results[i] =
+        (ResultEntry){.id = dmd->key,
+                      .docId = e->docIds[i],
+                      .score = e->scores[i],
+                      .payload = dmd->payload,
+                      .sortKey = q->sortKey ? RSSortingVector_Get(dmd->sortVector, q->sortKey)
+                                            : NULL};
+  }
+  return res;
+}
+
+void QueryResult_Cache(QueryResult *r, QueryCache *c, const char *key, size_t len,
+                       uint32_t revision) {
+  t_docId *docIds = malloc(r->numResults * sizeof(t_docId));
+  double *scores = malloc(r->numResults * sizeof(double));
+  for (size_t i = 0; i < r->numResults; i++) {
+    docIds[i] = r->results[i].docId;
+    scores[i] = r->results[i].score;
+  }
+  QueryCache_Put(c, key, len, revision, r->totalResults, docIds, scores, r->numResults);
+  free(docIds);
+  free(scores);
+}
+
 void QueryNode_Print(Query *q, QueryNode *qn, int depth) {
   sds s = QueryNode_DumpSds(sdsnew(""), q, qn, depth);
   printf("%s", s);
@@ -671,6 +976,7 @@ void Query_Free(Query *q) {
     q->scorerFree(q->scorerCtx.privdata);
   }
 
+  free(q->profile);
   free(q->raw);
   free(q);
 }
@@ -719,47 +1025,88 @@ void Query_OnReopen(RedisModuleKey *k, void *privdata) {
   q->docTable = &sp->docs;
 }
 
-QueryResult *Query_Execute(Query *query) {
+static heap_t *Query_NewHeap(Query *q, int num) {
+  heap_t *pq = malloc(heap_sizeof(num));
+  if (q->sortKey) {
+    heap_init(pq, sortByCmp, q->sortKey, num);
+  } else {
+    heap_init(pq, cmpHits, NULL, num);
+  }
+  return pq;
+}
 
-  ConcurrentSearch_AddKey(&query->conc, query->ctx->key, REDISMODULE_READ, query->ctx->keyName,
-                          Query_OnReopen, query, NULL);
+/* Offer a hit to the top results heap. Returns the hit if it did not make it into the heap, or the
+ * hit it pushed out of the heap, so it can be reused. minScore is updated to the lowest score in the
+ * heap once it is full */
+static heapResult *Query_OfferHit(Query *q, heap_t *pq, heapResult *h, double *minScore) {
+  if (heap_count(pq) < heap_size(pq)) {
+    heap_offerx(pq, h);
+    if (heap_count(pq) == heap_size(pq)) {
+      heapResult *minh = heap_peek(pq);
+      *minScore = minh->score;
+    }
+    return NULL;
+  }
 
-  // QueryNode_Print(query, query->root, 0);
-  QueryResult *res = malloc(sizeof(QueryResult));
-  res->error = 0;
-  res->errorString = NULL;
-  res->totalResults = 0;
-  res->results = NULL;
-  res->numResults = 0;
+  /* In SORTBY mode - compare the hit with the lowest ranked entry in the heap */
+  if (q->sortKey) {
+    heapResult *minh = heap_peek(pq);
 
-  // If 1, the query has SORTBY and is not score based
-  int sortByMode = query->sortKey != NULL;
-
-  //  start lazy evaluation of all query steps
-  IndexIterator *it = NULL;
-  if (query->root != NULL) {
-    it = Query_EvalNode(query, query->root);
+    /* if the current hit should be in the heap - remoe the lowest hit and add the new hit */
+    if (sortByCmp(h, minh, q->sortKey) < 0) {
+      heapResult *ret = heap_poll(pq);
+      heap_offerx(pq, h);
+      return ret;
+    }
+    /* The current should not enter the pool, so just leave it as is */
+    return h;
   }
 
-  // no query evaluation plan?
-  if (query->root == NULL || it == NULL) {
-    return res;
+  /* In Scored mode - compare scores with the lowest ranked result */
+  if (h->score < *minScore) {
+    return h;
   }
+  /* if the new result has a larger score, or has the same score
+   * but a larger id (we sort by score then id), we add it to the heap */
+  if (h->score > *minScore || cmpHits(h, heap_peek(pq), NULL) < 0) {
+    heapResult *ret = heap_poll(pq);
+    heap_offerx(pq, h);
+
+    // get the new min score
+    *minScore = ((heapResult *)heap_peek(pq))->score;
+    return ret;
+  }
+  return h;
+}
 
-  int num = query->offset + query->limit;
-
-  heap_t *pq = malloc(heap_sizeof(num));
-  if (sortByMode) {
-    heap_init(pq, sortByCmp, query->sortKey, num);
-  } else {
-    heap_init(pq, cmpHits, NULL, num);
+/* Collects the top results of an iterator, either the query's root or a clone of it covering a part
+ * of the docId space */
+typedef struct {
+  Query *query;
+  IndexIterator *it;
+  heap_t *pq;
+  double minScore;
+  int numDeleted;
+} QueryCollector;
+
+/* TF-IDF scored unions can skip the documents that cannot make it into the top results */
+static void Query_EnableTopK(Query *q, IndexIterator *it, const double *minScore) {
+  if (!q->sortKey && q->scorer == TFIDFScorer && q->root->type == QN_UNION &&
+      q->root->un.numChildren > 1) {
+    UnionIterator_EnableTopK(q->profile ? ProfileIterator_Child(it) : it, minScore);
   }
+}
 
+/* Read the collector's iterator to its end, pushing its hits to the collector's heap. If cxc is not
+ * NULL we yield to other queries when it's time to */
+static void Query_Collect(QueryCollector *c, ConcurrentSearchCtx *cxc) {
+  Query *query = c->query;
+  IndexIterator *it = c->it;
+  DocTable *dt = &query->ctx->spec->docs;
   heapResult *pooledHit = NULL;
-  double minScore = 0;
-  int numDeleted = 0;
   RSIndexResult *r = NULL;
-  ConcurrentSearchCtx *cxc = &query->conc;
+  QueryProfile *prof = query->profile;
+  uint64_t tick = prof ? Profile_Now() : 0;
 
   // iterate the root iterator and push everything to the PQ
   while (1) {
@@ -771,6 +1118,7 @@ QueryResult *Query_Execute(Query *query) {
 
     // Read the next result from the execution tree
     int rc = it->Read(it->ctx, &r);
+    if (prof) QueryProfile_Tick(prof, QueryStage_Iterate, &tick);
 
     // This means we are done!
     if (rc == INDEXREAD_EOF) {
@@ -779,78 +1127,151 @@ QueryResult *Query_Execute(Query *query) {
       continue;
     }
 
-    RSDocumentMetadata *dmd = DocTable_Get(&query->ctx->spec->docs, r->docId);
+    RSDocumentMetadata *dmd = DocTable_Get(dt, r->docId);
 
     // skip deleted documents
     if (!dmd || (dmd->flags & Document_Deleted)) {
-      ++numDeleted;
+      ++c->numDeleted;
       continue;
     }
 
     /* Call the query scoring function to calculate the score */
-    if (sortByMode) {
+    if (query->sortKey) {
       h->sv = dmd->sortVector;
       h->score = 0;
     } else {
-      h->score = query->scorer(&query->scorerCtx, r, dmd, minScore);
+      h->score = query->scorer(&query->scorerCtx, r, dmd, c->minScore);
       h->sv = NULL;
     }
     h->docId = r->docId;
+    if (prof) QueryProfile_Tick(prof, QueryStage_Score, &tick);
 
     CONCURRENT_CTX_TICK(cxc);
-    if (query->aborted) goto cleanup;
-
-    if (heap_count(pq) < heap_size(pq)) {
-      heap_offerx(pq, h);
-      pooledHit = NULL;
-      if (heap_count(pq) == heap_size(pq)) {
-        heapResult *minh = heap_peek(pq);
-        minScore = minh->score;
-      }
-    } else {
-      /* In SORTBY mode - compare the hit with the lowest ranked entry in the heap */
-      if (sortByMode) {
-        heapResult *minh = heap_peek(pq);
+    if (query->aborted) break;
 
-        /* if the current hit should be in the heap - remoe the lowest hit and add the new hit */
-        if (sortByCmp(h, minh, query->sortKey) < 0) {
-          pooledHit = heap_poll(pq);
-          heap_offerx(pq, h);
-        } else {
-          /* The current should not enter the pool, so just leave it as is */
-          pooledHit = h;
-        }
-
-      } else {
-        /* In Scored mode - compare scores with the lowest ranked result */
-        if (h->score < minScore) {
-          pooledHit = h;
-        } else {
-          /* if the new result has a larger score, or has the same score
-           * but a larger id (we sort by score then id), we add it to the heap */
-          if (h->score > minScore || cmpHits(h, heap_peek(pq), NULL) < 0) {
-
-            pooledHit = heap_poll(pq);
-            heap_offerx(pq, h);
-
-            // get the new min score
-            minScore = ((heapResult *)heap_peek(pq))->score;
-          } else {
-            pooledHit = h;
-          }
-        }
-      }
-    }
+    pooledHit = Query_OfferHit(query, c->pq, h, &c->minScore);
+    if (prof) QueryProfile_Tick(prof, QueryStage_Heap, &tick);
   }
 
   //  IndexResult_Free(r);
   if (pooledHit) {
     // IndexResult_Free(pooledHit);
     free(pooledHit);
-    pooledHit = NULL;
   }
-  res->totalResults = it->Len(it->ctx) - numDeleted;
+}
+
+static void Query_CollectPartition(void *p) {
+  Query_Collect(p, NULL);
+}
+
+/* Evaluate the query in parallel if it asked for it, or if it is expected to yield enough results,
+ * by splitting the docId space into equal ranges and collecting the top results of each range on
+ * its own thread, from a clone of the root iterator. The results are merged into pq, and
+ * totalResults is set to their total number. Returns 0 without doing anything if the query is not
+ * evaluated in parallel */
+static int Query_CollectParallel(Query *q, IndexIterator *it, heap_t *pq, size_t *totalResults) {
+  // profiled queries are timed stage by stage, so they are always evaluated serially
+  if (q->profile || !it->Clone || (!q->parallel && it->NumEstimated(it->ctx) < QUERY_PARALLEL_MIN_RESULTS)) {
+    return 0;
+  }
+  t_docId maxDocId = q->ctx->spec->docs.maxDocId;
+  int n = MIN(ConcurrentSearch_Parallelism(), maxDocId / QUERY_PARALLEL_MIN_DOCS + 1);
+  if (n < 2) {
+    return 0;
+  }
+
+  QueryCollector cs[n];
+  void *args[n];
+  t_docId step = maxDocId / n + 1;
+  for (int i = 0; i < n; i++) {
+    t_docId minId = 1 + i * step;
+    cs[i] = (QueryCollector){.query = q,
+                             .it = it->Clone(it->ctx, minId, minId + step),
+                             .pq = Query_NewHeap(q, heap_size(pq)),
+                             .minScore = 0,
+                             .numDeleted = 0};
+    args[i] = &cs[i];
+    if (!cs[i].it) {
+      for (int j = 0; j <= i; j++) {
+        if (cs[j].it) cs[j].it->Free(cs[j].it);
+        heap_free(cs[j].pq);
+      }
+      return 0;
+    }
+    Query_EnableTopK(q, cs[i].it, &cs[i].minScore);
+  }
+
+  ConcurrentSearch_RunParallel(Query_CollectPartition, args, n);
+
+  // merge the top results of all the ranges
+  double minScore = 0;
+  *totalResults = 0;
+  for (int i = 0; i < n; i++) {
+    while (heap_count(cs[i].pq)) {
+      heapResult *h = Query_OfferHit(q, pq, heap_poll(cs[i].pq), &minScore);
+      if (h) free(h);
+    }
+    *totalResults += cs[i].it->Len(cs[i].it->ctx) - cs[i].numDeleted;
+    cs[i].it->Free(cs[i].it);
+    heap_free(cs[i].pq);
+  }
+  return 1;
+}
+
+QueryResult *Query_Execute(Query *query) {
+
+  ConcurrentSearch_AddKey(&query->conc, query->ctx->key, REDISMODULE_READ, query->ctx->keyName,
+                          Query_OnReopen, query, NULL);
+
+  // QueryNode_Print(query, query->root, 0);
+  QueryResult *res = malloc(sizeof(QueryResult));
+  res->error = 0;
+  res->errorString = NULL;
+  res->totalResults = 0;
+  res->results = NULL;
+  res->numResults = 0;
+  res->profile = query->profile;
+
+  // If 1, the query has SORTBY and is not score based
+  int sortByMode = query->sortKey != NULL;
+
+  //  start lazy evaluation of all query steps
+  IndexIterator *it = NULL;
+  if (query->root != NULL) {
+    uint64_t start = Profile_Now();
+    it = Query_EvalNode(query, query->root);
+    if (query->profile) QueryProfile_Tick(query->profile, QueryStage_Open, &start);
+  }
+
+  // no query evaluation plan?
+  if (query->root == NULL || it == NULL) {
+    return res;
+  }
+
+  int num = query->offset + query->limit;
+  heap_t *pq = Query_NewHeap(query, num);
+  ConcurrentSearchCtx *cxc = &query->conc;
+
+  // The iterators read snapshots of the indexes, so we release the GIL while evaluating the query
+  // and take it back before touching the keyspace again
+  ConcurrentSearch_Unlock(cxc);
+
+  size_t totalResults;
+  if (!Query_CollectParallel(query, it, pq, &totalResults)) {
+    QueryCollector c = {.query = query, .it = it, .pq = pq, .minScore = 0, .numDeleted = 0};
+    Query_EnableTopK(query, it, &c.minScore);
+    Query_Collect(&c, cxc);
+    totalResults = it->Len(it->ctx) - c.numDeleted;
+  }
+
+  ConcurrentSearch_Lock(cxc);
+
   it->Free(it);
+  // the index might have been dropped while we were not holding the GIL
+  if (query->aborted) {
+    goto cleanup;
+  }
+  res->totalResults = totalResults;
 
   // if not enough results - just return nothing now
   if (heap_count(pq) <= query->offset) {
@@ -879,8 +1300,11 @@ QueryResult *Query_Execute(Query *query) {
 
         sv = RSSortingVector_Get(h->sv, query->sortKey);
       }
-      res->results[n - i - 1] =
-          (ResultEntry){.id = dmd->key, .score = h->score, .payload = dmd->payload, .sortKey = sv};
+      res->results[n - i - 1] = (ResultEntry){.id = dmd->key,
+                                              .docId = h->docId,
+                                              .score = h->score,
+                                              .payload = dmd->payload,
+                                              .sortKey = sv};
     }
     free(h);
   }
@@ -908,6 +1332,9 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
     return RedisModule_ReplyWithError(ctx, r->errorString);
   }
 
+  // the time spent loading documents is accounted separately from the rest of the reply
+  uint64_t start = Profile_Now(), loadNs = 0;
+
   RedisModule_ReplyWithArray(ctx, REDISMODULE_POSTPONED_ARRAY_LEN);
   RedisModule_ReplyWithLongLong(ctx, (long long)r->totalResults);
   size_t arrlen = 1;
@@ -923,9 +1350,11 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
     if (withDocs) {
       // Current behavior skips entire result if document does not exist.
       // I'm unusre if that's intentional or an oversight.
+      uint64_t loadStart = Profile_Now();
       RedisModuleString *idstr = RedisModule_CreateString(ctx, result->id, strlen(result->id));
       Redis_LoadDocumentEx(sctx, idstr, req->retfields, req->nretfields, &doc, &rkey);
       RedisModule_FreeString(ctx, idstr);
+      loadNs += Profile_Now() - loadStart;
     }
 
     ++arrlen;
@@ -982,5 +1411,61 @@ int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *sctx, RSSearchRequest
 
   RedisModule_ReplySetArrayLength(ctx, arrlen);
 
+  if (r->profile) {
+    r->profile->ns[QueryStage_Load] += loadNs;
+    r->profile->ns[QueryStage_Serialize] += Profile_Now() - start - loadNs;
+  }
   return REDISMODULE_OK;
 }
+
+#define NS_TO_MS(ns) ((double)(ns) / 1000000)
+
+/* Reply with the counters of a node and its children, as an array of the node's label, its counters
+ * and the nested replies of its children */
+static void QueryNode_ReplyProfile(RedisModuleCtx *ctx, Query *q, QueryNode *qn) {
+  int numChildren;
+  QueryNode **children = QueryNode_Children(qn, &numChildren);
+  RedisModule_ReplyWithArray(ctx, 11 + (numChildren ? 2 : 0));
+
+  sds label = QueryNode_DumpEstimate(QueryNode_DumpHead(sdsempty(), q, qn), q, qn);
+  RedisModule_ReplyWithStringBuffer(ctx, label, sdslen(label));
+  sdsfree(label);
+
+  const IteratorProfile *p = &qn->profile;
+  RedisModule_ReplyWithSimpleString(ctx, "reads");
+  RedisModule_ReplyWithLongLong(ctx, p->reads);
+  RedisModule_ReplyWithSimpleString(ctx, "skips");
+  RedisModule_ReplyWithLongLong(ctx, p->skips);
+  RedisModule_ReplyWithSimpleString(ctx, "records");
+  RedisModule_ReplyWithLongLong(ctx, p->records);
+  RedisModule_ReplyWithSimpleString(ctx, "blocks");
+  RedisModule_ReplyWithLongLong(ctx, p->blocks);
+  RedisModule_ReplyWithSimpleString(ctx, "time");
+  RedisModule_ReplyWithDouble(ctx, NS_TO_MS(p->ns));
+
+  if (numChildren) {
+    RedisModule_ReplyWithSimpleString(ctx, "children");
+    RedisModule_ReplyWithArray(ctx, numChildren);
+    for (int i = 0; i < numChildren; i++) {
+      if (children[i]) {
+        QueryNode_ReplyProfile(ctx, q, children[i]);
+      } else {
+        RedisModule_ReplyWithNull(ctx);
+      }
+    }
+  }
+}
+
+void Query_ReplyProfile(RedisModuleCtx *ctx, Query *q) {
+  RedisModule_ReplyWithArray(ctx, QueryStage_Count * 2 + 2);
+  for (int i = 0; i < QueryStage_Count; i++) {
+    RedisModule_ReplyWithSimpleString(ctx, QueryStage_Names[i]);
+    RedisModule_ReplyWithDouble(ctx, q->profile ? NS_TO_MS(q->profile->ns[i]) : 0);
+  }
+  RedisModule_ReplyWithSimpleString(ctx, "iterators");
+  if (q->root) {
+    QueryNode_ReplyProfile(ctx, q, q->root);
+  } else {
+    RedisModule_ReplyWithNull(ctx);
+  }
+}
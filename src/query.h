@@ -12,6 +12,8 @@
 #include "redis_index.h"
 #include "redismodule.h"
 #include "spec.h"
+#include "query_cache.h"
+#include "rmutil/sds.h"
 #include "id_filter.h"
 #include "redisearch.h"
 #include "rmutil/sds.h"
@@ -51,6 +53,20 @@ typedef struct RSQuery {
 
   int aborted;
 
+  // If set, the query is evaluated in parallel regardless of its estimated number of results
+  int parallel;
+
+  // Set once Query_Plan has estimated the nodes of the query
+  int planned;
+
+  // While evaluating the nodes below a negation, whose results only filter the documents, and
+  // below phrases that check the positions of their terms
+  int filterDepth;
+  int positionsDepth;
+
+  // The time spent in every stage of the query, only set when the query is profiled
+  QueryProfile *profile;
+
   // Query expander
   RSQueryTokenExpander expander;
   RSFreeFunction expanderFree;
@@ -73,6 +89,7 @@ typedef struct RSQuery {
 
 typedef struct {
   const char *id;
+  t_docId docId;
   double score;
   RSPayload *payload;
   RSSortableValue *sortKey;
@@ -85,11 +102,17 @@ typedef struct queryResult {
   ResultEntry *results;
   int error;
   char *errorString;
+  // the profile of the query that produced the result, if it was profiled
+  QueryProfile *profile;
 } QueryResult;
 
 /* Serialize a query result to the redis client. Returns REDISMODULE_OK/ERR */
 int QueryResult_Serialize(QueryResult *r, RedisSearchCtx *ctx, RSSearchRequest *req);
 
+/* Reply with the profile of a query: the time spent in every stage, and a tree of the counters of
+ * every query node, in the same layout as Query_DumpExplain */
+void Query_ReplyProfile(RedisModuleCtx *ctx, Query *q);
+
 /* Evaluate a query stage and prepare it for execution. As execution is lazy
 this doesn't
 actually do anything besides prepare the execution chaing */
@@ -115,6 +138,19 @@ void Query_SetIdFilter(Query *q, IdFilter *f);
  */
 const char *Query_DumpExplain(Query *q);
 
+/* Return the key of the query's results in the query cache: its parse tree, the exact values of its
+ * filters, and its paging, scoring and sorting. Should be called after the query is expanded and
+ * its filters are set, but before it is planned */
+sds Query_CacheKey(Query *q);
+
+/* Create a result from a cached page of results of the query */
+QueryResult *Query_CachedResult(Query *q, QueryCacheEntry *e);
+
+/* Cache the result of the query under the given key, for the revision of the index it was
+ * evaluated on */
+void QueryResult_Cache(QueryResult *r, QueryCache *c, const char *key, size_t len,
+                       uint32_t revision);
+
 /* Only used in tests, for now */
 void QueryNode_Print(Query *q, QueryNode *qs, int depth);
 
@@ -130,6 +166,12 @@ Query *NewQuery(RedisSearchCtx *ctx, const char *query, size_t len, int offset,
 
 Query *NewQueryFromRequest(RSSearchRequest *req);
 void Query_Expand(Query *q);
+
+/* Plan the query's execution. We estimate the number of documents every node matches, order the
+ * children of intersections by their estimates, and mark numeric filters that are cheaper to check
+ * on the results of their siblings than to intersect with. Nodes that cannot match anything are not
+ * evaluated at all. Should be called after the query is expanded and its filters are set */
+void Query_Plan(Query *q);
 /* Free a query object */
 void Query_Free(Query *q);
 
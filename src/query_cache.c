@@ -0,0 +1,135 @@
+#include <string.h>
+#include "query_cache.h"
+#include "rmalloc.h"
+
+size_t QueryCache_MaxMem = QUERY_CACHE_DEFAULT_MAXMEM;
+
+/* The entries are owned by the LRU list, not by the map */
+static void nopFree(void *p) {
+}
+
+QueryCache *NewQueryCache(size_t maxMem) {
+  QueryCache *c = rm_calloc(1, sizeof(QueryCache));
+  c->entries = NewTrieMap();
+  c->maxMem = maxMem;
+  return c;
+}
+
+static void QueryCacheEntry_Free(QueryCacheEntry *e) {
+  rm_free(e->key);
+  rm_free(e->docIds);
+  rm_free(e->scores);
+  rm_free(e);
+}
+
+static void QueryCache_Unlink(QueryCache *c, QueryCacheEntry *e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    c->head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  } else {
+    c->tail = e->prev;
+  }
+  e->prev = e->next = NULL;
+}
+
+static void QueryCache_PushFront(QueryCache *c, QueryCacheEntry *e) {
+  e->prev = NULL;
+  e->next = c->head;
+  if (c->head) {
+    c->head->prev = e;
+  } else {
+    c->tail = e;
+  }
+  c->head = e;
+}
+
+static void QueryCache_Remove(QueryCache *c, QueryCacheEntry *e) {
+  QueryCache_Unlink(c, e);
+  TrieMap_Delete(c->entries, e->key, e->keyLen, nopFree);
+  c->memsize -= e->memsize;
+  c->numEntries--;
+  QueryCacheEntry_Free(e);
+}
+
+void QueryCache_Clear(QueryCache *c) {
+  QueryCacheEntry *e = c->head;
+  while (e) {
+    QueryCacheEntry *next = e->next;
+    QueryCacheEntry_Free(e);
+    e = next;
+  }
+  TrieMap_Free(c->entries, nopFree);
+  c->entries = NewTrieMap();
+  c->head = c->tail = NULL;
+  c->numEntries = 0;
+  c->memsize = 0;
+}
+
+/* Drop the entries of older revisions of the index */
+static void QueryCache_SetRevision(QueryCache *c, uint32_t revision) {
+  if (revision != c->revision) {
+    QueryCache_Clear(c);
+    c->revision = revision;
+  }
+}
+
+QueryCacheEntry *QueryCache_Get(QueryCache *c, const char *key, size_t len, uint32_t revision) {
+  QueryCache_SetRevision(c, revision);
+  void *p = len > UINT16_MAX ? TRIEMAP_NOTFOUND : TrieMap_Find(c->entries, (char *)key, len);
+  if (p == TRIEMAP_NOTFOUND) {
+    c->misses++;
+    return NULL;
+  }
+
+  QueryCacheEntry *e = p;
+  QueryCache_Unlink(c, e);
+  QueryCache_PushFront(c, e);
+  c->hits++;
+  return e;
+}
+
+void QueryCache_Put(QueryCache *c, const char *key, size_t len, uint32_t revision,
+                    size_t totalResults, const t_docId *docIds, const double *scores, size_t num) {
+  // the map's keys are limited to 64KB
+  size_t memsize = sizeof(QueryCacheEntry) + len + num * (sizeof(t_docId) + sizeof(double));
+  if (len > UINT16_MAX || memsize > c->maxMem) {
+    return;
+  }
+  QueryCache_SetRevision(c, revision);
+
+  // another query with the same key might have been cached while this one was executing
+  void *old = TrieMap_Find(c->entries, (char *)key, len);
+  if (old != TRIEMAP_NOTFOUND) {
+    QueryCache_Remove(c, old);
+  }
+  while (c->tail && c->memsize + memsize > c->maxMem) {
+    QueryCache_Remove(c, c->tail);
+  }
+
+  QueryCacheEntry *e = rm_malloc(sizeof(QueryCacheEntry));
+  *e = (QueryCacheEntry){.key = rm_malloc(len),
+                         .keyLen = len,
+                         .totalResults = totalResults,
+                         .numResults = num,
+                         .docIds = rm_malloc(num * sizeof(t_docId)),
+                         .scores = rm_malloc(num * sizeof(double)),
+                         .memsize = memsize};
+  memcpy(e->key, key, len);
+  memcpy(e->docIds, docIds, num * sizeof(t_docId));
+  memcpy(e->scores, scores, num * sizeof(double));
+
+  TrieMap_Add(c->entries, e->key, len, e, NULL);
+  QueryCache_PushFront(c, e);
+  c->memsize += memsize;
+  c->numEntries++;
+}
+
+void QueryCache_Free(QueryCache *c) {
+  QueryCache_Clear(c);
+  TrieMap_Free(c->entries, nopFree);
+  rm_free(c);
+}
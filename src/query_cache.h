@@ -0,0 +1,61 @@
+#ifndef __QUERY_CACHE_H__
+#define __QUERY_CACHE_H__
+
+#include <stdlib.h>
+#include "redisearch.h"
+#include "dep/triemap/triemap.h"
+
+/* The default memory limit of the query cache of every index, in bytes. It can be changed with the
+ * QUERYCACHE_MAXMEM module argument, and 0 disables the cache */
+#define QUERY_CACHE_DEFAULT_MAXMEM (4 * 1024 * 1024)
+
+extern size_t QueryCache_MaxMem;
+
+/* A cached page of results. We only keep the docIds and scores of the results, everything else is
+ * read from the document table when the entry is used, which is safe as long as the index did not
+ * change since the entry was cached */
+typedef struct queryCacheEntry {
+  char *key;
+  size_t keyLen;
+  size_t totalResults;
+  size_t numResults;
+  t_docId *docIds;
+  double *scores;
+  size_t memsize;
+  // the neighbours of the entry in the LRU list, prev being the more recently used one
+  struct queryCacheEntry *prev, *next;
+} QueryCacheEntry;
+
+/* An LRU cache of query results of a single index, keyed by the normalized query and everything in
+ * the request that affects its results.
+ *
+ * The cache holds the results of a single revision of the index. Any access with a newer revision
+ * drops all the entries, so results are never served after the index has changed */
+typedef struct {
+  TrieMap *entries;
+  QueryCacheEntry *head, *tail;
+  uint32_t revision;
+  size_t numEntries;
+  // the approximate memory used by the entries
+  size_t memsize;
+  size_t maxMem;
+  size_t hits;
+  size_t misses;
+} QueryCache;
+
+QueryCache *NewQueryCache(size_t maxMem);
+
+/* Get the entry cached for a key at the given revision of the index, or NULL if there is none */
+QueryCacheEntry *QueryCache_Get(QueryCache *c, const char *key, size_t len, uint32_t revision);
+
+/* Cache a page of results for a key at the given revision of the index, evicting the least recently
+ * used entries to make room for it. Pages larger than the memory limit are not cached */
+void QueryCache_Put(QueryCache *c, const char *key, size_t len, uint32_t revision,
+                    size_t totalResults, const t_docId *docIds, const double *scores, size_t num);
+
+/* Drop all the entries of the cache, keeping its stats */
+void QueryCache_Clear(QueryCache *c);
+
+void QueryCache_Free(QueryCache *c);
+
+#endif
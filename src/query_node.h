@@ -2,6 +2,7 @@
 #define __QUERY_NODE_H__
 #include <stdlib.h>
 #include "redisearch.h"
+#include "profile.h"
 //#include "numeric_index.h"
 
 struct RSQueryNode;
@@ -93,6 +94,15 @@ typedef struct RSQueryNode {
   uint32_t fieldMask;
   /* The node type, for resolving the union access */
   QueryNodeType type;
+
+  /* The estimated number of documents matching the node, set by the query planner. 0 means the node
+   * cannot match anything */
+  size_t card;
+  /* Set by the planner on numeric filters that are applied to the results of their siblings using
+   * the sorting vectors, rather than intersected with them */
+  int postFilter;
+  /* The node's counters when the query is profiled */
+  IteratorProfile profile;
 } QueryNode;
 
 /* Add a child to a phrase node */
@@ -34,16 +34,22 @@
 #include "parse.h"
 #include "../rmutil/vector.h"
 #include "../query_node.h"
+#include "../tokenize.h"
 
-char *strdupcase(const char *s, size_t len) {
-  char *ret = strndup(s, len);
-  for (int i = 0; i < len; i++) {
-    ret[i] = tolower(ret[i]);
+/* Copy a query term, folding its case the same way the tokenizer folds the terms of the index. len
+ * is set to the length of the copy */
+char *strdupcase(parseCtx *ctx, const char *s, int *len) {
+  int unicode = 1;
+  if (ctx->q->ctx && ctx->q->ctx->spec) {
+    unicode = !!(ctx->q->ctx->spec->flags & Index_FoldUnicode);
   }
+  char *ret = malloc(FOLD_TERM_MAXLEN(*len) + 1);
+  *len = FoldTerm(ret, s, *len, unicode);
+  ret[*len] = '\0';
   return ret;
 }
    
-#line 47 "parser.c"
+#line 53 "parser.c"
 /**************** End of %include directives **********************************/
 /* These constants specify the various numeric values for terminal symbols
 ** in a format understandable to "makeheaders".  This section is blank unless
@@ -532,23 +538,23 @@ static void yy_destructor(
     case 25: /* modifier */
     case 26: /* term */
 {
-#line 51 "parser.y"
+#line 57 "parser.y"
  
-#line 538 "parser.c"
+#line 544 "parser.c"
 }
       break;
     case 18: /* expr */
     case 19: /* termlist */
     case 20: /* union */
 {
-#line 54 "parser.y"
+#line 60 "parser.y"
  QueryNode_Free((yypminor->yy53)); 
-#line 547 "parser.c"
+#line 553 "parser.c"
 }
       break;
     case 21: /* modifierlist */
 {
-#line 63 "parser.y"
+#line 69 "parser.y"
  
     for (size_t i = 0; i < Vector_Size((yypminor->yy48)); i++) {
         char *s;
@@ -557,16 +563,16 @@ static void yy_destructor(
     }
     Vector_Free((yypminor->yy48)); 
 
-#line 561 "parser.c"
+#line 567 "parser.c"
 }
       break;
     case 23: /* numeric_range */
 {
-#line 75 "parser.y"
+#line 81 "parser.y"
 
     NumericFilter_Free((yypminor->yy54));
 
-#line 570 "parser.c"
+#line 576 "parser.c"
 }
       break;
 /********* End destructor definitions *****************************************/
@@ -909,7 +915,7 @@ static void yy_reduce(
 /********** Begin reduce actions **********************************************/
         YYMINORTYPE yylhsminor;
       case 0: /* query ::= expr */
-#line 79 "parser.y"
+#line 85 "parser.y"
 { 
  /* If the root is a negative node, we intersect it with a wildcard node */
  if (yymsp[0].minor.yy53->type == QN_NOT) {
@@ -921,17 +927,17 @@ static void yy_reduce(
  }
 
 }
-#line 925 "parser.c"
+#line 931 "parser.c"
         break;
       case 1: /* query ::= */
-#line 90 "parser.y"
+#line 96 "parser.y"
 {
  ctx->root = NULL;
 }
-#line 932 "parser.c"
+#line 938 "parser.c"
         break;
       case 2: /* expr ::= expr expr */
-#line 94 "parser.y"
+#line 100 "parser.y"
 {
     if (yymsp[-1].minor.yy53->type == QN_PHRASE && yymsp[-1].minor.yy53->pn.exact == 0 && 
         yymsp[-1].minor.yy53->fieldMask == RS_FIELDMASK_ALL ) {
@@ -942,19 +948,19 @@ static void yy_reduce(
     } 
     QueryPhraseNode_AddChild(yylhsminor.yy53, yymsp[0].minor.yy53);
 }
-#line 946 "parser.c"
+#line 952 "parser.c"
   yymsp[-1].minor.yy53 = yylhsminor.yy53;
         break;
       case 3: /* expr ::= union */
-#line 105 "parser.y"
+#line 111 "parser.y"
 {
     yylhsminor.yy53 = yymsp[0].minor.yy53;
 }
-#line 954 "parser.c"
+#line 960 "parser.c"
   yymsp[0].minor.yy53 = yylhsminor.yy53;
         break;
       case 4: /* union ::= expr OR expr */
-#line 110 "parser.y"
+#line 116 "parser.y"
 {
     
     if (yymsp[-2].minor.yy53->type == QN_UNION && yymsp[-2].minor.yy53->fieldMask == RS_FIELDMASK_ALL) {
@@ -965,31 +971,31 @@ static void yy_reduce(
     }
     QueryUnionNode_AddChild(yylhsminor.yy53, yymsp[0].minor.yy53); 
 }
-#line 969 "parser.c"
+#line 975 "parser.c"
   yymsp[-2].minor.yy53 = yylhsminor.yy53;
         break;
       case 5: /* union ::= union OR expr */
-#line 123 "parser.y"
+#line 129 "parser.y"
 {
     yylhsminor.yy53 = yymsp[-2].minor.yy53;
     QueryUnionNode_AddChild(yylhsminor.yy53, yymsp[0].minor.yy53); 
 }
-#line 978 "parser.c"
+#line 984 "parser.c"
   yymsp[-2].minor.yy53 = yylhsminor.yy53;
         break;
       case 6: /* expr ::= modifier COLON expr */
-#line 132 "parser.y"
+#line 138 "parser.y"
 {
     if (ctx->q->ctx && ctx->q->ctx->spec) {
         yymsp[0].minor.yy53->fieldMask = IndexSpec_GetFieldBit(ctx->q->ctx->spec, yymsp[-2].minor.yy0.s, yymsp[-2].minor.yy0.len); 
     }
     yylhsminor.yy53 = yymsp[0].minor.yy53; 
 }
-#line 989 "parser.c"
+#line 995 "parser.c"
   yymsp[-2].minor.yy53 = yylhsminor.yy53;
         break;
       case 7: /* expr ::= modifierlist COLON expr */
-#line 140 "parser.y"
+#line 146 "parser.y"
 {
     yymsp[0].minor.yy53->fieldMask = 0;
     for (int i = 0; i < Vector_Size(yymsp[-2].minor.yy48); i++) {
@@ -1004,93 +1010,98 @@ static void yy_reduce(
     Vector_Free(yymsp[-2].minor.yy48);
     yylhsminor.yy53=yymsp[0].minor.yy53;
 }
-#line 1008 "parser.c"
+#line 1014 "parser.c"
   yymsp[-2].minor.yy53 = yylhsminor.yy53;
         break;
       case 8: /* expr ::= LP expr RP */
-#line 155 "parser.y"
+#line 161 "parser.y"
 {
     yymsp[-2].minor.yy53 = yymsp[-1].minor.yy53;
 }
-#line 1016 "parser.c"
+#line 1022 "parser.c"
         break;
       case 9: /* expr ::= QUOTE termlist QUOTE */
-#line 159 "parser.y"
+#line 165 "parser.y"
 {
     yymsp[-1].minor.yy53->pn.exact =1;
     yymsp[-2].minor.yy53 = yymsp[-1].minor.yy53;
 }
-#line 1024 "parser.c"
+#line 1030 "parser.c"
         break;
       case 10: /* term ::= QUOTE term QUOTE */
-#line 164 "parser.y"
+#line 170 "parser.y"
 {
     yymsp[-2].minor.yy0 = yymsp[-1].minor.yy0;
 }
-#line 1031 "parser.c"
+#line 1037 "parser.c"
         break;
       case 11: /* expr ::= term */
-#line 168 "parser.y"
+#line 174 "parser.y"
 {
-    yylhsminor.yy53 = NewTokenNode(ctx->q, strdupcase(yymsp[0].minor.yy0.s, yymsp[0].minor.yy0.len), yymsp[0].minor.yy0.len);
+    char *s = strdupcase(ctx, yymsp[0].minor.yy0.s, &yymsp[0].minor.yy0.len);
+    yylhsminor.yy53 = NewTokenNode(ctx->q, s, yymsp[0].minor.yy0.len);
 }
-#line 1038 "parser.c"
+#line 1045 "parser.c"
   yymsp[0].minor.yy53 = yylhsminor.yy53;
         break;
       case 12: /* termlist ::= term term */
-#line 172 "parser.y"
+#line 179 "parser.y"
 {
     
     yylhsminor.yy53 = NewPhraseNode(0);
-    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, strdupcase(yymsp[-1].minor.yy0.s, yymsp[-1].minor.yy0.len), yymsp[-1].minor.yy0.len));
-    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, strdupcase(yymsp[0].minor.yy0.s, yymsp[0].minor.yy0.len), yymsp[0].minor.yy0.len));
+    char *s = strdupcase(ctx, yymsp[-1].minor.yy0.s, &yymsp[-1].minor.yy0.len);
+    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, s, yymsp[-1].minor.yy0.len));
+    s = strdupcase(ctx, yymsp[0].minor.yy0.s, &yymsp[0].minor.yy0.len);
+    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, s, yymsp[0].minor.yy0.len));
 
 }
-#line 1050 "parser.c"
+#line 1059 "parser.c"
   yymsp[-1].minor.yy53 = yylhsminor.yy53;
         break;
       case 13: /* termlist ::= termlist term */
-#line 179 "parser.y"
+#line 188 "parser.y"
 {
     yylhsminor.yy53 = yymsp[-1].minor.yy53;
-    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, strdupcase(yymsp[0].minor.yy0.s, yymsp[0].minor.yy0.len), yymsp[0].minor.yy0.len));
+    char *s = strdupcase(ctx, yymsp[0].minor.yy0.s, &yymsp[0].minor.yy0.len);
+    QueryPhraseNode_AddChild(yylhsminor.yy53, NewTokenNode(ctx->q, s, yymsp[0].minor.yy0.len));
 
 }
-#line 1060 "parser.c"
+#line 1070 "parser.c"
   yymsp[-1].minor.yy53 = yylhsminor.yy53;
         break;
       case 14: /* expr ::= MINUS expr */
-#line 186 "parser.y"
+#line 196 "parser.y"
 { 
     yymsp[-1].minor.yy53 = NewNotNode(yymsp[0].minor.yy53);
 }
-#line 1068 "parser.c"
+#line 1078 "parser.c"
         break;
       case 15: /* expr ::= TILDE expr */
-#line 189 "parser.y"
+#line 199 "parser.y"
 { 
     yymsp[-1].minor.yy53 = NewOptionalNode(yymsp[0].minor.yy53);
 }
-#line 1075 "parser.c"
+#line 1085 "parser.c"
         break;
       case 16: /* expr ::= term STAR */
-#line 193 "parser.y"
+#line 203 "parser.y"
 {
-    yylhsminor.yy53 = NewPrefixNode(ctx->q, strdupcase(yymsp[-1].minor.yy0.s, yymsp[-1].minor.yy0.len), yymsp[-1].minor.yy0.len);
+    char *s = strdupcase(ctx, yymsp[-1].minor.yy0.s, &yymsp[-1].minor.yy0.len);
+    yylhsminor.yy53 = NewPrefixNode(ctx->q, s, yymsp[-1].minor.yy0.len);
 }
-#line 1082 "parser.c"
+#line 1093 "parser.c"
   yymsp[-1].minor.yy53 = yylhsminor.yy53;
         break;
       case 17: /* modifier ::= MODIFIER */
-#line 197 "parser.y"
+#line 208 "parser.y"
 {
     yylhsminor.yy0 = yymsp[0].minor.yy0;
  }
-#line 1090 "parser.c"
+#line 1101 "parser.c"
   yymsp[0].minor.yy0 = yylhsminor.yy0;
         break;
       case 18: /* modifierlist ::= modifier OR term */
-#line 201 "parser.y"
+#line 212 "parser.y"
 {
     yylhsminor.yy48 = NewVector(char *, 2);
     char *s = strndup(yymsp[-2].minor.yy0.s, yymsp[-2].minor.yy0.len);
@@ -1098,68 +1109,68 @@ static void yy_reduce(
     s = strndup(yymsp[0].minor.yy0.s, yymsp[0].minor.yy0.len);
     Vector_Push(yylhsminor.yy48, s);
 }
-#line 1102 "parser.c"
+#line 1113 "parser.c"
   yymsp[-2].minor.yy48 = yylhsminor.yy48;
         break;
       case 19: /* modifierlist ::= modifierlist OR term */
-#line 209 "parser.y"
+#line 220 "parser.y"
 {
     char *s = strndup(yymsp[0].minor.yy0.s, yymsp[0].minor.yy0.len);
     Vector_Push(yymsp[-2].minor.yy48, s);
     yylhsminor.yy48 = yymsp[-2].minor.yy48;
 }
-#line 1112 "parser.c"
+#line 1123 "parser.c"
   yymsp[-2].minor.yy48 = yylhsminor.yy48;
         break;
       case 20: /* expr ::= modifier COLON numeric_range */
-#line 215 "parser.y"
+#line 226 "parser.y"
 {
     // we keep the capitalization as is
     yymsp[0].minor.yy54->fieldName = strndup(yymsp[-2].minor.yy0.s, yymsp[-2].minor.yy0.len);
     yylhsminor.yy53 = NewNumericNode(yymsp[0].minor.yy54);
 }
-#line 1122 "parser.c"
+#line 1133 "parser.c"
   yymsp[-2].minor.yy53 = yylhsminor.yy53;
         break;
       case 21: /* numeric_range ::= LSQB num num RSQB */
-#line 221 "parser.y"
+#line 232 "parser.y"
 {
     yymsp[-3].minor.yy54 = NewNumericFilter(yymsp[-2].minor.yy11.num, yymsp[-1].minor.yy11.num, yymsp[-2].minor.yy11.inclusive, yymsp[-1].minor.yy11.inclusive);
 }
-#line 1130 "parser.c"
+#line 1141 "parser.c"
         break;
       case 22: /* num ::= NUMBER */
-#line 225 "parser.y"
+#line 236 "parser.y"
 {
     yylhsminor.yy11.num = yymsp[0].minor.yy0.numval;
     yylhsminor.yy11.inclusive = 1;
 }
-#line 1138 "parser.c"
+#line 1149 "parser.c"
   yymsp[0].minor.yy11 = yylhsminor.yy11;
         break;
       case 23: /* num ::= LP num */
-#line 230 "parser.y"
+#line 241 "parser.y"
 {
     yymsp[-1].minor.yy11=yymsp[0].minor.yy11;
     yymsp[-1].minor.yy11.inclusive = 0;
 }
-#line 1147 "parser.c"
+#line 1158 "parser.c"
         break;
       case 24: /* num ::= MINUS num */
-#line 235 "parser.y"
+#line 246 "parser.y"
 {
     yymsp[0].minor.yy11.num = -yymsp[0].minor.yy11.num;
     yymsp[-1].minor.yy11 = yymsp[0].minor.yy11;
 }
-#line 1155 "parser.c"
+#line 1166 "parser.c"
         break;
       case 25: /* term ::= TERM */
       case 26: /* term ::= NUMBER */ yytestcase(yyruleno==26);
-#line 240 "parser.y"
+#line 251 "parser.y"
 {
     yylhsminor.yy0 = yymsp[0].minor.yy0; 
 }
-#line 1163 "parser.c"
+#line 1174 "parser.c"
   yymsp[0].minor.yy0 = yylhsminor.yy0;
         break;
       default:
@@ -1228,7 +1239,7 @@ static void yy_syntax_error(
     
     ctx->ok = 0;
     ctx->errorMsg = strdup(buf);
-#line 1232 "parser.c"
+#line 1243 "parser.c"
 /************ End %syntax_error code ******************************************/
   ParseARG_STORE; /* Suppress warning about unused %extra_argument variable */
 }
@@ -35,12 +35,18 @@
 #include "parse.h"
 #include "../rmutil/vector.h"
 #include "../query_node.h"
-
-char *strdupcase(const char *s, size_t len) {
-  char *ret = strndup(s, len);
-  for (int i = 0; i < len; i++) {
-    ret[i] = tolower(ret[i]);
+#include "../tokenize.h"
+
+/* Copy a query term, folding its case the same way the tokenizer folds the terms of the index. len
+ * is set to the length of the copy */
+char *strdupcase(parseCtx *ctx, const char *s, int *len) {
+  int unicode = 1;
+  if (ctx->q->ctx && ctx->q->ctx->spec) {
+    unicode = !!(ctx->q->ctx->spec->flags & Index_FoldUnicode);
   }
+  char *ret = malloc(FOLD_TERM_MAXLEN(*len) + 1);
+  *len = FoldTerm(ret, s, *len, unicode);
+  ret[*len] = '\0';
   return ret;
 }
    
@@ -126,7 +132,7 @@ union(A) ::= union(B) OR expr(C). [ORX] {
 }
 
 // expr(A) ::= term(B) . { 
-//     A = NewTokenNode(ctx->q, strdupcase(B.s, B.len), B.len); 
+//     A = NewTokenNode(ctx->q, strdupcase(B.s, &B.len), B.len); 
 // }
 
 expr(A) ::= modifier(B) COLON expr(C) . [MODIFIER] {
@@ -166,19 +172,23 @@ term(A) ::= QUOTE term(B) QUOTE. {
 }
 
 expr(A) ::= term(B) .  {
-    A = NewTokenNode(ctx->q, strdupcase(B.s, B.len), B.len);
+    char *s = strdupcase(ctx, B.s, &B.len);
+    A = NewTokenNode(ctx->q, s, B.len);
 }
 
 termlist(A) ::= term(B) term(C). [TERMLIST]  {
     
     A = NewPhraseNode(0);
-    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, strdupcase(B.s, B.len), B.len));
-    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, strdupcase(C.s, C.len), C.len));
+    char *s = strdupcase(ctx, B.s, &B.len);
+    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, s, B.len));
+    s = strdupcase(ctx, C.s, &C.len);
+    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, s, C.len));
 
 }
 termlist(A) ::= termlist(B) term(C) . [TERMLIST] {
     A = B;
-    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, strdupcase(C.s, C.len), C.len));
+    char *s = strdupcase(ctx, C.s, &C.len);
+    QueryPhraseNode_AddChild(A, NewTokenNode(ctx->q, s, C.len));
 
 }
 
@@ -191,7 +201,8 @@ expr(A) ::= TILDE expr(B) . {
 }
 
 expr(A) ::= term(B) STAR. {
-    A = NewPrefixNode(ctx->q, strdupcase(B.s, B.len), B.len);
+    char *s = strdupcase(ctx, B.s, &B.len);
+    A = NewPrefixNode(ctx->q, s, B.len);
 }
 
 modifier(A) ::= MODIFIER(B) . {
@@ -2,11 +2,14 @@
 #include "doc_table.h"
 #include "redismodule.h"
 #include "inverted_index.h"
+#include "geo_index.h"
 #include "rmutil/strings.h"
 #include "rmutil/util.h"
 #include "util/logging.h"
 #include "rmalloc.h"
 #include <stdio.h>
+#include <float.h>
+#include <sys/param.h>
 
 RedisModuleType *InvertedIndexType;
 
@@ -21,21 +24,57 @@ void *InvertedIndex_RdbLoad(RedisModuleIO *rdb, int encver) {
   if (encver <= INVERTED_INDEX_NOFREQFLAG_VER) {
     idx->flags |= Index_StoreFreqs;
   }
+  if (encver < INVERTED_INDEX_PACKED_VER) {
+    idx->flags &= ~Index_PackedBlocks;
+  }
+  // we cannot rebuild the score index of older versions, so the index goes on without one
+  if (encver < INVERTED_INDEX_SCOREINDEX_VER) {
+    idx->flags &= ~Index_StoreScoreIndexes;
+  }
   idx->lastId = RedisModule_LoadUnsigned(rdb);
   idx->numDocs = RedisModule_LoadUnsigned(rdb);
+  if (encver >= INVERTED_INDEX_DOCIDGEN_VER) {
+    idx->docIdGen = RedisModule_LoadUnsigned(rdb);
+  }
   idx->size = RedisModule_LoadUnsigned(rdb);
   idx->blocks = rm_calloc(idx->size, sizeof(IndexBlock));
+  idx->cap = idx->size;
 
   for (uint32_t i = 0; i < idx->size; i++) {
     IndexBlock *blk = &idx->blocks[i];
     blk->firstId = RedisModule_LoadUnsigned(rdb);
     blk->lastId = RedisModule_LoadUnsigned(rdb);
     blk->numDocs = RedisModule_LoadUnsigned(rdb);
+    if (encver >= INVERTED_INDEX_BLOCKMAX_VER) {
+      blk->maxFreq = RedisModule_LoadUnsigned(rdb);
+      blk->maxScore = RedisModule_LoadFloat(rdb);
+    } else {
+      // we don't know the bounds of older blocks, so they are never pruned
+      blk->maxFreq = UINT32_MAX;
+      blk->maxScore = FLT_MAX;
+    }
 
     size_t cap;
     char *data = RedisModule_LoadStringBuffer(rdb, &cap);
     blk->data = Buffer_Wrap(data, cap);
     blk->data->offset = cap;
+    // the skip table is not persisted, we rebuild it from the block's data. Packed blocks don't
+    // have one
+    if (!(idx->flags & Index_PackedBlocks) || i + 1 == idx->size) {
+      IndexBlock_BuildCheckpoints(blk, idx->flags);
+    }
+  }
+
+  if (INDEX_HAS_SCOREINDEX(idx)) {
+    ScoreIndex *si = &idx->scoreIndex;
+    si->size = si->cap = RedisModule_LoadUnsigned(rdb);
+    si->floor = RedisModule_LoadFloat(rdb);
+    si->entries = si->cap ? rm_malloc(si->cap * sizeof(ScoreIndexEntry)) : NULL;
+    for (uint32_t i = 0; i < si->size; i++) {
+      si->entries[i].docId = RedisModule_LoadUnsigned(rdb);
+      si->entries[i].freq = RedisModule_LoadUnsigned(rdb);
+      si->entries[i].impact = RedisModule_LoadFloat(rdb);
+    }
   }
   return idx;
 }
@@ -45,6 +84,7 @@ void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value) {
   RedisModule_SaveUnsigned(rdb, idx->flags);
   RedisModule_SaveUnsigned(rdb, idx->lastId);
   RedisModule_SaveUnsigned(rdb, idx->numDocs);
+  RedisModule_SaveUnsigned(rdb, idx->docIdGen);
   RedisModule_SaveUnsigned(rdb, idx->size);
 
   for (uint32_t i = 0; i < idx->size; i++) {
@@ -52,8 +92,22 @@ void InvertedIndex_RdbSave(RedisModuleIO *rdb, void *value) {
     RedisModule_SaveUnsigned(rdb, blk->firstId);
     RedisModule_SaveUnsigned(rdb, blk->lastId);
     RedisModule_SaveUnsigned(rdb, blk->numDocs);
+    RedisModule_SaveUnsigned(rdb, blk->maxFreq);
+    RedisModule_SaveFloat(rdb, blk->maxScore);
     RedisModule_SaveStringBuffer(rdb, blk->data->data, blk->data->offset);
   }
+
+  // the score index is saved in its heap order
+  if (INDEX_HAS_SCOREINDEX(idx)) {
+    ScoreIndex *si = &idx->scoreIndex;
+    RedisModule_SaveUnsigned(rdb, si->size);
+    RedisModule_SaveFloat(rdb, si->floor);
+    for (uint32_t i = 0; i < si->size; i++) {
+      RedisModule_SaveUnsigned(rdb, si->entries[i].docId);
+      RedisModule_SaveUnsigned(rdb, si->entries[i].freq);
+      RedisModule_SaveFloat(rdb, si->entries[i].impact);
+    }
+  }
 }
 void InvertedIndex_Digest(RedisModuleDigest *digest, void *value) {
 }
@@ -69,7 +123,9 @@ unsigned long InvertedIndex_MemUsage(const void *value) {
     ret += sizeof(IndexBlock);
     ret += sizeof(Buffer);
     ret += Buffer_Offset(idx->blocks[i].data);
+    ret += idx->blocks[i].numCheckpoints * sizeof(IndexBlockCheckpoint);
   }
+  ret += idx->scoreIndex.cap * sizeof(ScoreIndexEntry);
   return ret;
 }
 
@@ -212,6 +268,28 @@ const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen) {
 //   return NewScoreIndex(b);
 // }
 
+int Redis_RenumberInvertedIndex(RedisSearchCtx *ctx, InvertedIndex *idx, IndexRepairStats *stats) {
+  DocTable *dt = &ctx->spec->docs;
+  if (idx->docIdGen == dt->docIdGen) {
+    return 0;
+  }
+  IndexRepairStats rs = {0};
+  if (dt->remap.newIds) {
+    InvertedIndex_Renumber(idx, &dt->remap, &rs);
+  }
+  idx->docIdGen = dt->docIdGen;
+
+  IndexStats *st = &ctx->spec->stats;
+  st->numRecords -= MIN(st->numRecords, rs.recordsRemoved);
+  st->invertedSize -= MIN(st->invertedSize, rs.bytesCollected);
+  if (stats) {
+    stats->recordsRemoved += rs.recordsRemoved;
+    stats->bytesCollected += rs.bytesCollected;
+    stats->blocksRemoved += rs.blocksRemoved;
+  }
+  return 1;
+}
+
 InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, size_t len,
                                        int write) {
   RedisModuleString *termKey = fmtRedisTermKey(ctx, term, len);
@@ -230,7 +308,13 @@ InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, si
   if (RedisModule_KeyType(k) == REDISMODULE_KEYTYPE_EMPTY) {
 
     if (write) {
-      InvertedIndex *idx = NewInvertedIndex(ctx->spec->flags, 1);
+      IndexFlags flags = ctx->spec->flags;
+      // docId-only indexes are packed, the other encodings already pack records with qint
+      if ((flags & INDEX_STORAGE_MASK) == Index_DocIdsOnly) {
+        flags |= Index_PackedBlocks;
+      }
+      InvertedIndex *idx = NewInvertedIndex(flags, 1);
+      idx->docIdGen = ctx->spec->docs.docIdGen;
       RedisModule_ModuleTypeSetValue(k, InvertedIndexType, idx);
       return idx;
     } else {
@@ -238,7 +322,22 @@ InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, si
     }
   }
 
-  return RedisModule_ModuleTypeGetValue(k);
+  InvertedIndex *idx = RedisModule_ModuleTypeGetValue(k);
+  Redis_RenumberInvertedIndex(ctx, idx, NULL);
+  return idx;
+}
+
+size_t Redis_TermNumDocs(RedisSearchCtx *ctx, const char *term, size_t len) {
+  RedisModuleString *termKey = fmtRedisTermKey(ctx, term, len);
+  RedisModuleKey *k = RedisModule_OpenKey(ctx->redisCtx, termKey, REDISMODULE_READ);
+  RedisModule_FreeString(ctx->redisCtx, termKey);
+
+  size_t numDocs = 0;
+  if (k && RedisModule_ModuleTypeGetType(k) == InvertedIndexType) {
+    numDocs = ((InvertedIndex *)RedisModule_ModuleTypeGetValue(k))->numDocs;
+  }
+  if (k) RedisModule_CloseKey(k);
+  return numDocs;
 }
 
 IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSToken *tok, DocTable *dt, int singleWordMode,
@@ -255,6 +354,7 @@ IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSToken *tok, DocTable *dt, i
   }
 
   InvertedIndex *idx = RedisModule_ModuleTypeGetValue(k);
+  Redis_RenumberInvertedIndex(ctx, idx, NULL);
 
   IndexReader *ret = NewTermIndexReader(idx, dt, fieldMask, NewTerm(tok));
   if (csx) {
@@ -535,6 +635,10 @@ int Redis_DropIndex(RedisSearchCtx *ctx, int deleteDocuments) {
     const FieldSpec *spec = ctx->spec->fields + i;
     if (spec->type == F_NUMERIC) {
       Redis_DeleteKey(ctx->redisCtx, fmtRedisNumericIndexKey(ctx, spec->name));
+    } else if (spec->type == F_GEO) {
+      // the renumbered copy left by a compaction in progress
+      GeoIndex gi = {.ctx = ctx, .sp = (FieldSpec *)spec};
+      Redis_DeleteKey(ctx->redisCtx, fmtGeoIndexRenumberKey(&gi));
     }
   }
 
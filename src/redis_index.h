@@ -14,10 +14,21 @@
 IndexReader *Redis_OpenReader(RedisSearchCtx *ctx, RSToken *tok, DocTable *dt, int singleWordMode,
                               t_fieldMask fieldMask, ConcurrentSearchCtx *csx);
 
+/* Open the inverted index of a term, creating it if it does not exist and write is set. Returns
+ * NULL if the term is not indexed. The index is renumbered first if the spec's DocTable was
+ * compacted since it was written */
 InvertedIndex *Redis_OpenInvertedIndex(RedisSearchCtx *ctx, const char *term, size_t len,
                                        int write);
+
+/* Renumber a term's inverted index if it was written before the spec's DocTable was last compacted,
+ * updating the spec's stats. Returns 1 if the index was renumbered */
+int Redis_RenumberInvertedIndex(RedisSearchCtx *ctx, InvertedIndex *idx, IndexRepairStats *stats);
 void Redis_CloseReader(IndexReader *r);
 
+/* Return the number of documents in a term's inverted index, or 0 if the term is not indexed. Used
+ * for query planning, so the key is not kept open */
+size_t Redis_TermNumDocs(RedisSearchCtx *ctx, const char *term, size_t len);
+
 /*
  * Select a random term from the index that matches the index prefix and inveted key format.
  * It tries RANDOMKEY 10 times and returns NULL if it can't find anything.
@@ -29,8 +40,16 @@ const char *Redis_SelectRandomTerm(RedisSearchCtx *ctx, size_t *tlen);
 #define SKIPINDEX_KEY_FORMAT "si:%s/%.*s"
 #define SCOREINDEX_KEY_FORMAT "ss:%s/%.*s"
 
-#define INVERTED_INDEX_ENCVER 1
+#define INVERTED_INDEX_ENCVER 5
 #define INVERTED_INDEX_NOFREQFLAG_VER 0
+// Versions below this never have packed blocks
+#define INVERTED_INDEX_PACKED_VER 2
+// Versions below this do not save the max freq and score of blocks
+#define INVERTED_INDEX_BLOCKMAX_VER 3
+// Versions below this do not save score indexes
+#define INVERTED_INDEX_SCOREINDEX_VER 4
+// Versions below this do not save the docIdGen of the index
+#define INVERTED_INDEX_DOCIDGEN_VER 5
 
 typedef int (*ScanFunc)(RedisModuleCtx *ctx, RedisModuleString *keyName, void *opaque);
 
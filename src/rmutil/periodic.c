@@ -5,11 +5,14 @@
 
 typedef struct RMUtilTimer {
   RMutilTimerFunc cb;
+  RMUtilTimerTerminationFunc onTerm;
   void *privdata;
   struct timespec interval;
   pthread_t thread;
   pthread_mutex_t lock;
   pthread_cond_t cond;
+  // set by RMUtilTimer_Terminate, under the lock
+  int terminated;
 } RMUtilTimer;
 
 static struct timespec timespecAdd(struct timespec *a, struct timespec *b) {
@@ -25,52 +28,77 @@ static struct timespec timespecAdd(struct timespec *a, struct timespec *b) {
 static void *rmutilTimer_Loop(void *ctx) {
   RMUtilTimer *tm = ctx;
 
-  int rc = ETIMEDOUT;
   struct timespec ts;
 
   pthread_mutex_lock(&tm->lock);
-  while (rc != 0) {
+  while (!tm->terminated) {
     clock_gettime(CLOCK_REALTIME, &ts);
     struct timespec timeout = timespecAdd(&ts, &tm->interval);
-    if ((rc = pthread_cond_timedwait(&tm->cond, &tm->lock, &timeout)) == ETIMEDOUT) {
+    if (pthread_cond_timedwait(&tm->cond, &tm->lock, &timeout) != ETIMEDOUT || tm->terminated) {
+      continue;
+    }
+
+    // we don't hold the lock while running the callback, so the timer can be terminated by
+    // someone holding a lock the callback is waiting for
+    pthread_mutex_unlock(&tm->lock);
 
-      // Create a thread safe context if we're running inside redis
-      RedisModuleCtx *rctx = NULL;
-      if (RedisModule_GetThreadSafeContext) rctx = RedisModule_GetThreadSafeContext(NULL);
+    // Create a thread safe context if we're running inside redis
+    RedisModuleCtx *rctx = NULL;
+    if (RedisModule_GetThreadSafeContext) rctx = RedisModule_GetThreadSafeContext(NULL);
 
-      // call our callback...
-      tm->cb(rctx, tm->privdata);
+    // call our callback...
+    int rc = tm->cb(rctx, tm->privdata);
 
-      // If needed - free the thread safe context.
-      // It's up to the user to decide whether automemory is active there
-      if (rctx) RedisModule_FreeThreadSafeContext(rctx);
+    // If needed - free the thread safe context.
+    // It's up to the user to decide whether automemory is active there
+    if (rctx) RedisModule_FreeThreadSafeContext(rctx);
+
+    pthread_mutex_lock(&tm->lock);
+    if (!rc) {
+      break;
     }
   }
+  pthread_mutex_unlock(&tm->lock);
   //  RedisModule_Log(tm->redisCtx, "notice", "Timer cancelled");
 
+  if (tm->onTerm) {
+    tm->onTerm(tm->privdata);
+  }
+  pthread_cond_destroy(&tm->cond);
+  pthread_mutex_destroy(&tm->lock);
+  free(tm);
   return NULL;
 }
 
-RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, void *privdata, struct timespec interval) {
+RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                     void *privdata, struct timespec interval) {
   RMUtilTimer *ret = malloc(sizeof(*ret));
   *ret = (RMUtilTimer){
-      .privdata = privdata, .interval = interval, .cb = cb,
+      .privdata = privdata, .interval = interval, .cb = cb, .onTerm = onTerm,
   };
   pthread_cond_init(&ret->cond, NULL);
   pthread_mutex_init(&ret->lock, NULL);
 
-  pthread_create(&ret->thread, NULL, rmutilTimer_Loop, ret);
+  // nobody joins the thread, it frees the timer when it stops
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  pthread_create(&ret->thread, &attr, rmutilTimer_Loop, ret);
+  pthread_attr_destroy(&attr);
   return ret;
 }
 
-int RMUtilTimer_Stop(RMUtilTimer *t) {
-  int rc;
-  if (0 == (rc = pthread_cond_signal(&t->cond))) {
-    rc = pthread_join(t->thread, NULL);
-  }
-  return rc;
+void RMUtilTimer_SetInterval(RMUtilTimer *t, struct timespec interval) {
+  pthread_mutex_lock(&t->lock);
+  t->interval = interval;
+  pthread_cond_signal(&t->cond);
+  pthread_mutex_unlock(&t->lock);
 }
 
-void RMUtilTimer_Free(RMUtilTimer *t) {
-  free(t);
+int RMUtilTimer_Terminate(RMUtilTimer *t) {
+  pthread_mutex_lock(&t->lock);
+  t->terminated = 1;
+  int rc = pthread_cond_signal(&t->cond);
+  pthread_mutex_unlock(&t->lock);
+  return rc;
 }
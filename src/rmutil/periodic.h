@@ -10,18 +10,27 @@ struct RMUtilTimer;
 
 /* RMutilTimerFunc - callback type for timer tasks. The ctx is a thread-safe redis module context
  * that should be locked/unlocked by the callback when running stuff against redis. privdata is
- * pre-existing private data */
-typedef void (*RMutilTimerFunc)(RedisModuleCtx *ctx, void *privdata);
+ * pre-existing private data. The timer keeps running as long as the callback returns non zero */
+typedef int (*RMutilTimerFunc)(RedisModuleCtx *ctx, void *privdata);
+
+/* RMUtilTimerTerminationFunc - called on the timer's thread once the timer stops, e.g. to free the
+ * private data */
+typedef void (*RMUtilTimerTerminationFunc)(void *privdata);
 
 /* Create and start a new periodic timer. Each timer has its own thread and can only be run and
- * stopped once. The timer runs `cb` every `interval` with `privdata` passed to the callback. */
-struct RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, void *privdata,
-                                            struct timespec interval);
+ * stopped once. The timer runs `cb` every `interval` with `privdata` passed to the callback, until
+ * the callback returns 0 or the timer is terminated. Then `onTerm` is called if it is set, and the
+ * timer frees itself. */
+struct RMUtilTimer *RMUtil_NewPeriodicTimer(RMutilTimerFunc cb, RMUtilTimerTerminationFunc onTerm,
+                                            void *privdata, struct timespec interval);
 
-/* Stop the timer loop. This should return immediately and join the thread */
-int RMUtilTimer_Stop(struct RMUtilTimer *t);
+/* Change the interval of a timer. A wait in progress is restarted with the new interval. It may be
+ * called from the callback */
+void RMUtilTimer_SetInterval(struct RMUtilTimer *t, struct timespec interval);
 
-/* Free the timer context. The caller should be responsible for freeing the private data at this
- * point */
-void RMUtilTimer_Free(struct RMUtilTimer *t);
+/* Stop the timer loop. This returns immediately, without waiting for a running callback, so it is
+ * safe to call while holding a lock the callback takes. The callback is not called again once this
+ * returns, unless it was already running. The timer must not be used afterwards, nor after its
+ * callback returned 0 */
+int RMUtilTimer_Terminate(struct RMUtilTimer *t);
 #endif
\ No newline at end of file
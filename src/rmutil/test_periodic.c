@@ -5,23 +5,42 @@
 #include "assert.h"
 #include "test_util.h"
 
-void timerCb(RedisModuleCtx *ctx, void *p) {
+int timerCb(RedisModuleCtx *ctx, void *p) {
   int *x = p;
   (*x)++;
+  return 1;
+}
+
+/* Stops the timer on its third run */
+int limitedTimerCb(RedisModuleCtx *ctx, void *p) {
+  int *x = p;
+  return ++(*x) < 3;
+}
+
+void timerTerm(void *p) {
+  int *x = p;
+  *x = -*x;
 }
 
 int testPeriodic() {
   int x = 0;
-  struct RMUtilTimer *tm =
-      RMUtil_NewPeriodicTimer(timerCb, &x, (struct timespec){.tv_sec = 0, .tv_nsec = 10000000});
+  struct RMUtilTimer *tm = RMUtil_NewPeriodicTimer(
+      timerCb, timerTerm, &x, (struct timespec){.tv_sec = 0, .tv_nsec = 10000000});
 
   sleep(1);
 
-  ASSERT_EQUAL(0, RMUtilTimer_Stop(tm));
-  ASSERT(x > 0);
-  ASSERT(x <= 100);
-  RMUtilTimer_Free(tm);
+  ASSERT_EQUAL(0, RMUtilTimer_Terminate(tm));
+  usleep(100000);
+  // the termination callback negated the count
+  ASSERT(x < 0);
+  ASSERT(x >= -100);
+
+  x = 0;
+  RMUtil_NewPeriodicTimer(limitedTimerCb, timerTerm, &x,
+                          (struct timespec){.tv_sec = 0, .tv_nsec = 10000000});
+  sleep(1);
+  ASSERT_EQUAL(-3, x);
   return 0;
 }
 
-TEST_MAIN({ TESTFUNC(testPeriodic); });
\ No newline at end of file
+TEST_MAIN({ TESTFUNC(testPeriodic); });
@@ -79,6 +79,9 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
   // parse WITHSORTKEYS
   if (RMUtil_ArgExists("WITHSORTKEYS", argv, argc, 3)) req->flags |= Search_WithSortKeys;
 
+  // parse PARALLEL
+  if (RMUtil_ArgExists("PARALLEL", argv, argc, 3)) req->flags |= Search_Parallel;
+
   // Parse VERBATIM and LANGUAGE arguments
   if (RMUtil_ArgExists("VERBATIM", argv, argc, 3)) req->flags |= Search_Verbatim;
 
@@ -193,7 +196,7 @@ RSSearchRequest *ParseRequest(RedisSearchCtx *ctx, RedisModuleString **argv, int
       *errStr = "Bad argument for `INKEYS`";
       goto err;
     }
-    req->idFilter = NewIdFilter(vargs, nargs, &ctx->spec->docs);
+    req->idFilter = NewIdFilter(vargs, nargs);
   }
 
   // parse RETURN argument
@@ -277,8 +280,8 @@ void threadProcessQuery(void *p) {
   RedisModuleCtx *ctx = RedisModule_GetThreadSafeContext(req->bc);
   RedisModule_AutoMemory(ctx);
 
-  RedisModule_ThreadSafeContextLock(ctx);
-
+  // The scheduler runs us with the GIL already held. Query_Execute releases it while evaluating
+  // the query, and takes it back before we reply
   req->sctx =
       NewSearchCtx(ctx, RedisModule_CreateString(ctx, req->indexName, strlen(req->indexName)));
   if (!req->sctx) {
@@ -287,6 +290,7 @@ void threadProcessQuery(void *p) {
   }
 
   Query *q = NewQueryFromRequest(req);
+  uint64_t tick = Profile_Now();
   char *err;
   if (!Query_Parse(q, &err)) {
 
@@ -296,20 +300,27 @@ void threadProcessQuery(void *p) {
       free(err);
     } else {
       /* Simulate an empty response - this means an empty query */
+      if (q->profile) RedisModule_ReplyWithArray(ctx, 2);
       RedisModule_ReplyWithArray(ctx, 1);
       RedisModule_ReplyWithLongLong(ctx, 0);
+      if (q->profile) Query_ReplyProfile(ctx, q);
     }
     Query_Free(q);
     goto end;
   }
+  if (q->profile) QueryProfile_Tick(q->profile, QueryStage_Parse, &tick);
 
   Query_Expand(q);
+  if (q->profile) QueryProfile_Tick(q->profile, QueryStage_Expand, &tick);
 
   if (req->geoFilter) {
     Query_SetGeoFilter(q, req->geoFilter);
   }
 
+  // the keys are only resolved now that we are inside the query's epoch, since a compaction may
+  // have renumbered the docIds since the request was parsed
   if (req->idFilter) {
+    IdFilter_Resolve(req->idFilter, &req->sctx->spec->docs);
     Query_SetIdFilter(q, req->idFilter);
   }
   // set numeric filters if possible
@@ -326,19 +337,57 @@ void threadProcessQuery(void *p) {
     req->numericFilters = NULL;
   }
 
+  // serve the query from the cache if it already ran on this revision of the index. Profiled
+  // queries are always executed
+  IndexSpec *sp = req->sctx->spec;
+  uint32_t revision = sp->revisionId;
+  sds cacheKey = NULL;
+  if (QueryCache_MaxMem && !q->profile) {
+    if (!sp->cache) {
+      sp->cache = NewQueryCache(QueryCache_MaxMem);
+    }
+    cacheKey = sdscatprintf(Query_CacheKey(q), "|%x", req->flags);
+    QueryCacheEntry *e = QueryCache_Get(sp->cache, cacheKey, sdslen(cacheKey), revision);
+    if (e) {
+      QueryResult *r = Query_CachedResult(q, e);
+      QueryResult_Serialize(r, req->sctx, req);
+      QueryResult_Free(r);
+      sdsfree(cacheKey);
+      Query_Free(q);
+      goto end;
+    }
+  }
+
+  Query_Plan(q);
+  if (q->profile) QueryProfile_Tick(q->profile, QueryStage_Plan, &tick);
+
   // Execute the query
   QueryResult *r = Query_Execute(q);
   if (r == NULL) {
     RedisModule_ReplyWithError(ctx, QUERY_ERROR_INTERNAL_STR);
+    sdsfree(cacheKey);
     goto end;
   }
 
-  QueryResult_Serialize(r, req->sctx, req);
+  // the index may have changed or been dropped while the query was executing without the GIL
+  if (cacheKey && !q->aborted && !r->errorString && q->ctx->spec &&
+      q->ctx->spec->revisionId == revision && q->ctx->spec->cache) {
+    QueryResult_Cache(r, q->ctx->spec->cache, cacheKey, sdslen(cacheKey), revision);
+  }
+  sdsfree(cacheKey);
+
+  // a profiled query replies with its results followed by its profile
+  if (q->profile && !r->errorString) {
+    RedisModule_ReplyWithArray(ctx, 2);
+    QueryResult_Serialize(r, req->sctx, req);
+    Query_ReplyProfile(ctx, q);
+  } else {
+    QueryResult_Serialize(r, req->sctx, req);
+  }
   QueryResult_Free(r);
   Query_Free(q);
 
 end:
-  RedisModule_ThreadSafeContextUnlock(ctx);
   RedisModule_UnblockClient(req->bc, NULL);
   RSSearchRequest_Free(req);
   RedisModule_FreeThreadSafeContext(ctx);
@@ -349,6 +398,6 @@ end:
 
 int RSSearchRequest_Process(RedisModuleCtx *ctx, RSSearchRequest *req) {
   req->bc = RedisModule_BlockClient(ctx, NULL, NULL, NULL, 0);
-  ConcurrentSearch_ThreadPoolRun(threadProcessQuery, req);
+  ConcurrentSearch_Run(threadProcessQuery, req);
   return REDISMODULE_OK;
 }
@@ -20,6 +20,11 @@ typedef enum {
 
   Search_WithSortKeys = 0x40,
 
+  Search_Parallel = 0x80,
+
+  // Set by FT.PROFILE, not parsed from the request's arguments
+  Search_Profile = 0x100,
+
 } RSSearchFlags;
 
 #define RS_DEFAULT_QUERY_FLAGS 0x00
@@ -7,6 +7,8 @@
 #include <math.h>
 #include <ctype.h>
 #include "rmalloc.h"
+#include "util/epoch.h"
+#include "gc.h"
 
 RedisModuleType *IndexSpecType;
 
@@ -51,7 +53,7 @@ char *GetFieldNameByBit(IndexSpec *sp, uint32_t id) {
 * Returns REDISMODULE_ERR if there's a parsing error.
 * The command only receives the relvant part of argv.
 *
-* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [NOFREQS]
+* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [NOFREQS] [HASHKEYS]
     SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC]
 */
 IndexSpec *IndexSpec_ParseRedisArgs(RedisModuleCtx *ctx, RedisModuleString *name,
@@ -158,7 +160,7 @@ void _spec_buildSortingTable(IndexSpec *spec, int len) {
     }
   }
 }
-/* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX]
+/* The format currently is FT.CREATE {index} [NOOFFSETS] [NOFIELDS] [NOSCOREIDX] [HASHKEYS]
     SCHEMA {field} [TEXT [WEIGHT {weight}]] | [NUMERIC]
   */
 IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char **err) {
@@ -187,6 +189,16 @@ IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char *
     spec->flags &= ~Index_StoreFreqs;
   }
 
+  if (__argExists(SPEC_HASHKEYS_STR, argv, argc, schemaOffset)) {
+    spec->flags |= Index_HashKeys;
+    DocTable_SetIdMapType(&spec->docs, DocIdMap_Hash);
+  }
+
+  // only written by the AOF rewrite of indexes created before Unicode case folding
+  if (__argExists(SPEC_ASCIIFOLD_STR, argv, argc, schemaOffset)) {
+    spec->flags &= ~Index_FoldUnicode;
+  }
+
   int swIndex = __findOffset(SPEC_STOPWORDS_STR, argv, argc);
   if (swIndex >= 0 && swIndex + 1 < schemaOffset) {
     int listSize = atoi(argv[swIndex + 1]);
@@ -239,7 +251,11 @@ failure:  // on failure free the spec fields array and return an error
 }
 
 int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len) {
-  return Trie_InsertStringBuffer(sp->terms, (char *)term, len, 1, 1, NULL);
+  return IndexSpec_AddTermDocs(sp, term, len, 1);
+}
+
+int IndexSpec_AddTermDocs(IndexSpec *sp, const char *term, size_t len, size_t numDocs) {
+  return Trie_InsertStringBuffer(sp->terms, (char *)term, len, (double)numDocs, 1, NULL);
 }
 
 void IndexSpec_Free(void *ctx) {
@@ -256,6 +272,9 @@ void IndexSpec_Free(void *ctx) {
     rm_free(spec->fields);
   }
   rm_free(spec->name);
+  if (spec->cache) {
+    QueryCache_Free(spec->cache);
+  }
   if (spec->sortables) {
     SortingTable_Free(spec->sortables);
     spec->sortables = NULL;
@@ -327,12 +346,17 @@ IndexSpec *NewIndexSpec(const char *name, size_t numFields) {
   IndexSpec *sp = rm_malloc(sizeof(IndexSpec));
   sp->fields = rm_calloc(sizeof(FieldSpec), numFields ? numFields : SPEC_MAX_FIELDS);
   sp->numFields = 0;
-  sp->flags = INDEX_DEFAULT_FLAGS;
+  // new indexes fold the case of their terms with the Unicode tables, older ones keep the flags
+  // they were saved with
+  sp->flags = INDEX_DEFAULT_FLAGS | Index_FoldUnicode;
   sp->name = rm_strdup(name);
   sp->docs = NewDocTable(1000);
   sp->stopwords = DefaultStopWordList();
   sp->terms = NewTrie();
   sp->sortables = NULL;
+  sp->revisionId = 0;
+  sp->cache = NULL;
+  sp->gc = NULL;
   memset(&sp->stats, 0, sizeof(sp->stats));
   return sp;
 }
@@ -344,6 +368,7 @@ void __fieldSpec_rdbSave(RedisModuleIO *rdb, FieldSpec *f) {
   RedisModule_SaveDouble(rdb, f->weight);
   RedisModule_SaveUnsigned(rdb, f->sortable);
   RedisModule_SaveSigned(rdb, f->sortIdx);
+  RedisModule_SaveUnsigned(rdb, f->docIdGen);
 }
 
 void __fieldSpec_rdbLoad(RedisModuleIO *rdb, FieldSpec *f, int encver) {
@@ -356,6 +381,9 @@ void __fieldSpec_rdbLoad(RedisModuleIO *rdb, FieldSpec *f, int encver) {
     f->sortable = RedisModule_LoadUnsigned(rdb);
     f->sortIdx = RedisModule_LoadSigned(rdb);
   }
+  if (encver >= INDEX_MIN_COMPACT_VERSION) {
+    f->docIdGen = RedisModule_LoadUnsigned(rdb);
+  }
 }
 
 void __indexStats_rdbLoad(RedisModuleIO *rdb, IndexStats *stats) {
@@ -392,11 +420,18 @@ void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
   sp->terms = NULL;
   sp->docs = NewDocTable(1000);
   sp->sortables = NULL;
+  sp->revisionId = 0;
+  sp->cache = NULL;
+  sp->gc = NULL;
   sp->name = RedisModule_LoadStringBuffer(rdb, NULL);
   sp->flags = (IndexFlags)RedisModule_LoadUnsigned(rdb);
   if (encver < INDEX_MIN_NOFREQ_VERSION) {
     sp->flags |= Index_StoreFreqs;
   }
+  // the id map is not saved, DocTable_RdbLoad rebuilds it from the keys
+  if (sp->flags & Index_HashKeys) {
+    DocTable_SetIdMapType(&sp->docs, DocIdMap_Hash);
+  }
 
   sp->numFields = RedisModule_LoadUnsigned(rdb);
   sp->fields = rm_calloc(sp->numFields, sizeof(FieldSpec));
@@ -429,6 +464,7 @@ void *IndexSpec_RdbLoad(RedisModuleIO *rdb, int encver) {
   } else {
     sp->stopwords = DefaultStopWordList();
   }
+  sp->gc = NewGarbageCollector(sp);
   return sp;
 }
 
@@ -477,6 +513,12 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
   if (!(sp->flags & Index_StoreScoreIndexes)) {
     __vpushStr(args, ctx, SPEC_NOSCOREIDX_STR);
   }
+  if (sp->flags & Index_HashKeys) {
+    __vpushStr(args, ctx, SPEC_HASHKEYS_STR);
+  }
+  if (!(sp->flags & Index_FoldUnicode)) {
+    __vpushStr(args, ctx, SPEC_ASCIIFOLD_STR);
+  }
 
   // write SCHEMA keyword
   __vpushStr(args, ctx, SPEC_SCHEMA_STR);
@@ -517,12 +559,23 @@ void IndexSpec_AofRewrite(RedisModuleIO *aof, RedisModuleString *key, void *valu
   Vector_Free(args);
 }
 
+/* Free callback of the index type. Queries running without the GIL may still be using the spec and
+ * its document table, so we only free it once they're done */
+static void IndexSpec_TypeFree(void *value) {
+  IndexSpec *sp = value;
+  if (sp->gc) {
+    GC_Stop(sp->gc);
+    sp->gc = NULL;
+  }
+  Epoch_Retire(value, IndexSpec_Free);
+}
+
 int IndexSpec_RegisterType(RedisModuleCtx *ctx) {
   RedisModuleTypeMethods tm = {.version = REDISMODULE_TYPE_METHOD_VERSION,
                                .rdb_load = IndexSpec_RdbLoad,
                                .rdb_save = IndexSpec_RdbSave,
                                .aof_rewrite = IndexSpec_AofRewrite,
-                               .free = IndexSpec_Free};
+                               .free = IndexSpec_TypeFree};
 
   IndexSpecType = RedisModule_CreateDataType(ctx, "ft_index0", INDEX_CURRENT_VERSION, &tm);
   if (IndexSpecType == NULL) {
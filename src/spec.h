@@ -8,6 +8,7 @@
 #include "trie/trie_type.h"
 #include "sortable.h"
 #include "stopwords.h"
+#include "query_cache.h"
 
 typedef enum fieldType { F_FULLTEXT, F_NUMERIC, F_GEO, F_TAG } FieldType;
 
@@ -18,6 +19,8 @@ typedef enum fieldType { F_FULLTEXT, F_NUMERIC, F_GEO, F_TAG } FieldType;
 #define SPEC_NOFIELDS_STR "NOFIELDS"
 #define SPEC_NOSCOREIDX_STR "NOSCOREIDX"
 #define SPEC_NOFREQS_STR "NOFREQS"
+#define SPEC_HASHKEYS_STR "HASHKEYS"
+#define SPEC_ASCIIFOLD_STR "ASCIIFOLD"
 #define SPEC_SCHEMA_STR "SCHEMA"
 #define SPEC_TEXT_STR "TEXT"
 #define SPEC_WEIGHT_STR "WEIGHT"
@@ -44,6 +47,13 @@ typedef struct fieldSpec {
   int sortable;
   int sortIdx;
 
+  // the docIdGen of the docIds in the index of a geo field, see DocTable. Text and numeric indexes
+  // keep it themselves, but geo indexes are plain sorted sets
+  uint32_t docIdGen;
+  // while the DocTable is being compacted, the old docIds whose locations were copied to the
+  // renumbered copy of the field's geo index, see GeoIndex_PrepareRenumber
+  t_docId renumberedUpTo;
+
   // TODO: const char **separators;
   // size_t numSeparators;
   // TODO: More options here..
@@ -69,6 +79,13 @@ typedef enum {
   Index_HasCustomStopwords = 0x08,
   Index_StoreFreqs = 0x010,
   Index_StoreNumeric = 0x020,
+  // Full blocks of the inverted index are PForDelta packed. Only for docId-only and numeric indexes
+  Index_PackedBlocks = 0x040,
+  // The document keys are mapped to docIds with a hash map instead of a trie
+  Index_HashKeys = 0x080,
+  // Terms are case folded with the Unicode tables. Indexes created before that only lowercase ASCII
+  // letters, and keep doing so, or their non ASCII terms would not be found anymore
+  Index_FoldUnicode = 0x100,
   Index_DocIdsOnly = 0x00
 } IndexFlags;
 
@@ -76,12 +93,15 @@ typedef enum {
   Index_StoreFreqs | Index_StoreTermOffsets | Index_StoreFieldFlags | Index_StoreScoreIndexes
 #define INDEX_STORAGE_MASK \
   (Index_StoreFreqs | Index_StoreFieldFlags | Index_StoreTermOffsets | Index_StoreNumeric)
-#define INDEX_CURRENT_VERSION 6
+#define INDEX_CURRENT_VERSION 7
 #define INDEX_MIN_COMPAT_VERSION 2
 
 // Versions below this always store the frequency
 #define INDEX_MIN_NOFREQ_VERSION 6
 
+// Versions below this do not save the docIdGen of the table and geo fields
+#define INDEX_MIN_COMPACT_VERSION 7
+
 typedef struct {
   char *name;
   FieldSpec *fields;
@@ -97,6 +117,14 @@ typedef struct {
   DocTable docs;
 
   StopWordList *stopwords;
+
+  // Bumped whenever documents are added to or deleted from the index, or their payloads change
+  uint32_t revisionId;
+  // Query results cached for the current revision, created on the first search
+  QueryCache *cache;
+
+  // The garbage collector of the index. Only set for indexes in the keyspace, if it is enabled
+  struct GarbageCollector *gc;
 } IndexSpec;
 
 extern RedisModuleType *IndexSpecType;
@@ -131,6 +159,9 @@ IndexSpec *IndexSpec_Parse(const char *name, const char **argv, int argc, char *
 IndexSpec *IndexSpec_Load(RedisModuleCtx *ctx, const char *name, int openWrite);
 
 int IndexSpec_AddTerm(IndexSpec *sp, const char *term, size_t len);
+
+/* Add a term that appears in numDocs new documents. Returns 1 if the term is new to the index */
+int IndexSpec_AddTermDocs(IndexSpec *sp, const char *term, size_t len, size_t numDocs);
 /*
 * Free an indexSpec. This doesn't free the spec itself as it's not allocated by the parser
 * and should be on the request's stack
@@ -2,11 +2,16 @@
 #include "stopwords.h"
 #include "dep/triemap/triemap.h"
 #include "rmalloc.h"
-#include <ctype.h>
+#include "tokenize.h"
+#include <string.h>
 
 #define MAX_STOPWORDLIST_SIZE 1024
 
-typedef struct StopWordList { TrieMap *m; } StopWordList;
+typedef struct StopWordList {
+  TrieMap *m;
+  // the list is freed when the last reference to it is released, see StopWordList_Ref
+  int refcount;
+} StopWordList;
 
 StopWordList *__default_stopwords = NULL;
 
@@ -18,7 +23,7 @@ StopWordList *DefaultStopWordList() {
   return __default_stopwords;
 }
 
-/* Check if a stopword list contains a term. The term must be already lowercased */
+/* Check if a stopword list contains a term. The term must be already folded */
 int StopWordList_Contains(StopWordList *sl, const char *term, size_t len) {
   if (!sl || !term) {
     return 0;
@@ -47,22 +52,20 @@ StopWordList *NewStopWordListCStr(const char **strs, size_t len) {
   }
   StopWordList *sl = rm_malloc(sizeof(*sl));
   sl->m = NewTrieMap();
+  sl->refcount = 1;
 
   for (size_t i = 0; i < len; i++) {
 
-    char *t = strdup(strs[i]);
+    // fold the stopwords the same way the tokenizer folds the terms they are matched against. Lists
+    // are only created with new indexes, older ones load theirs already folded
+    size_t tlen = strlen(strs[i]);
+    char *t = malloc(FOLD_TERM_MAXLEN(tlen) + 1);
     if (t == NULL) {
       break;
     }
-    size_t tlen = strlen(t);
+    tlen = FoldTerm(t, strs[i], tlen, 1);
 
-    // lowercase the letters
-    for (size_t pos = 0; pos < tlen; pos++) {
-      if (isalpha(t[pos])) {
-        t[pos] = tolower(t[pos]);
-      }
-    }
-    // printf("Adding stopword %s\n", t);
+    // printf("Adding stopword %.*s\n", (int)tlen, t);
     TrieMap_Add(sl->m, t, tlen, NULL, NULL);
     free(t);
   }
@@ -71,10 +74,18 @@ StopWordList *NewStopWordListCStr(const char **strs, size_t len) {
 }
 
 /* Free a stopword list's memory */
-void StopWordList_Free(StopWordList *sl) {
+StopWordList *StopWordList_Ref(StopWordList *sl) {
   if (sl) {
-    TrieMap_Free(sl->m, NULL);
+    __atomic_add_fetch(&sl->refcount, 1, __ATOMIC_RELAXED);
+  }
+  return sl;
+}
+
+void StopWordList_Free(StopWordList *sl) {
+  if (!sl || __atomic_sub_fetch(&sl->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
   }
+  TrieMap_Free(sl->m, NULL);
   rm_free(sl);
 }
 
@@ -83,6 +94,7 @@ StopWordList *StopWordList_RdbLoad(RedisModuleIO *rdb, int encver) {
   uint64_t elements = RedisModule_LoadUnsigned(rdb);
   StopWordList *sl = rm_malloc(sizeof(*sl));
   sl->m = NewTrieMap();
+  sl->refcount = 1;
 
   while (elements--) {
     size_t len;
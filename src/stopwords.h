@@ -15,7 +15,7 @@ typedef struct StopWordList StopWordList;
 struct StopWordList;
 #endif
 
-/* Check if a stopword list contains a term. The term must be already lowercased */
+/* Check if a stopword list contains a term. The term must be already folded, see FoldTerm */
 int StopWordList_Contains(struct StopWordList *sl, const char *term, size_t len);
 
 struct StopWordList *DefaultStopWordList();
@@ -26,7 +26,11 @@ struct StopWordList *NewStopWordList(RedisModuleString **strs, size_t len);
 /* Create a new stopword list from a list of NULL-terminated C strings */
 struct StopWordList *NewStopWordListCStr(const char **strs, size_t len);
 
-/* Free a stopword list's memory */
+/* Take another reference to a stopword list, keeping it alive after its index drops it. Returns
+ * the list */
+struct StopWordList *StopWordList_Ref(struct StopWordList *sl);
+
+/* Release a reference to a stopword list, freeing it once it was the last one */
 void StopWordList_Free(struct StopWordList *sl);
 
 /* Load a stopword list from RDB */
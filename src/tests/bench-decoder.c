@@ -1,14 +1,16 @@
 #include "redisearch.h"
 #include "index.h"
 #include "inverted_index.h"
+#include "qint.h"
 #include "spec.h"
 #include "rmutil/alloc.h"
 #include "time_sample.h"
 
 #define NUM_ENTRIES 5000000
+#define NUM_ITERATIONS 10
 #define MY_FLAGS Index_StoreFreqs | Index_StoreFieldFlags | Index_StoreScoreIndexes
 
-static void writeEntry(InvertedIndex *idx, size_t id) {
+static void writeEntry(InvertedIndex *idx, IndexEncoder enc, size_t id) {
   ForwardIndexEntry ent = {0};
   ent.docId = id;
   ent.docScore = 1.0;
@@ -17,29 +19,61 @@ static void writeEntry(InvertedIndex *idx, size_t id) {
   ent.term = "foo";
   ent.vw = NULL;
   ent.len = 3;
-  InvertedIndex_WriteEntry(idx, &ent);
+  InvertedIndex_WriteForwardIndexEntry(idx, enc, &ent);
+}
+
+static void printSample(const char *name, TimeSample *ts) {
+  printf("%-10s %d records in %lldms, %fns/record\n", name, ts->num, TimeSampler_DurationMS(ts),
+         (double)TimeSampler_DurationNS(ts) / (ts->num ? ts->num : 1));
+}
+
+/* Read the entire index with an index reader, either record by record or in batches */
+static void benchReader(InvertedIndex *idx, int batchMode) {
+  IndexReader *r = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  r->batchMode = batchMode;
+  IndexIterator *it = NewReadIterator(r);
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  RSIndexResult *res;
+  while (INDEXREAD_EOF != it->Read(it->ctx, &res)) {
+    TimeSampler_Tick(&ts);
+  }
+  TimeSampler_End(&ts);
+  printSample(batchMode ? "batch" : "record", &ts);
+  ReadIterator_Free(it);
+}
+
+typedef size_t (*BatchDecoder)(BufferReader *br, int len, int trailing, uint32_t *cols[],
+                               uint32_t *positions, size_t max);
+
+/* Decode the raw blocks of the index with a batch decoder */
+static void benchBlocks(InvertedIndex *idx, const char *name, BatchDecoder decode) {
+  uint32_t c[3][100], positions[101];
+  uint32_t *cols[3] = {c[0], c[1], c[2]};
+  TimeSample ts;
+  TimeSampler_Start(&ts);
+  for (uint32_t i = 0; i < idx->size; i++) {
+    BufferReader br = NewBufferReader(idx->blocks[i].data);
+    ts.num += decode(&br, 3, 0, cols, positions, 100);
+  }
+  TimeSampler_End(&ts);
+  printSample(name, &ts);
 }
 
 int main(int argc, char **argv) {
   RMUTil_InitAlloc();
   InvertedIndex *idx = NewInvertedIndex(MY_FLAGS, 1);
-  for (size_t ii = 0; ii < NUM_ENTRIES; ++ii) {
-    writeEntry(idx, ii);
+  IndexEncoder enc = InvertedIndex_GetEncoder(MY_FLAGS);
+  for (size_t ii = 1; ii <= NUM_ENTRIES; ++ii) {
+    writeEntry(idx, enc, ii);
   }
 
-  for (size_t ii = 0; ii < 100; ++ii) {
-    IndexReader *r = NewIndexReader(idx, NULL, RS_FIELDMASK_ALL, MY_FLAGS, NULL, 0);
-    IndexIterator *it = NewReadIterator(r);
-    TimeSample ts;
-    TimeSampler_Start(&ts);
-    RSIndexResult *res;
-    while (INDEXREAD_EOF != it->Read(it->ctx, &res)) {
-      TimeSampler_Tick(&ts);
-    }
-    TimeSampler_End(&ts);
-    printf("%d iterations in %lldms, %fns/iter\n", ts.num, TimeSampler_DurationMS(&ts),
-           TimeSampler_IterationMS(&ts) * 1000000);
-    ReadIterator_Free(it);
+  for (size_t ii = 0; ii < NUM_ITERATIONS; ++ii) {
+    benchReader(idx, 0);
+    benchReader(idx, 1);
+    benchBlocks(idx, "scalar", qint_decodeBatchScalar);
+    benchBlocks(idx, "simd", qint_decodeBatch);
   }
+  InvertedIndex_Free(idx);
   return 0;
-}
\ No newline at end of file
+}
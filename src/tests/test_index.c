@@ -1,11 +1,18 @@
 #include "../buffer.h"
 #include "../index.h"
+#include "../id_bitmap.h"
+#include "../id_list.h"
 #include "../inverted_index.h"
 #include "../query_parser/tokenizer.h"
 #include "../rmutil/alloc.h"
 #include "../spec.h"
 #include "../tokenize.h"
 #include "../varint.h"
+#include "../util/epoch.h"
+#include "../profile.h"
+#include "../decode_cache.h"
+#include "../forward_index.h"
+#include "../util/arena.h"
 #include "test_util.h"
 #include "time_sample.h"
 #include "../rmutil/alloc.h"
@@ -13,6 +20,7 @@
 #include <math.h>
 #include <stdio.h>
 #include <time.h>
+#include <sys/param.h>
 
 RSOffsetIterator _offsetVector_iterate(RSOffsetVector *v);
 int testVarint() {
@@ -131,7 +139,7 @@ int testIndexReadWriteFlags(uint32_t indexFlags) {
     //     w->ndocs);
     // }
 
-    ForwardIndexEntry h;
+    ForwardIndexEntry h = {0};
     h.docId = i;
     h.fieldMask = 1;
     h.freq = (1 + i % 100) / (float)101;
@@ -219,12 +227,11 @@ InvertedIndex *createIndex(int size, int idStep) {
     //     printf("iw cap: %ld, iw size: %d, numdocs: %d\n", w->cap, IW_Len(w),
     //     w->ndocs);
     // }
-    ForwardIndexEntry h;
+    ForwardIndexEntry h = {0};
     h.docId = id;
     h.fieldMask = 1;
     h.freq = 1;
     h.docScore = 1;
-    h.stringFreeable = 0;
     h.term = "hello";
     h.len = 5;
 
@@ -366,6 +373,421 @@ int testOptional() {
   return 0;
 }
 
+int testSkipTo() {
+  // every third docId, so skips hit both existing and missing ids
+  InvertedIndex *idx = createIndex(1000, 3);
+  ASSERT(idx->blocks[0].numCheckpoints > 0);
+
+  IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  RSIndexResult *h = NULL;
+  for (t_docId id = 1; id <= 3000; id += 7) {
+    int rc = IR_SkipTo(ir, id, &h);
+    if (id % 3 == 0) {
+      ASSERT_EQUAL(INDEXREAD_OK, rc);
+      ASSERT_EQUAL(id, h->docId);
+    } else {
+      ASSERT_EQUAL(INDEXREAD_NOTFOUND, rc);
+      ASSERT_EQUAL(id + 3 - id % 3, h->docId);
+    }
+    // the record must be fully decoded, not just stepped over
+    ASSERT_EQUAL(1, h->freq);
+    ASSERT_EQUAL(((h->docId / 3 - 1) % 4), h->offsetsSz);
+  }
+  ASSERT_EQUAL(INDEXREAD_EOF, IR_SkipTo(ir, 3001, &h));
+  IR_Free(ir);
+
+  // rebuilding the skip table from the block's data yields the same checkpoints
+  for (uint32_t i = 0; i < idx->size; i++) {
+    IndexBlock *blk = &idx->blocks[i];
+    IndexBlockCheckpoint cps[blk->numCheckpoints];
+    uint16_t ncps = blk->numCheckpoints;
+    memcpy(cps, blk->checkpoints, ncps * sizeof(*cps));
+    IndexBlock_BuildCheckpoints(blk, idx->flags);
+    ASSERT_EQUAL(ncps, blk->numCheckpoints);
+    for (uint16_t n = 0; n < ncps; n++) {
+      ASSERT_EQUAL(cps[n].lastId, blk->checkpoints[n].lastId);
+      ASSERT_EQUAL(cps[n].offset, blk->checkpoints[n].offset);
+    }
+  }
+
+  InvertedIndex_Free(idx);
+  return 0;
+}
+
+int testBatchRead() {
+  for (uint32_t flags = 0; flags < 32; flags++) {
+    IndexEncoder enc = InvertedIndex_GetEncoder(flags);
+    if (!enc || !InvertedIndex_GetDecoder(flags)) continue;
+
+    InvertedIndex *idx = NewInvertedIndex(flags, 1);
+    // growing gaps so deltas need different byte widths
+    t_docId id = 0;
+    for (int i = 0; i < 250; i++) {
+      ForwardIndexEntry h = {0};
+      h.docId = id += 1 + i * i * 3;
+      h.fieldMask = i % 3 ? 2 : 1;
+      h.freq = i * 7;
+      h.docScore = 1;
+      h.vw = NewVarintVectorWriter(8);
+      for (int n = 0; n < i % 5; n++) {
+        VVW_Write(h.vw, n * 1000);
+      }
+      VVW_Truncate(h.vw);
+      InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+      VVW_Free(h.vw);
+    }
+
+    // a batch reader must return exactly what the record-by-record reader returns
+    IndexReader *br = NewTermIndexReader(idx, NULL, 2, NULL);
+    IndexReader *sr = NewTermIndexReader(idx, NULL, 2, NULL);
+    sr->batchMode = 0;
+    RSIndexResult *bh, *sh;
+    int n = 0;
+    while (IR_Read(sr, &sh) != INDEXREAD_EOF) {
+      // skip to some of the records
+      int rc = n % 4 == 3 ? IR_SkipTo(br, sh->docId, &bh) : IR_Read(br, &bh);
+      ASSERT(rc != INDEXREAD_EOF);
+      ASSERT_EQUAL(sh->docId, bh->docId);
+      ASSERT_EQUAL(sh->freq, bh->freq);
+      ASSERT_EQUAL(sh->fieldMask, bh->fieldMask);
+      ASSERT_EQUAL(sh->term.offsets.len, bh->term.offsets.len);
+      ASSERT(!memcmp(sh->term.offsets.data, bh->term.offsets.data, sh->term.offsets.len));
+      n++;
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(br, &bh));
+    ASSERT(n > 0);
+    // every qint encoded index is read in batches
+    ASSERT_EQUAL(((flags & INDEX_STORAGE_MASK) != Index_DocIdsOnly), (br->batch != NULL));
+    IR_Free(br);
+    IR_Free(sr);
+    InvertedIndex_Free(idx);
+  }
+  return 0;
+}
+
+int testIntersectionOrder() {
+  InvertedIndex *dense = createIndex(10000, 1);
+  InvertedIndex *sparse = createIndex(20, 500);
+  IndexReader *rd = NewTermIndexReader(dense, NULL, RS_FIELDMASK_ALL, NULL);
+  IndexReader *rs = NewTermIndexReader(sparse, NULL, RS_FIELDMASK_ALL, NULL);
+
+  IndexIterator **irs = calloc(2, sizeof(IndexIterator *));
+  irs[0] = NewReadIterator(rd);
+  irs[1] = NewReadIterator(rs);
+  IndexIterator *ii = NewIntersecIterator(irs, 2, NULL, RS_FIELDMASK_ALL, -1, 0);
+  ASSERT_EQUAL(20, ii->NumEstimated(ii->ctx));
+
+  // the sparse child drives, but the hits keep the order of the query
+  IntersectContext *ic = ii->ctx;
+  ASSERT_EQUAL(1, ic->order[0]);
+  RSIndexResult *h;
+  int count = 0;
+  while (ii->Read(ii->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(500 * (count + 1), h->docId);
+    ASSERT(h->agg.children[0] == IR_Current(rd));
+    ASSERT(h->agg.children[1] == IR_Current(rs));
+    count++;
+  }
+  ASSERT_EQUAL(20, count);
+  // we skipped through the dense child instead of reading all of it
+  ASSERT(IR_NumDocs(rd) < 100);
+
+  ii->Free(ii);
+  InvertedIndex_Free(dense);
+  InvertedIndex_Free(sparse);
+  return 0;
+}
+
+int testUnionHeap() {
+#define NUM_CHILDREN 40
+  InvertedIndex *idxs[NUM_CHILDREN];
+  IndexIterator **irs = calloc(NUM_CHILDREN, sizeof(IndexIterator *));
+  // child i holds the multiples of i+2, so we know how many children hit every docId
+  int expected[4200] = {0};
+  for (int i = 0; i < NUM_CHILDREN; i++) {
+    idxs[i] = createIndex(100, i + 2);
+    irs[i] = NewReadIterator(NewTermIndexReader(idxs[i], NULL, RS_FIELDMASK_ALL, NULL));
+    for (int n = 1; n <= 100; n++) {
+      expected[n * (i + 2)]++;
+    }
+  }
+  IndexIterator *ui = NewUnionIterator(irs, NUM_CHILDREN, NULL, 0);
+  ASSERT(((UnionContext *)ui->ctx)->heap != NULL);
+
+  RSIndexResult *h;
+  t_docId id = 0;
+  while (ui->Read(ui->ctx, &h) != INDEXREAD_EOF) {
+    while (!expected[++id])
+      ;
+    ASSERT_EQUAL(id, h->docId);
+    ASSERT_EQUAL(expected[id], (RSIndexResult_IsAggregate(h) ? h->agg.numChildren : 1));
+    // skip ahead every once in a while
+    if (id % 50 == 0 && id < 4000) {
+      t_docId target = id + 7;
+      int rc = ui->SkipTo(ui->ctx, target, &h);
+      ASSERT_EQUAL((expected[target] ? INDEXREAD_OK : INDEXREAD_NOTFOUND), rc);
+      if (rc == INDEXREAD_OK) {
+        ASSERT_EQUAL(target, h->docId);
+        id = target;
+      } else {
+        // a miss moves us past the next docId in the union
+        for (id = target; !expected[id]; id++)
+          ;
+      }
+    }
+  }
+  // the last docId is 100 * (NUM_CHILDREN + 1)
+  ASSERT_EQUAL(4100, id);
+
+  ui->Free(ui);
+  for (int i = 0; i < NUM_CHILDREN; i++) {
+    InvertedIndex_Free(idxs[i]);
+  }
+  return 0;
+}
+
+int testIdBitmap() {
+  // the multiples of 3 and a few sparse ids, spanning several chunks with an empty one between them
+  size_t n = 0;
+  t_docId *ids = calloc(70000, sizeof(t_docId));
+  for (t_docId id = 3; id < 200000; id += 3) {
+    ids[n++] = id;
+  }
+  t_docId sparse[] = {5, 9, 70001, 400000};
+  IndexIterator **its = calloc(3, sizeof(IndexIterator *));
+  its[0] = NewIdListIterator(ids, n);
+  its[1] = NULL;
+  its[2] = NewIdListIterator(sparse, 4);
+  free(ids);
+
+  IndexIterator *it = NewIdBitmapIterator(its, 3);
+  // 9 is in both children
+  ASSERT_EQUAL(n + 3, it->NumEstimated(it->ctx));
+
+  RSIndexResult *h;
+  ASSERT_EQUAL(INDEXREAD_OK, it->Read(it->ctx, &h));
+  ASSERT_EQUAL(3, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, it->Read(it->ctx, &h));
+  ASSERT_EQUAL(5, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, it->Read(it->ctx, &h));
+  ASSERT_EQUAL(6, h->docId);
+  ASSERT_EQUAL(RSResultType_Virtual, h->type);
+
+  // hits
+  ASSERT_EQUAL(INDEXREAD_OK, it->SkipTo(it->ctx, 70001, &h));
+  ASSERT_EQUAL(70001, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, it->SkipTo(it->ctx, 150000, &h));
+  ASSERT_EQUAL(150000, it->LastDocId(it->ctx));
+  // a miss lands on the next docId
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, it->SkipTo(it->ctx, 150001, &h));
+  ASSERT_EQUAL(150003, h->docId);
+  ASSERT_EQUAL(INDEXREAD_OK, it->Read(it->ctx, &h));
+  ASSERT_EQUAL(150006, h->docId);
+  // skip over the empty chunks
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, it->SkipTo(it->ctx, 200000, &h));
+  ASSERT_EQUAL(400000, h->docId);
+  ASSERT_EQUAL(INDEXREAD_EOF, it->Read(it->ctx, &h));
+  ASSERT(!it->HasNext(it->ctx));
+  it->Free(it);
+
+  // skipping past the end
+  its = calloc(1, sizeof(IndexIterator *));
+  its[0] = NewIdListIterator(sparse, 4);
+  it = NewIdBitmapIterator(its, 1);
+  ASSERT_EQUAL(INDEXREAD_EOF, it->SkipTo(it->ctx, 400001, &h));
+  it->Free(it);
+  return 0;
+}
+
+#define TOPK_NUM_DOCS 30000
+#define TOPK_K 10
+
+typedef struct {
+  double score;
+  t_docId docId;
+} topkEntry;
+
+/* TF-IDF like the default scorer, without the slop */
+static double topkScore(RSIndexResult *r, float *docScores, uint32_t *maxFreqs) {
+  double tfidf = 0;
+  if (RSIndexResult_IsAggregate(r)) {
+    for (int i = 0; i < r->agg.numChildren; i++) {
+      RSIndexResult *c = r->agg.children[i];
+      tfidf += c->freq * c->term.term->idf;
+    }
+  } else {
+    tfidf = r->freq * r->term.term->idf;
+  }
+  return tfidf * docScores[r->docId] / maxFreqs[r->docId];
+}
+
+/* Collect the top-k of a union the way the query does. Returns the number of documents read */
+static size_t topkCollect(IndexIterator *ui, double *minScore, topkEntry *top, float *docScores,
+                          uint32_t *maxFreqs) {
+  size_t n = 0, read = 0;
+  RSIndexResult *h;
+  while (ui->Read(ui->ctx, &h) != INDEXREAD_EOF) {
+    read++;
+    double score = topkScore(h, docScores, maxFreqs);
+    // equal scores are won by the later document
+    if (n == TOPK_K && score < top[n - 1].score) continue;
+    int i = n < TOPK_K ? n++ : n - 1;
+    for (; i > 0 && top[i - 1].score <= score; i--) {
+      top[i] = top[i - 1];
+    }
+    top[i] = (topkEntry){score, h->docId};
+    if (n == TOPK_K) *minScore = top[n - 1].score;
+  }
+  return read;
+}
+
+int testUnionTopK() {
+  // a rare term with a high idf, and two common terms with low ones
+  const double idfs[3] = {6, 1, 2};
+  const int every[3] = {97, 2, 3};
+  float docScores[TOPK_NUM_DOCS + 1];
+  uint32_t maxFreqs[TOPK_NUM_DOCS + 1];
+  InvertedIndex *idxs[3];
+  for (int t = 0; t < 3; t++) {
+    idxs[t] = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  }
+
+  IndexEncoder enc = InvertedIndex_GetEncoder(INDEX_DEFAULT_FLAGS);
+  for (t_docId id = 1; id <= TOPK_NUM_DOCS; id++) {
+    // most documents have low scores, and every once in a while there's a high one
+    docScores[id] = id % 1067 == 0 ? 1 : (float)(id % 7) / 100;
+    maxFreqs[id] = 1;
+    for (int t = 0; t < 3; t++) {
+      if (id % every[t]) continue;
+      ForwardIndexEntry h = {0};
+      h.docId = id;
+      h.fieldMask = 1;
+      h.freq = 1 + id % 3;
+      h.docScore = docScores[id];
+      h.term = "hello";
+      h.len = 5;
+      InvertedIndex_WriteForwardIndexEntry(idxs[t], enc, &h);
+      maxFreqs[id] = MAX(maxFreqs[id], h.freq);
+    }
+  }
+  ASSERT_EQUAL(1, idxs[0]->blocks[0].maxScore);
+  ASSERT_EQUAL(3, idxs[0]->blocks[0].maxFreq);
+
+  topkEntry expected[TOPK_K], top[TOPK_K];
+  size_t numRead[2];
+  for (int pass = 0; pass < 2; pass++) {
+    IndexIterator **its = calloc(3, sizeof(IndexIterator *));
+    for (int t = 0; t < 3; t++) {
+      IndexReader *ir = NewTermIndexReader(idxs[t], NULL, RS_FIELDMASK_ALL, NULL);
+      RSToken tok = {.str = "hello", .len = 5};
+      ir->record->term.term = NewTerm(&tok);
+      ir->record->term.term->idf = idfs[t];
+      its[t] = NewReadIterator(ir);
+    }
+    IndexIterator *ui = NewUnionIterator(its, 3, NULL, 0);
+    double minScore = 0;
+    if (pass) {
+      ASSERT(UnionIterator_EnableTopK(ui, &minScore));
+    }
+    numRead[pass] = topkCollect(ui, &minScore, pass ? top : expected, docScores, maxFreqs);
+    ui->Free(ui);
+  }
+
+  // pruning yields the exact same results, reading far less documents
+  for (int i = 0; i < TOPK_K; i++) {
+    ASSERT_EQUAL(expected[i].docId, top[i].docId);
+    ASSERT_EQUAL(expected[i].score, top[i].score);
+  }
+  ASSERT(numRead[1] * 10 < numRead[0]);
+
+  for (int t = 0; t < 3; t++) {
+    InvertedIndex_Free(idxs[t]);
+  }
+  return 0;
+}
+
+int testScoreIndex() {
+#define SCOREINDEX_NUM_DOCS 1000
+  char buf[16];
+  DocTable dt = NewDocTable(SCOREINDEX_NUM_DOCS);
+  InvertedIndex *idx = NewInvertedIndex(INDEX_DEFAULT_FLAGS, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(idx->flags);
+  float impacts[SCOREINDEX_NUM_DOCS + 1];
+  for (int i = 1; i <= SCOREINDEX_NUM_DOCS; i++) {
+    sprintf(buf, "doc_%d", i);
+    double score = (double)((i * 7919) % 1009) / 1009;
+    t_docId docId = DocTable_Put(&dt, buf, score, Document_DefaultFlags, NULL, 0);
+
+    ForwardIndexEntry h = {0};
+    h.docId = docId;
+    h.fieldMask = 1;
+    h.freq = 1 + i % 4;
+    h.docMaxFreq = 4;
+    h.docScore = score;
+    h.term = "hello";
+    h.len = 5;
+    InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+    impacts[docId] = (float)((double)h.freq * h.docScore / 4);
+  }
+
+  // the score index holds the top records, all the others are below its floor
+  ScoreIndex *si = &idx->scoreIndex;
+  ASSERT_EQUAL(MAX_SCOREINDEX_SIZE, si->size);
+  int inIndex[SCOREINDEX_NUM_DOCS + 1] = {0};
+  for (int i = 0; i < si->size; i++) {
+    ASSERT_EQUAL(impacts[si->entries[i].docId], si->entries[i].impact);
+    ASSERT(si->entries[i].impact >= si->floor);
+    inIndex[si->entries[i].docId] = 1;
+  }
+  for (t_docId id = 1; id <= SCOREINDEX_NUM_DOCS; id++) {
+    ASSERT(inIndex[id] || impacts[id] <= si->floor);
+  }
+
+  RSToken tok = {.str = "hello", .len = 5};
+  IndexReader *ir = NewTermIndexReader(idx, &dt, RS_FIELDMASK_ALL, NewTerm(&tok));
+  // paging beyond the score index needs a full scan
+  ASSERT(NewScoreIndexIterator(ir, &dt, MAX_SCOREINDEX_SIZE + 1) == NULL);
+
+  IndexIterator *it = NewScoreIndexIterator(ir, &dt, 10);
+  ASSERT(it != NULL);
+  RSIndexResult *h;
+  t_docId lastId = 0;
+  int n = 0;
+  while (it->Read(it->ctx, &h) != INDEXREAD_EOF) {
+    ASSERT(h->docId > lastId);
+    ASSERT(inIndex[h->docId]);
+    ASSERT_EQUAL(1 + (h->docId % 4), h->freq);
+    lastId = h->docId;
+    n++;
+  }
+  ASSERT_EQUAL(MAX_SCOREINDEX_SIZE, n);
+  ASSERT_EQUAL(SCOREINDEX_NUM_DOCS, it->Len(it->ctx));
+  it->Free(it);
+
+  // deleted documents don't count, and are removed when repairing the index
+  for (int i = 0; i < si->size; i++) {
+    if (i % 2) {
+      DocTable_Get(&dt, si->entries[i].docId)->flags |= Document_Deleted;
+    }
+  }
+  ir = NewTermIndexReader(idx, &dt, RS_FIELDMASK_ALL, NewTerm(&tok));
+  ASSERT(NewScoreIndexIterator(ir, &dt, MAX_SCOREINDEX_SIZE / 2 + 1) == NULL);
+  it = NewScoreIndexIterator(ir, &dt, MAX_SCOREINDEX_SIZE / 2);
+  ASSERT(it != NULL);
+  it->Free(it);
+
+  InvertedIndex_Repair(idx, &dt, 0, 1, NULL);
+  ASSERT_EQUAL(MAX_SCOREINDEX_SIZE / 2, si->size);
+  // the heap order is kept
+  for (int i = 1; i < si->size; i++) {
+    ASSERT(si->entries[(i - 1) / 2].impact <= si->entries[i].impact);
+  }
+
+  InvertedIndex_Free(idx);
+  DocTable_Free(&dt);
+  return 0;
+}
+
 int testNumericInverted() {
 
   InvertedIndex *idx = NewInvertedIndex(Index_StoreNumeric, 1);
@@ -392,6 +814,645 @@ int testNumericInverted() {
   return 0;
 }
 
+int testPackedBlocks() {
+  InvertedIndex *packed[2] = {NewInvertedIndex(Index_DocIdsOnly | Index_PackedBlocks, 1),
+                              NewInvertedIndex(Index_StoreNumeric | Index_PackedBlocks, 1)};
+  InvertedIndex *plain = NewInvertedIndex(Index_DocIdsOnly, 1);
+  IndexEncoder enc = InvertedIndex_GetEncoder(Index_DocIdsOnly);
+
+  // mostly small gaps, with a few large ones that become exceptions
+  t_docId ids[1050];
+  t_docId id = 0;
+  for (int i = 0; i < 1050; i++) {
+    ids[i] = id += i % 97 ? 1 + i % 7 : 100000;
+    ForwardIndexEntry h = {.docId = id};
+    InvertedIndex_WriteForwardIndexEntry(packed[0], enc, &h);
+    InvertedIndex_WriteForwardIndexEntry(plain, enc, &h);
+    InvertedIndex_WriteNumericEntry(packed[1], id, (float)i);
+  }
+  ASSERT_EQUAL(11, packed[0]->size);
+  ASSERT(packed[0]->blocks[0].data->offset < plain->blocks[0].data->offset);
+
+  for (int n = 0; n < 2; n++) {
+    IndexReader *ir = n ? NewNumericReader(packed[n], NULL)
+                        : NewTermIndexReader(packed[n], NULL, RS_FIELDMASK_ALL, NULL);
+    RSIndexResult *h;
+    for (int i = 0; i < 1050; i++) {
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+      ASSERT_EQUAL(ids[i], h->docId);
+      if (n) ASSERT_EQUAL(i, h->num.value);
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+    IR_Free(ir);
+
+    // skip to existing and missing ids, across and within packed blocks
+    ir = n ? NewNumericReader(packed[n], NULL)
+           : NewTermIndexReader(packed[n], NULL, RS_FIELDMASK_ALL, NULL);
+    for (int i = 0; i < 1050; i += 13) {
+      t_docId target = ids[i] - (i % 2);
+      // the id just before a record might be the previous record
+      int j = i && ids[i - 1] == target ? i - 1 : i;
+      int rc = IR_SkipTo(ir, target, &h);
+      ASSERT_EQUAL((ids[j] == target ? INDEXREAD_OK : INDEXREAD_NOTFOUND), rc);
+      ASSERT_EQUAL(ids[j], h->docId);
+      if (n) ASSERT_EQUAL(j, h->num.value);
+    }
+    IR_Free(ir);
+  }
+
+  // numeric filters apply to packed records too
+  NumericFilter *f = NewNumericFilter(100, 199, 1, 1);
+  IndexReader *ir = NewNumericReader(packed[1], f);
+  RSIndexResult *h;
+  int count = 0;
+  while (IR_Read(ir, &h) == INDEXREAD_OK) {
+    ASSERT(h->num.value >= 100 && h->num.value <= 199);
+    count++;
+  }
+  ASSERT_EQUAL(100, count);
+  IR_Free(ir);
+  NumericFilter_Free(f);
+
+  InvertedIndex_Free(packed[0]);
+  InvertedIndex_Free(packed[1]);
+  InvertedIndex_Free(plain);
+  return 0;
+}
+
+int testSnapshotRead() {
+  IndexEncoder enc = InvertedIndex_GetEncoder(Index_DocIdsOnly);
+  for (int packed = 0; packed < 2; packed++) {
+    InvertedIndex *idx = NewInvertedIndex(Index_DocIdsOnly | (packed ? Index_PackedBlocks : 0), 1);
+    for (t_docId id = 1; id <= 150; id++) {
+      ForwardIndexEntry h = {.docId = id};
+      InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+    }
+
+    // a reader created inside an epoch only sees the records written before it was created, and
+    // the memory writers replace in the meantime is kept until it exits
+    int e = Epoch_Enter();
+    ASSERT(Epoch_Active());
+    IndexReader *ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    for (t_docId id = 151; id <= 1000; id++) {
+      ForwardIndexEntry h = {.docId = id};
+      InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+    }
+    ASSERT(Epoch_NumPending() > 0);
+
+    RSIndexResult *h;
+    int n = 0;
+    while (IR_Read(ir, &h) == INDEXREAD_OK) {
+      ASSERT_EQUAL(++n, h->docId);
+    }
+    ASSERT_EQUAL(150, n);
+    IR_Free(ir);
+
+    ir = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, 900, &h));
+    ASSERT_EQUAL(900, h->docId);
+    IR_Free(ir);
+
+    Epoch_Exit(e);
+    ASSERT(!Epoch_Active());
+    ASSERT_EQUAL(0, Epoch_NumPending());
+    InvertedIndex_Free(idx);
+  }
+  return 0;
+}
+
+int testIndexRepair() {
+  IndexFlags flags[] = {Index_DocIdsOnly, Index_DocIdsOnly | Index_PackedBlocks, Index_StoreNumeric,
+                        Index_StoreNumeric | Index_PackedBlocks};
+  for (int n = 0; n < 4; n++) {
+    DocTable dt = NewDocTable(100);
+    InvertedIndex *idx = NewInvertedIndex(flags[n], 1);
+    IndexEncoder enc = InvertedIndex_GetEncoder(flags[n]);
+    char buf[16];
+    for (t_docId id = 1; id <= 1000; id++) {
+      sprintf(buf, "doc_%d", (int)id);
+      DocTable_Put(&dt, buf, 1, Document_DefaultFlags, NULL, 0);
+      ForwardIndexEntry h = {.docId = id};
+      if (flags[n] & Index_StoreNumeric) {
+        InvertedIndex_WriteNumericEntry(idx, id, (double)id);
+      } else {
+        InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+      }
+    }
+    ASSERT_EQUAL(10, idx->size);
+
+    // the 2nd and 3rd blocks are deleted entirely, and a third of the other records
+    size_t numDeleted = 0;
+    for (t_docId id = 1; id <= 1000; id++) {
+      if ((id > 100 && id <= 300) || id % 3 == 0) {
+        sprintf(buf, "doc_%d", (int)id);
+        ASSERT_EQUAL(1, DocTable_Delete(&dt, buf));
+        numDeleted++;
+      }
+    }
+
+    // while a reader is active, blocks left empty are kept and nothing is merged
+    IndexRepairStats stats = {0};
+    int e = Epoch_Enter();
+    for (int b = 0; (b = InvertedIndex_Repair(idx, &dt, b, 3, &stats));) {
+    }
+    Epoch_Exit(e);
+    ASSERT_EQUAL(10, idx->size);
+    ASSERT_EQUAL(0, stats.blocksRemoved);
+    ASSERT_EQUAL(numDeleted - 200, stats.recordsRemoved);
+    ASSERT(stats.bytesCollected > 0);
+
+    // without readers the empty blocks are dropped. The remaining ones are too full to merge
+    memset(&stats, 0, sizeof(stats));
+    ASSERT_EQUAL(0, InvertedIndex_Repair(idx, &dt, 0, 0, &stats));
+    ASSERT_EQUAL(8, idx->size);
+    ASSERT_EQUAL(2, stats.blocksRemoved);
+    ASSERT_EQUAL(200, stats.recordsRemoved);
+    ASSERT_EQUAL(1000 - numDeleted, idx->numDocs);
+
+    IndexReader *ir = flags[n] & Index_StoreNumeric
+                          ? NewNumericReader(idx, NULL)
+                          : NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    RSIndexResult *h;
+    for (t_docId id = 1; id <= 1000; id++) {
+      if ((id > 100 && id <= 300) || id % 3 == 0) continue;
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &h));
+      ASSERT_EQUAL(id, h->docId);
+      if (flags[n] & Index_StoreNumeric) ASSERT_EQUAL(id, h->num.value);
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+    IR_Free(ir);
+
+    // once half of the records in every block are deleted, neighbouring blocks are merged
+    for (t_docId id = 1; id <= 1000; id += 2) {
+      sprintf(buf, "doc_%d", (int)id);
+      DocTable_Delete(&dt, buf);
+    }
+    memset(&stats, 0, sizeof(stats));
+    ASSERT_EQUAL(0, InvertedIndex_Repair(idx, &dt, 0, 0, &stats));
+    ASSERT_EQUAL(4, stats.blocksRemoved);
+    ASSERT_EQUAL(4, idx->size);
+
+    ir = flags[n] & Index_StoreNumeric ? NewNumericReader(idx, NULL)
+                                       : NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    for (t_docId id = 2; id <= 1000; id += 2) {
+      if ((id > 100 && id <= 300) || id % 3 == 0) continue;
+      ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, id, &h));
+      ASSERT_EQUAL(id, h->docId);
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &h));
+    IR_Free(ir);
+
+    InvertedIndex_Free(idx);
+    DocTable_Free(&dt);
+  }
+  return 0;
+}
+
+int testIndexRenumber() {
+  IndexFlags flags[] = {Index_DocIdsOnly, Index_DocIdsOnly | Index_PackedBlocks, Index_StoreNumeric,
+                        Index_StoreNumeric | Index_PackedBlocks};
+  for (int n = 0; n < 4; n++) {
+    DocTable dt = NewDocTable(100);
+    InvertedIndex *idx = NewInvertedIndex(flags[n], 1);
+    IndexEncoder enc = InvertedIndex_GetEncoder(flags[n]);
+    char buf[16];
+    for (t_docId id = 1; id <= 1000; id++) {
+      sprintf(buf, "doc_%d", (int)id);
+      DocTable_Put(&dt, buf, (double)id, Document_DefaultFlags, NULL, 0);
+      ForwardIndexEntry h = {.docId = id};
+      if (flags[n] & Index_StoreNumeric) {
+        InvertedIndex_WriteNumericEntry(idx, id, (double)id);
+      } else {
+        InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+      }
+    }
+
+    // the 2nd and 3rd blocks are deleted entirely, and a third of the other records
+    size_t numDeleted = 0;
+    for (t_docId id = 1; id <= 1000; id++) {
+      if ((id > 100 && id <= 300) || id % 3 == 0) {
+        sprintf(buf, "doc_%d", (int)id);
+        DocTable_Delete(&dt, buf);
+        numDeleted++;
+      }
+    }
+    size_t numLive = 1000 - numDeleted;
+
+    // the remaining documents get consecutive docIds in the same order
+    ASSERT_EQUAL(numDeleted, DocTable_Compact(&dt));
+    ASSERT_EQUAL(numLive, dt.maxDocId);
+    ASSERT_EQUAL(0, dt.numDeleted);
+    ASSERT_EQUAL(1, dt.docIdGen);
+    t_docId newId = 0;
+    for (t_docId id = 1; id <= 1000; id++) {
+      sprintf(buf, "doc_%d", (int)id);
+      if ((id > 100 && id <= 300) || id % 3 == 0) {
+        ASSERT_EQUAL(0, DocIdRemap_Get(&dt.remap, id));
+        ASSERT_EQUAL(0, DocTable_GetId(&dt, buf));
+        continue;
+      }
+      ASSERT_EQUAL(++newId, DocIdRemap_Get(&dt.remap, id));
+      ASSERT_EQUAL(newId, DocTable_GetId(&dt, buf));
+      ASSERT_STRING_EQ(buf, DocTable_GetKey(&dt, newId));
+      ASSERT_EQUAL(id, DocTable_GetScore(&dt, newId));
+    }
+
+    IndexRepairStats stats = {0};
+    InvertedIndex_Renumber(idx, &dt.remap, &stats);
+    ASSERT_EQUAL(numDeleted, stats.recordsRemoved);
+    ASSERT_EQUAL(numLive, idx->numDocs);
+    ASSERT_EQUAL(numLive, idx->lastId);
+    // the blocks left empty are dropped, the others are too full to merge
+    ASSERT_EQUAL(8, idx->size);
+
+    // new records are written after the renumbered ones
+    ForwardIndexEntry h = {.docId = numLive + 1};
+    if (flags[n] & Index_StoreNumeric) {
+      InvertedIndex_WriteNumericEntry(idx, numLive + 1, 0);
+    } else {
+      InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+    }
+
+    IndexReader *ir = flags[n] & Index_StoreNumeric
+                          ? NewNumericReader(idx, NULL)
+                          : NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    RSIndexResult *res;
+    for (newId = 1; newId <= numLive + 1; newId++) {
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &res));
+      ASSERT_EQUAL(newId, res->docId);
+      if ((flags[n] & Index_StoreNumeric) && newId <= numLive) {
+        ASSERT_EQUAL(DocTable_GetScore(&dt, newId), res->num.value);
+      }
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &res));
+    IR_Free(ir);
+
+    ir = flags[n] & Index_StoreNumeric ? NewNumericReader(idx, NULL)
+                                       : NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, numLive / 2, &res));
+    ASSERT_EQUAL(numLive / 2, res->docId);
+    IR_Free(ir);
+
+    DocTable_EndCompaction(&dt);
+    ASSERT(dt.remap.newIds == NULL);
+    InvertedIndex_Free(idx);
+    DocTable_Free(&dt);
+  }
+  return 0;
+}
+
+int testIndexPrepareRenumber() {
+  IndexFlags flags[] = {Index_DocIdsOnly, Index_DocIdsOnly | Index_PackedBlocks, Index_StoreNumeric,
+                        Index_StoreNumeric | Index_PackedBlocks};
+  for (int n = 0; n < 4; n++) {
+    DocTable dt = NewDocTable(100);
+    InvertedIndex *idx = NewInvertedIndex(flags[n], 1);
+    IndexEncoder enc = InvertedIndex_GetEncoder(flags[n]);
+    char buf[16];
+    for (t_docId id = 1; id <= 1000; id++) {
+      sprintf(buf, "doc_%d", (int)id);
+      DocTable_Put(&dt, buf, (double)id, Document_DefaultFlags, NULL, 0);
+      ForwardIndexEntry h = {.docId = id};
+      if (flags[n] & Index_StoreNumeric) {
+        InvertedIndex_WriteNumericEntry(idx, id, (double)id);
+      } else {
+        InvertedIndex_WriteForwardIndexEntry(idx, enc, &h);
+      }
+    }
+    size_t numDeleted = 0;
+    for (t_docId id = 1; id <= 1000; id++) {
+      if ((id > 100 && id <= 300) || id % 3 == 0) {
+        sprintf(buf, "doc_%d", (int)id);
+        DocTable_Delete(&dt, buf);
+        numDeleted++;
+      }
+    }
+
+    // only the blocks of the documents the compaction got to are copied
+    DocTable_StartCompaction(&dt);
+    ASSERT_EQUAL(0, DocTable_CompactStep(&dt, 500));
+    const DocIdRemap *remap = &dt.compaction->remap;
+    ASSERT_EQUAL(2, InvertedIndex_PrepareRenumber(idx, remap, 2));
+    // the 2nd block is left empty, so the 1st copy replaces both
+    ASSERT_EQUAL(1, idx->renumbering->size);
+    ASSERT_EQUAL(2, idx->renumbering->copies[0].end);
+    ASSERT_EQUAL(3, InvertedIndex_PrepareRenumber(idx, remap, 100));
+    ASSERT_EQUAL(3, idx->renumbering->size);
+    ASSERT_EQUAL(5, idx->renumbering->copies[2].end);
+    ASSERT_EQUAL(0, InvertedIndex_PrepareRenumber(idx, remap, 100));
+
+    // the index is used as usual meanwhile, and the copy of a block we modify is dropped
+    ASSERT_EQUAL(1, InvertedIndex_DeleteEntry(idx, 451));
+    ASSERT_EQUAL(2, idx->renumbering->size);
+    ASSERT_EQUAL(1, DocTable_CompactStep(&dt, SIZE_MAX));
+    ASSERT_EQUAL(5, InvertedIndex_PrepareRenumber(idx, &dt.compaction->remap, 100));
+    ASSERT_EQUAL(7, idx->renumbering->size);
+    ASSERT_EQUAL(9, idx->renumbering->copies[6].end);
+
+    DocTable_FreeCompacted(DocTable_SwitchCompacted(&dt));
+    size_t numLive = 1000 - numDeleted;
+    ASSERT_EQUAL(numLive, dt.maxDocId);
+
+    // the copies replace the blocks they were made of, and the last block is renumbered in place
+    IndexRepairStats stats = {0};
+    InvertedIndex_Renumber(idx, &dt.remap, &stats);
+    ASSERT(idx->renumbering == NULL);
+    ASSERT_EQUAL(numDeleted, stats.recordsRemoved);
+    ASSERT_EQUAL(numLive - 1, idx->numDocs);
+    ASSERT_EQUAL(numLive, idx->lastId);
+    ASSERT_EQUAL(8, idx->size);
+
+    IndexReader *ir = flags[n] & Index_StoreNumeric
+                          ? NewNumericReader(idx, NULL)
+                          : NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+    RSIndexResult *res;
+    t_docId deletedId = DocIdRemap_Get(&dt.remap, 451);
+    for (t_docId newId = 1; newId <= numLive; newId++) {
+      if (newId == deletedId) continue;
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &res));
+      ASSERT_EQUAL(newId, res->docId);
+      if (flags[n] & Index_StoreNumeric) {
+        ASSERT_EQUAL(DocTable_GetScore(&dt, newId), res->num.value);
+      }
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &res));
+    IR_Free(ir);
+
+    // copies that were not switched to are freed with the index
+    DocTable_EndCompaction(&dt);
+    DocTable_StartCompaction(&dt);
+    ASSERT_EQUAL(1, DocTable_CompactStep(&dt, SIZE_MAX));
+    ASSERT_EQUAL(7, InvertedIndex_PrepareRenumber(idx, &dt.compaction->remap, 100));
+    InvertedIndex_Free(idx);
+    DocTable_Free(&dt);
+  }
+  return 0;
+}
+
+int testIndexSplice() {
+  IndexFlags flags[] = {Index_StoreNumeric, Index_StoreNumeric | Index_PackedBlocks};
+  for (int n = 0; n < 2; n++) {
+    // only the even docIds are written at first
+    InvertedIndex *idx = NewInvertedIndex(flags[n], 1);
+    for (t_docId id = 2; id <= 2000; id += 2) {
+      InvertedIndex_WriteNumericEntry(idx, id, (float)id);
+    }
+    ASSERT_EQUAL(10, idx->size);
+
+    // a reader that is active while we modify the index keeps reading its snapshot
+    int e = Epoch_Enter();
+    IndexReader *snap = NewNumericReader(idx, NULL);
+
+    // the odd docIds are put in their place, filling up blocks that are then split
+    for (t_docId id = 1; id < 1000; id += 2) {
+      int rc = InvertedIndex_PutNumericEntry(idx, id, (float)id);
+      ASSERT_EQUAL(0, rc);
+    }
+    ASSERT(idx->size >= 15);
+    // the values of some records are replaced, and others are removed
+    for (t_docId id = 3; id <= 2000; id += 3) {
+      if (id % 2 && id > 1000) continue;
+      int rc = InvertedIndex_PutNumericEntry(idx, id, -(float)id);
+      ASSERT_EQUAL(1, rc);
+    }
+    for (t_docId id = 1000; id <= 1400; id += 2) {
+      int rc = InvertedIndex_DeleteEntry(idx, id);
+      ASSERT_EQUAL(1, rc);
+    }
+    int rc = InvertedIndex_DeleteEntry(idx, 1001);
+    ASSERT_EQUAL(0, rc);
+    rc = InvertedIndex_DeleteEntry(idx, 5000);
+    ASSERT_EQUAL(0, rc);
+
+    RSIndexResult *res;
+    for (t_docId id = 2; id <= 2000; id += 2) {
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(snap, &res));
+      ASSERT_EQUAL(id, res->docId);
+      ASSERT_EQUAL(id, res->num.value);
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(snap, &res));
+    IR_Free(snap);
+    Epoch_Exit(e);
+
+    size_t num = 0;
+    IndexReader *ir = NewNumericReader(idx, NULL);
+    for (t_docId id = 1; id <= 2000; id++) {
+      if ((id % 2 && id > 1000) || (id % 2 == 0 && id >= 1000 && id <= 1400)) continue;
+      ASSERT_EQUAL(INDEXREAD_OK, IR_Read(ir, &res));
+      ASSERT_EQUAL(id, res->docId);
+      float value = id % 3 ? (float)id : -(float)id;
+      ASSERT_EQUAL(value, res->num.value);
+      num++;
+    }
+    ASSERT_EQUAL(INDEXREAD_EOF, IR_Read(ir, &res));
+    IR_Free(ir);
+    ASSERT_EQUAL(num, idx->numDocs);
+
+    // skipping relies on the blocks' docId ranges
+    ir = NewNumericReader(idx, NULL);
+    ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(ir, 999, &res));
+    ASSERT_EQUAL(999, res->docId);
+    ASSERT_EQUAL(INDEXREAD_NOTFOUND, IR_SkipTo(ir, 1000, &res));
+    ASSERT_EQUAL(1402, res->docId);
+    IR_Free(ir);
+
+    // appending goes on as usual
+    InvertedIndex_WriteNumericEntry(idx, 2001, 1);
+    ASSERT_EQUAL(num + 1, idx->numDocs);
+    InvertedIndex_Free(idx);
+  }
+  return 0;
+}
+
+/* Read all the docIds an iterator yields */
+static size_t cloneReadIds(IndexIterator *it, t_docId *ids) {
+  size_t n = 0;
+  RSIndexResult *h;
+  int rc;
+  while (INDEXREAD_EOF != (rc = it->Read(it->ctx, &h))) {
+    if (rc == INDEXREAD_OK) ids[n++] = h->docId;
+  }
+  return n;
+}
+
+static IndexIterator *cloneTestIterator(int type, InvertedIndex **idx, t_docId *ids, size_t n) {
+  IndexIterator **its;
+  switch (type) {
+    case 0:
+      return NewReadIterator(NewTermIndexReader(idx[0], NULL, RS_FIELDMASK_ALL, NULL));
+    case 1:
+      return NewReadIterator(NewNumericReader(idx[2], NULL));
+    case 2:
+    case 3:
+      its = calloc(2, sizeof(IndexIterator *));
+      its[0] = NewReadIterator(NewTermIndexReader(idx[0], NULL, RS_FIELDMASK_ALL, NULL));
+      its[1] = NewReadIterator(NewTermIndexReader(idx[1], NULL, RS_FIELDMASK_ALL, NULL));
+      return type == 2 ? NewUnionIterator(its, 2, NULL, 0)
+                       : NewIntersecIterator(its, 2, NULL, RS_FIELDMASK_ALL, -1, 0);
+    case 4:
+      return NewIdListIterator(ids, n);
+    case 5:
+      its = calloc(1, sizeof(IndexIterator *));
+      its[0] = NewIdListIterator(ids, n);
+      return NewIdBitmapIterator(its, 1);
+    default:
+      return NewWildcardIterator(100000);
+  }
+}
+
+int testClone() {
+  // a term index, a packed numeric index, and ids spanning several bitmap chunks
+  InvertedIndex *idx[3] = {createIndex(20000, 2), createIndex(20000, 3),
+                           NewInvertedIndex(Index_StoreNumeric | Index_PackedBlocks, 1)};
+  t_docId *ids = calloc(30000, sizeof(t_docId));
+  for (size_t i = 0; i < 30000; i++) {
+    ids[i] = 1 + i * 7;
+    InvertedIndex_WriteNumericEntry(idx[2], ids[i], (float)i);
+  }
+  t_docId *expected = calloc(200000, sizeof(t_docId));
+  t_docId *got = calloc(200000, sizeof(t_docId));
+  t_docId ranges[][2] = {{1, 100}, {5, 6}, {999, 20001}, {20001, 39999}, {40000, 300000},
+                         {66000, 140000}, {300000, 400000}};
+
+  for (int type = 0; type < 7; type++) {
+    IndexIterator *it = cloneTestIterator(type, idx, ids, 30000);
+    size_t total = cloneReadIds(it, expected);
+    ASSERT(total > 0);
+
+    for (int r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+      t_docId minId = ranges[r][0], maxId = ranges[r][1];
+      // the clones do not depend on the position of the iterator they were cloned from
+      IndexIterator *fresh = cloneTestIterator(type, idx, ids, 30000);
+      IndexIterator *clones[2] = {it->Clone(it->ctx, minId, maxId),
+                                  fresh->Clone(fresh->ctx, minId, maxId)};
+      fresh->Free(fresh);
+      for (int c = 0; c < 2; c++) {
+        ASSERT(clones[c] != NULL);
+        size_t n = cloneReadIds(clones[c], got);
+        size_t j = 0;
+        for (size_t i = 0; i < total; i++) {
+          if (expected[i] < minId || expected[i] >= maxId) continue;
+          ASSERT(j < n);
+          ASSERT_EQUAL(expected[i], got[j++]);
+        }
+        ASSERT_EQUAL(j, n);
+
+        // a clone of a clone is restricted to both ranges
+        IndexIterator *cc = clones[c]->Clone(clones[c]->ctx, minId + 50, maxId + 50);
+        n = cloneReadIds(cc, got);
+        for (size_t i = 0; i < n; i++) {
+          ASSERT(got[i] >= minId + 50 && got[i] < maxId);
+        }
+        cc->Free(cc);
+        clones[c]->Free(clones[c]);
+      }
+    }
+    it->Free(it);
+  }
+
+  // the records of the clone are decoded like the original ones
+  IndexIterator *it = cloneTestIterator(1, idx, ids, 30000);
+  IndexIterator *cl = it->Clone(it->ctx, 7001, 8000);
+  RSIndexResult *h;
+  ASSERT_EQUAL(INDEXREAD_OK, cl->Read(cl->ctx, &h));
+  ASSERT_EQUAL(7001, h->docId);
+  ASSERT_EQUAL(1000, h->num.value);
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, cl->SkipTo(cl->ctx, 7010, &h));
+  ASSERT_EQUAL(7015, h->docId);
+  ASSERT_EQUAL(1002, h->num.value);
+  ASSERT_EQUAL(INDEXREAD_EOF, cl->SkipTo(cl->ctx, 8001, &h));
+  cl->Free(cl);
+  it->Free(it);
+
+  free(ids);
+  free(expected);
+  free(got);
+  for (int i = 0; i < 3; i++) {
+    InvertedIndex_Free(idx[i]);
+  }
+  return 0;
+}
+
+int testDecodeCache() {
+  DecodeCache_Clear();
+  // 10 blocks of 100 records, the last one is never cached
+  InvertedIndex *idx = createIndex(1000, 1);
+  DecodeCacheStats st = DecodeCache_GetStats();
+
+  IndexReader *r1 = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  RSIndexResult *h1, *h2, *h3;
+  while (IR_Read(r1, &h1) != INDEXREAD_EOF)
+    ;
+  IR_Free(r1);
+  DecodeCacheStats st1 = DecodeCache_GetStats();
+  ASSERT_EQUAL(9, st1.numBlocks);
+  ASSERT(st1.memsize > 0);
+  ASSERT_EQUAL(st.hits, st1.hits);
+
+  // the cached blocks read exactly like the index itself, both sequentially and when skipping
+  r1 = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  IndexReader *r2 = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  IndexReader *r3 = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  r2->batchMode = 0;
+  int n = 0;
+  while (IR_Read(r2, &h2) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(INDEXREAD_OK, IR_Read(r1, &h1));
+    ASSERT_EQUAL(h2->docId, h1->docId);
+    ASSERT_EQUAL(h2->freq, h1->freq);
+    ASSERT_EQUAL(h2->term.offsets.len, h1->term.offsets.len);
+    ASSERT(!memcmp(h2->term.offsets.data, h1->term.offsets.data, h2->term.offsets.len));
+    if (n++ % 150 == 0) {
+      ASSERT_EQUAL(INDEXREAD_OK, IR_SkipTo(r3, h2->docId, &h3));
+      ASSERT_EQUAL(h2->docId, h3->docId);
+      ASSERT_EQUAL(h2->term.offsets.len, h3->term.offsets.len);
+    }
+  }
+  ASSERT_EQUAL(1000, n);
+  IR_Free(r1);
+  IR_Free(r2);
+  IR_Free(r3);
+  DecodeCacheStats st2 = DecodeCache_GetStats();
+  ASSERT(st2.hits >= st1.hits + 9 + 6);
+  ASSERT_EQUAL(9, st2.numBlocks);
+
+  // freeing the index drops its blocks from the cache
+  InvertedIndex_Free(idx);
+  ASSERT_EQUAL(0, DecodeCache_GetStats().numBlocks);
+  ASSERT_EQUAL(0, DecodeCache_GetStats().memsize);
+  return 0;
+}
+
+int testProfileIterator() {
+  // 1000 records in blocks of 100
+  InvertedIndex *idx = createIndex(1000, 1);
+  IteratorProfile p = {0};
+  IndexReader *r = NewTermIndexReader(idx, NULL, RS_FIELDMASK_ALL, NULL);
+  IndexIterator *it = NewProfileIterator(NewReadIterator(r), &p);
+
+  RSIndexResult *h;
+  for (int i = 1; i <= 10; i++) {
+    ASSERT_EQUAL(INDEXREAD_OK, it->Read(it->ctx, &h));
+    ASSERT_EQUAL(i, h->docId);
+  }
+  ASSERT_EQUAL(INDEXREAD_OK, it->SkipTo(it->ctx, 500, &h));
+  ASSERT_EQUAL(500, h->docId);
+  ASSERT_EQUAL(500, it->LastDocId(it->ctx));
+  ASSERT_EQUAL(INDEXREAD_EOF, it->SkipTo(it->ctx, 2000, &h));
+  ASSERT_EQUAL(INDEXREAD_EOF, it->Read(it->ctx, &h));
+
+  ASSERT_EQUAL(11, p.reads);
+  ASSERT_EQUAL(2, p.skips);
+  ASSERT_EQUAL(11, p.records);
+  ASSERT(p.ns > 0);
+  // the blocks are counted once the reader is done. Skipping over blocks does not read them
+  ASSERT_EQUAL(0, p.blocks);
+  it->Free(it);
+  ASSERT(p.blocks >= 2 && p.blocks < 10);
+
+  InvertedIndex_Free(idx);
+  return 0;
+}
+
 int testAbort() {
 
   InvertedIndex *w = createIndex(1000, 1);
@@ -513,9 +1574,10 @@ typedef struct {
 
 int tokenFunc(void *ctx, Token t) {
   tokenContext *tx = ctx;
-  int ret = strcmp(t.s, tx->expected[tx->num++]);
-  assert(ret == 0);
-  assert(t.len == strlen(t.s));
+  // tokens are not NUL terminated, as they may point into the tokenized text
+  const char *expected = tx->expected[tx->num++];
+  assert(t.len == strlen(expected));
+  assert(strncmp(t.s, expected, t.len) == 0);
   assert(t.fieldId == 1);
   assert(t.pos > 0);
   assert(t.score == 1);
@@ -528,25 +1590,116 @@ int testTokenize() {
   const char *expected[] = {"hello", "world", "wazz", "up", "שלום"};
   ctx.expected = (char **)expected;
 
-  tokenize(txt, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList());
+  tokenize(txt, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList(), 1);
   ASSERT(ctx.num == 5);
+  // the text is left as it is
+  ASSERT_STRING_EQ("Hello? world...   ? -WAZZ@UP? שלום", txt);
 
   free(txt);
 
+  // long tokens and control characters go through the normalization buffer
+  const char *txt2 = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdef\x01 lower\x02" "CASE";
+  const char *expected2[] = {"abcdefghijklmnopqrstuvwxyz0123456789abcdef", "lowercase"};
+  ctx = (tokenContext){.expected = (char **)expected2};
+  tokenize(txt2, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList(), 1);
+  ASSERT(ctx.num == 2);
+
+  // non ASCII characters are case folded, and may fold into longer strings
+  const char *txt3 = "Größe ÜBER ПРИВЕТ ΣΊΣΥΦΟΣ straße";
+  const char *expected3[] = {"grösse", "über", "привет", "σίσυφοσ", "strasse"};
+  ctx = (tokenContext){.expected = (char **)expected3};
+  tokenize(txt3, 1, 1, &ctx, tokenFunc, NULL, 0, DefaultStopWordList(), 1);
+  ASSERT(ctx.num == 5);
+
+  // indexes created before Unicode folding only lowercase ASCII, and so do their queries
+  const char *expected4[] = {"grÖße", "Über", "ПРИВЕТ", "ΣΊΣΥΦΟΣ", "straße"};
+  ctx = (tokenContext){.expected = (char **)expected4};
+  tokenize("GrÖße Über ПРИВЕТ ΣΊΣΥΦΟΣ straße", 1, 1, &ctx, tokenFunc, NULL, 0,
+           DefaultStopWordList(), 0);
+  ASSERT(ctx.num == 5);
+
+  char buf[FOLD_TERM_MAXLEN(16)];
+  ASSERT_EQUAL(5, (int)FoldTerm(buf, "ÜBER\x01", 6, 0));
+  ASSERT(!strncmp(buf, "Über", 5));
+  ASSERT_EQUAL(5, (int)FoldTerm(buf, "ÜBER", 5, 1));
+  ASSERT(!strncmp(buf, "über", 5));
+
   return 0;
 }
 
-// int testForwardIndex() {
+int testArena() {
+  Arena a;
+  Arena_Init(&a, 1024);
+  char *first = Arena_Alloc(&a, 10);
+  ASSERT(first != NULL);
+  // allocations are aligned and do not overlap
+  char *second = Arena_Alloc(&a, 10);
+  ASSERT_EQUAL(16, (int)(second - first));
+  for (int i = 0; i < 1000; i++) {
+    memset(Arena_Alloc(&a, 100), i, 100);
+  }
+  // larger allocations than a block get a block of their own
+  char *big = Arena_Alloc(&a, 10000);
+  memset(big, 0, 10000);
+
+  // after a reset the same memory is handed out again
+  Arena_Reset(&a);
+  ASSERT(first == Arena_Alloc(&a, 10));
+  for (int i = 0; i < 1000; i++) {
+    memset(Arena_Alloc(&a, 100), i, 100);
+  }
+  Arena_Free(&a);
+  return 0;
+}
 
-//   Document doc = NewDocument(NULL, 1, 1, "english");
-//   doc.docId = 1;
-//   doc.fields[0] = N
-//   ForwardIndex *idx = NewForwardIndex(doc);
-//   char *txt = strdup("Hello? world...  hello hello ? __WAZZ@UP? שלום");
-//   tokenize(txt, 1, 1, idx, forwardIndexTokenFunc);
+int testForwardIndex() {
+  Document doc = {.score = 1, .docId = 1, .language = DEFAULT_LANGUAGE};
+  ForwardIndex *idx = NewForwardIndex(doc);
+  ASSERT(idx->stemmer != NULL);
+  char *txt = strdup("Hello? world...  hello hello ? going WAZZ@UP? worlds");
+  tokenize(txt, 1, 1, idx, forwardIndexTokenFunc, idx->stemmer, 0, DefaultStopWordList(), 1);
+
+  int n = 0, found = 0;
+  ForwardIndexIterator it = ForwardIndex_Iterate(idx);
+  ForwardIndexEntry *e;
+  while ((e = ForwardIndexIterator_Next(&it)) != NULL) {
+    n++;
+    ASSERT_EQUAL(1, e->docId);
+    ASSERT_EQUAL(3, e->docMaxFreq);
+    if (e->len == 5 && !strncmp(e->term, "hello", 5)) {
+      ASSERT_EQUAL(3, e->freq);
+      ASSERT_EQUAL(3, e->vw->nmemb);
+      found++;
+    } else if (e->len == 2 && !strncmp(e->term, "go", 2)) {
+      // stems are copied, the stemmer has stemmed other words since
+      ASSERT(e->term < txt || e->term > txt + strlen("Hello? world...  hello hello ? going"));
+      found++;
+    }
+  }
+  // hello, world, going, go, wazz, up, worlds. world's stem is the word itself
+  ASSERT_EQUAL(7, n);
+  ASSERT_EQUAL(2, found);
+
+  ForwardIndex_SetDocId(idx, 100);
+  it = ForwardIndex_Iterate(idx);
+  while ((e = ForwardIndexIterator_Next(&it)) != NULL) {
+    ASSERT_EQUAL(100, e->docId);
+  }
+  ForwardIndexFree(idx);
+  free(txt);
 
-//   return 0;
-// }
+  // freed forward indexes are reused, keeping their stemmer but none of their terms
+  ForwardIndex *idx2 = NewForwardIndex(doc);
+  ASSERT(idx2 == idx);
+  ASSERT(idx2->stemmer != NULL);
+  ASSERT_EQUAL(0, kh_size(idx2->hits));
+  txt = strdup("hello again");
+  tokenize(txt, 1, 1, idx2, forwardIndexTokenFunc, idx2->stemmer, 0, DefaultStopWordList(), 1);
+  ASSERT_EQUAL(2, kh_size(idx2->hits));
+  ForwardIndexFree(idx2);
+  free(txt);
+  return 0;
+}
 
 int testIndexSpec() {
 
@@ -650,7 +1803,7 @@ typedef union {
 
 int testIndexFlags() {
 
-  ForwardIndexEntry h;
+  ForwardIndexEntry h = {0};
   h.docId = 1234;
   h.fieldMask = 0x01;
   h.freq = 1;
@@ -710,6 +1863,8 @@ int testDocTable() {
   ASSERT_EQUAL(N, dt.maxDocId);
   ASSERT(dt.cap > dt.size);
   ASSERT_EQUAL(6780, (int)dt.memsize);
+  // the keys are packed one after the other, and the id map holds the docIds themselves
+  ASSERT(DocTable_GetKey(&dt, 2) == DocTable_GetKey(&dt, 1) + strlen("doc_0") + 1);
 
   for (int i = 0; i < N; i++) {
     sprintf(buf, "doc_%d", i);
@@ -746,6 +1901,130 @@ int testDocTable() {
   return 0;
 }
 
+int testDocTableCompaction() {
+  char buf[16];
+  DocTable dt = NewDocTable(10);
+  for (int i = 0; i < 100; i++) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Put(&dt, buf, (double)i, Document_DefaultFlags, buf, strlen(buf));
+  }
+  // the sorting vector of a deleted document is freed with the old table
+  DocTable_SetSortingVector(&dt, 2, NewSortingVector(1));
+  for (int i = 1; i < 100; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT_EQUAL(1, DocTable_Delete(&dt, buf));
+  }
+
+  DocTable_StartCompaction(&dt);
+  ASSERT_EQUAL(0, DocTable_CompactStep(&dt, 20));
+  // changes to the documents that were copied are copied as well
+  ASSERT_EQUAL(1, DocTable_Delete(&dt, "doc_2"));
+  ASSERT_EQUAL(1, DocTable_SetPayload(&dt, 5, "foo", 3));
+  ASSERT_EQUAL(1, DocTable_SetPayload(&dt, 41, "bar", 3));
+  ASSERT_EQUAL(101, DocTable_Put(&dt, "doc_100", 100, Document_DefaultFlags, NULL, 0));
+  ASSERT_EQUAL(1, DocTable_CompactStep(&dt, SIZE_MAX));
+  // the table is still used as usual until we switch
+  ASSERT_EQUAL(101, dt.maxDocId);
+  ASSERT_EQUAL(102, DocTable_Put(&dt, "doc_101", 101, Document_DefaultFlags, NULL, 0));
+  ASSERT_EQUAL(0, DocTable_CompactStep(&dt, 0));
+
+  DocTableCompaction *c = DocTable_SwitchCompacted(&dt);
+  ASSERT_EQUAL(102, c->table.maxDocId);
+  ASSERT_EQUAL(52, dt.maxDocId);
+  ASSERT_EQUAL(53, dt.size);
+  ASSERT_EQUAL(1, dt.numDeleted);
+  ASSERT_EQUAL(1, dt.docIdGen);
+  ASSERT(dt.compaction == NULL);
+  DocTable_FreeCompacted(c);
+
+  // the deleted copy keeps its docId, so its records are renumbered as usual
+  ASSERT_EQUAL(0, DocIdRemap_Get(&dt.remap, 2));
+  ASSERT_EQUAL(2, DocIdRemap_Get(&dt.remap, 3));
+  ASSERT_EQUAL(0, DocTable_GetId(&dt, "doc_2"));
+  ASSERT(DocTable_Get(&dt, 2)->flags & Document_Deleted);
+  ASSERT(DocTable_Get(&dt, 2)->payload == NULL);
+  ASSERT_EQUAL(3, DocTable_GetId(&dt, "doc_4"));
+  ASSERT_EQUAL(0, strncmp("foo", DocTable_GetPayload(&dt, 3)->data, 3));
+  ASSERT_EQUAL(21, DocTable_GetId(&dt, "doc_40"));
+  ASSERT_EQUAL(0, strncmp("bar", DocTable_GetPayload(&dt, 21)->data, 3));
+  ASSERT_EQUAL(51, DocTable_GetId(&dt, "doc_100"));
+  ASSERT_EQUAL(52, DocIdRemap_Get(&dt.remap, 102));
+  ASSERT_STRING_EQ("doc_101", DocTable_GetKey(&dt, 52));
+  ASSERT_EQUAL(53, DocTable_Put(&dt, "doc_102", 102, Document_DefaultFlags, NULL, 0));
+
+  DocTable_EndCompaction(&dt);
+  // a compaction that is not switched to is freed with the table
+  DocTable_StartCompaction(&dt);
+  ASSERT_EQUAL(0, DocTable_CompactStep(&dt, 10));
+  DocTable_Free(&dt);
+  return 0;
+}
+
+int testDocIdHash() {
+  int N = 100000;
+  char **keys = malloc(N * sizeof(char *));
+  DocIdHash *h = NewDocIdHash();
+  for (int i = 0; i < N; i++) {
+    keys[i] = malloc(32);
+    sprintf(keys[i], "%08x-%d", i * 2654435761u, i);
+    DocIdHash_Put(h, keys[i], strlen(keys[i]), i + 1);
+  }
+  ASSERT_EQUAL(N, h->size);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQUAL(i + 1, DocIdHash_Get(h, keys[i], strlen(keys[i])));
+  }
+  // prefixes and extensions of keys are other keys
+  ASSERT_EQUAL(0, DocIdHash_Get(h, keys[0], strlen(keys[0]) - 1));
+  ASSERT_EQUAL(0, DocIdHash_Get(h, "foo", 3));
+
+  // deleted keys are gone, and their slots are reused
+  for (int i = 0; i < N; i += 2) {
+    ASSERT_EQUAL(1, DocIdHash_Delete(h, keys[i], strlen(keys[i])));
+  }
+  ASSERT_EQUAL(0, DocIdHash_Delete(h, keys[0], strlen(keys[0])));
+  size_t mem = DocIdHash_MemUsage(h);
+  for (int i = 0; i < N; i++) {
+    ASSERT_EQUAL((i % 2 ? i + 1 : 0), DocIdHash_Get(h, keys[i], strlen(keys[i])));
+  }
+  for (int r = 0; r < 4; r++) {
+    for (int i = 0; i < N; i += 2) {
+      DocIdHash_Put(h, keys[i], strlen(keys[i]), N + i);
+    }
+    for (int i = 0; i < N; i += 2) {
+      DocIdHash_Delete(h, keys[i], strlen(keys[i]));
+    }
+  }
+  ASSERT_EQUAL(N / 2, h->size);
+  ASSERT_EQUAL(mem, DocIdHash_MemUsage(h));
+
+  // putting an existing key replaces its docId
+  DocIdHash_Put(h, keys[1], strlen(keys[1]), 7);
+  ASSERT_EQUAL(7, DocIdHash_Get(h, keys[1], strlen(keys[1])));
+  ASSERT_EQUAL(N / 2, h->size);
+
+  DocIdHash_Free(h);
+  for (int i = 0; i < N; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+
+  // a doc table with a hash id map keeps working the same
+  DocTable dt = NewDocTable(10);
+  DocTable_SetIdMapType(&dt, DocIdMap_Hash);
+  char buf[16];
+  for (int i = 0; i < 100; i++) {
+    sprintf(buf, "doc_%d", i);
+    ASSERT_EQUAL(i + 1, DocTable_Put(&dt, buf, 1, Document_DefaultFlags, NULL, 0));
+  }
+  ASSERT_EQUAL(0, DocTable_Put(&dt, "doc_1", 1, Document_DefaultFlags, NULL, 0));
+  ASSERT_EQUAL(2, DocTable_GetId(&dt, "doc_1"));
+  ASSERT_EQUAL(1, DocTable_Delete(&dt, "doc_1"));
+  ASSERT_EQUAL(0, DocTable_GetId(&dt, "doc_1"));
+  ASSERT_EQUAL(101, DocTable_Put(&dt, "doc_1", 1, Document_DefaultFlags, NULL, 0));
+  DocTable_Free(&dt);
+  return 0;
+}
+
 int testSortable() {
   RSSortingTable *tbl = NewSortingTable(3);
   ASSERT_EQUAL(3, tbl->len);
@@ -817,20 +2096,40 @@ TEST_MAIN({
   RMUTil_InitAlloc();
   TESTFUNC(testAbort)
   TESTFUNC(testNumericInverted);
+  TESTFUNC(testPackedBlocks);
+  TESTFUNC(testSnapshotRead);
+  TESTFUNC(testIndexRepair);
+  TESTFUNC(testIndexRenumber);
+  TESTFUNC(testIndexPrepareRenumber);
+  TESTFUNC(testIndexSplice);
 
   TESTFUNC(testVarint);
   TESTFUNC(testDistance);
   TESTFUNC(testIndexReadWrite);
 
   TESTFUNC(testReadIterator);
+  TESTFUNC(testSkipTo);
+  TESTFUNC(testBatchRead);
   TESTFUNC(testIntersection);
+  TESTFUNC(testIntersectionOrder);
   TESTFUNC(testNot);
   TESTFUNC(testUnion);
+  TESTFUNC(testUnionHeap);
+  TESTFUNC(testIdBitmap);
+  TESTFUNC(testClone);
+  TESTFUNC(testProfileIterator);
+  TESTFUNC(testDecodeCache);
+  TESTFUNC(testUnionTopK);
+  TESTFUNC(testScoreIndex);
 
   TESTFUNC(testBuffer);
   TESTFUNC(testTokenize);
+  TESTFUNC(testArena);
+  TESTFUNC(testForwardIndex);
   TESTFUNC(testIndexSpec);
   TESTFUNC(testIndexFlags);
   TESTFUNC(testDocTable);
+  TESTFUNC(testDocTableCompaction);
+  TESTFUNC(testDocIdHash);
   TESTFUNC(testSortable);
 });
\ No newline at end of file
@@ -32,5 +32,32 @@ int main(int argc, char **argv) {
   assert(arr[1] == 456);
   assert(arr[2] == 789);
 
+  // decoding only the first integer should still consume the entire record
+  r = NewBufferReader(b);
+  assert(qint_decodeFirst(&r, 4) == 123);
+  assert(BufferReader_AtEnd(&r));
+
+  // batch decoding of records with trailing data must match decoding them one by one
+  b = NewBuffer(1024);
+  w = NewBufferWriter(b);
+  for (uint32_t i = 0; i < 50; i++) {
+    qint_encode3(&w, i * i * i, i << 12, i % 3);
+    Buffer_Write(&w, "xyz", i % 3);
+  }
+  uint32_t c0[50], c1[50], c2[50], pos[51], s0[50], s1[50], s2[50], spos[51];
+  uint32_t *cols[3] = {c0, c1, c2}, *scols[3] = {s0, s1, s2};
+  r = NewBufferReader(b);
+  assert(qint_decodeBatch(&r, 3, 1, cols, pos, 50) == 50);
+  assert(BufferReader_AtEnd(&r));
+  r = NewBufferReader(b);
+  assert(qint_decodeBatchScalar(&r, 3, 1, scols, spos, 50) == 50);
+  for (uint32_t i = 0; i < 50; i++) {
+    assert(c0[i] == i * i * i && s0[i] == c0[i]);
+    assert(c1[i] == i << 12 && s1[i] == c1[i]);
+    assert(c2[i] == i % 3 && s2[i] == c2[i]);
+    assert(pos[i] == spos[i]);
+  }
+  assert(pos[50] == b->offset);
+
   return 0;
 }
\ No newline at end of file
@@ -4,9 +4,12 @@
 #include "test_util.h"
 #include "time_sample.h"
 #include "../extension.h"
+#include "../concurrent_ctx.h"
 #include "../ext/default.h"
 #include "../rmutil/alloc.h"
 #include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
 
 void QueryNode_Print(Query *q, QueryNode *qs, int depth);
 
@@ -157,6 +160,50 @@ int testQueryParser() {
   return 0;
 }
 
+int testQueryFolding() {
+  char *err = NULL;
+  char *qt = "Straße ÜBER \"ПРИВЕТ Мир\" GRÖ*";
+  Query *q = NewQuery(NULL, qt, strlen(qt), 0, 1, 0xff, 0, "zz", DefaultStopWordList(), NULL, -1, 0,
+                      NULL, (RSPayload){}, NULL);
+
+  QueryNode *n = Query_Parse(q, &err);
+  if (err) FAIL("Error parsing query: %s", err);
+  ASSERT(n != NULL);
+  ASSERT_EQUAL(n->type, QN_PHRASE);
+  ASSERT_EQUAL(n->pn.numChildren, 4);
+
+  // query terms are folded the same way as indexed terms
+  ASSERT_STRING_EQ("strasse", n->pn.children[0]->tn.str);
+  ASSERT_EQUAL(strlen("strasse"), n->pn.children[0]->tn.len);
+  ASSERT_STRING_EQ("über", n->pn.children[1]->tn.str);
+  QueryNode *_n = n->pn.children[2];
+  ASSERT_EQUAL(_n->pn.exact, 1);
+  ASSERT_STRING_EQ("привет", _n->pn.children[0]->tn.str);
+  ASSERT_STRING_EQ("мир", _n->pn.children[1]->tn.str);
+  ASSERT_EQUAL(n->pn.children[3]->type, QN_PREFX);
+  ASSERT_STRING_EQ("grö", n->pn.children[3]->pfx.str);
+
+  Query_Free(q);
+
+  // indexes created before Unicode folding only lowercase ASCII query terms
+  static const char *args[] = {"ASCIIFOLD", "SCHEMA", "title", "text"};
+  RedisSearchCtx ctx = {
+      .spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(const char *), &err)};
+  ASSERT(!(ctx.spec->flags & Index_FoldUnicode));
+  q = NewQuery(&ctx, qt, strlen(qt), 0, 1, 0xff, 0, "zz", DefaultStopWordList(), NULL, -1, 0,
+               NULL, (RSPayload){}, NULL);
+  n = Query_Parse(q, &err);
+  if (err) FAIL("Error parsing query: %s", err);
+  ASSERT_STRING_EQ("straße", n->pn.children[0]->tn.str);
+  ASSERT_STRING_EQ("Über", n->pn.children[1]->tn.str);
+  ASSERT_STRING_EQ("ПРИВЕТ", n->pn.children[2]->pn.children[0]->tn.str);
+  ASSERT_STRING_EQ("grÖ", n->pn.children[3]->pfx.str);
+
+  Query_Free(q);
+  IndexSpec_Free(ctx.spec);
+  return 0;
+}
+
 int testPureNegative() {
   char *err = NULL;
   const char *qs[] = {"-@title:hello", "-hello", "@title:-hello", "-(foo)", "-foo", "(-foo)", NULL};
@@ -265,6 +312,101 @@ int testFieldSpec() {
 
   return 0;
 }
+static sds cacheKey(RedisSearchCtx *ctx, const char *qt) {
+  char *err = NULL;
+  Query *q = NewQuery(ctx, qt, strlen(qt), 0, 10, 0xff, 0, "en", DefaultStopWordList(), NULL, -1, 0,
+                      NULL, (RSPayload){}, NULL);
+  Query_Parse(q, &err);
+  sds key = Query_CacheKey(q);
+  Query_Free(q);
+  return key;
+}
+
+int testQueryCache() {
+  t_docId ids[] = {1, 2, 3};
+  double scores[] = {3, 2, 1};
+  size_t entrySize = sizeof(QueryCacheEntry) + 3 + 3 * (sizeof(t_docId) + sizeof(double));
+  QueryCache *c = NewQueryCache(2 * entrySize);
+
+  ASSERT(QueryCache_Get(c, "foo", 3, 1) == NULL);
+  QueryCache_Put(c, "foo", 3, 1, 100, ids, scores, 3);
+  QueryCache_Put(c, "bar", 3, 1, 50, ids, scores, 2);
+  QueryCacheEntry *e = QueryCache_Get(c, "foo", 3, 1);
+  ASSERT(e != NULL);
+  ASSERT_EQUAL(100, e->totalResults);
+  ASSERT_EQUAL(3, e->numResults);
+  ASSERT_EQUAL(3, e->docIds[2]);
+  ASSERT_EQUAL(1.0, e->scores[2]);
+
+  // bar is the least recently used entry, so it is evicted to make room
+  QueryCache_Put(c, "baz", 3, 1, 10, ids, scores, 1);
+  ASSERT_EQUAL(2, c->numEntries);
+  ASSERT(QueryCache_Get(c, "bar", 3, 1) == NULL);
+  ASSERT(QueryCache_Get(c, "foo", 3, 1) != NULL);
+  ASSERT(QueryCache_Get(c, "baz", 3, 1) != NULL);
+
+  // a new revision of the index drops everything
+  ASSERT(QueryCache_Get(c, "foo", 3, 2) == NULL);
+  ASSERT_EQUAL(0, c->numEntries);
+  ASSERT_EQUAL(0, c->memsize);
+  ASSERT_EQUAL(3, c->hits);
+  ASSERT_EQUAL(3, c->misses);
+  QueryCache_Free(c);
+
+  // the keys are normalized, but keep the exact values of the filters
+  char *err = NULL;
+  static const char *args[] = {"SCHEMA", "title", "text", "num", "numeric"};
+  RedisSearchCtx ctx = {
+      .spec = IndexSpec_Parse("idx", args, sizeof(args) / sizeof(const char *), &err)};
+  sds k1 = cacheKey(&ctx, "hello   world @num:[0.4 (500]");
+  sds k2 = cacheKey(&ctx, "hello world @num:[0.4 (500]");
+  sds k3 = cacheKey(&ctx, "hello world @num:[0.4000000001 (500]");
+  ASSERT_STRING_EQ(k1, k2);
+  ASSERT(strcmp(k1, k3));
+  sdsfree(k1);
+  sdsfree(k2);
+  sdsfree(k3);
+  IndexSpec_Free(ctx.spec);
+  return 0;
+}
+
+#define PARALLEL_CALLS 8
+#define PARALLEL_CALLERS 16
+
+static void parallelIncr(void *p) {
+  __atomic_add_fetch((int *)p, 1, __ATOMIC_RELAXED);
+  usleep(1000);
+}
+
+/* Run a parallel batch from inside a parallel call, so that every pool thread waits for a batch of
+ * its own */
+static void parallelNested(void *p) {
+  void *args[PARALLEL_CALLS];
+  for (int i = 0; i < PARALLEL_CALLS; i++) args[i] = p;
+  ConcurrentSearch_RunParallel(parallelIncr, args, PARALLEL_CALLS);
+}
+
+static void *parallelCaller(void *p) {
+  void *args[PARALLEL_CALLS];
+  for (int i = 0; i < PARALLEL_CALLS; i++) args[i] = p;
+  ConcurrentSearch_RunParallel(parallelNested, args, PARALLEL_CALLS);
+  return NULL;
+}
+
+int testRunParallel() {
+  // more callers than pool threads, all of them waiting for their batches, must not deadlock
+  int count = 0;
+  pthread_t threads[PARALLEL_CALLERS];
+  for (int i = 0; i < PARALLEL_CALLERS; i++) {
+    pthread_create(&threads[i], NULL, parallelCaller, &count);
+  }
+  for (int i = 0; i < PARALLEL_CALLERS; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  ASSERT_EQUAL(PARALLEL_CALLERS * PARALLEL_CALLS * PARALLEL_CALLS, count);
+  return 0;
+}
+
 void benchmarkQueryParser() {
   char *qt = "(hello|world) \"another world\"";
   char *err = NULL;
@@ -279,8 +421,11 @@ TEST_MAIN({
   RMUTil_InitAlloc();
   LOGGING_INIT(L_INFO);
   TESTFUNC(testQueryParser);
+  TESTFUNC(testQueryFolding);
   TESTFUNC(testPureNegative);
   TESTFUNC(testFieldSpec);
+  TESTFUNC(testQueryCache);
+  TESTFUNC(testRunParallel);
   benchmarkQueryParser();
 
 });
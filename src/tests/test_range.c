@@ -4,6 +4,8 @@
 #include "time_sample.h"
 #include "../index.h"
 #include "../rmutil/alloc.h"
+#include "../id_list.h"
+#include "../doc_table.h"
 
 // Helper so we get the same pseudo-random numbers
 // in tests across environments
@@ -53,7 +55,7 @@ int testNumericRangeTree() {
 #define _max(x, y) (x < y ? y : x)
 
 // declaration for an internal function implemented in numeric_index.c
-IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f);
+IndexIterator *createNumericIterator(NumericRangeTree *t, NumericFilter *f, int filterOnly);
 
 int testRangeIterator() {
   NumericRangeTree *t = NewNumericRangeTree();
@@ -87,7 +89,10 @@ int testRangeIterator() {
     }
 
     // printf("Testing range %f..%f, should have %d docs\n", min, max, count);
-    IndexIterator *it = createNumericIterator(t, flt);
+    // the estimate is exact for the ranges inside the filter, and prorated for the ones at its ends
+    size_t est = NumericRangeTree_EstimateCard(t, flt);
+    ASSERT(est > count * 0.95 && est < count * 1.05);
+    IndexIterator *it = createNumericIterator(t, flt, 0);
 
     int xcount = 0;
     RSIndexResult *res = NULL;
@@ -127,6 +132,19 @@ int testRangeIterator() {
     // printf("The iterator returned %d elements\n", xcount);
     ASSERT_EQUAL(xcount, count);
     it->Free(it);
+
+    // a filter only iterator yields the same documents, in order
+    it = createNumericIterator(t, flt, 1);
+    t_docId lastId = 0;
+    xcount = 0;
+    while (INDEXREAD_EOF != it->Read(it->ctx, &res)) {
+      ASSERT(res->docId > lastId);
+      ASSERT_EQUAL(matched[res->docId], 2);
+      lastId = res->docId;
+      xcount++;
+    }
+    ASSERT_EQUAL(xcount, count);
+    it->Free(it);
   }
   free(lookup);
   free(matched);
@@ -138,6 +156,50 @@ int testRangeIterator() {
   return 0;
 }
 
+int testPostFilter() {
+  // documents with their docId as a sortable value, except docIds 1, 11, 21... that have none
+  DocTable dt = NewDocTable(10);
+  t_docId ids[50];
+  for (int i = 0; i < 100; i++) {
+    char buf[16];
+    sprintf(buf, "doc%d", i);
+    t_docId docId = DocTable_Put(&dt, buf, 1, Document_DefaultFlags, NULL, 0);
+    RSSortingVector *sv = NewSortingVector(2);
+    if (i % 10) {
+      double val = docId;
+      RSSortingVector_Put(sv, 1, &val, RS_SORTABLE_NUM);
+    }
+    DocTable_SetSortingVector(&dt, docId, sv);
+    if (i % 2 == 0) ids[i / 2] = docId;
+  }
+
+  // the odd docIds between 20 and 60 with a value
+  NumericFilter *flt = NewNumericFilter(20, 60, 1, 0);
+  IndexIterator *it = NewNumericPostFilterIterator(NewIdListIterator(ids, 50), flt, &dt, 1);
+  RSIndexResult *h;
+  t_docId expected = 21;
+  while (INDEXREAD_EOF != it->Read(it->ctx, &h)) {
+    if (expected % 10 == 1) expected += 2;
+    ASSERT_EQUAL(expected, h->docId);
+    expected += 2;
+  }
+  ASSERT_EQUAL(61, expected);
+  it->Free(it);
+
+  it = NewNumericPostFilterIterator(NewIdListIterator(ids, 50), flt, &dt, 1);
+  ASSERT_EQUAL(INDEXREAD_OK, it->SkipTo(it->ctx, 25, &h));
+  ASSERT_EQUAL(25, h->docId);
+  // 31 has no value, so we land on the next one that passes
+  ASSERT_EQUAL(INDEXREAD_NOTFOUND, it->SkipTo(it->ctx, 30, &h));
+  ASSERT_EQUAL(33, h->docId);
+  ASSERT_EQUAL(INDEXREAD_EOF, it->SkipTo(it->ctx, 60, &h));
+  it->Free(it);
+
+  NumericFilter_Free(flt);
+  DocTable_Free(&dt);
+  return 0;
+}
+
 int benchmarkNumericRangeTree() {
   NumericRangeTree *t = NewNumericRangeTree();
   int count = 1;
@@ -156,7 +218,7 @@ int benchmarkNumericRangeTree() {
   TimeSample ts;
 
   NumericFilter *flt = NewNumericFilter(1000, 50000, 0, 0);
-  IndexIterator *it = createNumericIterator(t, flt);
+  IndexIterator *it = createNumericIterator(t, flt, 0);
   ASSERT(it->HasNext(it->ctx));
 
   // ASSERT_EQUAL(it->Len(it->ctx), N);
@@ -171,10 +233,112 @@ int benchmarkNumericRangeTree() {
   return 0;
 }
 
+int testNumericRepair() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  DocTable dt = NewDocTable(100);
+  char buf[16];
+  int N = 10000;
+  for (int i = 0; i < N; i++) {
+    sprintf(buf, "doc_%d", i);
+    t_docId id = DocTable_Put(&dt, buf, 1, Document_DefaultFlags, NULL, 0);
+    NumericRangeTree_Add(t, id, (double)(1 + prng() % 5000));
+  }
+  for (int i = 0; i < N; i += 2) {
+    sprintf(buf, "doc_%d", i);
+    DocTable_Delete(&dt, buf);
+  }
+
+  // repair the tree a few blocks at a time
+  IndexRepairStats stats = {0};
+  int runs = 0;
+  for (size_t r = 0; (r = NumericRangeTree_Repair(t, &dt, r, 10, &stats)); runs++) {
+  }
+  ASSERT(runs > 1);
+  ASSERT_EQUAL(N / 2, t->numEntries);
+  ASSERT(stats.recordsRemoved >= N / 2);
+  ASSERT(stats.bytesCollected > 0);
+
+  NumericFilter *flt = NewNumericFilter(0, 5000, 1, 1);
+  IndexIterator *it = createNumericIterator(t, flt, 0);
+  RSIndexResult *res;
+  int count = 0;
+  while (it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+    ASSERT(res->docId % 2 == 0);
+    count++;
+  }
+  ASSERT_EQUAL(N / 2, count);
+  it->Free(it);
+
+  // compacting the table renumbers the remaining documents 1..N/2
+  ASSERT_EQUAL(N / 2, DocTable_Compact(&dt));
+  memset(&stats, 0, sizeof(stats));
+  NumericRangeTree_Renumber(t, &dt.remap, &stats);
+  ASSERT_EQUAL(0, stats.recordsRemoved);
+  ASSERT_EQUAL(N / 2, t->numEntries);
+  it = createNumericIterator(t, flt, 0);
+  t_docId expected = 0;
+  while (it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+    ASSERT_EQUAL(++expected, res->docId);
+  }
+  ASSERT_EQUAL(N / 2, expected);
+  it->Free(it);
+  NumericFilter_Free(flt);
+
+  NumericRangeTree_Free(t);
+  DocTable_Free(&dt);
+  return 0;
+}
+
+int testNumericUpdate() {
+  NumericRangeTree *t = NewNumericRangeTree();
+  int N = 10000;
+  double *values = calloc(N + 1, sizeof(double));
+  for (t_docId id = 1; id <= N; id++) {
+    values[id] = 1 + prng() % 5000;
+    NumericRangeTree_Add(t, id, values[id]);
+  }
+
+  // move a tenth of the documents to other values, keeping their docIds. Some of them were added
+  // with another value than the one we think, and are found by searching the whole tree
+  for (t_docId id = 1; id <= N; id += 10) {
+    double value = 1 + prng() % 5000;
+    ASSERT_EQUAL(1, NumericRangeTree_Delete(t, id, id % 20 == 1 ? values[id] : -1));
+    NumericRangeTree_Add(t, id, value);
+    values[id] = value;
+  }
+  ASSERT_EQUAL(0, NumericRangeTree_Delete(t, N + 1, 1));
+  ASSERT_EQUAL(N, t->numEntries);
+
+  NumericFilter *flt = NewNumericFilter(1000, 2000, 1, 1);
+  IndexIterator *it = createNumericIterator(t, flt, 0);
+  RSIndexResult *res;
+  t_docId lastId = 0;
+  int count = 0, expected = 0;
+  while (it->Read(it->ctx, &res) != INDEXREAD_EOF) {
+    ASSERT(res->docId > lastId);
+    ASSERT(values[res->docId] >= 1000 && values[res->docId] <= 2000);
+    lastId = res->docId;
+    count++;
+  }
+  for (t_docId id = 1; id <= N; id++) {
+    if (values[id] >= 1000 && values[id] <= 2000) expected++;
+  }
+  ASSERT_EQUAL(expected, count);
+  it->Free(it);
+  NumericFilter_Free(flt);
+
+  free(values);
+  NumericRangeTree_Free(t);
+  return 0;
+}
+
 TEST_MAIN({
   RMUTil_InitAlloc();
 
   TESTFUNC(testNumericRangeTree);
   TESTFUNC(testRangeIterator);
+  TESTFUNC(testPostFilter);
+  TESTFUNC(testNumericRepair);
+  TESTFUNC(testNumericUpdate);
   benchmarkNumericRangeTree();
 });
@@ -6,8 +6,9 @@ void RMUTil_InitAlloc();
 
 int testStopwordList() {
 
-  char *terms[] = {strdup("foo"), strdup("bar"), strdup("שלום"), strdup("Hello"), strdup("WORLD")};
-  const char *test_terms[] = {"foo", "bar", "שלום", "hello", "world"};
+  char *terms[] = {strdup("foo"),   strdup("bar"),   strdup("שלום"),
+                   strdup("Hello"), strdup("WORLD"), strdup("ÜBER")};
+  const char *test_terms[] = {"foo", "bar", "שלום", "hello", "world", "über"};
 
   StopWordList *sl = NewStopWordListCStr((const char **)terms, sizeof(terms) / sizeof(char *));
   ASSERT(sl != NULL);
@@ -20,6 +21,10 @@ int testStopwordList() {
   ASSERT(!StopWordList_Contains(sl, NULL, 0));
   ASSERT(!StopWordList_Contains(NULL, NULL, 0));
 
+  // the list lives on as long as it has references
+  ASSERT(StopWordList_Ref(sl) == sl);
+  StopWordList_Free(sl);
+  ASSERT(StopWordList_Contains(sl, "foo", 3));
   StopWordList_Free(sl);
   for (int i = 0; i < sizeof(terms) / sizeof(const char *); i++) {
     free(terms[i]);
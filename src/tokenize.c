@@ -2,44 +2,198 @@
 #include "stopwords.h"
 #include "tokenize.h"
 #include "rmalloc.h"
-#include <ctype.h>
+#include "dep/libnu/libnu.h"
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#define TOKENIZE_SIMD
+#include <emmintrin.h>
+#endif
+
+/* Character classes of the tokenizer's lookup table */
+#define TOK_SEP 1    // separates tokens, see DEFAULT_SEPARATORS
+#define TOK_UPPER 2  // lowercased by normalization
+#define TOK_DROP 4   // removed by normalization
+#define TOK_UTF8 8   // part of a multibyte character, folded with libnu
+
+static const unsigned char tokenizeTable[256] = {
+    // control characters are dropped from tokens, except for tab which is a separator
+    [1 ... 31] = TOK_DROP,
+    [127] = TOK_DROP,
+    [128 ... 255] = TOK_UTF8,
+    ['A' ... 'Z'] = TOK_UPPER,
+    [' '] = TOK_SEP,
+    ['\t'] = TOK_SEP,
+    [','] = TOK_SEP,
+    ['.'] = TOK_SEP,
+    ['/'] = TOK_SEP,
+    ['('] = TOK_SEP,
+    [')'] = TOK_SEP,
+    ['{'] = TOK_SEP,
+    ['}'] = TOK_SEP,
+    ['['] = TOK_SEP,
+    [']'] = TOK_SEP,
+    [':'] = TOK_SEP,
+    [';'] = TOK_SEP,
+    ['\\'] = TOK_SEP,
+    ['~'] = TOK_SEP,
+    ['!'] = TOK_SEP,
+    ['@'] = TOK_SEP,
+    ['#'] = TOK_SEP,
+    ['$'] = TOK_SEP,
+    ['%'] = TOK_SEP,
+    ['^'] = TOK_SEP,
+    ['&'] = TOK_SEP,
+    ['*'] = TOK_SEP,
+    ['-'] = TOK_SEP,
+    ['='] = TOK_SEP,
+    ['+'] = TOK_SEP,
+    ['|'] = TOK_SEP,
+    ['\''] = TOK_SEP,
+    ['`'] = TOK_SEP,
+    ['"'] = TOK_SEP,
+    ['<'] = TOK_SEP,
+    ['>'] = TOK_SEP,
+    ['?'] = TOK_SEP,
+};
+
 int tokenize(const char *text, float score, t_fieldMask fieldId, void *ctx, TokenFunc f, Stemmer *s,
-             u_int offset, StopWordList *stopwords) {
+             u_int offset, StopWordList *stopwords, int foldUnicode) {
+  char scratch[TOKENIZE_SCRATCH_SIZE];
   TokenizerCtx tctx;
   tctx.text = text;
-  tctx.pos = (char **)&text;
-  tctx.separators = DEFAULT_SEPARATORS;
+  tctx.pos = text;
   tctx.fieldScore = score;
   tctx.tokenFunc = f;
   tctx.tokenFuncCtx = ctx;
-  tctx.normalize = DefaultNormalize;
   tctx.fieldId = fieldId;
   tctx.stemmer = s;
   tctx.lastOffset = offset;
   tctx.stopwords = stopwords;
+  tctx.foldUnicode = foldUnicode;
+  tctx.scratch = scratch;
+  tctx.scratchCap = sizeof(scratch);
+
+  int ret = _tokenize(&tctx);
+  if (tctx.scratch != scratch) {
+    rm_free(tctx.scratch);
+  }
+  return ret;
+}
+
+/* Lowercase len ASCII bytes from src into dst */
+static void tokenize_Lower(char *dst, const char *src, size_t len) {
+  size_t i = 0;
+#ifdef TOKENIZE_SIMD
+  // bytes above 127 are negative, so the signed range check leaves them alone
+  const __m128i lo = _mm_set1_epi8('A' - 1), hi = _mm_set1_epi8('Z' + 1),
+                bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(v, _mm_and_si128(upper, bit)));
+  }
+#endif
+  for (; i < len; i++) {
+    unsigned char c = src[i];
+    dst[i] = (tokenizeTable[c] & TOK_UPPER) ? c + ('a' - 'A') : c;
+  }
+}
+
+/* The length of the UTF-8 character at p, or 0 if it is not a valid one within len bytes */
+static size_t tokenize_CharLen(const unsigned char *p, size_t len) {
+  size_t n = *p < 0xC2 ? 0 : *p < 0xE0 ? 2 : *p < 0xF0 ? 3 : *p < 0xF5 ? 4 : 0;
+  if (n > len) return 0;
+  for (size_t i = 1; i < n; i++) {
+    if ((p[i] & 0xC0) != 0x80) return 0;
+  }
+  return n;
+}
+
+size_t FoldTerm(char *dst, const char *src, size_t len, int unicode) {
+  const unsigned char *p = (const unsigned char *)src, *end = p + len;
+  char *out = dst;
+  while (p < end) {
+    unsigned char c = *p;
+    if (c < 0x80) {
+      if (!(tokenizeTable[c] & TOK_DROP)) {
+        *out++ = (tokenizeTable[c] & TOK_UPPER) ? c + ('a' - 'A') : c;
+      }
+      p++;
+      continue;
+    }
+
+    size_t cl = unicode ? tokenize_CharLen(p, end - p) : 0;
+    if (!cl) {
+      *out++ = *p++;
+      continue;
+    }
+    uint32_t cp;
+    nu_utf8_read((const char *)p, &cp);
+    const char *map = nu_tofold(cp);
+    if (!map) {
+      memcpy(out, p, cl);
+      out += cl;
+    } else {
+      // a character may fold into several ones, e.g. the German sharp s into "ss"
+      uint32_t u;
+      for (map = nu_casemap_read(map, &u); u; map = nu_casemap_read(map, &u)) {
+        out = nu_utf8_write(u, out);
+      }
+    }
+    p += cl;
+  }
+  return out - dst;
+}
+
+/* Normalize a token into the scratch buffer, returning its new length */
+static size_t tokenize_Normalize(TokenizerCtx *ctx, const char *tok, size_t len, int classes) {
+  size_t cap = (classes & TOK_UTF8) ? FOLD_TERM_MAXLEN(len) : len;
+  if (cap > ctx->scratchCap) {
+    ctx->scratch = ctx->scratchCap > TOKENIZE_SCRATCH_SIZE ? rm_realloc(ctx->scratch, cap)
+                                                           : rm_malloc(cap);
+    ctx->scratchCap = cap;
+  }
 
-  return _tokenize(&tctx);
+  // the fast path for ASCII tokens that only need lowercasing
+  if (!(classes & (TOK_DROP | TOK_UTF8))) {
+    tokenize_Lower(ctx->scratch, tok, len);
+    return len;
+  }
+  return FoldTerm(ctx->scratch, tok, len, ctx->foldUnicode);
 }
 
 // tokenize the text in the context
 int _tokenize(TokenizerCtx *ctx) {
   u_int pos = ctx->lastOffset + 1;
+  const unsigned char *p = (const unsigned char *)ctx->pos;
 
-  while (*ctx->pos != NULL) {
-    // get the next token
-    char *tok = strsep(ctx->pos, ctx->separators);
-    // this means we're at the end
-    if (tok == NULL) break;
+  while (*p) {
+    // skip to the beginning of the next token
+    while (tokenizeTable[*p] & TOK_SEP) p++;
+    if (!*p) break;
 
-    // normalize the token
-    size_t tlen;
-    tok = ctx->normalize(tok, &tlen);
+    // find its end, collecting the classes of its characters to know if it needs normalizing
+    const char *tok = (const char *)p;
+    int classes = 0;
+    while (*p && !(tokenizeTable[*p] & TOK_SEP)) {
+      classes |= tokenizeTable[*p++];
+    }
+    size_t tlen = (const char *)p - tok;
+    if (!ctx->foldUnicode) {
+      classes &= ~TOK_UTF8;
+    }
+
+    // only tokens that actually change are copied
+    if (classes) {
+      tlen = tokenize_Normalize(ctx, tok, tlen, classes);
+      tok = ctx->scratch;
+    }
 
     // ignore tokens that turn into nothing
-    if (tok == NULL || tlen == 0) {
+    if (tlen == 0) {
       continue;
     }
 
@@ -48,7 +202,7 @@ int _tokenize(TokenizerCtx *ctx) {
       continue;
     }
     // create the token struct
-    Token t = {tok, tlen, ++pos, ctx->fieldScore, ctx->fieldId, DT_WORD, 0};
+    Token t = {tok, tlen, ++pos, ctx->fieldScore, ctx->fieldId, DT_WORD};
 
     // let it be handled - and break on non zero response
     if (ctx->tokenFunc(ctx->tokenFuncCtx, t) != 0) {
@@ -59,12 +213,11 @@ int _tokenize(TokenizerCtx *ctx) {
     if (ctx->stemmer) {
       size_t sl;
       const char *stem = ctx->stemmer->Stem(ctx->stemmer->ctx, tok, tlen, &sl);
-      if (stem && strncmp(stem, tok, tlen)) {
-        t.s = rm_strndup(stem, sl);
+      if (stem && (sl != tlen || strncmp(stem, tok, tlen))) {
+        t.s = stem;
         t.type = DT_STEM;
         t.len = sl;
         t.fieldId = ctx->fieldId;
-        t.stringFreeable = 1;
         if (ctx->tokenFunc(ctx->tokenFuncCtx, t) != 0) {
           break;
         }
@@ -72,23 +225,6 @@ int _tokenize(TokenizerCtx *ctx) {
     }
   }
 
+  ctx->pos = (const char *)p;
   return pos;
 }
-
-char *DefaultNormalize(char *s, size_t *len) {
-  char *dst = s, *src = s;
-  *len = 0;
-  while (*src != '\0') {
-    if (isupper(*src)) {
-      *dst++ = tolower(*src++);
-    } else if (isblank(*src) || iscntrl(*src)) {
-      src++;
-      continue;
-    } else {
-      *dst++ = *src++;
-    }
-    ++(*len);
-  }
-  *dst = 0;
-  return s;
-}
@@ -17,7 +17,9 @@ typedef enum {
 } DocTokenType;
 /* Represents a token found in a document */
 typedef struct {
-  // token string
+  // token string. It is not NULL terminated, and points either into the tokenized text, into the
+  // tokenizer's scratch buffer or into the stemmer's buffer, so it is only valid until the token
+  // function returns. Token functions that keep it must copy it
   const char *s;
   // token string length
   size_t len;
@@ -31,8 +33,6 @@ typedef struct {
   // Field id - used later for filtering.
   t_fieldMask fieldId;
 
-  int stringFreeable;
-
   DocTokenType type;
 } Token;
 
@@ -43,22 +43,30 @@ typedef int (*TokenFunc)(void *ctx, Token t);
 typedef char *(*NormalizeFunc)(char *, size_t *);
 
 //! " # $ % & ' ( ) * + , - . / : ; < = > ? @ [ \ ] ^ _ ` { | } ~
+// The tokenizer looks the separators up in a table built from this list, see tokenize.c
 #define DEFAULT_SEPARATORS " \t,./(){}[]:;/\\~!@#$%^&*-=+|'`\"<>?";
 
 #define STEM_TOKEN_FACTOR 0.2
 
+/* The size of the scratch buffer on the tokenizer's stack. Longer tokens that need normalizing use
+ * a heap buffer */
+#define TOKENIZE_SCRATCH_SIZE 128
+
 typedef struct {
   const char *text;
-  char **pos;
-  const char *separators;
+  const char *pos;
   double fieldScore;
   int fieldId;
   TokenFunc tokenFunc;
   void *tokenFuncCtx;
-  NormalizeFunc normalize;
   Stemmer *stemmer;
-  StopWordList *stopwords;
+  struct StopWordList *stopwords;
+  // whether non ASCII characters are case folded, or left as they are
+  int foldUnicode;
   u_int lastOffset;
+  // tokens that need normalizing are copied here, the rest are passed as they are in the text
+  char *scratch;
+  size_t scratchCap;
 } TokenizerCtx;
 
 /* The actual tokenizing process runner */
@@ -66,13 +74,24 @@ int _tokenize(TokenizerCtx *ctx);
 
 /** The extenral API. Tokenize text, and create tokens with the given score and fieldId.
 TokenFunc is a callback that will be called for each token found
-if doStem is 1, we will add stemming extraction for the text
+if doStem is 1, we will add stemming extraction for the text.
+
+The text is only read, never modified, and tokens are normalized (case folded, with control
+characters removed) on the fly. If foldUnicode is 0 only ASCII letters are lowercased, as indexes
+created before Unicode case folding expect
 */
 int tokenize(const char *text, float fieldScore, t_fieldMask fieldId, void *ctx, TokenFunc f,
-             Stemmer *s, u_int offset, StopWordList *stopwords);
-
-/** A simple text normalizer that convertes all tokens to lowercase and removes accents.
-Does NOT normalize unicode */
-char *DefaultNormalize(char *s, size_t *len);
+             Stemmer *s, u_int offset, struct StopWordList *stopwords, int foldUnicode);
+
+/* The maximal length of a folded term of len bytes. Folding a non ASCII character takes at most
+ * three times its UTF-8 length */
+#define FOLD_TERM_MAXLEN(len) (3 * (len))
+
+/* Fold the case of len bytes of UTF-8 text into dst, which must have room for FOLD_TERM_MAXLEN(len)
+ * bytes, dropping control characters. ASCII is folded with a lookup table, other characters with
+ * libnu's case folding tables if unicode is set, and invalid UTF-8 is copied as it is. Terms are
+ * folded the same way when indexed and when queried. Returns the length of the folded term, which
+ * is not NUL terminated */
+size_t FoldTerm(char *dst, const char *src, size_t len, int unicode);
 
 #endif
\ No newline at end of file
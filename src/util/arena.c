@@ -0,0 +1,83 @@
+#include <sys/param.h>
+#include <string.h>
+#include "arena.h"
+#include "rmalloc.h"
+
+#define ARENA_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+void Arena_Init(Arena *a, size_t blockSize) {
+  a->first = a->cur = NULL;
+  a->blockSize = blockSize;
+}
+
+/* Allocate size bytes at an offset aligned to align, which is 1 or 8 */
+static void *arena_Alloc(Arena *a, size_t size, size_t align) {
+  ArenaBlock *b = a->cur;
+  if (b) {
+    size_t off = align > 1 ? ARENA_ALIGN(b->used) : b->used;
+    if (off + size <= b->cap) {
+      b->used = off + size;
+      return b->data + off;
+    }
+  }
+
+  // move on to the next block if it was kept by a reset and is big enough, otherwise we put a new
+  // block after the current one, leaving the next one for later
+  if (b && b->next && b->next->cap >= size) {
+    b = b->next;
+  } else {
+    size_t cap = MAX(a->blockSize, size);
+    ArenaBlock *nb = rm_malloc(sizeof(ArenaBlock) + cap);
+    nb->cap = cap;
+    nb->used = 0;
+    if (b) {
+      nb->next = b->next;
+      b->next = nb;
+    } else {
+      nb->next = NULL;
+      a->first = nb;
+    }
+    b = nb;
+  }
+  a->cur = b;
+  b->used = size;
+  return b->data;
+}
+
+void *Arena_Alloc(Arena *a, size_t size) {
+  return arena_Alloc(a, ARENA_ALIGN(size), 8);
+}
+
+char *Arena_Strndup(Arena *a, const char *s, size_t len) {
+  char *ret = arena_Alloc(a, len + 1, 1);
+  memcpy(ret, s, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+void Arena_Reset(Arena *a) {
+  size_t retained = 0;
+  ArenaBlock **pb = &a->first;
+  while (*pb) {
+    ArenaBlock *b = *pb;
+    if (retained + b->cap > ARENA_MAX_RETAINED) {
+      *pb = b->next;
+      rm_free(b);
+      continue;
+    }
+    retained += b->cap;
+    b->used = 0;
+    pb = &b->next;
+  }
+  a->cur = a->first;
+}
+
+void Arena_Free(Arena *a) {
+  ArenaBlock *b = a->first;
+  while (b) {
+    ArenaBlock *next = b->next;
+    rm_free(b);
+    b = next;
+  }
+  a->first = a->cur = NULL;
+}
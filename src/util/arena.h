@@ -0,0 +1,47 @@
+#ifndef __RS_ARENA_H__
+#define __RS_ARENA_H__
+
+#include <stdlib.h>
+
+/* Arena - a thread-unsafe bump allocator for objects that are all released together.
+ *
+ * Allocations are carved out of large blocks, and are never freed one by one. Resetting the arena
+ * releases everything allocated from it at once, while keeping its blocks for the next round of
+ * allocations, so an arena that is reset between similar workloads stops calling malloc at all */
+
+typedef struct arenaBlock {
+  struct arenaBlock *next;
+  size_t cap;
+  size_t used;
+  char data[];
+} ArenaBlock;
+
+typedef struct {
+  // the first block, and the one we currently allocate from
+  ArenaBlock *first, *cur;
+  // the capacity of new blocks. Larger allocations get a block of their own
+  size_t blockSize;
+} Arena;
+
+/* The memory an arena keeps across resets. Blocks beyond it are released by Arena_Reset */
+#define ARENA_MAX_RETAINED (1024 * 1024)
+
+/* Initialize an empty arena. No memory is allocated until the first allocation */
+void Arena_Init(Arena *a, size_t blockSize);
+
+/* Allocate size bytes from the arena, aligned for any type. The memory is valid until the arena is
+ * reset or freed */
+void *Arena_Alloc(Arena *a, size_t size);
+
+/* Copy len bytes of a string into the arena, NUL terminated. Strings are packed without
+ * alignment, so an arena used only for strings wastes no space between them */
+char *Arena_Strndup(Arena *a, const char *s, size_t len);
+
+/* Release all the allocations made from the arena, keeping up to ARENA_MAX_RETAINED bytes of its
+ * blocks for reuse */
+void Arena_Reset(Arena *a);
+
+/* Release all the memory of the arena */
+void Arena_Free(Arena *a);
+
+#endif
@@ -0,0 +1,135 @@
+#include <pthread.h>
+#include <string.h>
+#include "epoch.h"
+#include "rmalloc.h"
+
+typedef struct {
+  void *ptr;
+  void (*freeFn)(void *);
+  // the epoch in which the pointer was retired
+  uint64_t epoch;
+} epochRetired;
+
+static struct {
+  pthread_mutex_t lock;
+  uint64_t epoch;
+  // the epochs of the active readers, indexed by their handles. 0 marks a free slot
+  uint64_t *readers;
+  size_t numReaders;
+  size_t numActive;
+  epochRetired *retired;
+  size_t numRetired;
+  size_t capRetired;
+} epochState = {.lock = PTHREAD_MUTEX_INITIALIZER, .epoch = 1};
+
+static void epoch_Free(epochRetired *r) {
+  if (r->freeFn) {
+    r->freeFn(r->ptr);
+  } else {
+    rm_free(r->ptr);
+  }
+}
+
+/* Move the retired pointers that no active reader can access to the end of the retired list, and
+ * return how many of them there are. Must be called with the lock held */
+static size_t epoch_CollectLocked() {
+  uint64_t minEpoch = UINT64_MAX;
+  for (size_t i = 0; i < epochState.numReaders; i++) {
+    if (epochState.readers[i] && epochState.readers[i] < minEpoch) {
+      minEpoch = epochState.readers[i];
+    }
+  }
+
+  // partition the list, keeping the ones that still wait at its beginning
+  size_t n = 0;
+  for (size_t i = 0; i < epochState.numRetired; i++) {
+    if (epochState.retired[i].epoch >= minEpoch) {
+      epochRetired tmp = epochState.retired[n];
+      epochState.retired[n++] = epochState.retired[i];
+      epochState.retired[i] = tmp;
+    }
+  }
+  return epochState.numRetired - n;
+}
+
+/* Release the memory that is no longer accessible to any reader */
+static void epoch_Reclaim() {
+  pthread_mutex_lock(&epochState.lock);
+  size_t num = epoch_CollectLocked();
+  if (!num) {
+    pthread_mutex_unlock(&epochState.lock);
+    return;
+  }
+  // we call the free callbacks outside the lock, so we take the freed entries out of the list
+  epochRetired *freed = malloc(num * sizeof(epochRetired));
+  epochState.numRetired -= num;
+  memcpy(freed, epochState.retired + epochState.numRetired, num * sizeof(epochRetired));
+  pthread_mutex_unlock(&epochState.lock);
+
+  for (size_t i = 0; i < num; i++) {
+    epoch_Free(&freed[i]);
+  }
+  free(freed);
+}
+
+int Epoch_Enter() {
+  pthread_mutex_lock(&epochState.lock);
+  size_t h = 0;
+  while (h < epochState.numReaders && epochState.readers[h]) {
+    h++;
+  }
+  if (h == epochState.numReaders) {
+    epochState.numReaders = epochState.numReaders ? epochState.numReaders * 2 : 8;
+    epochState.readers = realloc(epochState.readers, epochState.numReaders * sizeof(uint64_t));
+    memset(epochState.readers + h, 0, (epochState.numReaders - h) * sizeof(uint64_t));
+  }
+  epochState.readers[h] = epochState.epoch;
+  epochState.numActive++;
+  pthread_mutex_unlock(&epochState.lock);
+  return (int)h;
+}
+
+void Epoch_Exit(int handle) {
+  pthread_mutex_lock(&epochState.lock);
+  epochState.readers[handle] = 0;
+  epochState.numActive--;
+  int pending = epochState.numRetired > 0;
+  pthread_mutex_unlock(&epochState.lock);
+
+  if (pending) {
+    epoch_Reclaim();
+  }
+}
+
+void Epoch_Retire(void *ptr, void (*freeFn)(void *)) {
+  epochRetired r = {.ptr = ptr, .freeFn = freeFn};
+  pthread_mutex_lock(&epochState.lock);
+  if (!epochState.numActive) {
+    pthread_mutex_unlock(&epochState.lock);
+    epoch_Free(&r);
+    return;
+  }
+
+  // readers entering from now on can't see the pointer, so they get a later epoch
+  r.epoch = epochState.epoch++;
+  if (epochState.numRetired == epochState.capRetired) {
+    epochState.capRetired = epochState.capRetired ? epochState.capRetired * 2 : 16;
+    epochState.retired = realloc(epochState.retired, epochState.capRetired * sizeof(epochRetired));
+  }
+  epochState.retired[epochState.numRetired++] = r;
+  pthread_mutex_unlock(&epochState.lock);
+}
+
+int Epoch_Active() {
+  pthread_mutex_lock(&epochState.lock);
+  int ret = epochState.numActive > 0;
+  pthread_mutex_unlock(&epochState.lock);
+  return ret;
+}
+
+size_t Epoch_NumPending() {
+  pthread_mutex_lock(&epochState.lock);
+  size_t ret = epochState.numRetired;
+  pthread_mutex_unlock(&epochState.lock);
+  return ret;
+}
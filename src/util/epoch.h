@@ -0,0 +1,36 @@
+#ifndef __RS_EPOCH_H__
+#define __RS_EPOCH_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Epoch based memory reclamation.
+ *
+ * Readers that access shared structures without holding the lock their writers use (e.g. queries
+ * running without the GIL) announce it by entering an epoch, and leave it when they no longer hold
+ * any pointer into those structures.
+ *
+ * Writers never free memory a reader may still be looking at. Instead they retire it, and it is
+ * released once every reader that entered before it was retired has exited. Memory retired while
+ * no reader is active is released right away.
+ *
+ * All the functions are thread safe. The free callbacks are called with no internal lock held, so
+ * they may retire memory themselves */
+
+/* Enter an epoch. Returns a handle to pass to Epoch_Exit */
+int Epoch_Enter();
+
+/* Exit an epoch entered with Epoch_Enter, releasing any memory that was only waiting for us */
+void Epoch_Exit(int handle);
+
+/* Retire a pointer, calling freeFn on it once no active reader can access it. If freeFn is NULL
+ * the pointer is released with rm_free */
+void Epoch_Retire(void *ptr, void (*freeFn)(void *));
+
+/* Returns 1 if any reader is currently inside an epoch */
+int Epoch_Active();
+
+/* The number of retired pointers that are still waiting to be released */
+size_t Epoch_NumPending();
+
+#endif